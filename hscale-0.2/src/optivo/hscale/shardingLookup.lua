@@ -4,15 +4,33 @@ local utils = require("optivo.common.utils")
 
 local _shardingTable
 
+-- The partitions are looked up in C by proxy.shard if the proxy has it.
+local _shard = proxy and proxy.shard
+
 function init(config)
     _shardingTable = config.getShardingTable()
     assert(_shardingTable, "Option 'sharding_list' missing.")
+    if (_shard) then
+        -- only 'int' tables are partitioned by ranges
+        local tables = {}
+        for tableName, shard_info in pairs(_shardingTable) do
+            tables[tableName] = {
+                type = shard_info.shard_type == "int" and "range" or "hash",
+                partitions = shard_info.partitions
+            }
+        end
+        local version, err = _shard.load(tables)
+        assert(version, err)
+    end
 end
 
 
 --- Query all available groups for a given table.
 -- @return all sharding names.
 function getAllShardingGroups(tableName)
+    if (_shard) then
+        return _shard.groups(tableName)
+    end
     local tables = {}
     local num = #(_shardingTable[tableName].partitions)
     for i = 1, num do
@@ -54,6 +72,13 @@ function getShardingGroup(tableName, range)
         return result
     end
 
+    if (_shard) then
+        -- a negative value means the range is open at that end
+        return _shard.lookup_range(tableName,
+            min_value >= 0 and min_value or nil,
+            max_value >= 0 and max_value or nil)
+    end
+
     for i = 1, partitions do
         local partition_max_value = shard_info.partitions[i].value
         if max_value >= 0 and max_value <= partition_max_value then
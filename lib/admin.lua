@@ -118,6 +118,10 @@ function read_query(packet)
 			  type = proxy.MYSQL_TYPE_STRING },
 			{ name = "connected_clients", 
 			  type = proxy.MYSQL_TYPE_LONG },
+			{ name = "rtt_ms",
+			  type = proxy.MYSQL_TYPE_DOUBLE },
+			{ name = "lag",
+			  type = proxy.MYSQL_TYPE_LONG },
 		}
 
 		-- used in the loop.
@@ -131,9 +135,22 @@ function read_query(packet)
 				states[b.state + 1], -- the C-id is pushed down starting at 0
 				types[b.type + 1],   -- the C-id is pushed down starting at 0
 				b.uuid,              -- the MySQL Server's UUID if it is managed
-				b.connected_clients  -- currently connected clients
+				b.connected_clients, -- currently connected clients
+				b.rtt and b.rtt * 1000, -- round-trip-time of the health-checks
+				b.lag                -- replication lag of a read-only backend
 			}
 		end
+	elseif query_lower == "select * from buffers" then
+		local stats = (require("chassis").get_stats() or {}).chassis or {}
+
+		fields = {
+			{ name = "name",
+			  type = proxy.MYSQL_TYPE_STRING },
+			{ name = "bytes",
+			  type = proxy.MYSQL_TYPE_LONGLONG },
+		}
+		rows[#rows + 1] = { "resultset_bytes", stats.resultset_bytes or 0 }
+		rows[#rows + 1] = { "resultset_bytes_max", stats.resultset_bytes_max or 0 }
 	elseif query_lower == "select version" then
 		fields = {
 			{ name = "version",
@@ -161,6 +178,7 @@ function read_query(packet)
 		rows[#rows + 1] = { "CONFIG SET module.parameter value", "set the parameters with value" }
 		rows[#rows + 1] = { "STATS GET modulenames", "display the stats of modulenames." }
 		rows[#rows + 1] = { "select conn_details from backend", "display the idle conns" }
+		rows[#rows + 1] = { "SELECT * FROM buffers", "shows the bytes of resultsets queued in the proxy" }
 	elseif string.find(query_lower, "select conn_num from backends where") then
 		local parameters = string.match(query_lower, 
 								"select conn_num from backends where (.+)$")
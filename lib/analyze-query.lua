@@ -19,7 +19,6 @@
  $%ENDLICENSE%$ --]]
 
 local commands     = require("proxy.commands")
-local tokenizer    = require("proxy.tokenizer")
 local auto_config  = require("proxy.auto-config")
 
 ---
@@ -142,16 +141,18 @@ function read_query(packet)
 		return
 	end
 
-	tokens = tokenizer.tokenize(cmd.query)
-	norm_query = tokenizer.normalize(tokens)
+	-- the digest is built in C, no need to tokenize in lua
+	local digest = proxy.connection.digest
+	norm_query = digest.text
+	is_select  = proxy.connection.classification.type == "select"
 
 	-- create a id for this query
-	query_id   = ("%s.%s.%s"):format(
+	query_id   = ("%s.%s.%.0f"):format(
 		proxy.connection.backend_ndx, 
 		proxy.connection.client.default_db ~= "" and 
 			proxy.connection.client.default_db or 
 			"(null)", 
-		norm_query)
+		digest.hash)
 
 	-- handle the internal data
 	if norm_query == "SELECT * FROM `histogram` . `queries` " then
@@ -316,7 +317,7 @@ function read_query_result(inj)
 		end
 	
 		if log_query and config.auto_explain then
-			if tokens[1] and tokens[1].token_name == "TK_SQL_SELECT" then
+			if is_select then
 				proxy.queries:append(5, string.char(proxy.COM_QUERY) .. "EXPLAIN " .. inj.query:sub(2),
 					{ resultset_is_needed = true })
 			end
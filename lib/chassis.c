@@ -53,7 +53,7 @@ static int lua_chassis_set_shutdown (lua_State G_GNUC_UNUSED *L) {
  */
 static void chassis_stats_setluaval(gpointer key, gpointer val, gpointer userdata) {
     const gchar *name = key;
-    const guint value = GPOINTER_TO_UINT(val);
+    const gsize value = GPOINTER_TO_SIZE(val); /* the 64bit stats don't fit a guint */
     lua_State *L = userdata;
 
     g_assert(lua_istable(L, -1));
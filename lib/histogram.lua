@@ -49,8 +49,9 @@ function read_query(packet)
 	if r then return r end
 
 	if cmd.type == proxy.COM_QUERY then
-		local tokens     = assert(tokenizer.tokenize(cmd.query))
-		local norm_query = tokenizer.normalize(tokens)
+		-- the digest is built in C, remember it for read_query_result()
+		local norm_query = proxy.connection.digest.text
+		last_norm_query  = norm_query
 
 		-- print("normalized query: " .. norm_query)
 
@@ -144,8 +145,7 @@ function read_query_result(inj)
 	local cmd = commands.parse(inj.query)
 
 	if cmd.type == proxy.COM_QUERY then
-		local tokens     = assert(tokenizer.tokenize(cmd.query))
-		local norm_query = tokenizer.normalize(tokens)
+		local norm_query = last_norm_query
 
 		if proxy.global.config.histogram.collect_queries then
 			if not proxy.global.norm_queries[norm_query] then
@@ -171,6 +171,7 @@ function read_query_result(inj)
 	
 		if proxy.global.config.histogram.collect_tables then
 			-- extract the tables from the queries
+			local tokens = assert(tokenizer.tokenize(cmd.query))
 			tables = parser.get_tables(tokens)
 	
 			for table, qtype in pairs(tables) do
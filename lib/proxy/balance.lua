@@ -94,27 +94,22 @@ function idle_failsafe_rw()
     return backend_ndx
 end
 
+---
+-- pick a slave which has some idling connections for the user
+--
+-- the policy of proxy.global.backends (--proxy-balance) decides which one:
+-- sqf takes the one with the least clients, p2c the one with less queries
+-- in flight times response-time out of two random ones
+--
+-- a slave has to have applied the last write of the client (if the master
+-- tracks the GTIDs) or lag at most --proxy-backend-max-lag seconds
+--
+-- @return the index of the backend or 0
 function idle_ro() 
-    local max_conns = -1
-    local max_conns_ndx = 0
+    local ndx = proxy.global.backends:balance(proxy.BACKEND_TYPE_RO, proxy.connection.client.username,
+        proxy.connection.last_write_gtids)
 
-    for i = 1, #proxy.global.backends do
-        local s = proxy.global.backends[i]
-        if s.type == proxy.BACKEND_TYPE_RO then
-            if s.state == proxy.BACKEND_STATE_UP or s.state == proxy.BACKEND_STATE_UNKNOWN then
-                local conns = s.pool.users[proxy.connection.client.username]
-                -- pick a slave which has some idling connections
-                if conns.cur_idle_connections > 0 then
-                    if max_conns == -1 or s.connected_clients < max_conns then
-                        max_conns = s.connected_clients
-                        max_conns_ndx = i
-                    end
-                end
-            end
-        end
-    end
-
-    return max_conns_ndx
+    return ndx or 0
 end
 
 function idle_ndx(n)
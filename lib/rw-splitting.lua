@@ -381,6 +381,8 @@ function read_query( packet )
     local cmd      = commands.parse(packet)
     local c        = proxy.connection.client
     local ps_cnt   = 0
+    -- the proxy prepares the statements again on any connection
+    local shared_stmts = proxy.connection.shared_prepared_stmts
     local conn_reserved = false
     local ro_server = false
     local rw_op = true
@@ -403,7 +405,6 @@ function read_query( packet )
     local norm_query
 
     local backend_comment = false
-    local backend_ndx_comment
 
     if is_prepared then
         ps_cnt = proxy.connection.valid_prepare_stmt_cnt
@@ -529,45 +530,34 @@ function read_query( packet )
 
     -- read/write splitting 
 
+    local cl
     local tokens_name = {}
     local tokens_text = {}
-    local token_len
-    local first_token_name
-    -- Set all tokens info in local table
+    local token_len = 0
+    -- the statement is classified in C, only SET and USE need the tokens for their arguments
     if cmd.type == proxy.COM_QUERY or cmd.type == proxy.COM_STMT_PREPARE then
-        tokens = tokens or assert(tokenizer.tokenize(cmd.query))
-        token_len = #tokens
-        for i = 1, token_len do
-            local token = tokens[i]
-            local token_name = token.token_name
-            if first_token_name == nil and token_name ~= "TK_COMMENT" then
-                first_token_name = token_name
+        cl = proxy.connection.classification
+
+        if cl.type == "set" or cl.type == "use" then
+            tokens = tokens or assert(tokenizer.tokenize(cmd.query))
+            token_len = #tokens
+            for i = 1, token_len do
+                local token = tokens[i]
+                tokens_name[#tokens_name + 1] = token.token_name
+                tokens_text[#tokens_text + 1] = token.text
             end
-            tokens_name[#tokens_name + 1] = token_name
-            tokens_text[#tokens_text + 1] = token.text
         end
 
         -- comment issues
         if not is_in_transaction then
-            -- find comment token
             -- "master" set m; "slave" set s; "backend(%d)" set $1
             -- Priority: master > slave > backendN(last one)
-            for i = 1, token_len do
-                local token_name = tokens_name[i]
-                local token_text = tokens_text[i]
-                if token_name == "TK_COMMENT" then
-                    if string.find(string.lower(token_text), "master") ~= nil then
-                        backend_comment = "m"
-                        break
-                    elseif string.find(string.lower(token_text), "slave") ~= nil then
-                        backend_comment = "s"
-                    elseif backend_comment ~= "s" then
-                        _, _, backend_ndx_comment = string.find(string.lower(token_text), "backend(%d)")
-                        if backend_ndx_comment ~= nil then
-                            backend_comment = backend_ndx_comment
-                        end
-                    end
-                end
+            if cl.hint == "master" then
+                backend_comment = "m"
+            elseif cl.hint == "slave" then
+                backend_comment = "s"
+            elseif cl.hint == "backend" then
+                backend_comment = tostring(cl.hint_backend_ndx)
             end
 
             if is_debug then
@@ -668,44 +658,15 @@ function read_query( packet )
             end
         end
 
-        if first_token_name == "TK_SQL_SELECT" then
-            is_in_select_calc_found_rows = false
-            local is_insert_id = false
-            local last_insert_id_name = nil
-
-            for i = 2, token_len do
-                local token_name = tokens_name[i]
-                local token_text = tokens_text[i]
-                -- SQL_CALC_FOUND_ROWS + FOUND_ROWS() have to be executed
-                -- on the same connection
-                -- print("token: " .. token.token_name)
-                -- print("  val: " .. token.text)
-
-                if not is_in_select_calc_found_rows and token_name == "TK_SQL_SQL_CALC_FOUND_ROWS" then
-                    is_in_select_calc_found_rows = true
-                elseif not is_insert_id and token_name == "TK_LITERAL" then
-                    local utext = token_text:upper()
-
-                    if utext == "@@LAST_INSERT_ID" then
-                        is_insert_id = true
-                        last_insert_id_name = token_text
-                    end
-                elseif not is_insert_id and token_name == "TK_FUNCTION" then
-                    local utext = token_text:upper()
-                    if utext == "LAST_INSERT_ID" then
-                        is_insert_id = true
-                        last_insert_id_name = token_text .. "()"
-                    end
-                end
-
-                -- we found the two special token, we can't find more
-                if is_insert_id and is_in_select_calc_found_rows then
-                    break
-                end
-            end
+        if cl.type == "select" then
+            -- SQL_CALC_FOUND_ROWS + FOUND_ROWS() have to be executed
+            -- on the same connection
+            is_in_select_calc_found_rows = cl.has_calc_found_rows
+            local last_insert_id_name = cl.last_insert_id
 
-            if not is_insert_id then
-                if is_backend_conn_keepalive then
+            if not last_insert_id_name then
+                -- SELECT ... FOR UPDATE and friends stay on the master
+                if is_backend_conn_keepalive and cl.is_read_only then
                     rw_op = false
                     local ro_backend_ndx = lb.idle_ro()
                     if backend_ndx ~= ro_backend_ndx and ro_backend_ndx > 0 then
@@ -726,7 +687,7 @@ function read_query( packet )
         else 
 
             -- We assume charset set will happen before transaction
-            if first_token_name == "TK_SQL_SET" then
+            if cl.type == "set" then
                 if token_len  > 2 then
                     local token_name = tokens_name[2]
                     local token_text = tokens_text[2]
@@ -783,16 +744,15 @@ function read_query( packet )
             end
 
             if is_backend_conn_keepalive and is_auto_commit and 
-                (first_token_name == "TK_SQL_USE" or first_token_name == "TK_SQL_SET" or
-                first_token_name == "TK_SQL_SHOW" or first_token_name == "TK_SQL_DESC"
-                or first_token_name == "TK_SQL_EXPLAIN") then
+                (cl.type == "use" or cl.type == "set" or
+                cl.type == "show" or cl.type == "describe") then
                 rw_op = false
                 local ro_backend_ndx = lb.idle_ro()
                 if backend_ndx ~= ro_backend_ndx and ro_backend_ndx > 0 then
                     backend_ndx = ro_backend_ndx
                     proxy.connection.backend_ndx = backend_ndx
 
-                    if first_token_name == "TK_SQL_USE" then
+                    if cl.type == "use" then
                         if token_len  > 1 then
                             c.default_db = tokens_text[2]
                         end
@@ -834,18 +794,10 @@ function read_query( packet )
 
         if is_in_transaction then
             if cmd.type == proxy.COM_QUERY then
-                if first_token_name == "TK_SQL_SET" then
-                    if token_len  > 3 then
-                        local token_text = tokens_text[2]
-                        local nxt_token_text = tokens_text[4]
-                        if token_text == "autocommit" then
-                            if nxt_token_text == "1" then
-                                is_auto_commit = true
-                                if is_debug then
-                                    print("  [set is_auto_commit true after trans]" )
-                                end
-                            end
-                        end
+                if cl.autocommit == true then
+                    is_auto_commit = true
+                    if is_debug then
+                        print("  [set is_auto_commit true after trans]" )
                     end
                 end
             elseif cmd.type == proxy.COM_STMT_PREPARE then
@@ -860,28 +812,20 @@ function read_query( packet )
         else
             if cmd.type == proxy.COM_STMT_PREPARE then
                 is_prepared = true
-                conn_reserved = true
+                conn_reserved = not shared_stmts
                 if is_debug then
                     print("  [prepare statement], cmd:" .. cmd.query)
                 end
 
                 local session_read_only = 0
 
-                if first_token_name == "TK_SQL_SELECT" then
+                if cl.type == "select" then
                     session_read_only = 1
-                    for i = 2, token_len do
-                        local token_name = tokens_name[i]
-                        local token_text = tokens_text[i]
-                        if (token_name == "TK_COMMENT") then
-                            if is_debug then
-                                print("  [check trans for ps]")
-                            end
-                            local _, _, in_trans = string.find(token_text, "in_trans=%s*(%d)")
-                            if in_trans ~= 0 then
-                                is_in_transaction = true
-                                break
-                            end
+                    if cl.hint_in_transaction then
+                        if is_debug then
+                            print("  [in_trans hint for ps]")
                         end
+                        is_in_transaction = true
                     end
 
                     if is_backend_conn_keepalive and ps_cnt == 0 and session_read_only == 1 then
@@ -901,7 +845,7 @@ function read_query( packet )
                     if ro_server == true then
                         local rw_backend_ndx = lb.idle_failsafe_rw()
                         if rw_backend_ndx > 0 then
-                            multiple_server_mode = true
+                            multiple_server_mode = not shared_stmts
                             backend_ndx = rw_backend_ndx
                             proxy.connection.backend_ndx = backend_ndx
                             if is_debug then
@@ -1022,6 +966,11 @@ function read_query( packet )
         end
     end
 
+    -- the proxy gives the server connection the session of the client
+    if proxy.connection.multiplex then
+        return proxy.PROXY_SEND_QUERY
+    end
+
     local s = proxy.connection.server
     local sql_mode = proxy.connection.client.sql_mode
     local srv_sql_mode = proxy.connection.server.sql_mode
@@ -1305,7 +1254,7 @@ function read_query_result( inj )
                         print("   set is_in_transaction true")
                     end
                 else
-                    if not is_prepared then
+                    if not is_prepared or proxy.connection.shared_prepared_stmts then
                         proxy.connection.client.is_server_conn_reserved = false
                     end
                 end
@@ -457,6 +457,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
 
 	ret = admin_lua_read_query(con);
 
+#ifdef HAVE_LUA_H
+	/* config changes of the admin-script have to reach the lua_States of all event-threads */
+	network_mysqld_lua_global_publish(network_mysqld_con_get_lua_scope(con), con->srv->priv);
+#endif
+
 	switch (ret) {
 	case PROXY_NO_DECISION:
 		network_mysqld_con_send_error(con->client, C("need a resultset + proxy.PROXY_SEND_RESULT"));
@@ -484,7 +489,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(server_read_query) {
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(admin_disconnect_client) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
+	lua_scope  *sc = network_mysqld_con_get_lua_scope(con);
 
 	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
 	
@@ -133,6 +133,12 @@ typedef int socklen_t;
 
 #include "network-conn-pool.h"
 #include "network-conn-pool-lua.h"
+#include "network-conn-pool-maintainer.h"
+#include "network-backend-probe.h"
+#include "network-query-cache.h"
+#include "network-prepared-stmts.h"
+#include "network-mysqld-session.h"
+#include "network-mysqld-scatter.h"
 
 #include "sys-pedantic.h"
 #include "network-injection.h"
@@ -201,11 +207,1294 @@ struct chassis_plugin_config {
 
 	network_mysqld_con *listen_con;
 
+	gint listen_reuseport;            /**< one SO_REUSEPORT listen-socket per event-thread */
+
 	gdouble connect_timeout_dbl; /* exposed in the config as double */
 	gdouble read_timeout_dbl; /* exposed in the config as double */
 	gdouble write_timeout_dbl; /* exposed in the config as double */
+
+	gint result_flush_bytes;          /**< bytes watermark of the resultset flush policy */
+	gdouble result_flush_latency_dbl; /**< latency watermark of the resultset flush policy in seconds */
+
+	gint resultset_buffer_max;        /**< max. bytes of resultsets queued per connection */
+	gint resultset_buffer_max_total;  /**< max. bytes of resultsets queued over all connections */
+
+	gchar *pool_user;                 /**< the user the pool maintainer authenticates as, NULL disables it */
+	gchar *pool_password;             /**< password of the pool_user, dropped once it is hashed */
+	gdouble pool_maintain_interval_dbl; /**< how often the pools are checked in seconds */
+
+	network_connection_pool_maintainer *pool_maintainer;
+
+	gdouble backend_check_interval_dbl; /**< how often the backends are checked in seconds, 0 disables the checks */
+	gchar *backend_check_user;        /**< the user the health-checks log in as, NULL to only wait for the handshake */
+	gchar *backend_check_password;    /**< password of the backend_check_user, dropped once it is hashed */
+	gint backend_check_lag;           /**< get the replication lag of the read-only backends */
+	gint backend_max_lag;             /**< read-only backends which lag more seconds get no reads, -1 for no limit */
+
+	network_backends_prober *backends_prober;
+
+	gchar *balance;                   /**< the policy picking the backends: sqf or p2c */
+
+	gint query_cache_size;            /**< max. bytes of resultsets in the query-cache, 0 disables it */
+	gdouble query_cache_ttl_dbl;      /**< seconds a cached resultset is used */
+
+	network_query_cache *query_cache;
+
+	gboolean share_prepared_stmts;    /**< prepare the statements of the clients on any pooled connection */
+	gint max_prepared_stmts;          /**< statements kept prepared per server connection */
+
+	gboolean multiplex;               /**< give the server connection back to the pool at each transaction boundary */
+
+	gboolean backend_compress;        /**< negotiate the compressed protocol with the backends */
+	gboolean client_compress;         /**< offer the compressed protocol to the clients */
+	gint compress_min_length;         /**< payloads shorter than this are sent uncompressed */
 };
 
+/**
+ * ids of the queries we inject on our own, the scripts use positive ids
+ */
+#define PROXY_INJECTION_STMT_PREPARE -10 /**< prepares a statement of the client on the current server connection */
+#define PROXY_INJECTION_STMT_FORWARD -11 /**< the command of the client which waits for our own injections */
+#define PROXY_INJECTION_SESSION_RESTORE -12 /**< gives the server connection the session-variables of the client */
+#define PROXY_INJECTION_STMT_INIT_DB -13 /**< switches the default-db around our PROXY_INJECTION_STMT_PREPARE */
+
+/**
+ * account the query we are about to send to the backend of the connection
+ *
+ * feeds the in-flight counter and the response-time of network_backends_balance()
+ */
+static void proxy_query_track_start(network_mysqld_con_lua_t *st) {
+	/* the last query didn't get a result we noticed (COM_STMT_CLOSE, ...) */
+	if (st->query_backend) {
+		network_backend_query_done(st->query_backend, -1);
+		st->query_backend = NULL;
+	}
+
+	if (NULL == st->backend) return;
+
+	st->query_backend = st->backend;
+	st->query_started = chassis_get_rel_microseconds();
+	network_backend_query_start(st->query_backend);
+}
+
+/**
+ * the query is done, with a result if is_finished is set
+ */
+static void proxy_query_track_done(network_mysqld_con_lua_t *st, gboolean is_finished) {
+	if (NULL == st->query_backend) return;
+
+	network_backend_query_done(st->query_backend,
+			is_finished ? (gint64)(chassis_get_rel_microseconds() - st->query_started) : -1);
+	st->query_backend = NULL;
+}
+
+/**
+ * the "db.tbl" names of the tables of a classified query
+ *
+ * @param db  the default-db the query runs in
+ * @return NULL if we don't know all of them
+ */
+static GPtrArray *proxy_query_cache_tables(const GString *db, sql_classification *cl, const gchar *query) {
+	GPtrArray *tables;
+	guint i;
+
+	if (cl->tables_incomplete || cl->n_tables == 0) return NULL;
+
+	tables = g_ptr_array_sized_new(cl->n_tables);
+
+	for (i = 0; i < cl->n_tables; i++) {
+		sql_table_ref *ref = &(cl->tables[i]);
+
+		if (ref->db_len > 0) {
+			g_ptr_array_add(tables, g_strdup_printf("%.*s.%.*s",
+						ref->db_len, query + ref->db_offset,
+						ref->name_len, query + ref->name_offset));
+		} else if (db->len > 0) {
+			g_ptr_array_add(tables, g_strdup_printf("%s.%.*s",
+						db->str,
+						ref->name_len, query + ref->name_offset));
+		} else {
+			/* no default-db, the server will complain */
+			for (i = 0; i < tables->len; i++) g_free(tables->pdata[i]);
+			g_ptr_array_free(tables, TRUE);
+
+			return NULL;
+		}
+	}
+
+	return tables;
+}
+
+/**
+ * drop the cached results of the written tables
+ *
+ * the tables are remembered to drop them again once the write is committed
+ *
+ * @param tables the written tables, NULL if we don't know them. We take them over
+ */
+static void proxy_query_cache_write(network_query_cache *cache, network_mysqld_con_lua_t *st, GPtrArray *tables) {
+	guint i;
+
+	if (NULL == tables) {
+		network_query_cache_invalidate_all(cache);
+		st->cache_write_all = TRUE;
+
+		return;
+	}
+
+	if (NULL == st->cache_write_tables) st->cache_write_tables = g_ptr_array_new();
+
+	for (i = 0; i < tables->len; i++) {
+		network_query_cache_invalidate_table(cache, tables->pdata[i]);
+		g_ptr_array_add(st->cache_write_tables, tables->pdata[i]);
+	}
+	g_ptr_array_free(tables, TRUE);
+}
+
+/**
+ * the writes are committed, drop the results which were cached in the meantime
+ */
+static void proxy_query_cache_committed(network_query_cache *cache, network_mysqld_con_lua_t *st) {
+	guint i;
+
+	if (st->cache_write_all) {
+		network_query_cache_invalidate_all(cache);
+		st->cache_write_all = FALSE;
+	}
+
+	if (NULL == st->cache_write_tables) return;
+
+	for (i = 0; i < st->cache_write_tables->len; i++) {
+		network_query_cache_invalidate_table(cache, st->cache_write_tables->pdata[i]);
+		g_free(st->cache_write_tables->pdata[i]);
+	}
+	g_ptr_array_free(st->cache_write_tables, TRUE);
+	st->cache_write_tables = NULL;
+}
+
+/**
+ * drop the cached results of the tables a classified query may write
+ *
+ * @param db  the default-db the query runs in
+ * @return TRUE if the query may write
+ */
+static gboolean proxy_query_cache_classify_write(network_query_cache *cache, network_mysqld_con_lua_t *st, const GString *db, sql_classification *cl, const gchar *query) {
+	if (cl->is_multi_statement) {
+		/* we only know the first statement */
+		proxy_query_cache_write(cache, st, NULL);
+
+		return TRUE;
+	}
+
+	switch (cl->type) {
+	case SQL_STATEMENT_INSERT:
+	case SQL_STATEMENT_UPDATE:
+	case SQL_STATEMENT_DELETE:
+	case SQL_STATEMENT_REPLACE:
+	case SQL_STATEMENT_LOAD:
+		proxy_query_cache_write(cache, st, proxy_query_cache_tables(db, cl, query));
+
+		return TRUE;
+	case SQL_STATEMENT_DDL:
+	case SQL_STATEMENT_CALL:
+	case SQL_STATEMENT_OTHER:
+		/* may write anything */
+		proxy_query_cache_write(cache, st, NULL);
+
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/**
+ * drop the cached results of the tables a COM_STMT_EXECUTE may write
+ *
+ * the query of the statement is only known if the statements are shared,
+ * without it the statement may write anything
+ */
+static void proxy_query_cache_stmt_write(network_query_cache *cache, network_mysqld_con_lua_t *st, GString *packet) {
+	sql_classification cl;
+	GString *key = NULL;
+	GString *db;
+	const gchar *sql;
+	guint32 stmt_id;
+
+	if (st->stmts && 0 == network_prepared_stmts_get_packet_stmt_id(packet, NET_HEADER_SIZE, &stmt_id)) {
+		key = g_hash_table_lookup(st->stmts, GUINT_TO_POINTER(stmt_id));
+	}
+
+	if (NULL == key) {
+		proxy_query_cache_write(cache, st, NULL);
+
+		return;
+	}
+
+	/* default-db \0 query */
+	sql = (const gchar *)memchr(key->str, '\0', key->len) + 1;
+
+	if (0 != sql_classify(&cl, sql, key->len - (sql - key->str))) {
+		proxy_query_cache_write(cache, st, NULL);
+
+		return;
+	}
+
+	db = g_string_new_len(key->str, sql - key->str - 1);
+	proxy_query_cache_classify_write(cache, st, db, &cl, sql);
+	g_string_free(db, TRUE);
+}
+
+/**
+ * look the query of the client up in the query-cache
+ *
+ * writes drop the cached results of their tables. A SELECT which isn't found
+ * is remembered to add its result once it is complete.
+ *
+ * commands we can't classify (queries larger than a packet, COM_STMT_EXECUTE
+ * of statements we don't know) drop all cached results
+ *
+ * @return TRUE if the result was found and queued for the client
+ */
+static gboolean proxy_query_cache_lookup(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	chassis_plugin_config *config = con->config;
+	network_query_cache *cache = config->query_cache;
+	network_mysqld_session *session;
+	sql_classification *cl;
+	GString *packet;
+	const gchar *query;
+	gsize query_len;
+	GPtrArray *tables;
+	GQueue *packets;
+
+	network_mysqld_con_lua_cache_reset(st);
+
+	if (NULL == cache) return FALSE;
+
+	packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	if (NULL == packet || packet->len < NET_HEADER_SIZE + 1) return FALSE;
+
+	switch (packet->str[NET_HEADER_SIZE]) {
+	case COM_QUERY:
+		break;
+	case COM_STMT_EXECUTE:
+		proxy_query_cache_stmt_write(cache, st, packet);
+
+		return FALSE;
+	default:
+		return FALSE;
+	}
+
+	/* a query larger than a packet isn't worth caching, but it may write */
+	if (con->client->recv_queue->chunks->length != 1) {
+		proxy_query_cache_write(cache, st, NULL);
+
+		return FALSE;
+	}
+
+	if (NULL == (cl = network_mysqld_con_get_classification(con))) {
+		proxy_query_cache_write(cache, st, NULL);
+
+		return FALSE;
+	}
+
+	query = packet->str + NET_HEADER_SIZE + 1;
+	query_len = packet->len - NET_HEADER_SIZE - 1;
+
+	if (proxy_query_cache_classify_write(cache, st, con->client->default_db, cl, query)) {
+		st->cache_query = g_string_new_len(packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+
+		return FALSE;
+	}
+
+	if (cl->type != SQL_STATEMENT_SELECT) return FALSE;
+
+	/* the key doesn't cover the temporary tables and the untracked session-variables of the client */
+	session = st->session ? st->session : st->cache_session;
+	if (NULL == session || !network_mysqld_session_is_cacheable(session)) return FALSE;
+
+	/* inside a transaction we may see our own writes */
+	if (st->cache_in_trans ||
+	    !cl->is_read_only ||
+	    cl->is_locking ||
+	    cl->has_calc_found_rows ||
+	    cl->has_last_insert_id ||
+	    cl->has_volatile ||
+	    cl->hint == SQL_ROUTE_MASTER) {
+		return FALSE;
+	}
+
+	if (NULL == (tables = proxy_query_cache_tables(con->client->default_db, cl, query))) return FALSE;
+
+	st->cache_key = g_string_new(NULL);
+	network_query_cache_key(st->cache_key, con->client, query, query_len);
+
+	packets = g_queue_new();
+
+	if (network_query_cache_lookup(cache, st->cache_key, packets, &(st->cache_gen))) {
+		while ((packet = g_queue_pop_head(packets))) {
+			network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
+		}
+		g_queue_free(packets);
+
+		st->cache_tables = tables;
+		network_mysqld_con_lua_cache_reset(st);
+
+		return TRUE;
+	}
+	g_queue_free(packets);
+
+	st->cache_tables = tables;
+	st->cache_query = g_string_new_len(packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE);
+
+	return FALSE;
+}
+
+/**
+ * keep a copy of a packet of the result we want to cache
+ */
+static void proxy_query_cache_capture(network_mysqld_con *con, network_mysqld_con_lua_t *st, GString *packet) {
+	chassis_plugin_config *config = con->config;
+
+	if (NULL == st->cache_key) return;
+
+	if (st->cache_result_size + packet->len > config->query_cache->max_entry_size) {
+		/* too large, forget about it */
+		network_mysqld_con_lua_cache_reset(st);
+
+		return;
+	}
+
+	if (NULL == st->cache_result) st->cache_result = g_queue_new();
+
+	g_queue_push_tail(st->cache_result, g_string_new_len(packet->str, packet->len));
+	st->cache_result_size += packet->len;
+}
+
+/**
+ * the result of the query of the client is complete
+ *
+ * add it to the cache if we kept a copy and drop the results of the written
+ * tables if they are committed
+ *
+ * @param use_result  the script passed the result on to the client as is
+ */
+static void proxy_query_cache_done(network_mysqld_con *con, network_mysqld_con_lua_t *st, gboolean use_result) {
+	chassis_plugin_config *config = con->config;
+
+	if (st->cache_key && st->cache_result && use_result && !st->cache_in_trans &&
+	    con->parse.command == COM_QUERY) {
+		network_mysqld_com_query_result_t *com_query = con->parse.data;
+
+		if (com_query->was_resultset &&
+		    com_query->query_status == MYSQLD_PACKET_OK) {
+			network_query_cache_insert(config->query_cache, st->cache_key, st->cache_result, st->cache_tables, st->cache_gen);
+
+			/* the cache took them over */
+			st->cache_result = NULL;
+			st->cache_tables = NULL;
+		}
+	}
+
+	network_mysqld_con_lua_cache_reset(st);
+
+	if (!st->cache_in_trans) proxy_query_cache_committed(config->query_cache, st);
+}
+
+/**
+ * the statements prepared on the current server connection
+ */
+static network_prepared_stmts *proxy_stmt_server_stmts(network_mysqld_con *con) {
+	chassis_plugin_config *config = con->config;
+
+	if (NULL == con->server->prepared_stmts) {
+		con->server->prepared_stmts = network_prepared_stmts_new();
+
+		if (config->max_prepared_stmts >= 0) {
+			con->server->prepared_stmts->max_stmts = config->max_prepared_stmts;
+		}
+	}
+
+	return con->server->prepared_stmts;
+}
+
+/**
+ * answer a COM_STMT_PREPARE with the response the server sent for the statement before
+ *
+ * the response is stored as the client which prepared it got it, the EOFs after the
+ * definitions are dropped or added if this client disagrees about CLIENT_DEPRECATE_EOF
+ */
+static void proxy_stmt_answer_prepare(network_mysqld_con *con, network_mysqld_con_lua_t *st, network_prepared_stmt *stmt) {
+	network_mysqld_stmt_prepare_ok_packet_t *prepare_ok;
+	network_packet p;
+	gboolean add_eofs;
+	guint defs = 0;
+	GList *node;
+
+	prepare_ok = network_mysqld_stmt_prepare_ok_packet_new();
+
+	p.data = stmt->response->head->data;
+	p.offset = NET_HEADER_SIZE;
+
+	if (0 != network_mysqld_proto_get_stmt_prepare_ok_packet(&p, prepare_ok)) {
+		prepare_ok->num_params = prepare_ok->num_columns = 0;
+	}
+
+	add_eofs = !con->client->is_eof_deprecated &&
+		stmt->response->length == 1 + prepare_ok->num_params + prepare_ok->num_columns;
+
+	for (node = stmt->response->head; node; node = node->next) {
+		GString *packet = node->data;
+		GString *copy;
+
+		if (node != stmt->response->head) {
+			if (!network_mysqld_proto_packet_is_eof(packet)) {
+				defs++;
+			} else if (con->client->is_eof_deprecated) {
+				continue;
+			}
+		}
+
+		copy = g_string_new_len(packet->str, packet->len);
+
+		if (node == stmt->response->head) {
+			network_prepared_stmts_set_packet_stmt_id(copy, NET_HEADER_SIZE, st->stmt_prepare_client_id);
+		}
+
+		network_mysqld_queue_append_raw(con->client, con->client->send_queue, copy);
+
+		/* the last param- or column-definition */
+		if (add_eofs && defs > 0 &&
+		    (defs == prepare_ok->num_params || defs == (guint)prepare_ok->num_params + prepare_ok->num_columns)) {
+			network_mysqld_queue_append(con->client, con->client->send_queue, C("\xfe\x00\x00\x02\x00"));
+		}
+	}
+
+	network_mysqld_stmt_prepare_ok_packet_free(prepare_ok);
+
+	g_hash_table_insert(st->stmts, GUINT_TO_POINTER(st->stmt_prepare_client_id), g_string_dup(stmt->key));
+}
+
+/**
+ * keep the parameter types the server has for the statement in line with the client
+ *
+ * a COM_STMT_EXECUTE without types relies on the ones its last COM_STMT_EXECUTE
+ * bound. If the statement was prepared again or another client bound other
+ * types since, the types of the client are sent along
+ */
+static void proxy_stmt_bind(network_mysqld_con_lua_t *st, network_prepared_stmt *stmt, guint32 client_id, GString *packet, gsize offset) {
+	GString *types;
+
+	if (0 == stmt->num_params) return;
+
+	if (NULL == (types = g_hash_table_lookup(st->stmt_param_types, GUINT_TO_POINTER(client_id)))) {
+		types = g_string_new(NULL);
+		g_hash_table_insert(st->stmt_param_types, GUINT_TO_POINTER(client_id), types);
+	}
+
+	switch (network_prepared_stmts_get_packet_param_types(packet, offset, stmt->num_params, types)) {
+	case 0:
+		break;
+	case 1:
+		if (0 == types->len || g_string_equal(types, stmt->bound_types)) return;
+
+		if (0 != network_prepared_stmts_set_packet_param_types(packet, offset, stmt->num_params, types)) {
+			g_debug("%s: can't send the parameter types of stmt-id %u along", G_STRLOC, client_id);
+			return;
+		}
+		break;
+	default:
+		return;
+	}
+
+	g_string_assign_len(stmt->bound_types, S(types));
+}
+
+typedef enum {
+	PROXY_STMT_SEND,     /**< send the command, it carries the stmt-id of the server now */
+	PROXY_STMT_ANSWERED, /**< the response is queued for the client, don't send the command */
+	PROXY_STMT_PREPARE   /**< the statement isn't prepared on the connection, our COM_STMT_PREPARE (and the COM_INIT_DBs around it) are the head of the injections */
+} proxy_stmt_ret;
+
+/**
+ * map a command of the client to the statements of the server connection it is sent to
+ *
+ * - a COM_STMT_PREPARE of a query which is already prepared on the connection
+ *   is answered with the response of the server, if we can answer
+ * - the stmt-id of COM_STMT_EXECUTE and friends is replaced by the one the
+ *   server knows. If the statement isn't prepared on the connection yet, it is
+ *   prepared first, in the default-db it was prepared in by the client
+ *
+ * @param packet     the command, we change it in place
+ * @param offset     where the payload starts in the packet
+ * @param can_answer if we can answer instead of the server
+ */
+static proxy_stmt_ret proxy_stmt_send(network_mysqld_con *con, network_mysqld_con_lua_t *st, GString *packet, gsize offset, gboolean can_answer) {
+	network_prepared_stmts *stmts;
+	network_prepared_stmt *stmt;
+	GString *key;
+	GString *query;
+	const gchar *sql;
+	injection *inj;
+	guint32 stmt_id;
+	guint8 command;
+	gsize db_len;
+	gboolean is_other_db;
+
+	if (NULL == st->stmts || NULL == con->server) return PROXY_STMT_SEND;
+	if (packet->len < offset + 1) return PROXY_STMT_SEND;
+
+	stmts = proxy_stmt_server_stmts(con);
+	command = packet->str[offset];
+
+	switch (command) {
+	case COM_CHANGE_USER:
+		/* the server drops all statements */
+		network_prepared_stmts_reset(stmts);
+		g_hash_table_remove_all(st->stmts);
+		g_hash_table_remove_all(st->stmt_param_types);
+		g_hash_table_remove_all(st->stmt_cursors);
+
+		return PROXY_STMT_SEND;
+	case COM_STMT_PREPARE:
+		network_mysqld_con_lua_stmt_reset(st);
+
+		st->stmt_prepare_key = g_string_new(NULL);
+		network_prepared_stmts_key(st->stmt_prepare_key, con->server->default_db, packet->str + offset + 1, packet->len - offset - 1);
+
+		if (0 == ++st->last_stmt_id) ++st->last_stmt_id;
+		st->stmt_prepare_client_id = st->last_stmt_id;
+
+		if (can_answer && NULL != (stmt = network_prepared_stmts_get(stmts, st->stmt_prepare_key))) {
+			proxy_stmt_answer_prepare(con, st, stmt);
+			network_mysqld_con_lua_stmt_reset(st);
+
+			return PROXY_STMT_ANSWERED;
+		}
+
+		return PROXY_STMT_SEND;
+	case COM_STMT_EXECUTE:
+	case COM_STMT_SEND_LONG_DATA:
+	case COM_STMT_RESET:
+	case COM_STMT_FETCH:
+		break;
+	default:
+		return PROXY_STMT_SEND;
+	}
+
+	if (0 != network_prepared_stmts_get_packet_stmt_id(packet, offset, &stmt_id)) return PROXY_STMT_SEND;
+
+	/* not ours, the server will complain */
+	if (NULL == (key = g_hash_table_lookup(st->stmts, GUINT_TO_POINTER(stmt_id)))) return PROXY_STMT_SEND;
+
+	if (NULL != (stmt = network_prepared_stmts_get(stmts, key))) {
+		network_prepared_stmts_set_packet_stmt_id(packet, offset, stmt->stmt_id);
+		if (command == COM_STMT_EXECUTE) proxy_stmt_bind(st, stmt, stmt_id, packet, offset);
+
+		st->stmt_command_id = stmt_id;
+
+		return PROXY_STMT_SEND;
+	}
+
+	/* prepare it on this connection first, the command follows */
+	sql = (const gchar *)memchr(key->str, '\0', key->len) + 1;
+	db_len = sql - key->str - 1;
+
+	/* the tables of the statement resolve in the default-db of the key, the server has another one */
+	is_other_db = db_len > 0 &&
+		(db_len != con->server->default_db->len || 0 != memcmp(key->str, con->server->default_db->str, db_len));
+
+	/* the first one ends up at the head */
+	if (is_other_db && con->server->default_db->len > 0) {
+		query = g_string_sized_new(con->server->default_db->len + 1);
+		g_string_append_c(query, COM_INIT_DB);
+		g_string_append_len(query, S(con->server->default_db));
+
+		inj = injection_new(PROXY_INJECTION_STMT_INIT_DB, query);
+		inj->resultset_is_needed = TRUE;
+		network_injection_queue_prepend(st->injected.queries, inj);
+	}
+
+	query = g_string_sized_new(key->len);
+	g_string_append_c(query, COM_STMT_PREPARE);
+	g_string_append_len(query, sql, key->len - (sql - key->str));
+
+	inj = injection_new(PROXY_INJECTION_STMT_PREPARE, query);
+	inj->resultset_is_needed = TRUE;
+	network_injection_queue_prepend(st->injected.queries, inj);
+
+	if (is_other_db) {
+		query = g_string_sized_new(db_len + 1);
+		g_string_append_c(query, COM_INIT_DB);
+		g_string_append_len(query, key->str, db_len);
+
+		inj = injection_new(PROXY_INJECTION_STMT_INIT_DB, query);
+		inj->resultset_is_needed = TRUE;
+		network_injection_queue_prepend(st->injected.queries, inj);
+
+		/* the COM_INIT_DB tracking changes the default-db of the client too */
+		if (NULL == st->stmt_reprepare_db) st->stmt_reprepare_db = g_string_new(NULL);
+		g_string_assign_len(st->stmt_reprepare_db, S(con->client->default_db));
+	}
+
+	network_mysqld_con_lua_stmt_reset(st);
+	st->stmt_prepare_key = g_string_dup(key);
+	st->stmt_reprepare_command = command;
+
+	return PROXY_STMT_PREPARE;
+}
+
+/**
+ * handle the statement-commands of the client which don't need a server
+ *
+ * COM_STMT_CLOSE only drops the stmt-id of the client, the statement stays
+ * prepared on the server connections for the next client
+ *
+ * @return TRUE if the command is handled, the response (if any) is queued for the client
+ */
+static gboolean proxy_stmt_read_query(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	GString *packet;
+	guint32 stmt_id;
+	guint8 command;
+
+	if (NULL == st->stmts) return FALSE;
+	if (con->client->recv_queue->chunks->length != 1) return FALSE;
+
+	packet = g_queue_peek_head(con->client->recv_queue->chunks);
+	if (packet->len < NET_HEADER_SIZE + 1) return FALSE;
+
+	command = packet->str[NET_HEADER_SIZE];
+
+	switch (command) {
+	case COM_STMT_CLOSE:
+	case COM_STMT_EXECUTE:
+	case COM_STMT_SEND_LONG_DATA:
+	case COM_STMT_RESET:
+	case COM_STMT_FETCH:
+		break;
+	default:
+		return FALSE;
+	}
+
+	if (0 != network_prepared_stmts_get_packet_stmt_id(packet, NET_HEADER_SIZE, &stmt_id)) return FALSE;
+
+	if (command == COM_STMT_CLOSE) {
+		g_hash_table_remove(st->stmts, GUINT_TO_POINTER(stmt_id));
+		g_hash_table_remove(st->stmt_param_types, GUINT_TO_POINTER(stmt_id));
+		g_hash_table_remove(st->stmt_cursors, GUINT_TO_POINTER(stmt_id));
+
+		return TRUE;
+	}
+
+	if (NULL == g_hash_table_lookup(st->stmts, GUINT_TO_POINTER(stmt_id))) {
+		/* COM_STMT_SEND_LONG_DATA has no response */
+		if (command != COM_STMT_SEND_LONG_DATA) {
+			GString *errmsg = g_string_new(NULL);
+
+			g_string_printf(errmsg, "Unknown prepared statement handler (%u) given to mysqld_stmt_execute", stmt_id);
+			network_mysqld_con_send_error_full(con->client, S(errmsg), ER_UNKNOWN_STMT_HANDLER, "HY000");
+
+			g_string_free(errmsg, TRUE);
+		}
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * close the statements which were pushed out of the registry of the server connection
+ *
+ * COM_STMT_CLOSE has no response, we send it after the command which is
+ * already in the send-queue
+ */
+static void proxy_stmt_send_closed(network_mysqld_con *con) {
+	network_prepared_stmts *stmts;
+	guint i;
+
+	if (NULL == con->server || NULL == (stmts = con->server->prepared_stmts)) return;
+
+	for (i = 0; i < stmts->closed->len; i++) {
+		GString *packet = g_string_sized_new(NET_HEADER_SIZE + 5);
+
+		network_mysqld_proto_append_int24(packet, 5);
+		network_mysqld_proto_append_int8(packet, 0); /* packet-id */
+		network_mysqld_proto_append_int8(packet, COM_STMT_CLOSE);
+		network_mysqld_proto_append_int32(packet, g_array_index(stmts->closed, guint32, i));
+
+		network_queue_append(con->server->send_queue, packet);
+	}
+	g_array_set_size(stmts->closed, 0);
+}
+
+/**
+ * map the statement-command the script decided to send
+ *
+ * @return the new decision
+ */
+static network_mysqld_lua_stmt_ret proxy_stmt_route(network_mysqld_con *con, network_mysqld_con_lua_t *st, network_mysqld_lua_stmt_ret ret) {
+	GString *packet;
+	injection *inj;
+	guint queued;
+
+	if (NULL == st->stmts) return ret;
+
+	switch (ret) {
+	case PROXY_NO_DECISION:
+	case PROXY_SEND_QUERY:
+		if (con->client->recv_queue->chunks->length != 1) break;
+
+		packet = g_queue_peek_head(con->client->recv_queue->chunks);
+		queued = st->injected.queries->length;
+
+		switch (proxy_stmt_send(con, st, packet, NET_HEADER_SIZE, TRUE)) {
+		case PROXY_STMT_SEND:
+			break;
+		case PROXY_STMT_ANSWERED:
+			return PROXY_SEND_RESULT;
+		case PROXY_STMT_PREPARE:
+			/* the command of the client follows our COM_STMT_PREPARE and COM_INIT_DBs */
+			inj = injection_new(PROXY_INJECTION_STMT_FORWARD,
+					g_string_new_len(packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE));
+			inj->resultset_is_needed = FALSE;
+			g_queue_push_nth(st->injected.queries, inj, st->injected.queries->length - queued);
+
+			return PROXY_SEND_INJECTION;
+		}
+		break;
+	case PROXY_SEND_INJECTION:
+		inj = g_queue_peek_head(st->injected.queries);
+
+		/* we can only answer if no other query waits for the server */
+		switch (proxy_stmt_send(con, st, inj->query, 0, st->injected.queries->length == 1)) {
+		case PROXY_STMT_ANSWERED:
+			injection_free(g_queue_pop_head(st->injected.queries));
+
+			return PROXY_SEND_RESULT;
+		default:
+			break;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+/**
+ * keep a copy of a packet of a COM_STMT_PREPARE response and give the client our stmt-id
+ */
+static void proxy_stmt_capture(network_mysqld_con_lua_t *st, GString *packet) {
+	gboolean is_first;
+
+	if (NULL == st->stmt_prepare_result) st->stmt_prepare_result = g_queue_new();
+
+	is_first = (0 == st->stmt_prepare_result->length);
+
+	g_queue_push_tail(st->stmt_prepare_result, g_string_new_len(packet->str, packet->len));
+
+	if (is_first && st->stmt_prepare_client_id != 0 &&
+	    packet->len > NET_HEADER_SIZE && packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_OK) {
+		network_prepared_stmts_set_packet_stmt_id(packet, NET_HEADER_SIZE, st->stmt_prepare_client_id);
+	}
+}
+
+/**
+ * the COM_STMT_PREPARE response is complete, add the statement to the registry of the connection
+ */
+static void proxy_stmt_prepared(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	GString *head;
+	guint32 stmt_id;
+
+	if (NULL == st->stmt_prepare_key) return;
+
+	/* the statement isn't bound to the connection */
+	con->valid_prepare_stmt_cnt = 0;
+
+	head = st->stmt_prepare_result ? g_queue_peek_head(st->stmt_prepare_result) : NULL;
+
+	if (head &&
+	    head->len > NET_HEADER_SIZE && head->str[NET_HEADER_SIZE] == MYSQLD_PACKET_OK &&
+	    0 == network_prepared_stmts_get_packet_stmt_id(head, NET_HEADER_SIZE, &stmt_id)) {
+		network_prepared_stmts_add(proxy_stmt_server_stmts(con), st->stmt_prepare_key, stmt_id, st->stmt_prepare_result);
+		st->stmt_prepare_result = NULL; /* the registry took it over */
+
+		if (st->stmt_prepare_client_id != 0) {
+			g_hash_table_insert(st->stmts, GUINT_TO_POINTER(st->stmt_prepare_client_id), g_string_dup(st->stmt_prepare_key));
+		}
+	}
+
+	network_mysqld_con_lua_stmt_reset(st);
+}
+
+/**
+ * drop the command which waited for our COM_STMT_PREPARE
+ *
+ * the COM_INIT_DB which switches the default-db back stays
+ */
+static void proxy_stmt_drop_command(network_mysqld_con_lua_t *st) {
+	GList *node;
+
+	for (node = st->injected.queries->head; node; node = node->next) {
+		injection *inj = node->data;
+
+		if (inj->id == PROXY_INJECTION_STMT_INIT_DB) continue;
+
+		g_queue_delete_link(st->injected.queries, node);
+		injection_free(inj);
+
+		return;
+	}
+}
+
+/**
+ * the result of our COM_STMT_PREPARE
+ *
+ * if the statement can't be prepared anymore, the client gets the error
+ * instead of the result of the command which waited for it
+ */
+static network_mysqld_lua_stmt_ret proxy_stmt_reprepared(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	GString *packet = g_queue_peek_head(con->server->recv_queue->chunks);
+
+	if (packet && packet->len > NET_HEADER_SIZE && packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+		proxy_stmt_drop_command(st);
+
+		if (st->stmt_reprepare_command != COM_STMT_SEND_LONG_DATA) {
+			while ((packet = g_queue_pop_head(con->server->recv_queue->chunks))) {
+				network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
+			}
+			st->injected.sent_resultset++;
+
+			return PROXY_NO_DECISION;
+		}
+	}
+
+	while ((packet = g_queue_pop_head(con->server->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+	return PROXY_IGNORE_RESULT;
+}
+
+/**
+ * the result of a COM_INIT_DB around our COM_STMT_PREPARE
+ *
+ * the client keeps its default-db. If the server can't switch to the
+ * default-db of the statement, the client gets the error instead of the
+ * result of its command
+ */
+static network_mysqld_lua_stmt_ret proxy_stmt_db_switched(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	GString *packet = g_queue_peek_head(con->server->recv_queue->chunks);
+	injection *inj = g_queue_peek_head(st->injected.queries);
+
+	if (st->stmt_reprepare_db) g_string_assign_len(con->client->default_db, S(st->stmt_reprepare_db));
+
+	/* only the switch to the default-db of the statement is followed by the COM_STMT_PREPARE */
+	if (packet && packet->len > NET_HEADER_SIZE && packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR &&
+	    inj && inj->id == PROXY_INJECTION_STMT_PREPARE) {
+		injection_free(g_queue_pop_head(st->injected.queries));
+		network_mysqld_con_lua_stmt_reset(st);
+
+		/* we are still in the old default-db */
+		inj = g_queue_peek_head(st->injected.queries);
+		if (inj && inj->id == PROXY_INJECTION_STMT_INIT_DB) injection_free(g_queue_pop_head(st->injected.queries));
+
+		proxy_stmt_drop_command(st);
+
+		if (st->stmt_reprepare_command != COM_STMT_SEND_LONG_DATA) {
+			while ((packet = g_queue_pop_head(con->server->recv_queue->chunks))) {
+				network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
+			}
+			st->injected.sent_resultset++;
+
+			return PROXY_NO_DECISION;
+		}
+	}
+
+	while ((packet = g_queue_pop_head(con->server->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+	return PROXY_IGNORE_RESULT;
+}
+
+static void proxy_multiplex_park_handle(int event_fd, short events, void *user_data);
+
+/**
+ * stop waiting for a server connection
+ */
+static void proxy_multiplex_unpark(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	if (NULL == st->park_backend) return;
+
+	network_connection_pool_unwait(st->park_backend->pool, &st->evt_timer);
+	event_del(&st->evt_timer);
+
+	st->park_backend = NULL;
+	st->park_until = 0;
+}
+
+/**
+ * wait for a server connection of the backend until the connect-timeout of the client passed
+ *
+ * we get woken up when a connection comes back into the pool of our event-loop
+ * or the pool-maintainer added one it opened for us
+ *
+ * @return FALSE if waiting is pointless and the client should get an error
+ */
+static gboolean proxy_multiplex_park(network_mysqld_con *con, network_mysqld_con_lua_t *st, network_backend_t *backend, network_mysqld_lua_stmt_ret ret) {
+	chassis_plugin_config *config = con->config;
+	guint64 now = chassis_get_rel_microseconds();
+	gboolean is_opening;
+	struct timeval tv;
+	guint64 left;
+
+	if (NULL == backend) return FALSE;
+
+	if (0 == st->park_until) {
+		st->park_until = now + con->connect_timeout.tv_sec * G_USEC_PER_SEC + con->connect_timeout.tv_usec;
+	}
+	if (now >= st->park_until) return FALSE;
+
+	is_opening = config->pool_maintainer && network_connection_pool_maintainer_connect(config->pool_maintainer, backend);
+
+	/* nobody will give a connection back */
+	if (!is_opening && 0 == g_atomic_int_get(&(backend->connected_clients))) return FALSE;
+
+	if (st->park_backend) {
+		network_connection_pool_unwait(st->park_backend->pool, &st->evt_timer);
+		event_del(&st->evt_timer);
+	}
+
+	left = st->park_until - now;
+	tv.tv_sec = left / G_USEC_PER_SEC;
+	tv.tv_usec = left % G_USEC_PER_SEC;
+
+	evtimer_set(&st->evt_timer, proxy_multiplex_park_handle, con);
+	chassis_event_add_local_with_timeout(con->srv, &st->evt_timer, &tv);
+	network_connection_pool_wait(backend->pool, &st->evt_timer);
+
+	st->park_backend = backend;
+	st->park_ret = ret;
+
+	return TRUE;
+}
+
+/**
+ * attach a pooled server connection if we gave ours back after the last command
+ *
+ * the script may have picked one already
+ */
+static network_mysqld_lua_stmt_ret proxy_multiplex_attach(network_mysqld_con *con, network_mysqld_con_lua_t *st, network_mysqld_lua_stmt_ret ret) {
+	chassis_private *g = con->srv->priv;
+	network_socket *send_sock = NULL;
+	GString *packet;
+	gint ndx;
+
+	if (NULL == st->session) return ret;
+
+	switch (ret) {
+	case PROXY_NO_DECISION:
+	case PROXY_SEND_QUERY:
+		packet = g_queue_peek_head(con->client->recv_queue->chunks);
+
+		/* keep the server connection for the pool, if it isn't bound to the client */
+		if (packet && packet->len > NET_HEADER_SIZE && packet->str[NET_HEADER_SIZE] == COM_QUIT &&
+		    (NULL == con->server || network_mysqld_session_is_idle(st->session))) {
+			return PROXY_SEND_NONE;
+		}
+		break;
+	case PROXY_SEND_INJECTION:
+		break;
+	default:
+		return ret;
+	}
+
+	if (NULL != con->server) return ret;
+
+	ndx = network_backends_balance(g->backends, BACKEND_TYPE_RW,
+			con->client->response ? con->client->response->username : NULL, NULL);
+
+	if (ndx >= 0) send_sock = network_connection_pool_lua_swap(con, ndx);
+
+	if (NULL == send_sock && ndx >= 0 &&
+	    proxy_multiplex_park(con, st, network_backends_get(g->backends, ndx), ret)) {
+		return ret;
+	}
+
+	proxy_multiplex_unpark(con, st);
+
+	if (NULL == send_sock) {
+		network_injection_queue_reset(st->injected.queries);
+		network_mysqld_con_send_error(con->client, C("(proxy) no idle server connection"));
+
+		return PROXY_SEND_RESULT;
+	}
+
+	con->server = send_sock;
+
+	return ret;
+}
+
+/**
+ * give the server connection the session-variables of the client before its command
+ *
+ * if the command is sent as is, it becomes a injection which follows ours
+ */
+static network_mysqld_lua_stmt_ret proxy_multiplex_restore(network_mysqld_con *con, network_mysqld_con_lua_t *st, network_mysqld_lua_stmt_ret ret) {
+	GString *packet;
+	GQueue *queries;
+	GString *query;
+	injection *inj;
+
+	if (NULL == st->session || NULL == con->server) return ret;
+
+	switch (ret) {
+	case PROXY_NO_DECISION:
+	case PROXY_SEND_QUERY:
+		/* we can't inject in front of a command which spans several packets */
+		if (con->client->recv_queue->chunks->length != 1) return ret;
+		break;
+	case PROXY_SEND_INJECTION:
+		break;
+	default:
+		return ret;
+	}
+
+	queries = g_queue_new();
+	network_mysqld_session_restore(queries, con->client, con->server);
+
+	if (0 == queries->length) {
+		g_queue_free(queries);
+
+		return ret;
+	}
+
+	if (ret != PROXY_SEND_INJECTION) {
+		packet = g_queue_peek_head(con->client->recv_queue->chunks);
+
+		inj = injection_new(PROXY_INJECTION_STMT_FORWARD,
+				g_string_new_len(packet->str + NET_HEADER_SIZE, packet->len - NET_HEADER_SIZE));
+		inj->resultset_is_needed = FALSE;
+		network_injection_queue_append(st->injected.queries, inj);
+	}
+
+	/* the first one ends up at the head */
+	while ((query = g_queue_pop_tail(queries))) {
+		inj = injection_new(PROXY_INJECTION_SESSION_RESTORE, query);
+		inj->resultset_is_needed = TRUE;
+		network_injection_queue_prepend(st->injected.queries, inj);
+	}
+	g_queue_free(queries);
+
+	return PROXY_SEND_INJECTION;
+}
+
+/**
+ * send the restore-commands which follow the first one right away
+ *
+ * they don't depend on each other, their results are read one after the
+ * other without waiting for the server in between. The command of the client
+ * is only sent once they succeeded: a restore costs one round-trip on top
+ * of the one of the command.
+ */
+static void proxy_multiplex_pipeline(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	GList *node = st->injected.queries->head;
+
+	st->injected.pipelined = 0;
+
+	if (NULL == node || ((injection *)node->data)->id != PROXY_INJECTION_SESSION_RESTORE) return;
+
+	for (node = node->next; node && ((injection *)node->data)->id == PROXY_INJECTION_SESSION_RESTORE; node = node->next) {
+		injection *inj = node->data;
+
+		network_mysqld_queue_reset(con->server);
+		network_mysqld_queue_append(con->server, con->server->send_queue, S(inj->query));
+
+		st->injected.pipelined++;
+	}
+}
+
+/**
+ * read the result of a command we already sent with proxy_multiplex_pipeline()
+ */
+static void proxy_multiplex_read_pipelined(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	injection *inj = g_queue_peek_head(st->injected.queries);
+	network_packet p;
+
+	st->injected.pipelined--;
+	con->resultset_is_needed = inj->resultset_is_needed;
+
+	network_mysqld_con_reset_command_response_state(con);
+
+	/* track the result of the command as it was sent */
+	p.data = g_string_sized_new(NET_HEADER_SIZE + inj->query->len);
+	p.offset = 0;
+	network_mysqld_proto_append_packet_len(p.data, inj->query->len);
+	network_mysqld_proto_append_packet_id(p.data, 0);
+	g_string_append_len(p.data, S(inj->query));
+
+	if (0 != network_mysqld_con_command_states_init(con, &p)) {
+		g_debug("%s: tracking mysql protocol states failed", G_STRLOC);
+	}
+	g_string_free(p.data, TRUE);
+
+	proxy_query_track_start(st);
+	con->state = CON_STATE_READ_QUERY_RESULT;
+}
+
+/**
+ * the result of one of our PROXY_INJECTION_SESSION_RESTORE
+ *
+ * the command of the client isn't run with the wrong session, it gets the error instead.
+ * the results of the pipelined commands are still on their way, they are read and dropped
+ */
+static network_mysqld_lua_stmt_ret proxy_multiplex_restored(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	GString *packet = g_queue_peek_head(con->server->recv_queue->chunks);
+
+	if (packet && packet->len > NET_HEADER_SIZE && packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR &&
+	    0 == st->injected.sent_resultset) {
+		while (st->injected.queries->length > st->injected.pipelined) {
+			injection_free(g_queue_pop_tail(st->injected.queries));
+		}
+
+		while ((packet = g_queue_pop_head(con->server->recv_queue->chunks))) {
+			network_mysqld_queue_append_raw(con->client, con->client->send_queue, packet);
+		}
+		st->injected.sent_resultset++;
+
+		return PROXY_NO_DECISION;
+	}
+
+	while ((packet = g_queue_pop_head(con->server->recv_queue->chunks))) g_string_free(packet, TRUE);
+
+	return PROXY_IGNORE_RESULT;
+}
+
+/**
+ * remember the GTIDs of the last transaction of the client
+ *
+ * the server only sends them with session_track_gtids = OWN_GTID, the reads
+ * which follow go to read-only backends which applied them
+ */
+static void proxy_gtid_track(network_mysqld_con *con, network_mysqld_con_lua_t *st, GString *packet) {
+	network_packet p;
+
+	if (con->parse.command != COM_QUERY && con->parse.command != COM_STMT_EXECUTE) return;
+	if (NULL == con->server->response ||
+	    !(con->server->response->client_capabilities & CLIENT_SESSION_TRACK)) return;
+	if (packet->len <= NET_HEADER_SIZE) return;
+
+	/* with CLIENT_DEPRECATE_EOF the end of the rows is a OK too, the packet is in the format of the client */
+	if (packet->str[NET_HEADER_SIZE] != MYSQLD_PACKET_OK &&
+	    !(con->client->is_eof_deprecated && network_mysqld_proto_packet_is_eof(packet))) return;
+
+	if (NULL == st->last_write_gtids) st->last_write_gtids = g_string_new(NULL);
+
+	p.data = packet;
+	p.offset = NET_HEADER_SIZE;
+
+	network_mysqld_proto_get_ok_packet_gtids(&p, st->last_write_gtids);
+}
+
+/**
+ * track the cursors of the client from the result of a statement-command
+ *
+ * a COM_STMT_EXECUTE opens one if the server says SERVER_STATUS_CURSOR_EXISTS,
+ * it is gone after the last row is fetched or a COM_STMT_RESET
+ */
+static void proxy_stmt_track_cursor(network_mysqld_con *con, network_mysqld_con_lua_t *st, GString *packet) {
+	gpointer client_id = GUINT_TO_POINTER(st->stmt_command_id);
+	network_mysqld_eof_packet_t *eof;
+	network_packet p;
+
+	if (NULL == st->stmts || 0 == st->stmt_command_id) return;
+
+	st->stmt_command_id = 0;
+
+	switch (con->parse.command) {
+	case COM_STMT_EXECUTE:
+		if (((network_mysqld_com_query_result_t *)con->parse.data)->server_status & SERVER_STATUS_CURSOR_EXISTS) {
+			g_hash_table_insert(st->stmt_cursors, client_id, client_id);
+		} else {
+			g_hash_table_remove(st->stmt_cursors, client_id);
+		}
+		break;
+	case COM_STMT_FETCH:
+		if (packet->len <= NET_HEADER_SIZE) break;
+
+		if (packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_ERR) {
+			g_hash_table_remove(st->stmt_cursors, client_id);
+			break;
+		}
+
+		if (!network_mysqld_proto_packet_is_eof(packet)) break;
+
+		eof = network_mysqld_eof_packet_new();
+
+		p.data = packet;
+		p.offset = NET_HEADER_SIZE;
+
+		if (0 == network_mysqld_proto_get_eof_packet(&p, eof) &&
+		    (eof->server_status & SERVER_STATUS_LAST_ROW_SENT)) {
+			g_hash_table_remove(st->stmt_cursors, client_id);
+		}
+		network_mysqld_eof_packet_free(eof);
+		break;
+	case COM_STMT_RESET:
+		g_hash_table_remove(st->stmt_cursors, client_id);
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * track the transaction-state and the session-variables from the result of a command
+ */
+static void proxy_multiplex_track_result(network_mysqld_con *con, network_mysqld_con_lua_t *st, injection *inj) {
+	network_mysqld_session *session = st->session ? st->session : st->cache_session;
+	network_mysqld_com_query_result_t *com_query;
+
+	if (NULL == session) return;
+	if (con->parse.command != COM_QUERY && con->parse.command != COM_STMT_EXECUTE) return;
+
+	com_query = con->parse.data;
+
+	/* a ERR doesn't carry a server_status */
+	if (com_query->query_status == MYSQLD_PACKET_OK) {
+		session->server_status = com_query->server_status;
+	}
+
+	if (con->parse.command == COM_QUERY) {
+		network_mysqld_session_track_result(session,
+				(inj && inj->id != PROXY_INJECTION_STMT_FORWARD) ? inj->query : NULL,
+				com_query->query_status == MYSQLD_PACKET_OK,
+				con->client, con->server);
+	}
+}
+
+/**
+ * give the server connection back to the pool if the client is at a transaction boundary
+ *
+ * the next command of the client gets a connection from the pool again
+ */
+static void proxy_multiplex_release(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
+	if (NULL == st->session || NULL == con->server) return;
+
+	if (!network_mysqld_session_is_idle(st->session)) return;
+
+	/* the statements of the client only exist on this connection */
+	if (NULL == st->stmts && con->valid_prepare_stmt_cnt > 0) return;
+	/* COM_STMT_FETCH has to find the cursor */
+	if (NULL != st->stmts && g_hash_table_size(st->stmt_cursors) > 0) return;
+	if (NULL != con->server_list) return;
+
+	/* the client sends the file next */
+	if (con->parse.command == COM_QUERY &&
+	    network_mysqld_com_query_result_is_local_infile(con->parse.data)) return;
+
+	if (network_connection_pool_lua_add_connection(con, 0) != 0) {
+		g_debug("%s, con:%p:server connection returned to pool failed", G_STRLOC, con);
+	}
+}
+
 /**
  * handle event-timeouts on the different states
  *
@@ -303,6 +1592,32 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query_result(network_mysqld_co
 
 	inj = g_queue_pop_head(st->injected.queries);
 
+	switch (inj->id) {
+	case PROXY_INJECTION_STMT_PREPARE:
+		ret = proxy_stmt_reprepared(con, st);
+		injection_free(inj);
+
+		return ret;
+	case PROXY_INJECTION_STMT_FORWARD:
+		/* the result is already forwarded */
+		st->injected.sent_resultset++;
+		injection_free(inj);
+
+		return PROXY_NO_DECISION;
+	case PROXY_INJECTION_SESSION_RESTORE:
+		ret = proxy_multiplex_restored(con, st);
+		injection_free(inj);
+
+		return ret;
+	case PROXY_INJECTION_STMT_INIT_DB:
+		ret = proxy_stmt_db_switched(con, st);
+		injection_free(inj);
+
+		return ret;
+	default:
+		break;
+	}
+
 #ifdef HAVE_LUA_H
 	/* call the lua script to pick a backend
 	 * */
@@ -553,6 +1868,7 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_handshake(network_mysqld_con *
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 	network_packet packet;
 	network_socket *recv_sock, *send_sock;
+	chassis_plugin_config *config = con->config;
 	network_mysqld_auth_challenge *challenge;
 	GString *challenge_packet;
 	guint8 status = 0;
@@ -589,8 +1905,13 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 
  	con->server->challenge = challenge;
 
-	/* we can't sniff compressed packets nor do we support SSL */
-	challenge->capabilities &= ~(CLIENT_COMPRESS);
+	/* we don't support SSL
+	 *
+	 * compression is negotiated on each side on its own, the server-side 
+	 * challenge keeps CLIENT_COMPRESS for proxy_read_auth()
+	 *
+	 * CLIENT_DEPRECATE_EOF is offered to the client as the server offers it
+	 */
 	challenge->capabilities &= ~(CLIENT_SSL);
 
 	switch (proxy_lua_read_handshake(con)) {
@@ -608,18 +1929,24 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_handshake) {
 		break;
 	}
 
+	/* copy the pack to the client */
+	g_assert(con->client->challenge == NULL);
+	con->client->challenge = network_mysqld_auth_challenge_copy(challenge);
+
+	if (config->client_compress) {
+		con->client->challenge->capabilities |= CLIENT_COMPRESS;
+	} else {
+		con->client->challenge->capabilities &= ~(CLIENT_COMPRESS);
+	}
+
 	challenge_packet = g_string_sized_new(packet.data->len); /* the packet we generate will be likely as large as the old one. should save some reallocs */
-	network_mysqld_proto_append_auth_challenge(challenge_packet, challenge);
+	network_mysqld_proto_append_auth_challenge(challenge_packet, con->client->challenge);
 	network_mysqld_queue_sync(send_sock, recv_sock);
 	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(challenge_packet));
 
 	g_string_free(challenge_packet, TRUE);
 
 	g_string_free(g_queue_pop_tail(recv_sock->recv_queue->chunks), TRUE);
-
-	/* copy the pack to the client */
-	g_assert(con->client->challenge == NULL);
-	con->client->challenge = network_mysqld_auth_challenge_copy(challenge);
 	
 	con->state = CON_STATE_SEND_HANDSHAKE;
 
@@ -715,6 +2042,29 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_auth(network_mysqld_con *con)
 	return ret;
 }
 
+/**
+ * decide about the compressed protocol of the backend by the auth-packet we send it
+ *
+ * the backend gets the compressed protocol if we want it, whatever the client
+ * or the script asked for. The socket only compresses after the auth if the
+ * packet keeps CLIENT_COMPRESS.
+ *
+ * @param capabilities the first byte of the capabilities in the auth-packet, CLIENT_COMPRESS is in it
+ */
+static void proxy_auth_compress(network_mysqld_con *con, network_socket *send_sock, gchar *capabilities) {
+	chassis_plugin_config *config = con->config;
+
+	if (config->backend_compress && send_sock->challenge &&
+	    (send_sock->challenge->capabilities & CLIENT_COMPRESS)) {
+		*capabilities |= CLIENT_COMPRESS;
+
+		send_sock->compress_after_auth = TRUE;
+		if (config->compress_min_length >= 0) send_sock->compress_min_len = config->compress_min_length;
+	} else {
+		*capabilities &= ~CLIENT_COMPRESS;
+	}
+}
+
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 	/* read auth from client */
 	network_packet packet;
@@ -725,6 +2075,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 	gboolean free_client_packet = TRUE;
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	gboolean got_all_data = TRUE;
+	gboolean is_auth_response = FALSE;
 
 	recv_sock = con->client;
 	send_sock = con->server;
@@ -768,6 +2119,17 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 		}
 
  		con->client->response = auth;
+		is_auth_response = TRUE;
+
+		/* resultsets without the EOF after the column-definitions, if we offered it */
+		con->client->is_eof_deprecated = (auth->client_capabilities & CLIENT_DEPRECATE_EOF) &&
+			(con->client->challenge->capabilities & CLIENT_DEPRECATE_EOF);
+
+		/* the client takes the compressed protocol we offered in proxy_read_handshake() */
+		if ((auth->client_capabilities & CLIENT_COMPRESS) && (con->client->challenge->capabilities & CLIENT_COMPRESS)) {
+			con->client->compress_after_auth = TRUE;
+			if (config->compress_min_length >= 0) con->client->compress_min_len = config->compress_min_length;
+		}
 
 		g_string_assign_len(con->client->default_db, S(auth->database));
 
@@ -820,6 +2182,14 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 			/* replace the client challenge that is sent to the server */
 			inj = g_queue_pop_head(st->injected.queries);
 
+			/* the script decides about CLIENT_DEPRECATE_EOF too, it is in the last byte of the capabilities */
+			send_sock->is_eof_deprecated = inj->query->len > 3 &&
+				((guint8)inj->query->str[3] & (CLIENT_DEPRECATE_EOF >> 24)) &&
+				send_sock->challenge && (send_sock->challenge->capabilities & CLIENT_DEPRECATE_EOF);
+
+			/* a CLIENT_COMPRESS the socket doesn't know about would leave it uncompressed */
+			if (inj->query->len > 0) proxy_auth_compress(con, send_sock, &(inj->query->str[0]));
+
 	        g_debug("con:%p, append packet to send queues", con);
 			network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
 
@@ -887,6 +2257,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 					/* we just injected a com_change_user packet so let's set the flag to track it on the connection */
 					st->is_in_com_change_user = TRUE;
 
+					/* ... which drops the prepared statements */
+					if (con->server->prepared_stmts) network_prepared_stmts_reset(con->server->prepared_stmts);
+
 					/**
 					 * the server is already authenticated, the client isn't
 					 *
@@ -943,6 +2316,13 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_auth) {
 				}
 			} else {
                 g_debug("sock:%p, append raw packet", con);
+
+				if (is_auth_response) {
+					proxy_auth_compress(con, send_sock, &(packet.data->str[NET_HEADER_SIZE]));
+
+					/* CLIENT_DEPRECATE_EOF goes through, the client got the server's offer */
+					send_sock->is_eof_deprecated = con->client->is_eof_deprecated;
+				}
 				network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet.data);
 				con->state = CON_STATE_SEND_AUTH;
 
@@ -1337,7 +2717,11 @@ static network_mysqld_lua_stmt_ret proxy_lua_read_query(network_mysqld_con *con)
 				 * 
 				 *  */
 
-				if (st->injected.queries->length == 0) {
+				if (con->scatter) {
+					/* proxy.connection:scatter() sends the query to the shards */
+					network_injection_queue_reset(st->injected.queries);
+					ret = PROXY_SEND_SCATTER;
+				} else if (st->injected.queries->length == 0) {
 					g_critical("%s: 'return proxy.PROXY_SEND_QUERY' used without proxy.queue:append() or :prepend(). Assuming 'nil' was returned",
 							G_STRLOC);
 				} else {
@@ -1391,9 +2775,45 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 	 */
 	st->is_in_com_change_user = FALSE;
 
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter_lua");
-	ret = proxy_lua_read_query(con);
-	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::leave_lua");
+	if (st->park_backend) {
+		/* we waited for a server connection, the script already saw the query */
+		ret = proxy_multiplex_attach(con, st, st->park_ret);
+	} else {
+		if (st->session && 1 == recv_sock->recv_queue->chunks->length) {
+			network_mysqld_session_track_query(st->session, g_queue_peek_head(recv_sock->recv_queue->chunks), NET_HEADER_SIZE);
+		} else if (st->cache_session) {
+			/* a command larger than a packet may change anything */
+			if (1 == recv_sock->recv_queue->chunks->length) {
+				network_mysqld_session_track_query(st->cache_session, g_queue_peek_head(recv_sock->recv_queue->chunks), NET_HEADER_SIZE);
+			} else {
+				st->cache_session->pins |= NETWORK_SESSION_PIN_SESSION_VARS;
+			}
+		}
+
+		if (proxy_query_cache_lookup(con, st) ||
+		    proxy_stmt_read_query(con, st)) {
+			/* the result is already queued for the client */
+			ret = PROXY_SEND_RESULT;
+		} else {
+			NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::enter_lua");
+			ret = proxy_lua_read_query(con);
+			NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::leave_lua");
+
+			ret = proxy_multiplex_attach(con, st, ret);
+		}
+	}
+
+	/* the query stays in the recv-queue until proxy_multiplex_park_handle() gets called */
+	if (st->park_backend) return NETWORK_SOCKET_SUCCESS;
+
+	ret = proxy_multiplex_restore(con, st, ret);
+	ret = proxy_stmt_route(con, st, ret);
+
+	if (ret != PROXY_SEND_SCATTER && con->scatter) {
+		/* proxy.connection:scatter() without 'return proxy.PROXY_SEND_QUERY' */
+		network_mysqld_scatter_free(con->scatter);
+		con->scatter = NULL;
+	}
 
 	/**
 	 * if we disconnected in read_query_result() we have no connection open
@@ -1401,7 +2821,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 	 *
 	 * for PROXY_SEND_RESULT we don't need a server
 	 */
-	if (ret != PROXY_SEND_NONE && ret != PROXY_SEND_RESULT &&
+	if (ret != PROXY_SEND_NONE && ret != PROXY_SEND_RESULT && ret != PROXY_SEND_SCATTER &&
 	    con->server == NULL) {
 		g_critical("%s.%d: I have no server backend, closing connection", __FILE__, __LINE__);
 		return NETWORK_SOCKET_ERROR;
@@ -1416,9 +2836,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) {
 			network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, packet);
 		}
+		proxy_stmt_send_closed(con);
 		con->resultset_is_needed = FALSE; /* we don't want to buffer the result-set */
 
 		break;
+	case PROXY_SEND_SCATTER: /* the shards queue the result */
 	case PROXY_SEND_RESULT: {
 		gboolean is_first_packet = TRUE;
 		proxy_query = 0;
@@ -1456,6 +2878,8 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 
 		network_mysqld_queue_reset(send_sock);
 		network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+		proxy_multiplex_pipeline(con, st);
+		proxy_stmt_send_closed(con);
 
 		while ((packet = g_queue_pop_head(recv_sock->recv_queue->chunks))) g_string_free(packet, TRUE);
 
@@ -1472,11 +2896,20 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
         if (quietly_quit) {
 		    con->state = CON_STATE_CLIENT_QUIT;
         } else {
+            proxy_query_track_start(st);
             con->state = CON_STATE_SEND_QUERY;
         }
 	} else {
 		GList *cur;
 
+		if (ret == PROXY_SEND_SCATTER) {
+			if (0 != network_mysqld_scatter_start(con->scatter, con)) {
+				g_debug("%s: starting the scatter-gather query failed", G_STRLOC);
+			}
+		} else {
+			con->resultset_is_finished = TRUE; /* we don't have more too send */
+		}
+
 		/* if we don't send the query to the backend, it won't be tracked. So track it here instead 
 		 * to get the packet tracking right (LOAD DATA LOCAL INFILE, ...) */
 
@@ -1490,14 +2923,48 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query) {
 			r = network_mysqld_proto_get_query_result(&p, con);
 		}
 
+		/* a COM_STMT_PREPARE we answered doesn't bind the client to the connection */
+		if (st->stmts) con->valid_prepare_stmt_cnt = 0;
+
 		con->state = CON_STATE_SEND_QUERY_RESULT;
-		con->resultset_is_finished = TRUE; /* we don't have more too send */
 	}
 	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query::done");
 
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * a server connection came back into the pool or we waited too long
+ *
+ * try to attach it to the parked client and continue with its query
+ */
+static void proxy_multiplex_park_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+	network_mysqld_con_lua_t *st = con->plugin_con_state;
+	lua_scope *sc = network_mysqld_con_get_lua_scope(con);
+	network_socket_retval_t ret;
+
+	if (NULL == st || NULL == st->park_backend) return;
+
+	network_connection_pool_unwait(st->park_backend->pool, &st->evt_timer);
+
+	LOCK_LUA(sc);
+	ret = proxy_read_query(con->srv, con);
+	UNLOCK_LUA(sc);
+
+	if (ret != NETWORK_SOCKET_SUCCESS) {
+		con->prev_state = con->state;
+		con->state = CON_STATE_ERROR;
+	} else if (st->park_backend) {
+		/* parked again until the next connection comes back */
+		return;
+	} else if (con->state == CON_STATE_SEND_QUERY) {
+		network_mysqld_con_reset_command_response_state(con);
+	}
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
 /**
  * decide about the next state after the result-set has been written 
  * to the client
@@ -1522,6 +2989,12 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 		return NETWORK_SOCKET_SUCCESS;
 	}
 
+	if (con->scatter) {
+		/* the merged result of the shards is sent */
+		network_mysqld_scatter_free(con->scatter);
+		con->scatter = NULL;
+	}
+
 	if (con->parse.command == COM_BINLOG_DUMP) {
 		/**
 		 * the binlog dump is different as it doesn't have END packet
@@ -1537,6 +3010,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 	 */
 	if (!send_sock) {
 		network_injection_queue_reset(st->injected.queries);
+		st->injected.pipelined = 0;
 	}
 
 	if (st->injected.queries->length == 0) {
@@ -1544,6 +3018,15 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 
 		con->state = CON_STATE_READ_QUERY;
 
+		proxy_multiplex_release(con, st);
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	if (st->injected.pipelined > 0) {
+		/* the next one is sent already */
+		proxy_multiplex_read_pipelined(con, st);
+
 		return NETWORK_SOCKET_SUCCESS;
 	}
 
@@ -1551,6 +3034,10 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 	 * push the next one 
 	 */
 	inj = g_queue_peek_head(st->injected.queries);
+	if (send_sock && PROXY_STMT_PREPARE == proxy_stmt_send(con, st, inj->query, 0, FALSE)) {
+		/* our COM_STMT_PREPARE goes first */
+		inj = g_queue_peek_head(st->injected.queries);
+	}
 	con->resultset_is_needed = inj->resultset_is_needed;
 
 	if (!inj->resultset_is_needed && st->injected.sent_resultset > 0) {
@@ -1567,9 +3054,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_send_query_result) {
 
 	network_mysqld_queue_reset(send_sock);
 	network_mysqld_queue_append(send_sock, send_sock->send_queue, S(inj->query));
+	proxy_stmt_send_closed(con);
 
 	network_mysqld_con_reset_command_response_state(con);
 
+	proxy_query_track_start(st);
 	con->state = CON_STATE_SEND_QUERY;
 
 	return NETWORK_SOCKET_SUCCESS;
@@ -1591,6 +3080,7 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
 	network_socket *recv_sock, *send_sock;
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	injection *inj = NULL;
+	gboolean is_client_query;
 
 	NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter");
 
@@ -1618,8 +3108,23 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
 
 	con->resultset_is_finished = is_finished;
 
+	/* the result of the client's query, not of a query the script injected */
+	is_client_query = (NULL == inj || NULL == st->cache_query || g_string_equal(inj->query, st->cache_query));
+
+	if (is_client_query && (con->resultset_is_spliced || !con->resultset_is_needed)) {
+		proxy_query_cache_capture(con, st, packet.data);
+	}
+
+	if (st->stmt_prepare_key && con->parse.command == COM_STMT_PREPARE &&
+	    (con->resultset_is_spliced || !con->resultset_is_needed)) {
+		proxy_stmt_capture(st, packet.data);
+	}
+
 	/* copy the packet over to the send-queue if we don't need it */
-	if (!con->resultset_is_needed) {
+	if (con->resultset_is_spliced) {
+		/* the packet is a view into the raw recv-queue, the core forwards it */
+		g_queue_pop_tail(recv_sock->recv_queue->chunks);
+	} else if (!con->resultset_is_needed) {
 		network_mysqld_queue_append_raw(send_sock, send_sock->send_queue, g_queue_pop_tail(recv_sock->recv_queue->chunks));
 	}
 
@@ -1665,10 +3170,48 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_read_query_result) {
 		
 		network_mysqld_queue_reset(recv_sock); /* reset the packet-id checks as the server-side is finished */
 
+		/* before the lua-script gets a chance to switch the backend */
+		proxy_query_track_done(st, TRUE);
+
+		if (con->parse.command == COM_QUERY || con->parse.command == COM_STMT_EXECUTE) {
+			network_mysqld_com_query_result_t *com_query = con->parse.data;
+
+			st->cache_in_trans = (0 != (com_query->server_status & SERVER_STATUS_IN_TRANS));
+		}
+
+		proxy_multiplex_track_result(con, st, inj);
+		proxy_gtid_track(con, st, packet.data);
+		proxy_stmt_track_cursor(con, st, packet.data);
+
+		if (is_client_query && con->resultset_is_needed && !con->resultset_is_spliced) {
+			GList *chunk;
+
+			/* the buffered result, before the script can change it */
+			for (chunk = recv_sock->recv_queue->chunks->head; chunk; chunk = chunk->next) {
+				proxy_query_cache_capture(con, st, chunk->data);
+			}
+		}
+
+		if (st->stmt_prepare_key && con->parse.command == COM_STMT_PREPARE) {
+			if (con->resultset_is_needed && !con->resultset_is_spliced) {
+				GList *chunk;
+
+				for (chunk = recv_sock->recv_queue->chunks->head; chunk; chunk = chunk->next) {
+					proxy_stmt_capture(st, chunk->data);
+				}
+			}
+
+			proxy_stmt_prepared(con, st);
+		}
+
 		NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::enter_lua");
 		ret = proxy_lua_read_query_result(con);
 		NETWORK_MYSQLD_CON_TRACK_TIME(con, "proxy::ready_query_result::leave_lua");
 
+		if (is_client_query) {
+			proxy_query_cache_done(con, st, PROXY_NO_DECISION == ret);
+		}
+
 		if (PROXY_IGNORE_RESULT != ret) {
 			/* reset the packet-id checks, if we sent something to the client */
 			network_mysqld_queue_reset(send_sock);
@@ -1818,8 +3361,6 @@ static network_mysqld_lua_stmt_ret proxy_lua_connect_server(network_mysqld_con *
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
 	chassis_private *g = con->srv->priv;
-	guint min_connected_clients = G_MAXUINT;
-	guint i;
 	gboolean use_pooled_connection = FALSE;
 	network_backend_t *cur;
 
@@ -1838,9 +3379,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
             g_debug("%s.%d: connecting to backend (%s) success, fd:%d",
 					__FILE__, __LINE__, con->server->dst->name->str, con->server->fd);
 			/* increment the connected clients value only if we connected successfully */
-			st->backend->connected_clients++;
+			g_atomic_int_inc(&(st->backend->connected_clients));
 			g_debug("%s, con:%p, backend ndx:%d:connected_clients++, clients:%d",
-                        G_STRLOC, con, st->backend_ndx, st->backend->connected_clients);
+                        G_STRLOC, con, st->backend_ndx, g_atomic_int_get(&(st->backend->connected_clients)));
 
 			break;
 		case NETWORK_SOCKET_ERROR:
@@ -1937,24 +3478,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 		/**
 		 * we can choose between different back addresses 
 		 *
-		 * prefer SQF (shorted queue first) to load all backends equally
+		 * let the balancing policy pick one of the writable backends
 		 */ 
-
-		for (i = 0; i < network_backends_count(g->backends); i++) {
-			cur = network_backends_get(g->backends, i);
-	
-			/**
-			 * skip backends which are down or not writable
-			 */	
-			if (cur->state == BACKEND_STATE_DOWN ||
-				cur->state == BACKEND_STATE_MAINTAINING ||
-			    cur->type != BACKEND_TYPE_RW) continue;
-	
-			if (cur->connected_clients < min_connected_clients) {
-				st->backend_ndx = i;
-				min_connected_clients = cur->connected_clients;
-			}
-		}
+		st->backend_ndx = network_backends_balance(g->backends, BACKEND_TYPE_RW, NULL, NULL);
 
 		if ((cur = network_backends_get(g->backends, st->backend_ndx))) {
 			st->backend = cur;
@@ -1988,9 +3514,9 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 					__FILE__, __LINE__, con->server->dst->name->str, con->server->fd);
 
 			/* increment the connected clients value only if we connected successfully */
-			st->backend->connected_clients++;
+			g_atomic_int_inc(&(st->backend->connected_clients));
                         g_debug("%s, con:%p, backend ndx:%d:connected_clients++, total clients:%d",
-                        G_STRLOC, con, st->backend_ndx, st->backend->connected_clients);
+                        G_STRLOC, con, st->backend_ndx, g_atomic_int_get(&(st->backend->connected_clients)));
 			break;
 		default:
 			g_message("%s.%d: connecting to backend (%s) failed, marking it as down for ...", 
@@ -2018,8 +3544,16 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 		 * send the old hand-shake packet
 		 */
 
+		g_assert(con->client->challenge == NULL);
+		con->client->challenge = network_mysqld_auth_challenge_copy(con->server->challenge);
+
+		/* offer CLIENT_DEPRECATE_EOF only if the pooled connection has it, the resultsets don't need to be rewritten then */
+		if (!con->server->is_eof_deprecated) {
+			con->client->challenge->capabilities &= ~(CLIENT_DEPRECATE_EOF);
+		}
+
 		auth_packet = g_string_new(NULL);
-		network_mysqld_proto_append_auth_challenge(auth_packet, con->server->challenge);
+		network_mysqld_proto_append_auth_challenge(auth_packet, con->client->challenge);
 
 		network_mysqld_queue_append(
 				con->client,
@@ -2028,9 +3562,6 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_connect_server) {
 
 		g_string_free(auth_packet, TRUE);
 
-		g_assert(con->client->challenge == NULL);
-		con->client->challenge = network_mysqld_auth_challenge_copy(con->server->challenge);
-
 		con->state = CON_STATE_SEND_HANDSHAKE;
 
 		/**
@@ -2064,6 +3595,22 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init) {
 	st = network_mysqld_con_lua_new();
 
 	con->plugin_con_state = st;
+
+	/* proxy_read_query_result() handles spliced packets */
+	con->resultset_splice_is_supported = TRUE;
+
+	if (config->share_prepared_stmts) {
+		st->stmts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_hash_table_string_free);
+		st->stmt_param_types = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_hash_table_string_free);
+		st->stmt_cursors = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
+
+	if (config->multiplex) {
+		st->session = network_mysqld_session_new();
+	} else if (config->query_cache) {
+		/* keeps the charsets and the sql_mode of the client current for the key of the cache */
+		st->cache_session = network_mysqld_session_new();
+	}
 	
 	con->state = CON_STATE_CONNECT_SERVER;
 
@@ -2081,6 +3628,16 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_init) {
 		timeval_from_double(&con->write_timeout, config->write_timeout_dbl);
 	}
 
+	if (config->result_flush_bytes > 0) {
+		con->resultset_flush.max_bytes = config->result_flush_bytes;
+	}
+	if (config->result_flush_latency_dbl >= 0) {
+		con->resultset_flush.max_latency_us = config->result_flush_latency_dbl * 1000000;
+	}
+	if (config->resultset_buffer_max > 0) {
+		con->resultset_buffer_max = config->resultset_buffer_max;
+	}
+
 	return NETWORK_SOCKET_SUCCESS;
 }
 
@@ -2169,10 +3726,21 @@ static network_mysqld_lua_stmt_ret proxy_lua_disconnect_client(network_mysqld_co
  */
 NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
 	network_mysqld_con_lua_t *st = con->plugin_con_state;
-	lua_scope  *sc = con->srv->priv->sc;
+	lua_scope  *sc = network_mysqld_con_get_lua_scope(con);
 
 	if (st == NULL) return NETWORK_SOCKET_SUCCESS;
+
+	proxy_multiplex_unpark(con, st);
 	
+	/* a query which was still running doesn't give us a response-time */
+	proxy_query_track_done(st, FALSE);
+
+	if (con->config->query_cache) {
+		/* we don't know if the writes got committed */
+		st->cache_in_trans = FALSE;
+		proxy_query_cache_committed(con->config->query_cache, st);
+	}
+
 	/**
 	 * let the lua-level decide if we want to keep the connection in the pool
 	 */
@@ -2189,6 +3757,11 @@ NETWORK_MYSQLD_PLUGIN_PROTO(proxy_disconnect_client) {
 		break;
 	}
 
+	if (st->session && con->server && !network_mysqld_session_is_idle(st->session)) {
+		/* the next client would inherit the transaction or the session-state */
+		con->server_is_closed = TRUE;
+	}
+
     if (con->server && !con->server_is_closed) {
         if (con->state == CON_STATE_CLOSE_CLIENT ||
                 (con->pool_conn_used && con->prev_state <= CON_STATE_READ_QUERY))
@@ -2383,6 +3956,13 @@ chassis_plugin_config * network_mysqld_proxy_plugin_new(void) {
 	config->connect_timeout_dbl = -1.0;
 	config->read_timeout_dbl = -1.0;
 	config->write_timeout_dbl = -1.0;
+	config->result_flush_bytes = -1;
+	config->result_flush_latency_dbl = -1.0;
+	config->pool_maintain_interval_dbl = -1.0;
+	config->query_cache_ttl_dbl = -1.0;
+	config->max_prepared_stmts = -1;
+	config->backend_max_lag = -1;
+	config->compress_min_length = -1;
 
 	return config;
 }
@@ -2416,6 +3996,18 @@ void network_mysqld_proxy_plugin_free(chassis_plugin_config *config) {
 
 	if (config->lua_script) g_free(config->lua_script);
 
+	if (config->pool_maintainer) network_connection_pool_maintainer_free(config->pool_maintainer);
+	if (config->pool_user) g_free(config->pool_user);
+	if (config->pool_password) g_free(config->pool_password);
+
+	if (config->backends_prober) network_backends_prober_free(config->backends_prober);
+	if (config->backend_check_user) g_free(config->backend_check_user);
+	if (config->backend_check_password) g_free(config->backend_check_password);
+
+	if (config->balance) g_free(config->balance);
+
+	if (config->query_cache) network_query_cache_free(config->query_cache);
+
 	g_free(config);
 }
 
@@ -2445,6 +4037,29 @@ static GOptionEntry * network_mysqld_proxy_plugin_get_options(chassis_plugin_con
 		{ "proxy-connect-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "connect timeout in seconds (default: 2.0 seconds)", NULL },
 		{ "proxy-read-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "read timeout in seconds (default: 8 hours)", NULL },
 		{ "proxy-write-timeout",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "write timeout in seconds (default: 8 hours)", NULL },
+
+		{ "proxy-listen-reuseport",   0, 0, G_OPTION_ARG_NONE, NULL, "open one SO_REUSEPORT listen-socket per event-thread (default: disabled)", NULL },
+		{ "proxy-result-flush-bytes", 0, 0, G_OPTION_ARG_INT, NULL, "send unbuffered resultsets to the client once this many bytes are queued (default: 65536)", NULL },
+		{ "proxy-result-flush-latency", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "send unbuffered resultsets to the client if they wait longer than this many seconds, 0 to disable (default: 0.01 seconds)", NULL },
+		{ "proxy-max-resultset-buffer", 0, 0, G_OPTION_ARG_INT, NULL, "max. bytes of resultsets queued per connection, 0 for no limit (default: 0)", NULL },
+		{ "proxy-max-resultset-buffer-total", 0, 0, G_OPTION_ARG_INT, NULL, "max. bytes of resultsets queued over all connections, 0 for no limit (default: 0)", NULL },
+		{ "proxy-pool-user",          0, 0, G_OPTION_ARG_STRING, NULL, "keep the connection pools warm with connections authenticated as this user (default: not set)", "<user>" },
+		{ "proxy-pool-password",      0, 0, G_OPTION_ARG_STRING, NULL, "password of the --proxy-pool-user (default: empty)", "<password>" },
+		{ "proxy-pool-maintain-interval", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "check the connection pools every this many seconds (default: 1.0 seconds)", NULL },
+		{ "proxy-backend-check-interval", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "check the health of the backends every this many seconds, 0 to disable (default: 0)", NULL },
+		{ "proxy-backend-check-user", 0, 0, G_OPTION_ARG_STRING, NULL, "log in as this user and send COM_PING to check the backends (default: only wait for the handshake)", "<user>" },
+		{ "proxy-backend-check-password", 0, 0, G_OPTION_ARG_STRING, NULL, "password of the --proxy-backend-check-user (default: empty)", "<password>" },
+		{ "proxy-backend-check-lag", 0, 0, G_OPTION_ARG_NONE, NULL, "get the replication lag of the read-only backends with SHOW SLAVE STATUS (default: disabled)", NULL },
+		{ "proxy-backend-max-lag",    0, 0, G_OPTION_ARG_INT, NULL, "don't balance to read-only backends which lag more than this many seconds, -1 for no limit (default: -1)", NULL },
+		{ "proxy-balance",            0, 0, G_OPTION_ARG_STRING, NULL, "how to pick a backend: sqf (least clients) or p2c (power of two choices over in-flight queries and response-time) (default: sqf)", "<sqf|p2c>" },
+		{ "proxy-query-cache-size",   0, 0, G_OPTION_ARG_INT, NULL, "max. bytes of resultsets kept in the query-cache, 0 disables it (default: 0)", NULL },
+		{ "proxy-query-cache-ttl",    0, 0, G_OPTION_ARG_DOUBLE, NULL, "use a cached resultset for this many seconds (default: 1.0 seconds)", NULL },
+		{ "proxy-share-prepared-stmts", 0, 0, G_OPTION_ARG_NONE, NULL, "prepare the statements of the clients again on any pooled connection instead of binding the client to one (default: disabled)", NULL },
+		{ "proxy-max-prepared-stmts", 0, 0, G_OPTION_ARG_INT, NULL, "statements kept prepared per server connection with --proxy-share-prepared-stmts, 0 for no limit (default: 256)", NULL },
+		{ "proxy-multiplex",          0, 0, G_OPTION_ARG_NONE, NULL, "give the server connection back to the pool at the end of each transaction and autocommit statement (default: disabled)", NULL },
+		{ "proxy-backend-compress",   0, 0, G_OPTION_ARG_NONE, NULL, "use the compressed protocol on the connections to the backends which support it (default: disabled)", NULL },
+		{ "proxy-client-compress",    0, 0, G_OPTION_ARG_NONE, NULL, "offer the compressed protocol to the clients (default: disabled)", NULL },
+		{ "proxy-compress-min-length", 0, 0, G_OPTION_ARG_INT, NULL, "send payloads shorter than this many bytes uncompressed (default: 50)", NULL },
 		
 		{ NULL,                       0, 0, G_OPTION_ARG_NONE,   NULL, NULL, NULL }
 	};
@@ -2463,28 +4078,42 @@ static GOptionEntry * network_mysqld_proxy_plugin_get_options(chassis_plugin_con
 	config_entries[i++].arg_data = &(config->connect_timeout_dbl);
 	config_entries[i++].arg_data = &(config->read_timeout_dbl);
 	config_entries[i++].arg_data = &(config->write_timeout_dbl);
+	config_entries[i++].arg_data = &(config->listen_reuseport);
+	config_entries[i++].arg_data = &(config->result_flush_bytes);
+	config_entries[i++].arg_data = &(config->result_flush_latency_dbl);
+	config_entries[i++].arg_data = &(config->resultset_buffer_max);
+	config_entries[i++].arg_data = &(config->resultset_buffer_max_total);
+	config_entries[i++].arg_data = &(config->pool_user);
+	config_entries[i++].arg_data = &(config->pool_password);
+	config_entries[i++].arg_data = &(config->pool_maintain_interval_dbl);
+	config_entries[i++].arg_data = &(config->backend_check_interval_dbl);
+	config_entries[i++].arg_data = &(config->backend_check_user);
+	config_entries[i++].arg_data = &(config->backend_check_password);
+	config_entries[i++].arg_data = &(config->backend_check_lag);
+	config_entries[i++].arg_data = &(config->backend_max_lag);
+	config_entries[i++].arg_data = &(config->balance);
+	config_entries[i++].arg_data = &(config->query_cache_size);
+	config_entries[i++].arg_data = &(config->query_cache_ttl_dbl);
+	config_entries[i++].arg_data = &(config->share_prepared_stmts);
+	config_entries[i++].arg_data = &(config->max_prepared_stmts);
+	config_entries[i++].arg_data = &(config->multiplex);
+	config_entries[i++].arg_data = &(config->backend_compress);
+	config_entries[i++].arg_data = &(config->client_compress);
+	config_entries[i++].arg_data = &(config->compress_min_length);
 
 	return config_entries;
 }
 
 /**
- * init the plugin with the parsed config
+ * create a listen-socket on config->address
+ *
+ * the accept-event is prepared, but not added to a event-base yet
+ *
+ * @return the listening connection, NULL on error
  */
-int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
+static network_mysqld_con *network_mysqld_proxy_listen_con_new(chassis *chas, chassis_plugin_config *config) {
 	network_mysqld_con *con;
 	network_socket *listen_sock;
-	chassis_private *g = chas->priv;
-	guint i;
-
-	if (!config->start_proxy) {
-		return 0;
-	}
-
-	if (!config->address) config->address = g_strdup(":4040");
-	if (!config->backend_addresses) {
-		config->backend_addresses = g_new0(char *, 2);
-		config->backend_addresses[0] = g_strdup("127.0.0.1:3306");
-	}
 
 	/** 
 	 * create a connection handle for the listen socket 
@@ -2493,21 +4122,58 @@ int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_confi
 	network_mysqld_add_connection(chas, con);
 	con->config = config;
 
-	config->listen_con = con;
-	
 	listen_sock = network_socket_new();
+	listen_sock->reuse_port = config->listen_reuseport;
 	con->server = listen_sock;
 
 	/* set the plugin hooks as we want to apply them to the new connections too later */
 	network_mysqld_proxy_connection_init(con);
 
 	if (0 != network_address_set_address(listen_sock->dst, config->address)) {
-		return -1;
+		return NULL;
 	}
 
 	if (0 != network_socket_bind(listen_sock)) {
+		return NULL;
+	}
+
+	/**
+	 * call network_mysqld_con_accept() with this connection when we are done
+	 */
+	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
+
+	return con;
+}
+
+/**
+ * init the plugin with the parsed config
+ */
+int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_config *config) {
+	network_mysqld_con *con;
+	chassis_private *g = chas->priv;
+	guint i;
+
+	if (!config->start_proxy) {
+		return 0;
+	}
+
+	if (!config->address) config->address = g_strdup(":4040");
+	if (!config->backend_addresses) {
+		config->backend_addresses = g_new0(char *, 2);
+		config->backend_addresses[0] = g_strdup("127.0.0.1:3306");
+	}
+
+	if (config->listen_reuseport && !(chas->event_threads && chas->event_threads->len > 0)) {
+		/* a single socket with SO_REUSEPORT would only let other processes steal its connections */
+		g_warning("%s: --proxy-listen-reuseport needs --event-threads, ignored", G_STRLOC);
+		config->listen_reuseport = FALSE;
+	}
+
+	if (NULL == (con = network_mysqld_proxy_listen_con_new(chas, config))) {
 		return -1;
 	}
+	config->listen_con = con;
+
 	g_message("proxy listening on port %s", config->address);
 
 	for (i = 0; config->backend_addresses && config->backend_addresses[i]; i++) {
@@ -2524,16 +4190,111 @@ int network_mysqld_proxy_plugin_apply_config(chassis *chas, chassis_plugin_confi
 		}
 	}
 
+	if (config->resultset_buffer_max_total > 0) {
+		g->resultset_buffer_max = config->resultset_buffer_max_total;
+	}
+
+	if (config->balance && 0 != network_backends_set_balance(g->backends, config->balance)) {
+		g_critical("%s: --proxy-balance=%s is unknown, use sqf or p2c", G_STRLOC, config->balance);
+		return -1;
+	}
+
+	if (config->backend_max_lag >= 0) {
+		if (!config->backend_check_lag) {
+			g_warning("%s: --proxy-backend-max-lag needs --proxy-backend-check-lag, no read-only backend will be picked", G_STRLOC);
+		}
+		g->backends->max_lag = config->backend_max_lag;
+	}
+
+#ifndef HAVE_ZLIB_H
+	if (config->backend_compress || config->client_compress) {
+		g_critical("%s: --proxy-backend-compress and --proxy-client-compress need zlib, this build doesn't support the compressed protocol", G_STRLOC);
+		return -1;
+	}
+#endif
+
+	if (config->query_cache_size > 0) {
+		config->query_cache = network_query_cache_new();
+		config->query_cache->max_size = config->query_cache_size;
+		if (config->query_cache_ttl_dbl > 0) {
+			config->query_cache->ttl_us = config->query_cache_ttl_dbl * G_USEC_PER_SEC;
+		}
+	}
+
 	/* load the script and setup the global tables */
 	network_mysqld_lua_setup_global(chas->priv->sc->L, g);
 
-	/**
-	 * call network_mysqld_con_accept() with this connection when we are done
-	 */
+	if (config->listen_reuseport) {
+		/**
+		 * each event-thread accepts on its own socket and keeps the connections,
+		 * the kernel spreads the new connections over the sockets
+		 */
+		for (i = 0; i < chas->event_threads->len; i++) {
+			if (i > 0 && NULL == (con = network_mysqld_proxy_listen_con_new(chas, config))) {
+				return -1;
+			}
 
-	event_set(&(listen_sock->event), listen_sock->fd, EV_READ|EV_PERSIST, network_mysqld_con_accept, con);
-	event_base_set(chas->event_base, &(listen_sock->event));
-	event_add(&(listen_sock->event), NULL);
+			chassis_event_add_to(chas->event_threads->pdata[i], &(con->server->event), NULL);
+		}
+
+		g_message("proxy accepts on %u SO_REUSEPORT sockets", chas->event_threads->len);
+	} else {
+		event_base_set(chas->event_base, &(con->server->event));
+		event_add(&(con->server->event), NULL);
+	}
+
+	if (config->pool_user) {
+		network_connection_pool_maintainer *m;
+
+		m = network_connection_pool_maintainer_new();
+		network_connection_pool_maintainer_set_auth(m, config->pool_user, config->pool_password);
+
+		if (config->pool_password) {
+			/* we only need the hash from now on */
+			memset(config->pool_password, 0, strlen(config->pool_password));
+		}
+
+		if (config->pool_maintain_interval_dbl > 0) {
+			timeval_from_double(&(m->interval), config->pool_maintain_interval_dbl);
+		}
+		if (config->connect_timeout_dbl >= 0) {
+			timeval_from_double(&(m->connect_timeout), config->connect_timeout_dbl);
+		}
+
+		config->pool_maintainer = m;
+
+		if (0 != network_connection_pool_maintainer_start(m, chas, g->backends)) {
+			return -1;
+		}
+	}
+
+	if (config->backend_check_interval_dbl > 0) {
+		network_backends_prober *p;
+
+		p = network_backends_prober_new();
+		network_backends_prober_set_auth(p, config->backend_check_user, config->backend_check_password);
+
+		if (config->backend_check_password) {
+			/* we only need the hash from now on */
+			memset(config->backend_check_password, 0, strlen(config->backend_check_password));
+		}
+
+		if (config->backend_check_lag && !config->backend_check_user) {
+			g_warning("%s: --proxy-backend-check-lag needs a --proxy-backend-check-user, ignored", G_STRLOC);
+		}
+		p->check_lag = config->backend_check_lag;
+
+		timeval_from_double(&(p->interval), config->backend_check_interval_dbl);
+		if (config->connect_timeout_dbl >= 0) {
+			timeval_from_double(&(p->timeout), config->connect_timeout_dbl);
+		}
+
+		config->backends_prober = p;
+
+		if (0 != network_backends_prober_start(p, chas, chassis_event_pick(chas), g->backends)) {
+			return -1;
+		}
+	}
 
 	return 0;
 }
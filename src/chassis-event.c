@@ -33,7 +33,12 @@
 
 #include <event.h>
 
+#ifdef HAVE_LUA_H
+#include <lua.h>
+#endif
+
 #include "chassis-event.h"
+#include "lua-registry-keys.h"
 #include "glib-ext.h"
 
 #define C(x) x, sizeof(x) - 1
@@ -108,28 +113,52 @@ chassis_event_op_set_timeout(chassis_event_op_t *op, struct timeval *tv) {
 	}
 }
 
-void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv) {
-	chassis_event_op_t *op = chassis_event_op_new();
-	gssize ret;
+static GStaticPrivate tls_event_loop = G_STATIC_PRIVATE_INIT;
 
-	op->type = CHASSIS_EVENT_OP_ADD;
-	op->ev   = ev;
-	chassis_event_op_set_timeout(op, tv);
+/**
+ * deferred reclamation of shared data
+ *
+ * data which may still be read by other event-threads (like a replaced
+ * snapshot) is handed to chassis_event_defer_free(). It gets freed after
+ * all running event-loops went through their idle-point once.
+ */
+typedef struct {
+	gint epoch;
+
+	gpointer data;
+	GDestroyNotify free_func;
+} chassis_event_retired_t;
+
+static GStaticMutex rcu_mutex = G_STATIC_MUTEX_INIT;
+static GQueue *rcu_retired = NULL;   /**< queue(chassis_event_retired_t) ordered by epoch */
+static GPtrArray *rcu_loops = NULL;  /**< array(chassis_event_t) of the running loops */
+static volatile gint rcu_epoch = 0;
 
-    g_async_queue_push_unlocked(chas->event_queue, op);
+/**
+ * get the event-loop that is running in the current thread
+ *
+ * @return NULL if the current thread isn't inside chassis_event_loop()
+ */
+chassis_event_t *chassis_event_get_current(void) {
+	return g_static_private_get(&tls_event_loop);
+}
+
+/**
+ * push a event-op into a event-queue and ping the loop owning the queue 
+ */
+static void chassis_event_op_push(GAsyncQueue *event_queue, int notify_send_fd, chassis_event_op_t *op) {
+	gssize ret;
 
-    g_debug("%s: cal chassis_event_add_with_timeout, fd:%d, timeout sec:%d,usec:%d",
-					G_STRLOC, chas->event_notify_fds[1],
-					(int) tv->tv_sec, (int) tv->tv_usec);
+	g_async_queue_push(event_queue, op);
 
 	/* ping the event handler */
-	if (1 != (ret = send(chas->event_notify_fds[1], C("."), 0))) {
+	if (1 != (ret = send(notify_send_fd, C("."), 0))) {
 		int last_errno; 
 
 		last_errno = errno;
 
-        g_debug("%s: cal chassis_event_add_with_timeout, fd:%d errno:%d",
-					G_STRLOC, chas->event_notify_fds[1], last_errno);
+		g_debug("%s: send() to notify-fd:%d, errno:%d",
+					G_STRLOC, notify_send_fd, last_errno);
 
 		switch (last_errno) {
 		case EAGAIN:
@@ -137,19 +166,69 @@ void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct time
 			/* that's fine ... */
 			g_debug("%s: send() to event-notify-pipe failed: %s (len = %d)",
 					G_STRLOC,
-					g_strerror(errno),
-					g_async_queue_length_unlocked(chas->event_queue));
+					g_strerror(last_errno),
+					g_async_queue_length(event_queue));
 			break;
 		default:
 			g_critical("%s: send() to event-notify-pipe failed: %s (len = %d)",
 					G_STRLOC,
-					g_strerror(errno),
-					g_async_queue_length_unlocked(chas->event_queue));
+					g_strerror(last_errno),
+					g_async_queue_length(event_queue));
 			break;
 		}
 	}
 }
 
+/**
+ * add a event with a timeout
+ *
+ * if the current thread runs a event-loop it owns the event and we can add it
+ * right away. Otherwise the event is handed to the main-loop through the global
+ * event-queue.
+ */
+void chassis_event_add_with_timeout(chassis *chas, struct event *ev, struct timeval *tv) {
+	chassis_event_op_t *op;
+
+	if (NULL != chassis_event_get_current()) {
+		chassis_event_add_local_with_timeout(chas, ev, tv);
+		return;
+	}
+
+	op = chassis_event_op_new();
+
+	op->type = CHASSIS_EVENT_OP_ADD;
+	op->ev   = ev;
+	chassis_event_op_set_timeout(op, tv);
+
+	chassis_event_op_push(chas->event_queue, chas->event_notify_fds[1], op);
+}
+
+/**
+ * add a event to a specific event-loop
+ *
+ * used to hand over a connection to a event-thread, the loop will own the 
+ * event from now on
+ *
+ * @see network_mysqld_con_accept()
+ */
+void chassis_event_add_to(chassis_event_t *loop, struct event *ev, struct timeval *tv) {
+	chassis_event_op_t *op;
+
+	op = chassis_event_op_new();
+
+	op->type = CHASSIS_EVENT_OP_ADD;
+	op->ev   = ev;
+	chassis_event_op_set_timeout(op, tv);
+
+	if (loop == chassis_event_get_current()) {
+		chassis_event_op_apply(op, loop->event_base);
+		chassis_event_op_free(op);
+		return;
+	}
+
+	chassis_event_op_push(loop->event_queue, loop->notify_send_fd, op);
+}
+
 /**
  * add a event asynchronously
  *
@@ -161,12 +240,16 @@ void chassis_event_add(chassis *chas, struct event *ev) {
 
 
 /**
- * add a event
+ * add a event to the event-base of the current thread
+ *
+ * falls back to the event-base of the main-loop if the current thread
+ * doesn't run a event-loop
  *
  * @see network_connection_pool_lua_add_connection()
  */
-void chassis_event_add_local_with_timeout(chassis G_GNUC_UNUSED *chas, struct event *ev, struct timeval *tv) {
-	struct event_base *event_base = chas->event_base;
+void chassis_event_add_local_with_timeout(chassis *chas, struct event *ev, struct timeval *tv) {
+	chassis_event_t *loop = chassis_event_get_current();
+	struct event_base *event_base = loop ? loop->event_base : chas->event_base;
 	chassis_event_op_t *op;
 
 	g_assert(event_base); 
@@ -186,14 +269,13 @@ void chassis_event_add_local(chassis *chas, struct event *ev) {
 	chassis_event_add_local_with_timeout(chas, ev, NULL);
 }
 /**
- * handled events sent through the global event-queue 
+ * handled events sent through the event-queue of this loop
  *
  * @see chassis_event_add()
  */
 void chassis_event_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
 	chassis_event_t *event = user_data;
 	struct event_base *event_base = event->event_base;
-	chassis *chas = event->chas;
 	chassis_event_op_t *op;
 
 	do {
@@ -201,7 +283,7 @@ void chassis_event_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events
 
         gsize ret;
 
-        if (op = g_async_queue_try_pop_unlocked(chas->event_queue)) {
+        if (op = g_async_queue_try_pop(event->event_queue)) {
 
             chassis_event_op_apply(op, event_base);
 
@@ -238,6 +320,8 @@ chassis_event_t *chassis_event_new() {
 	chassis_event_t *event;
 
 	event = g_new0(chassis_event_t, 1);
+	event->notify_fd = -1;
+	event->notify_send_fd = -1;
 
 	return event;
 }
@@ -256,6 +340,21 @@ void chassis_event_free(chassis_event_t *event) {
 		closesocket(event->notify_fd);
 	}
 
+	if (event->is_worker) {
+		chassis_event_op_t *op;
+
+		if (event->notify_send_fd != -1) closesocket(event->notify_send_fd);
+
+		if (event->event_queue) {
+			while ((op = g_async_queue_try_pop(event->event_queue))) {
+				chassis_event_op_free(op);
+			}
+			g_async_queue_unref(event->event_queue);
+		}
+	}
+
+	if (event->sc) lua_scope_free(event->sc);
+
 	if (event->event_base) event_base_free(event->event_base);
 
 	g_free(event);
@@ -270,6 +369,8 @@ void chassis_event_free(chassis_event_t *event) {
 int chassis_event_init(chassis_event_t *loop, chassis *chas) {
 	loop->event_base = event_base_new();
 	loop->chas = chas;
+	loop->event_queue = chas->event_queue;
+	loop->notify_send_fd = chas->event_notify_fds[1];
 	loop->notify_fd = dup(chas->event_notify_fds[0]);
 	if (-1 == loop->notify_fd) {
 		g_critical("%s: Could not create duplicated socket: %s (%d)", G_STRLOC, g_strerror(errno), errno);
@@ -283,12 +384,153 @@ int chassis_event_init(chassis_event_t *loop, chassis *chas) {
 	return 0;
 }
 
+/**
+ * setup a event-loop for a event-thread
+ *
+ * unlike the main-loop each worker has its own event-queue and notification-pipe
+ * so that events can be handed to exactly this thread
+ *
+ * @see chassis_event_add_to()
+ */
+int chassis_event_init_worker(chassis_event_t *loop, chassis *chas, guint index) {
+	int fds[2];
+
+	loop->chas = chas;
+	loop->index = index;
+	loop->is_worker = TRUE;
+
+	if (0 != evutil_socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		g_critical("%s: evutil_socketpair() failed: %s (%d)", G_STRLOC, g_strerror(errno), errno);
+		return -1;
+	}
+
+	/* make both ends non-blocking */
+	evutil_make_socket_nonblocking(fds[0]);
+	evutil_make_socket_nonblocking(fds[1]);
+
+	loop->notify_fd = fds[0];
+	loop->notify_send_fd = fds[1];
+	loop->event_queue = g_async_queue_new();
+	loop->event_base = event_base_new();
+
+	/* each event-thread runs the scripts of its connections in its own lua_State */
+	loop->sc = lua_scope_new();
+#ifdef HAVE_LUA_H
+	lua_pushlightuserdata(loop->sc->L, (void *)chas);
+	lua_setfield(loop->sc->L, LUA_REGISTRYINDEX, CHASSIS_LUA_REGISTRY_KEY);
+#endif
+
+	event_set(&(loop->notify_fd_event), loop->notify_fd, EV_READ | EV_PERSIST, chassis_event_handle, loop);
+	event_base_set(loop->event_base, &(loop->notify_fd_event));
+	event_add(&(loop->notify_fd_event), NULL);
+
+	return 0;
+}
+
+/**
+ * retire data that may still be used by other event-threads
+ *
+ * @param data       the data to free
+ * @param free_func  called with data once no loop can reference it anymore
+ */
+void chassis_event_defer_free(gpointer data, GDestroyNotify free_func) {
+	chassis_event_retired_t *r;
+
+	if (!data) return;
+
+	r = g_slice_new0(chassis_event_retired_t);
+	r->data = data;
+	r->free_func = free_func;
+
+	g_static_mutex_lock(&rcu_mutex);
+	if (!rcu_retired) rcu_retired = g_queue_new();
+
+	r->epoch = g_atomic_int_get(&rcu_epoch) + 1;
+	g_atomic_int_set(&rcu_epoch, r->epoch);
+
+	g_queue_push_tail(rcu_retired, r);
+	g_static_mutex_unlock(&rcu_mutex);
+}
+
+/**
+ * free the retired data all loops have seen the retirement of
+ */
+static void chassis_event_reclaim(void) {
+	chassis_event_retired_t *r;
+	gint min_epoch;
+	guint i;
+
+	g_static_mutex_lock(&rcu_mutex);
+	if (!rcu_retired || rcu_retired->length == 0) {
+		g_static_mutex_unlock(&rcu_mutex);
+		return;
+	}
+
+	min_epoch = g_atomic_int_get(&rcu_epoch);
+	for (i = 0; rcu_loops && i < rcu_loops->len; i++) {
+		chassis_event_t *loop = rcu_loops->pdata[i];
+		gint loop_epoch = g_atomic_int_get(&loop->rcu_epoch);
+
+		if (loop_epoch < min_epoch) min_epoch = loop_epoch;
+	}
+
+	while ((r = g_queue_peek_head(rcu_retired)) && r->epoch <= min_epoch) {
+		g_queue_pop_head(rcu_retired);
+
+		if (r->free_func) r->free_func(r->data);
+		g_slice_free(chassis_event_retired_t, r);
+	}
+	g_static_mutex_unlock(&rcu_mutex);
+}
+
+/**
+ * free all retired data
+ *
+ * only safe to call if no event-loop is running anymore
+ *
+ * @see chassis_free()
+ */
+void chassis_event_reclaim_all(void) {
+	chassis_event_retired_t *r;
+
+	g_static_mutex_lock(&rcu_mutex);
+	if (rcu_retired) {
+		while ((r = g_queue_pop_head(rcu_retired))) {
+			if (r->free_func) r->free_func(r->data);
+			g_slice_free(chassis_event_retired_t, r);
+		}
+		g_queue_free(rcu_retired);
+		rcu_retired = NULL;
+	}
+	g_static_mutex_unlock(&rcu_mutex);
+}
+
+static void chassis_event_rcu_register(chassis_event_t *loop) {
+	g_static_mutex_lock(&rcu_mutex);
+	if (!rcu_loops) rcu_loops = g_ptr_array_new();
+
+	g_atomic_int_set(&loop->rcu_epoch, g_atomic_int_get(&rcu_epoch));
+	g_ptr_array_add(rcu_loops, loop);
+	g_static_mutex_unlock(&rcu_mutex);
+}
+
+static void chassis_event_rcu_unregister(chassis_event_t *loop) {
+	g_static_mutex_lock(&rcu_mutex);
+	g_ptr_array_remove_fast(rcu_loops, loop);
+	g_static_mutex_unlock(&rcu_mutex);
+}
+
 /**
  * event-handler 
  *
  */
 void *chassis_event_loop(chassis_event_t *loop) {
 
+	/* the events added from this thread go to our event-base */
+	g_static_private_set(&tls_event_loop, loop, NULL);
+
+	chassis_event_rcu_register(loop);
+
 	/**
 	 * check once a second if we shall shutdown the proxy
 	 */
@@ -296,6 +538,11 @@ void *chassis_event_loop(chassis_event_t *loop) {
 		struct timeval timeout;
 		int r;
 
+		/* we are between two dispatches and don't hold on to shared data */
+		g_atomic_int_set(&loop->rcu_epoch, g_atomic_int_get(&rcu_epoch));
+
+		if (!loop->is_worker) chassis_event_reclaim();
+
 		timeout.tv_sec = 1;
 		timeout.tv_usec = 0;
 
@@ -315,6 +562,147 @@ void *chassis_event_loop(chassis_event_t *loop) {
 		}
 	}
 
+	chassis_event_rcu_unregister(loop);
+
+	return NULL;
+}
+
+static gpointer chassis_event_thread_loop(gpointer user_data) {
+	chassis_event_t *loop = user_data;
+
+	g_debug("%s: event-thread %u started", G_STRLOC, loop->index);
+
+	chassis_event_loop(loop);
+
+	g_debug("%s: event-thread %u stopped", G_STRLOC, loop->index);
+
 	return NULL;
 }
 
+/**
+ * start the --event-threads workers
+ *
+ * each worker runs its own event-base. Connections are handed over to them
+ * by network_mysqld_con_accept() and stay there for their whole lifetime.
+ *
+ * @return 0 on success (also if no event-threads are configured), -1 on error
+ */
+int chassis_event_threads_start(chassis *chas) {
+	guint i;
+
+	if (chas->event_thread_count == 0) return 0;
+
+	chas->event_threads = g_ptr_array_new();
+
+	for (i = 0; i < chas->event_thread_count; i++) {
+		chassis_event_t *loop;
+		GError *gerr = NULL;
+
+		loop = chassis_event_new();
+		if (0 != chassis_event_init_worker(loop, chas, i)) {
+			chassis_event_free(loop);
+			chassis_set_shutdown();
+			return -1;
+		}
+
+		g_ptr_array_add(chas->event_threads, loop);
+
+		loop->thr = g_thread_create(chassis_event_thread_loop, loop, TRUE, &gerr);
+		if (gerr) {
+			g_critical("%s: starting event-thread %u failed: %s", G_STRLOC, i, gerr->message);
+			g_error_free(gerr);
+			loop->thr = NULL;
+			chassis_set_shutdown();
+			return -1;
+		}
+	}
+
+	g_message("%s: started %u event-threads", G_STRLOC, chas->event_thread_count);
+
+	return 0;
+}
+
+/**
+ * wait for all event-threads to finish
+ *
+ * the threads leave their loop once chassis_is_shutdown() is set
+ */
+void chassis_event_threads_join(chassis *chas) {
+	guint i;
+
+	if (!chas->event_threads) return;
+
+	for (i = 0; i < chas->event_threads->len; i++) {
+		chassis_event_t *loop = chas->event_threads->pdata[i];
+
+		if (loop->thr) {
+			g_thread_join(loop->thr);
+			loop->thr = NULL;
+		}
+	}
+}
+
+/**
+ * free the event-loops of the event-threads
+ *
+ * has to be called after the connections are freed as they may still 
+ * have events registered in the loops
+ */
+void chassis_event_threads_free(chassis *chas) {
+	guint i;
+
+	if (!chas->event_threads) return;
+
+	chassis_event_threads_join(chas);
+
+	for (i = 0; i < chas->event_threads->len; i++) {
+		chassis_event_free(chas->event_threads->pdata[i]);
+	}
+
+	g_ptr_array_free(chas->event_threads, TRUE);
+	chas->event_threads = NULL;
+}
+
+/**
+ * pick the event-thread for a new connection
+ *
+ * takes the loop which owns the least connections, equally loaded 
+ * loops are taken round-robin
+ *
+ * @return NULL if no event-threads are running
+ */
+chassis_event_t *chassis_event_threads_pick(chassis *chas) {
+	chassis_event_t *picked = NULL;
+	guint i, n, start;
+
+	if (!chas->event_threads || chas->event_threads->len == 0) return NULL;
+
+	n = chas->event_threads->len;
+	start = chas->event_thread_next++ % n;
+
+	for (i = 0; i < n; i++) {
+		chassis_event_t *loop = chas->event_threads->pdata[(start + i) % n];
+
+		if (!picked || g_atomic_int_get(&loop->con_count) < g_atomic_int_get(&picked->con_count)) {
+			picked = loop;
+		}
+	}
+
+	return picked;
+}
+
+/**
+ * pick the event-loop for a new timer or connection of a plugin
+ *
+ * the plugins set up their timers in apply_config() before any loop runs,
+ * chassis_event_get_current() is NULL there
+ *
+ * @return a event-thread if --event-threads is set, the main-loop otherwise
+ */
+chassis_event_t *chassis_event_pick(chassis *chas) {
+	chassis_event_t *loop;
+
+	if (NULL != (loop = chassis_event_threads_pick(chas))) return loop;
+
+	return chas->event_loop;
+}
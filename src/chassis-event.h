@@ -26,6 +26,7 @@
 
 #include "chassis-exports.h"
 #include "chassis-mainloop.h"
+#include "lua-scope.h"
 
 /**
  * event operations
@@ -53,13 +54,26 @@ CHASSIS_API void chassis_event_add_with_timeout(chassis *chas, struct event *ev,
 CHASSIS_API void chassis_event_add_local(chassis *chas, struct event *ev);
 CHASSIS_API void chassis_event_add_local_with_timeout(chassis *chas, struct event *ev, struct timeval *tv);
 
-typedef struct {
+typedef struct chassis_event {
 	chassis *chas;
 
 	int notify_fd;
 	struct event notify_fd_event;
 
 	struct event_base *event_base;
+
+	GAsyncQueue *event_queue;  /**< event-ops for this loop, the chas->event_queue for the main-loop */
+	int notify_send_fd;        /**< the write-end of the notification pipe of this loop */
+
+	gboolean is_worker;        /**< TRUE if this loop is a --event-threads worker owning its queue and pipe */
+	GThread *thr;              /**< the thread running the loop, NULL for the main-loop */
+	guint index;               /**< position in chas->event_threads */
+
+	volatile gint con_count;   /**< number of connections owned by this loop */
+
+	lua_scope *sc;             /**< the lua-scope of the connections of this event-thread, NULL for the main-loop */
+
+	volatile gint rcu_epoch;   /**< the last reclaim-epoch this loop has seen while it was idle */
 } chassis_event_t;
 
 CHASSIS_API chassis_event_t *chassis_event_new();
@@ -69,5 +83,17 @@ CHASSIS_API void chassis_event_set_event_base(chassis_event_t *e, struct event_b
 CHASSIS_API void *chassis_event_loop(chassis_event_t *);
 
 CHASSIS_API int chassis_event_init(chassis_event_t *loop, chassis *chas);
+CHASSIS_API int chassis_event_init_worker(chassis_event_t *loop, chassis *chas, guint index);
+CHASSIS_API chassis_event_t *chassis_event_get_current(void);
+CHASSIS_API void chassis_event_add_to(chassis_event_t *loop, struct event *ev, struct timeval *tv);
+
+CHASSIS_API int chassis_event_threads_start(chassis *chas);
+CHASSIS_API void chassis_event_threads_join(chassis *chas);
+CHASSIS_API void chassis_event_threads_free(chassis *chas);
+CHASSIS_API chassis_event_t *chassis_event_threads_pick(chassis *chas);
+CHASSIS_API chassis_event_t *chassis_event_pick(chassis *chas);
+
+CHASSIS_API void chassis_event_defer_free(gpointer data, GDestroyNotify free_func);
+CHASSIS_API void chassis_event_reclaim_all(void);
 
 #endif
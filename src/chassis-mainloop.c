@@ -181,6 +181,10 @@ void chassis_free(chassis *chas) {
 
     /* free the pointers _AFTER_ the modules are shutdown */
 	if (chas->priv_free) chas->priv_free(chas, chas->priv);
+
+	/* the connections are gone, we can free the loops of the event-threads now */
+	chassis_event_threads_free(chas);
+	chassis_event_reclaim_all();
 #ifdef HAVE_EVENT_BASE_FREE
 	/* only recent versions have this call */
 
@@ -258,9 +262,19 @@ int chassis_mainloop(void *_chas) {
 	}
 
 	chas->event_base = mainloop->event_base; 
+	chas->event_loop = mainloop;
 
 	g_assert(chas->event_base);
 
+	/**
+	 * start the event-threads before the plugins are set up, the plugins may
+	 * register their listen-sockets in the event-threads directly
+	 */
+	if (0 != chassis_event_threads_start(chas)) {
+		g_critical("%s: starting the event-threads failed", G_STRLOC);
+		return -1;
+	}
+
 	/* setup all plugins all plugins */
 	for (i = 0; i < chas->modules->len; i++) {
 		chassis_plugin *p = chas->modules->pdata[i];
@@ -269,6 +283,7 @@ int chassis_mainloop(void *_chas) {
 		if (0 != p->apply_config(chas, p->config)) {
 			g_critical("%s: applying config of plugin %s failed",
 					G_STRLOC, p->name);
+			chassis_set_shutdown(); /* let the event-threads exit */
 			return -1;
 		}
 	}
@@ -334,6 +349,8 @@ int chassis_mainloop(void *_chas) {
 	 */
 	chassis_event_loop(mainloop);
 
+	chassis_event_threads_join(chas);
+
 	signal_del(&ev_sigterm);
 	signal_del(&ev_sigint);
 #ifdef SIGHUP
@@ -71,6 +71,11 @@ struct chassis {
 	chassis_shutdown_hooks_t *shutdown_hooks;
 	GAsyncQueue *event_queue;
 	int event_notify_fds[2];
+
+	guint event_thread_count;               /**< number of --event-threads, 0 runs everything in the main-loop */
+	GPtrArray *event_threads;               /**< array(chassis_event_t) of the running event-threads */
+	struct chassis_event *event_loop;       /**< the main-loop, set before the plugins apply their config */
+	guint event_thread_next;                /**< round-robin position for handing out new connections */
 };
 
 CHASSIS_API chassis *chassis_new(void);
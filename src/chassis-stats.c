@@ -28,6 +28,55 @@
 
 chassis_stats_t *chassis_global_stats = NULL;
 
+#ifndef __GNUC__
+static GStaticMutex int64_mutex = G_STATIC_MUTEX_INIT;
+#endif
+
+/**
+ * add to a 64bit counter atomically
+ *
+ * @return the new value
+ */
+gint64 chassis_stats_int64_add(volatile gint64 *atomic, gint64 val) {
+#ifdef __GNUC__
+	return __sync_add_and_fetch(atomic, val);
+#else
+	gint64 ret;
+
+	g_static_mutex_lock(&int64_mutex);
+	ret = (*atomic += val);
+	g_static_mutex_unlock(&int64_mutex);
+
+	return ret;
+#endif
+}
+
+/**
+ * read a 64bit counter, a plain read may be torn on 32bit platforms
+ */
+gint64 chassis_stats_int64_get(volatile gint64 *atomic) {
+	return chassis_stats_int64_add(atomic, 0);
+}
+
+/**
+ * raise a 64bit high-watermark to val if it is lower
+ */
+void chassis_stats_int64_max(volatile gint64 *atomic, gint64 val) {
+#ifdef __GNUC__
+	gint64 cur;
+
+	do {
+		cur = *atomic;
+
+		if (cur >= val) return;
+	} while (!__sync_bool_compare_and_swap(atomic, cur, val));
+#else
+	g_static_mutex_lock(&int64_mutex);
+	if (*atomic < val) *atomic = val;
+	g_static_mutex_unlock(&int64_mutex);
+#endif
+}
+
 chassis_stats_t * chassis_stats_new(void) {
 	if (chassis_global_stats != NULL) return chassis_global_stats;
 	
@@ -60,15 +109,19 @@ GHashTable* chassis_stats_get(chassis_stats_t *stats){
 #define STR(x) #x
 #define N(x) g_strdup(x)
 #define ADD_STAT(x) g_hash_table_insert(stats_hash, N( STR(x)), GUINT_TO_POINTER(g_atomic_int_get(&(stats->x))))
+#define ADD_INT64_STAT(x) g_hash_table_insert(stats_hash, N( STR(x)), GSIZE_TO_POINTER(MIN(chassis_stats_int64_get(&(stats->x)), G_MAXSIZE)))
 #define ADD_ALLOC_STAT(x) ADD_STAT(x ## _alloc); ADD_STAT(x ## _free);
 	
 	ADD_ALLOC_STAT(lua_mem);
 	ADD_STAT(lua_mem_bytes);
 	ADD_STAT(lua_mem_bytes_max);
+	ADD_INT64_STAT(resultset_bytes);
+	ADD_INT64_STAT(resultset_bytes_max);
 	
 #undef N
 #undef STR
 #undef ADD_STAT
+#undef ADD_INT64_STAT
 #undef ADD_ALLOC_STAT
 	
 	return stats_hash;
@@ -30,6 +30,8 @@ typedef struct chassis_stats {
 	volatile gint lua_mem_free;
 	volatile gint lua_mem_bytes;
 	volatile gint lua_mem_bytes_max;
+	volatile gint64 resultset_bytes;   /**< bytes of resultsets queued in the proxy */
+	volatile gint64 resultset_bytes_max;
 } chassis_stats_t;
 
 CHASSIS_API chassis_stats_t *chassis_global_stats;
@@ -39,6 +41,10 @@ CHASSIS_API void chassis_stats_free(chassis_stats_t *stats);
 
 CHASSIS_API GHashTable* chassis_stats_get(chassis_stats_t *user_data);
 
+CHASSIS_API gint64 chassis_stats_int64_add(volatile gint64 *atomic, gint64 val);
+CHASSIS_API gint64 chassis_stats_int64_get(volatile gint64 *atomic);
+CHASSIS_API void chassis_stats_int64_max(volatile gint64 *atomic, gint64 val);
+
 #define CHASSIS_STATS_ALLOC_INC_NAME(name) ((chassis_global_stats != NULL) ? g_atomic_int_inc(&(chassis_global_stats->name ## _alloc)) : (void)0)
 #define CHASSIS_STATS_FREE_INC_NAME(name) ((chassis_global_stats != NULL) ? g_atomic_int_inc(&(chassis_global_stats->name ## _free)) : (void)0)
 
@@ -53,4 +59,9 @@ CHASSIS_API GHashTable* chassis_stats_get(chassis_stats_t *user_data);
 #define CHASSIS_STATS_GET_NAME(name) ((chassis_global_stats != NULL) ? g_atomic_int_get(&(chassis_global_stats->name)) : 0)
 #define CHASSIS_STATS_SET_NAME(name, setme) ((chassis_global_stats != NULL) ? g_atomic_int_set(&(chassis_global_stats->name), setme) : (void)0)
 
+/* glib has no 64bit atomics, the gint64 counters use chassis_stats_int64_*() */
+#define CHASSIS_STATS_ADD_INT64_NAME(name, addme) ((chassis_global_stats != NULL) ? chassis_stats_int64_add(&(chassis_global_stats->name), addme) : 0)
+#define CHASSIS_STATS_GET_INT64_NAME(name) ((chassis_global_stats != NULL) ? chassis_stats_int64_get(&(chassis_global_stats->name)) : 0)
+#define CHASSIS_STATS_MAX_INT64_NAME(name, val) ((chassis_global_stats != NULL) ? chassis_stats_int64_max(&(chassis_global_stats->name), val) : (void)0)
+
 #endif
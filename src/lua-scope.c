@@ -49,6 +49,7 @@ lua_scope *lua_scope_new(void) {
 	lua_scope *sc;
 
 	sc = g_new0(lua_scope, 1);
+	sc->mutex = g_mutex_new();
 
 #ifdef HAVE_LUA_H
 	sc->L = luaL_newstate();
@@ -80,11 +81,16 @@ void lua_scope_free(lua_scope *sc) {
 	lua_close(sc->L);
 #endif
 
+	g_mutex_free(sc->mutex);
+
+	if (sc->global_config) g_string_free(sc->global_config, TRUE);
+
 	g_free(sc);
 }
 
 void lua_scope_get(lua_scope *sc, const char G_GNUC_UNUSED* pos) {
 /*	g_warning("%s: === waiting for lua-scope", pos); */
+	g_mutex_lock(sc->mutex);
 /*	g_warning("%s: +++ got lua-scope", pos); */
 #ifdef HAVE_LUA_H
 	sc->L_top = lua_gettop(sc->L);
@@ -100,6 +106,7 @@ void lua_scope_release(lua_scope *sc, const char* pos) {
 	}
 #endif
 
+	g_mutex_unlock(sc->mutex);
 /*	g_warning("%s: --- released lua scope", pos); */
 
 	return;
@@ -40,6 +40,12 @@ typedef struct {
 	int L_ref;
 #endif
 	int L_top;
+
+	GMutex *mutex; /**< guards the lua_State, each event-thread has its own scope so only the shutdown contends on it */
+
+	gint global_version;      /**< version of the shared proxy.global.config loaded into L */
+	GString *global_config;   /**< proxy.global.config of L after the last sync, the writes of the scripts are the difference */
+	gboolean global_published; /**< TRUE once the script-defaults of L were published */
 } lua_scope;
 
 CHASSIS_API lua_scope *lua_scope_new(void);
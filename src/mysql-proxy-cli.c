@@ -83,6 +83,13 @@
 
 #define GETTEXT_PACKAGE "mysql-proxy"
 
+/**
+ * --event-threads may be at most this many times the number of CPUs
+ *
+ * more threads than CPUs only add context-switches, each one has its own lua_State
+ */
+#define EVENT_THREADS_PER_CPU_MAX 4
+
 /**
  * options of the MySQL Proxy frontend
  */
@@ -113,6 +120,8 @@ typedef struct {
 
 	gint max_files_number;
 
+	gint event_thread_count;
+
 	gchar *log_level;
 	gchar *log_filename;
 	int    use_syslog;
@@ -204,6 +213,9 @@ int chassis_frontend_set_chassis_options(chassis_frontend_t *frontend, chassis_o
 	chassis_options_add(opts,
 		"max-open-files",           0, 0, G_OPTION_ARG_INT, &(frontend->max_files_number), "maximum number of open files (ulimit -n)", NULL);
 
+	chassis_options_add(opts,
+		"event-threads",            0, 0, G_OPTION_ARG_INT, &(frontend->event_thread_count), "number of event-handling threads, at most 4 per CPU (default: 0, all in the main-loop)", NULL);
+
 	chassis_options_add(opts,
 		"lua-path",                 0, 0, G_OPTION_ARG_STRING, &(frontend->lua_path), "set the LUA_PATH", "<...>");
 
@@ -543,6 +555,26 @@ int main_cmdline(int argc, char **argv) {
 	g_debug("max open file-descriptors = %"G_GINT64_FORMAT,
 			chassis_fdlimit_get());
 
+	if (frontend->event_thread_count < 0) {
+		g_critical("%s: --event-threads has to be >= 0, got %d",
+				G_STRLOC,
+				frontend->event_thread_count);
+		GOTO_EXIT(EXIT_FAILURE);
+	} else {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		gint event_threads_max = EVENT_THREADS_PER_CPU_MAX * (cpus > 0 ? cpus : 1);
+
+		if (frontend->event_thread_count > event_threads_max) {
+			g_critical("%s: --event-threads has to be <= %d (%d per CPU), got %d",
+					G_STRLOC,
+					event_threads_max,
+					EVENT_THREADS_PER_CPU_MAX,
+					frontend->event_thread_count);
+			GOTO_EXIT(EXIT_FAILURE);
+		}
+	}
+	srv->event_thread_count = frontend->event_thread_count;
+
     g_debug("two unix sockets, fd1:%d, fd2:%d",
             srv->event_notify_fds[0], srv->event_notify_fds[1]);
 
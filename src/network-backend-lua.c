@@ -40,6 +40,11 @@
  *   address           => ip:port or unix-path of to the backend
  *   state             => int(BACKEND_STATE_UP|BACKEND_STATE_DOWN) 
  *   type              => int(BACKEND_TYPE_RW|BACKEND_TYPE_RO) 
+ *   rtt               => round-trip-time of the health-checks in seconds or nil
+ *   lag               => seconds the replication lags behind or nil
+ *   weight            => relative share of the load for network_backends_balance()
+ *   in_flight         => queries which haven't finished yet
+ *   response_time     => average response-time of the queries in seconds or nil
  *
  * @return nil or requested information
  * @see backend_state_t backend_type_t
@@ -50,7 +55,7 @@ static int proxy_backend_get(lua_State *L) {
 	const char *key = luaL_checklstring(L, 2, &keysize);
 
 	if (strleq(key, keysize, C("connected_clients"))) {
-		lua_pushinteger(L, backend->connected_clients);
+		lua_pushinteger(L, g_atomic_int_get(&(backend->connected_clients)));
 	} else if (strleq(key, keysize, C("dst"))) {
 		network_address_lua_push(L, backend->addr);
 	} else if (strleq(key, keysize, C("state"))) {
@@ -63,6 +68,29 @@ static int proxy_backend_get(lua_State *L) {
 		} else {
 			lua_pushnil(L);
 		}
+	} else if (strleq(key, keysize, C("rtt"))) {
+		/* the round-trip-time of the health-checks in seconds */
+		if (backend->rtt_us > 0) {
+			lua_pushnumber(L, backend->rtt_us / 1000000.0);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("lag"))) {
+		if (backend->lag >= 0) {
+			lua_pushinteger(L, backend->lag);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("weight"))) {
+		lua_pushinteger(L, backend->weight);
+	} else if (strleq(key, keysize, C("in_flight"))) {
+		lua_pushinteger(L, g_atomic_int_get(&(backend->in_flight)));
+	} else if (strleq(key, keysize, C("response_time"))) {
+		if (backend->response_us > 0) {
+			lua_pushnumber(L, backend->response_us / 1000000.0);
+		} else {
+			lua_pushnil(L);
+		}
 	} else if (strleq(key, keysize, C("pool"))) {
 		network_connection_pool *pool; 
 		network_connection_pool **pool_p;
@@ -73,7 +101,7 @@ static int proxy_backend_get(lua_State *L) {
 		network_connection_pool_getmetatable(L);
         lua_setmetatable(L, -2);
     } else if (strleq(key, keysize, C("connections"))) {
-        guint total = backend->connected_clients;
+        guint total = g_atomic_int_get(&(backend->connected_clients));
 
         GHashTable *users = backend->pool->users;
 
@@ -81,11 +109,11 @@ static int proxy_backend_get(lua_State *L) {
 
             GHashTableIter iter;
             GString *key;
-            GQueue *queue;
+            network_connection_pool_user *user;
 
             g_hash_table_iter_init(&iter, users);
-            while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&queue)) {
-                total += queue->length;
+            while (g_hash_table_iter_next(&iter, (void **)&key, (void **)&user)) {
+                total += user->conns->length;
             }
         }
 
@@ -116,6 +144,13 @@ static int proxy_backend_set(lua_State *L) {
 		} else {
 			return luaL_error(L, "proxy.global.backends[...].%s has to be a string", key);
 		}
+	} else if (strleq(key, keysize, C("weight"))) {
+		lua_Integer weight = luaL_checkinteger(L, -1);
+
+		if (weight < 0) {
+			return luaL_error(L, "proxy.global.backends[...].%s has to be >= 0", key);
+		}
+		backend->weight = weight;
 	} else {
 		return luaL_error(L, "proxy.global.backends[...].%s is not writable", key);
 	}
@@ -132,11 +167,69 @@ int network_backend_lua_getmetatable(lua_State *L) {
 	return proxy_getmetatable(L, methods);
 }
 
+/**
+ * proxy.global.backends:balance(type[, username[, gtids]])
+ *
+ * pick a backend with the balancing policy of the backends
+ *
+ * @param type     BACKEND_TYPE_RW, BACKEND_TYPE_RO or BACKEND_TYPE_UNKNOWN for any
+ * @param username if set, only backends which have idling connections for this user
+ * @param gtids    if set, only read-only backends which applied them (proxy.connection.last_write_gtids)
+ * @return nil or the index of the backend
+ * @see network_backends_balance
+ */
+static int proxy_backends_balance(lua_State *L) {
+	network_backends_t *bs = *(network_backends_t **)luaL_checkself(L);
+	backend_type_t type = luaL_optinteger(L, 2, BACKEND_TYPE_UNKNOWN);
+	GString *username = NULL;
+	network_gtid_set *read_after = NULL;
+	gint ndx;
+
+	luaL_argcheck(L, type >= BACKEND_TYPE_UNKNOWN && type < BACKEND_TYPE_MAX, 2, "unknown backend type");
+
+	if (lua_isstring(L, 3)) {
+		size_t s_len = 0;
+		const char *s = lua_tolstring(L, 3, &s_len);
+
+		username = g_string_new_len(s, s_len);
+	}
+
+	if (lua_isstring(L, 4)) {
+		size_t s_len = 0;
+		const char *s = lua_tolstring(L, 4, &s_len);
+
+		read_after = network_gtid_set_new();
+		if (0 != network_gtid_set_add(read_after, s, s_len)) {
+			network_gtid_set_free(read_after);
+			if (username) g_string_free(username, TRUE);
+
+			return luaL_argerror(L, 4, "invalid GTID set");
+		}
+	}
+
+	ndx = network_backends_balance(bs, type, username, read_after);
+
+	if (username) g_string_free(username, TRUE);
+	if (read_after) network_gtid_set_free(read_after);
+
+	if (ndx < 0) {
+		lua_pushnil(L);
+	} else {
+		lua_pushinteger(L, ndx + 1); /** lua is indexes from 1, C from 0 */
+	}
+
+	return 1;
+}
+
 /**
  * get proxy.global.backends[ndx]
  *
  * get the backend from the array of mysql backends.
  *
+ * proxy.global.backends.
+ *   balance           => function(type[, username]) picking a backend
+ *   policy            => name of the balancing policy (sqf or p2c)
+ *
  * @return nil or the backend
  * @see proxy_backend_get
  */
@@ -145,7 +238,24 @@ static int proxy_backends_get(lua_State *L) {
 	network_backend_t **backend_p;
 
 	network_backends_t *bs = *(network_backends_t **)luaL_checkself(L);
-	int backend_ndx = luaL_checkinteger(L, 2) - 1; /** lua is indexes from 1, C from 0 */
+	int backend_ndx;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		gsize keysize = 0;
+		const char *key = lua_tolstring(L, 2, &keysize);
+
+		if (strleq(key, keysize, C("balance"))) {
+			lua_pushcfunction(L, proxy_backends_balance);
+		} else if (strleq(key, keysize, C("policy"))) {
+			lua_pushstring(L, backend_balance_t_str[bs->balance]);
+		} else {
+			lua_pushnil(L);
+		}
+
+		return 1;
+	}
+
+	backend_ndx = luaL_checkinteger(L, 2) - 1; /** lua is indexes from 1, C from 0 */
 	
 	/* check that we are in range for a _int_ */
 	if (NULL == (backend = network_backends_get(bs, backend_ndx))) {
@@ -189,6 +299,12 @@ static int proxy_backends_set(lua_State *L) {
 		add_flag = 1;
 	} else if (strleq(key, keysize, C("backend_replace"))) {
 		replace_flag = 1;
+	} else if (strleq(key, keysize, C("policy"))) {
+		const char *policy = luaL_checkstring(L, -1);
+
+		if (0 != network_backends_set_balance(bs, policy)) {
+			return luaL_error(L, "proxy.global.backends.%s: unknown policy '%s'", key, policy);
+		}
 	} else {
 		return luaL_error(L, "proxy.global.backends.%s is not writable", key);
 	}
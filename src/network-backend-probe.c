@@ -0,0 +1,748 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * health-checks of the backends
+ *
+ * each backend has one probe which runs through
+ *
+ *   connect -> read handshake [-> send auth -> read auth result]
+ *
+ * and then, if we are logged in, for each interval
+ *
+ *   send COM_PING -> read OK [-> send SHOW SLAVE STATUS -> read resultset]
+ *
+ * SHOW SLAVE STATUS gives us the lag and the GTIDs the read-only backends applied.
+ *
+ * All probes run in the event-loop the prober was started in.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "network-backend-probe.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "chassis-gtimeval.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * weight of a new round-trip-time in the EWMA of the backend: 1/8
+ */
+#define NETWORK_BACKEND_PROBE_RTT_WEIGHT_SHIFT 3
+
+typedef struct {
+	enum {
+		PROBE_STATE_IDLE,
+		PROBE_STATE_CONNECT,
+		PROBE_STATE_READ_HANDSHAKE,
+		PROBE_STATE_SEND_AUTH,
+		PROBE_STATE_READ_AUTH_RESULT,
+		PROBE_STATE_SEND_PING,
+		PROBE_STATE_READ_PING,
+		PROBE_STATE_SEND_LAG_QUERY,
+		PROBE_STATE_READ_LAG_RESULT
+	} state;
+
+	network_backends_prober *prober;
+	network_backend_t *backend;
+
+	network_socket *sock;         /** kept open between the checks if we are logged in */
+	gboolean is_reused;           /** the check runs on the connection of a previous check */
+
+	GTimeVal started;             /** when the current round-trip started */
+	guint eof_seen;               /** EOF packets of the SHOW SLAVE STATUS resultset */
+} network_backend_probe;
+
+network_backends_prober *network_backends_prober_new(void) {
+	network_backends_prober *p;
+
+	p = g_new0(network_backends_prober, 1);
+	p->username = g_string_new(NULL);
+	p->hashed_password = g_string_new(NULL);
+	p->interval.tv_sec = 1;
+	p->timeout.tv_sec = 2;
+
+	return p;
+}
+
+static void network_backend_probe_close(network_backend_probe *probe) {
+	if (probe->sock) {
+		event_del(&(probe->sock->event));
+		network_socket_free(probe->sock);
+		probe->sock = NULL;
+	}
+
+	probe->state = PROBE_STATE_IDLE;
+}
+
+static void network_backend_probe_free(gpointer _probe) {
+	network_backend_probe *probe = _probe;
+
+	network_backend_probe_close(probe);
+
+	g_free(probe);
+}
+
+/**
+ * free the prober
+ *
+ * the event-loop of the prober has to be stopped already
+ */
+void network_backends_prober_free(network_backends_prober *p) {
+	if (!p) return;
+
+	if (p->probes) {
+		event_del(&(p->timer));
+		g_hash_table_destroy(p->probes);
+	}
+
+	g_string_free(p->username, TRUE);
+	g_string_free(p->hashed_password, TRUE);
+
+	g_free(p);
+}
+
+/**
+ * log in as username to ping the backends instead of just waiting for their handshake
+ */
+void network_backends_prober_set_auth(network_backends_prober *p, const gchar *username, const gchar *password) {
+	g_string_assign(p->username, username ? username : "");
+
+	if (password && *password) {
+		network_mysqld_proto_password_hash(p->hashed_password, password, strlen(password));
+	} else {
+		g_string_truncate(p->hashed_password, 0);
+	}
+}
+
+/**
+ * the backend answered
+ *
+ * add the round-trip-time since probe->started to the EWMA and mark it UP
+ */
+static void network_backend_probe_answered(network_backend_probe *probe) {
+	network_backend_t *backend = probe->backend;
+	GTimeVal now;
+	gint64 rtt_us;
+
+	g_get_current_time(&now);
+	ge_gtimeval_diff(&(probe->started), &now, &rtt_us);
+	if (rtt_us < 1) rtt_us = 1;
+
+	if (backend->rtt_us == 0) {
+		backend->rtt_us = rtt_us;
+	} else {
+		backend->rtt_us += (rtt_us - backend->rtt_us) >> NETWORK_BACKEND_PROBE_RTT_WEIGHT_SHIFT;
+	}
+
+	if (backend->state == BACKEND_STATE_DOWN ||
+	    backend->state == BACKEND_STATE_UNKNOWN) {
+		g_message("%s: backend %s is up (rtt: %"G_GINT64_FORMAT" us)",
+				G_STRLOC, backend->addr->name->str, rtt_us);
+
+		backend->state = BACKEND_STATE_UP;
+		chassis_gtime_testset_now(&(backend->state_since), NULL);
+	}
+}
+
+/**
+ * replace the GTIDs a backend applied
+ *
+ * the event-threads read them without a lock, the old set is freed once they are done with it
+ */
+static void network_backend_probe_set_gtid_executed(network_backend_t *backend, network_gtid_set *gtids) {
+	network_gtid_set *old = backend->gtid_executed;
+
+	g_atomic_pointer_set((gpointer *)&(backend->gtid_executed), gtids);
+
+	if (old) chassis_event_defer_free(old, (GDestroyNotify)network_gtid_set_free);
+}
+
+static void network_backend_probe_connect(network_backend_probe *probe);
+
+/**
+ * the check failed
+ *
+ * a connection which was kept from the last check may just have been closed by the
+ * backend (wait_timeout, ...), retry once on a new one before the backend is marked DOWN
+ */
+static void network_backend_probe_failed(network_backend_probe *probe, const char *reason) {
+	network_backend_t *backend = probe->backend;
+	gboolean retry = probe->is_reused;
+
+	network_backend_probe_close(probe);
+
+	if (retry) {
+		g_debug("%s: check of %s failed on the kept connection (%s), reconnecting",
+				G_STRLOC, backend->addr->name->str, reason);
+
+		network_backend_probe_connect(probe);
+		return;
+	}
+
+	backend->lag = -1;
+	network_backend_probe_set_gtid_executed(backend, NULL);
+
+	if (backend->state == BACKEND_STATE_UP ||
+	    backend->state == BACKEND_STATE_UNKNOWN) {
+		g_message("%s: backend %s is down: %s",
+				G_STRLOC, backend->addr->name->str, reason);
+
+		backend->state = BACKEND_STATE_DOWN;
+		chassis_gtime_testset_now(&(backend->state_since), NULL);
+	}
+}
+
+static void network_backend_probe_handle(int event_fd, short events, void *user_data);
+
+static void network_backend_probe_wait(network_backend_probe *probe, short what) {
+	network_socket *sock = probe->sock;
+
+	event_set(&(sock->event), sock->fd, what, network_backend_probe_handle, probe);
+	chassis_event_add_to(probe->prober->loop, &(sock->event), &(probe->prober->timeout));
+}
+
+/**
+ * get the next packet of the backend into sock->recv_queue
+ */
+static network_socket_retval_t network_backend_probe_read(network_backend_probe *probe) {
+	network_socket *sock = probe->sock;
+
+	if (NETWORK_SOCKET_SUCCESS == network_mysqld_con_get_packet(probe->prober->chas, sock)) {
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	sock->to_read = NETWORK_SOCKET_READ_MAX;
+	switch (network_socket_read(sock)) {
+	case NETWORK_SOCKET_SUCCESS:
+		break;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		if (sock->is_peer_closed) return NETWORK_SOCKET_ERROR;
+
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	default:
+		return NETWORK_SOCKET_ERROR;
+	}
+
+	return network_mysqld_con_get_packet(probe->prober->chas, sock);
+}
+
+/**
+ * the first byte of the last packet in the recv-queue
+ *
+ * @return -1 if the packet is empty
+ */
+static gint network_backend_probe_peek_status(network_backend_probe *probe, gsize *payload_len) {
+	network_packet packet;
+	guint8 status = 0;
+	int err = 0;
+
+	packet.data = g_queue_peek_tail(probe->sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+
+	if (payload_len) *payload_len = packet.data->len - NET_HEADER_SIZE;
+
+	return err ? -1 : status;
+}
+
+static void network_backend_probe_clear_recv_queue(network_backend_probe *probe) {
+	GString *packet;
+
+	while ((packet = g_queue_pop_head(probe->sock->recv_queue->chunks))) g_string_free(packet, TRUE);
+}
+
+/**
+ * queue a command for the backend, it starts a new packet-sequence
+ */
+static void network_backend_probe_send_command(network_backend_probe *probe, guint8 command, const char *arg, gsize arg_len) {
+	GString *packet;
+
+	packet = g_string_sized_new(arg_len + 1);
+	g_string_append_c(packet, command);
+	if (arg_len) g_string_append_len(packet, arg, arg_len);
+
+	network_mysqld_queue_reset(probe->sock);
+	network_mysqld_queue_append(probe->sock, probe->sock->send_queue, S(packet));
+
+	g_string_free(packet, TRUE);
+}
+
+/**
+ * turn the handshake in the recv-queue into a auth-response
+ */
+static int network_backend_probe_auth(network_backend_probe *probe) {
+	network_backends_prober *p = probe->prober;
+	network_socket *sock = probe->sock;
+	network_mysqld_auth_challenge *challenge;
+	network_mysqld_auth_response *auth;
+	network_packet packet;
+	GString *auth_packet;
+
+	packet.data = g_queue_peek_tail(sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	challenge = network_mysqld_auth_challenge_new();
+	if (network_mysqld_proto_skip_network_header(&packet) ||
+	    network_mysqld_proto_get_auth_challenge(&packet, challenge)) {
+		network_mysqld_auth_challenge_free(challenge);
+		return -1;
+	}
+	sock->challenge = challenge;
+
+	if (NULL == (auth = network_mysqld_auth_response_new_native(challenge, p->username, p->hashed_password))) {
+		return -1;
+	}
+	sock->response = auth;
+
+	auth_packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_response(auth_packet, auth);
+	network_mysqld_queue_append(sock, sock->send_queue, S(auth_packet));
+	g_string_free(auth_packet, TRUE);
+
+	return 0;
+}
+
+/**
+ * get Seconds_Behind_Master and Executed_Gtid_Set from the SHOW SLAVE STATUS resultset in the recv-queue
+ *
+ * the lag is -1 and the GTIDs are unknown if the backend isn't replicating
+ */
+static void network_backend_probe_get_slave_status(network_backend_probe *probe) {
+	network_backend_t *backend = probe->backend;
+	GList *chunk = probe->sock->recv_queue->chunks->head;
+	GPtrArray *fields;
+	network_gtid_set *gtids = NULL;
+	gint lag = -1;
+	guint i, lag_col = G_MAXUINT, gtid_col = G_MAXUINT, last_col;
+
+	fields = network_mysqld_proto_fielddefs_new();
+
+	if (NULL == (chunk = network_mysqld_proto_get_fielddefs(chunk, fields))) {
+		network_mysqld_proto_fielddefs_free(fields);
+
+		backend->lag = -1;
+		network_backend_probe_set_gtid_executed(backend, NULL);
+		return;
+	}
+
+	for (i = 0; i < fields->len; i++) {
+		MYSQL_FIELD *field = fields->pdata[i];
+
+		if (!field->name) continue;
+
+		if (0 == strcmp(field->name, "Seconds_Behind_Master")) {
+			lag_col = i;
+		} else if (0 == strcmp(field->name, "Executed_Gtid_Set")) {
+			/* 5.6 and later */
+			gtid_col = i;
+		}
+	}
+
+	last_col = (lag_col == G_MAXUINT) ? gtid_col :
+	           (gtid_col == G_MAXUINT) ? lag_col : MAX(lag_col, gtid_col);
+
+	/* the first row after the EOF of the field-defs, a master has none */
+	if (last_col != G_MAXUINT && NULL != (chunk = chunk->next)) {
+		network_packet packet;
+		network_mysqld_lenenc_type lenenc_type;
+		GString *value = g_string_new(NULL);
+		int err = 0;
+
+		packet.data = chunk->data;
+		packet.offset = 0;
+
+		err = err || network_mysqld_proto_skip_network_header(&packet);
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		err = err || (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF);
+
+		for (i = 0; !err && i <= last_col; i++) {
+			err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+			if (err) break;
+
+			if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_NULL) {
+				/* NULL: the replication isn't running */
+				err = err || network_mysqld_proto_skip(&packet, 1);
+				continue;
+			}
+
+			err = err || network_mysqld_proto_get_lenenc_gstring(&packet, value);
+			if (err) break;
+
+			if (i == lag_col && value->len > 0) {
+				lag = atoi(value->str);
+			} else if (i == gtid_col) {
+				gtids = network_gtid_set_new();
+
+				if (0 != network_gtid_set_add(gtids, S(value))) {
+					network_gtid_set_free(gtids);
+					gtids = NULL;
+				}
+			}
+		}
+
+		g_string_free(value, TRUE);
+	}
+
+	network_mysqld_proto_fielddefs_free(fields);
+
+	backend->lag = lag;
+	network_backend_probe_set_gtid_executed(backend, gtids);
+}
+
+/**
+ * the state-machine of a probe
+ */
+static void network_backend_probe_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_backend_probe *probe = user_data;
+	network_backends_prober *p = probe->prober;
+	network_socket *sock = probe->sock;
+	gsize payload_len = 0;
+	gint status;
+
+	if (events == EV_TIMEOUT) {
+		network_backend_probe_failed(probe, "timed out");
+		return;
+	}
+
+	switch (probe->state) {
+	case PROBE_STATE_IDLE:
+		/* we didn't ask for it */
+		network_backend_probe_close(probe);
+		return;
+	case PROBE_STATE_CONNECT:
+		if (NETWORK_SOCKET_SUCCESS != network_socket_connect_finish(sock)) {
+			network_backend_probe_failed(probe, g_strerror(errno));
+			return;
+		}
+
+		probe->state = PROBE_STATE_READ_HANDSHAKE;
+		network_backend_probe_wait(probe, EV_READ);
+		return;
+	case PROBE_STATE_READ_HANDSHAKE:
+		switch (network_backend_probe_read(probe)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_backend_probe_wait(probe, EV_READ);
+			return;
+		default:
+			network_backend_probe_failed(probe, "reading the handshake failed");
+			return;
+		}
+
+		if (0xff == network_backend_probe_peek_status(probe, NULL)) {
+			/* too many connections, host blocked, ... */
+			network_backend_probe_failed(probe, "the handshake is a ERR packet");
+			return;
+		}
+
+		if (p->username->len == 0) {
+			/* the handshake is all we wanted */
+			network_backend_probe_answered(probe);
+			network_backend_probe_close(probe);
+			return;
+		}
+
+		if (0 != network_backend_probe_auth(probe)) {
+			network_backend_probe_failed(probe, "the handshake is invalid");
+			return;
+		}
+		network_backend_probe_clear_recv_queue(probe);
+
+		probe->state = PROBE_STATE_SEND_AUTH;
+		/* fall through */
+	case PROBE_STATE_SEND_AUTH:
+		switch (network_socket_write(sock, -1)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_backend_probe_wait(probe, EV_WRITE);
+			return;
+		default:
+			network_backend_probe_failed(probe, "sending the auth packet failed");
+			return;
+		}
+
+		probe->state = PROBE_STATE_READ_AUTH_RESULT;
+		network_backend_probe_wait(probe, EV_READ);
+		return;
+	case PROBE_STATE_READ_AUTH_RESULT:
+		switch (network_backend_probe_read(probe)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_backend_probe_wait(probe, EV_READ);
+			return;
+		default:
+			network_backend_probe_failed(probe, "reading the auth result failed");
+			return;
+		}
+
+		status = network_backend_probe_peek_status(probe, NULL);
+		network_backend_probe_clear_recv_queue(probe);
+
+		if (status != 0x00) {
+			/* the backend is there, but we can't get in: no reason to mark it DOWN */
+			g_critical("%s: logging into %s as '%s' for the health-checks failed, checking the handshake only",
+					G_STRLOC, probe->backend->addr->name->str, p->username->str);
+			g_string_truncate(p->username, 0);
+
+			network_backend_probe_answered(probe);
+			network_backend_probe_close(probe);
+			return;
+		}
+
+		/* measure the ping, not the login */
+		g_get_current_time(&(probe->started));
+		network_backend_probe_send_command(probe, COM_PING, NULL, 0);
+		probe->state = PROBE_STATE_SEND_PING;
+		/* fall through */
+	case PROBE_STATE_SEND_PING:
+		switch (network_socket_write(sock, -1)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_backend_probe_wait(probe, EV_WRITE);
+			return;
+		default:
+			network_backend_probe_failed(probe, "sending COM_PING failed");
+			return;
+		}
+
+		probe->state = PROBE_STATE_READ_PING;
+		network_backend_probe_wait(probe, EV_READ);
+		return;
+	case PROBE_STATE_READ_PING:
+		switch (network_backend_probe_read(probe)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_backend_probe_wait(probe, EV_READ);
+			return;
+		default:
+			network_backend_probe_failed(probe, "reading the COM_PING result failed");
+			return;
+		}
+
+		status = network_backend_probe_peek_status(probe, NULL);
+		network_backend_probe_clear_recv_queue(probe);
+
+		if (status != 0x00) {
+			network_backend_probe_failed(probe, "COM_PING failed");
+			return;
+		}
+
+		network_backend_probe_answered(probe);
+
+		if (!p->check_lag || probe->backend->type != BACKEND_TYPE_RO) {
+			event_del(&(sock->event));
+			probe->state = PROBE_STATE_IDLE;
+			return;
+		}
+
+		probe->eof_seen = 0;
+		network_backend_probe_send_command(probe, COM_QUERY, C("SHOW SLAVE STATUS"));
+		probe->state = PROBE_STATE_SEND_LAG_QUERY;
+		/* fall through */
+	case PROBE_STATE_SEND_LAG_QUERY:
+		switch (network_socket_write(sock, -1)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_backend_probe_wait(probe, EV_WRITE);
+			return;
+		default:
+			network_backend_probe_failed(probe, "sending SHOW SLAVE STATUS failed");
+			return;
+		}
+
+		probe->state = PROBE_STATE_READ_LAG_RESULT;
+		network_backend_probe_wait(probe, EV_READ);
+		return;
+	case PROBE_STATE_READ_LAG_RESULT:
+		/* collect the resultset: OK or ERR, or field-count, fields, EOF, rows, EOF */
+		for (;;) {
+			switch (network_backend_probe_read(probe)) {
+			case NETWORK_SOCKET_SUCCESS:
+				break;
+			case NETWORK_SOCKET_WAIT_FOR_EVENT:
+				network_backend_probe_wait(probe, EV_READ);
+				return;
+			default:
+				network_backend_probe_failed(probe, "reading the SHOW SLAVE STATUS result failed");
+				return;
+			}
+
+			status = network_backend_probe_peek_status(probe, &payload_len);
+
+			if (sock->recv_queue->chunks->length == 1 && (status == 0x00 || status == 0xff)) {
+				/* no resultset: no privileges, ... */
+				probe->backend->lag = -1;
+				network_backend_probe_set_gtid_executed(probe->backend, NULL);
+				break;
+			}
+
+			if (status == 0xff) {
+				probe->backend->lag = -1;
+				network_backend_probe_set_gtid_executed(probe->backend, NULL);
+				break;
+			}
+
+			if (status == 0xfe && payload_len < 9 && ++probe->eof_seen == 2) {
+				network_backend_probe_get_slave_status(probe);
+				break;
+			}
+		}
+
+		network_backend_probe_clear_recv_queue(probe);
+		event_del(&(sock->event));
+		probe->state = PROBE_STATE_IDLE;
+		return;
+	}
+}
+
+/**
+ * open a new connection to the backend
+ */
+static void network_backend_probe_connect(network_backend_probe *probe) {
+	network_backend_t *backend = probe->backend;
+
+	probe->is_reused = FALSE;
+	probe->sock = network_socket_new();
+	network_address_copy(probe->sock->dst, backend->addr);
+
+	g_get_current_time(&(probe->started));
+
+	switch (network_socket_connect(probe->sock)) {
+	case NETWORK_SOCKET_ERROR_RETRY:
+		/* the socket is non-blocking, wait until it is writable */
+		probe->state = PROBE_STATE_CONNECT;
+		network_backend_probe_wait(probe, EV_WRITE);
+		break;
+	case NETWORK_SOCKET_SUCCESS:
+		probe->state = PROBE_STATE_READ_HANDSHAKE;
+		network_backend_probe_wait(probe, EV_READ);
+		break;
+	default:
+		network_backend_probe_failed(probe, "connect() failed");
+		break;
+	}
+}
+
+/**
+ * start the next check of a backend
+ */
+static void network_backend_probe_start(network_backend_probe *probe) {
+	if (probe->state != PROBE_STATE_IDLE) return; /* the last check is still running, its timeout will end it */
+
+	if (NULL == probe->sock) {
+		network_backend_probe_connect(probe);
+		return;
+	}
+
+	/* we are logged in already, just ping */
+	probe->is_reused = TRUE;
+	g_get_current_time(&(probe->started));
+	network_backend_probe_send_command(probe, COM_PING, NULL, 0);
+
+	probe->state = PROBE_STATE_SEND_PING;
+	network_backend_probe_handle(probe->sock->fd, EV_WRITE, probe);
+}
+
+/**
+ * start the checks of all backends
+ */
+static void network_backends_prober_tick(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_backends_prober *p = user_data;
+	guint i;
+
+	if (chassis_is_shutdown()) return;
+
+	for (i = 0; i < network_backends_count(p->backends); i++) {
+		network_backend_t *backend = network_backends_get(p->backends, i);
+		network_backend_probe *probe;
+
+		if (NULL == (probe = g_hash_table_lookup(p->probes, backend))) {
+			probe = g_new0(network_backend_probe, 1);
+			probe->prober = p;
+			probe->backend = backend;
+
+			g_hash_table_insert(p->probes, backend, probe);
+		}
+
+		switch (backend->state) {
+		case BACKEND_STATE_MAINTAINING:
+		case BACKEND_STATE_DELETED:
+			/* the admin took it out, leave it alone */
+			network_backend_probe_close(probe);
+			continue;
+		default:
+			break;
+		}
+
+		network_backend_probe_start(probe);
+	}
+
+	chassis_event_add_to(p->loop, &(p->timer), &(p->interval));
+}
+
+/**
+ * start the checks in the event-loop @a loop
+ *
+ * called from apply_config() before the loops run, the timer is queued to
+ * @a loop and armed as soon as it dispatches
+ */
+int network_backends_prober_start(network_backends_prober *p, chassis *chas, chassis_event_t *loop, network_backends_t *backends) {
+	p->chas = chas;
+	p->backends = backends;
+
+	if (NULL == (p->loop = loop)) {
+		g_critical("%s: no event-loop to run the health-checks in", G_STRLOC);
+		return -1;
+	}
+
+	p->probes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, network_backend_probe_free);
+
+	evtimer_set(&(p->timer), network_backends_prober_tick, p);
+	chassis_event_add_to(p->loop, &(p->timer), &(p->interval));
+
+	g_message("%s: checking the backends every %.2f seconds%s%s",
+			G_STRLOC,
+			p->interval.tv_sec + p->interval.tv_usec / 1000000.0,
+			p->username->len ? " as " : "",
+			p->username->len ? p->username->str : "");
+
+	return 0;
+}
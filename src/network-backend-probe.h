@@ -0,0 +1,67 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_BACKEND_PROBE_H_
+#define _NETWORK_BACKEND_PROBE_H_
+
+#include <glib.h>
+
+#include "network-backend.h"
+#include "chassis-mainloop.h"
+#include "chassis-event.h"
+
+#include "network-exports.h"
+
+/**
+ * checks the health of the backends in the background
+ *
+ * without a user each check opens a connection and waits for the handshake of
+ * the backend. With a user the prober keeps a connection to each backend and
+ * sends a COM_PING, for read-only backends optionally followed by a
+ * SHOW SLAVE STATUS to get the replication lag and the applied GTIDs.
+ *
+ * A backend which doesn't answer in time is marked DOWN, one which answers is
+ * marked UP. The round-trip-times end up in network_backend_t::rtt_us.
+ */
+typedef struct {
+	chassis *chas;
+	network_backends_t *backends;
+	chassis_event_t *loop;        /** the event-loop the probes run in */
+
+	GString *username;            /** the user the prober logs in as, empty for handshake-only checks */
+	GString *hashed_password;     /** SHA1(password) */
+
+	gboolean check_lag;           /** ask the read-only backends for Seconds_Behind_Master and Executed_Gtid_Set */
+
+	struct timeval interval;      /** how often each backend is checked */
+	struct timeval timeout;       /** a backend which doesn't answer within this time is DOWN */
+
+	struct event timer;
+
+	GHashTable *probes;           /** GHashTable<network_backend_t, network_backend_probe> */
+} network_backends_prober;
+
+NETWORK_API network_backends_prober *network_backends_prober_new(void);
+NETWORK_API void network_backends_prober_free(network_backends_prober *p);
+NETWORK_API void network_backends_prober_set_auth(network_backends_prober *p, const gchar *username, const gchar *password);
+NETWORK_API int network_backends_prober_start(network_backends_prober *p, chassis *chas, chassis_event_t *loop, network_backends_t *backends);
+
+#endif
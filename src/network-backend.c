@@ -24,6 +24,7 @@
 
 #include "network-backend.h"
 #include "chassis-plugin.h"
+#include "chassis-event.h"
 #include "glib-ext.h"
 
 #define C(x) x, sizeof(x) - 1
@@ -43,6 +44,14 @@ const char * backend_type_t_str[BACKEND_TYPE_MAX] = {
 "readonly"
 };
 
+const char * backend_balance_t_str[BACKEND_BALANCE_MAX] = {
+"sqf",
+"p2c"
+};
+
+/* weight of a new sample in the response-time EWMA: 1/8 */
+#define NETWORK_BACKEND_RESPONSE_WEIGHT_SHIFT 3
+
 network_backend_t *network_backend_new() {
 	network_backend_t *b;
 
@@ -51,6 +60,8 @@ network_backend_t *network_backend_new() {
 	b->pool = network_connection_pool_new();
 	b->uuid = g_string_new(NULL);
 	b->addr = network_address_new();
+	b->lag = -1;
+	b->weight = 1;
 
 	return b;
 }
@@ -63,16 +74,45 @@ void network_backend_free(network_backend_t *b) {
 
 	if (b->addr)     network_address_free(b->addr);
 	if (b->uuid)     g_string_free(b->uuid, TRUE);
+	if (b->gtid_executed) network_gtid_set_free(b->gtid_executed);
 
 	g_free(b);
 }
 
+/**
+ * a query was sent to the backend
+ */
+void network_backend_query_start(network_backend_t *b) {
+	g_atomic_int_inc(&(b->in_flight));
+}
+
+/**
+ * a query sent to the backend finished
+ *
+ * @param response_us time it took in microseconds, < 0 if the query didn't finish normally
+ */
+void network_backend_query_done(network_backend_t *b, gint64 response_us) {
+	g_atomic_int_add(&(b->in_flight), -1);
+
+	if (response_us < 0) return;
+	if (response_us < 1) response_us = 1;
+
+	/* a lost update from another thread only costs us one sample */
+	if (b->response_us == 0) {
+		b->response_us = response_us;
+	} else {
+		b->response_us += (response_us - b->response_us) >> NETWORK_BACKEND_RESPONSE_WEIGHT_SHIFT;
+	}
+}
+
 network_backends_t *network_backends_new() {
 	network_backends_t *bs;
 
 	bs = g_new0(network_backends_t, 1);
 
 	bs->backends = g_ptr_array_new();
+	bs->backends_mutex = g_mutex_new();
+	bs->max_lag = -1;
 
 	return bs;
 }
@@ -89,16 +129,22 @@ void network_backends_free(network_backends_t *bs) {
 	}
 
 	g_ptr_array_free(bs->backends, TRUE);
+	g_mutex_free(bs->backends_mutex);
 
 	g_free(bs);
 }
 
+static void network_backends_array_free(gpointer backends) {
+	g_ptr_array_free(backends, TRUE);
+}
+
 /*
  * FIXME: 1) remove _set_address, make this function callable with result of same
  *        2) differentiate between reasons for "we didn't add" (now -1 in all cases)
  */
 int network_backends_add(network_backends_t *bs, const  gchar *address, backend_type_t type, backend_state_t state) {
 	network_backend_t *new_backend;
+	GPtrArray *old_backends, *new_backends;
 	guint i;
 
 	new_backend = network_backend_new();
@@ -110,11 +156,15 @@ int network_backends_add(network_backends_t *bs, const  gchar *address, backend_
 		return -1;
 	}
 
+	g_mutex_lock(bs->backends_mutex);
+	old_backends = bs->backends;
+
 	/* check if this backend is already known */
-	for (i = 0; i < bs->backends->len; i++) {
-		network_backend_t *old_backend = bs->backends->pdata[i];
+	for (i = 0; i < old_backends->len; i++) {
+		network_backend_t *old_backend = old_backends->pdata[i];
 
 		if (strleq(S(old_backend->addr->name), S(new_backend->addr->name))) {
+			g_mutex_unlock(bs->backends_mutex);
 			network_backend_free(new_backend);
 
 			g_critical("backend %s is already known!", address);
@@ -122,8 +172,17 @@ int network_backends_add(network_backends_t *bs, const  gchar *address, backend_
 		}
 	}
 
+	/* the event-threads read the array without a lock: add to a copy and swap it in */
+	new_backends = g_ptr_array_sized_new(old_backends->len + 1);
+	for (i = 0; i < old_backends->len; i++) {
+		g_ptr_array_add(new_backends, old_backends->pdata[i]);
+	}
+	g_ptr_array_add(new_backends, new_backend);
 
-	g_ptr_array_add(bs->backends, new_backend);
+	g_atomic_pointer_set((gpointer *)&(bs->backends), new_backends);
+	g_mutex_unlock(bs->backends_mutex);
+
+	chassis_event_defer_free(old_backends, network_backends_array_free);
 
 	g_message("added %s backend: %s, state: %s", backend_type_t_str[type],
 			address, backend_state_t_str[state]);
@@ -234,3 +293,158 @@ guint network_backends_count(network_backends_t *bs) {
 	return len;
 }
 
+
+/**
+ * set the balancing policy by name
+ *
+ * @returns   0 for success -1 for an unknown policy
+ */
+int network_backends_set_balance(network_backends_t *bs, const gchar *name) {
+	guint i;
+
+	for (i = 0; i < BACKEND_BALANCE_MAX; i++) {
+		if (0 == g_ascii_strcasecmp(name, backend_balance_t_str[i])) {
+			bs->balance = i;
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * check if a read-only backend is recent enough
+ *
+ * if we know what the client wrote last, the backend has to have applied it.
+ * Otherwise its lag has to be within the limit.
+ */
+static gboolean network_backend_is_consistent(network_backends_t *bs, network_backend_t *b, const network_gtid_set *read_after) {
+	if (b->type != BACKEND_TYPE_RO) return TRUE;
+
+	if (read_after && !network_gtid_set_is_empty(read_after)) {
+		network_gtid_set *executed = g_atomic_pointer_get(&(b->gtid_executed));
+
+		return executed && network_gtid_set_is_subset(read_after, executed);
+	}
+
+	if (bs->max_lag < 0) return TRUE;
+
+	return b->lag >= 0 && b->lag <= bs->max_lag;
+}
+
+/**
+ * check if a backend may be picked by network_backends_balance()
+ */
+static gboolean network_backend_is_candidate(network_backends_t *bs, network_backend_t *b, backend_type_t type, GString *idle_user, const network_gtid_set *read_after) {
+	if (b->state != BACKEND_STATE_UP &&
+	    b->state != BACKEND_STATE_UNKNOWN) return FALSE;
+	if (type != BACKEND_TYPE_UNKNOWN && b->type != type) return FALSE;
+	if (b->weight == 0) return FALSE;
+	if (!network_backend_is_consistent(bs, b, read_after)) return FALSE;
+
+	/* called from the event-threads, the pool has to be locked */
+	if (idle_user && network_connection_pool_get_idle_count(b->pool, idle_user) == 0) return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * the expected cost of sending one more query to the backend
+ *
+ * the queries in flight times the response-time, the rtt of the health-checks
+ * stands in as long as we haven't seen a query-response
+ */
+static gdouble network_backend_cost(network_backend_t *b) {
+	gint64 latency_us;
+
+	if (b->response_us > 0) {
+		latency_us = b->response_us;
+	} else if (b->rtt_us > 0) {
+		latency_us = b->rtt_us;
+	} else {
+		latency_us = 1;
+	}
+
+	return (gdouble)(g_atomic_int_get(&(b->in_flight)) + 1) * latency_us / b->weight;
+}
+
+/**
+ * pick a random candidate, weighted by network_backend_t::weight
+ *
+ * @param total_weight the sum of the weights of the candidates without skip_ndx
+ * @param skip_ndx     a candidate which shall not be picked, or -1
+ * @return the index of the backend or -1
+ */
+static gint network_backends_pick_weighted(network_backends_t *bs, GPtrArray *backends, backend_type_t type, GString *idle_user, const network_gtid_set *read_after, guint total_weight, gint skip_ndx) {
+	guint r;
+	guint i;
+
+	if (total_weight == 0) return -1;
+
+	r = g_random_int_range(0, total_weight);
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+
+		if ((gint)i == skip_ndx) continue;
+		if (!network_backend_is_candidate(bs, cur, type, idle_user, read_after)) continue;
+
+		if (r < cur->weight) return i;
+
+		r -= cur->weight;
+	}
+
+	return -1;
+}
+
+/**
+ * pick a backend with the balancing policy of the backends
+ *
+ * only backends which are UP or UNKNOWN and have a weight are considered.
+ * Read-only backends also have to be within --proxy-backend-max-lag or have
+ * applied read_after.
+ *
+ * @param type       the type of the backend or BACKEND_TYPE_UNKNOWN for any
+ * @param idle_user  if set, only backends which have idling connections for this user
+ * @param read_after if set, the GTIDs the client wrote last
+ * @return the index of the backend or -1 if none is available
+ */
+gint network_backends_balance(network_backends_t *bs, backend_type_t type, GString *idle_user, const network_gtid_set *read_after) {
+	GPtrArray *backends = g_atomic_pointer_get(&(bs->backends));
+	guint total_weight = 0;
+	guint candidates = 0;
+	gint ndx = -1;
+	gint first, second;
+	gdouble min_cost = 0;
+	guint i;
+
+	for (i = 0; i < backends->len; i++) {
+		network_backend_t *cur = backends->pdata[i];
+		gdouble cost;
+
+		if (!network_backend_is_candidate(bs, cur, type, idle_user, read_after)) continue;
+
+		candidates++;
+		total_weight += cur->weight;
+
+		if (bs->balance != BACKEND_BALANCE_SQF) continue;
+
+		cost = (gdouble)(g_atomic_int_get(&(cur->connected_clients)) + 1) / cur->weight;
+		if (ndx == -1 || cost < min_cost) {
+			ndx = i;
+			min_cost = cost;
+		}
+	}
+
+	if (bs->balance == BACKEND_BALANCE_SQF || candidates == 0) return ndx;
+
+	first = network_backends_pick_weighted(bs, backends, type, idle_user, read_after, total_weight, -1);
+	if (first == -1 || candidates == 1) return first;
+
+	second = network_backends_pick_weighted(bs, backends, type, idle_user, read_after,
+			total_weight - ((network_backend_t *)backends->pdata[first])->weight, first);
+	if (second == -1) return first;
+
+	return network_backend_cost(backends->pdata[first]) <= network_backend_cost(backends->pdata[second]) ? first : second;
+}
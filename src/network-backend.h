@@ -27,6 +27,7 @@
 #endif
 
 #include "network-conn-pool.h"
+#include "network-gtid.h"
 #include "chassis-mainloop.h"
 
 #include "network-exports.h"
@@ -61,20 +62,45 @@ typedef struct {
 
 	network_connection_pool *pool; /**< the pool of open connections */
 
-	guint connected_clients; /**< number of open connections to this backend for SQF */
+	volatile gint connected_clients; /**< number of open connections to this backend for SQF, changed with g_atomic_int_*() by all event-threads */
 	guint connections; 
 
 	GString *uuid;           /**< the UUID of the backend */
+
+	gint64 rtt_us;           /**< EWMA of the round-trip-time of the health-checks in microseconds, 0 if unknown */
+	gint lag;                /**< seconds the replication lags behind the master, -1 if unknown */
+	network_gtid_set *gtid_executed; /**< the transactions a read-only backend applied, NULL if unknown. Replaced as a whole, the old one is freed deferred */
+
+	guint weight;            /**< relative share of the load, 0 takes the backend out of the balancing */
+	volatile gint in_flight; /**< queries sent to this backend which haven't finished yet */
+	gint64 response_us;      /**< EWMA of the response-time of the queries in microseconds, 0 if unknown */
 } network_backend_t;
 
 
 NETWORK_API network_backend_t *network_backend_new();
 NETWORK_API void network_backend_free(network_backend_t *b);
+NETWORK_API void network_backend_query_start(network_backend_t *b);
+NETWORK_API void network_backend_query_done(network_backend_t *b, gint64 response_us);
+
+/**
+ * how network_backends_balance() picks a backend
+ */
+typedef enum {
+	BACKEND_BALANCE_SQF,     /**< shortest queue first: least connected_clients per weight */
+	BACKEND_BALANCE_P2C,     /**< power of two choices over in-flight queries and response-time */
+	BACKEND_BALANCE_MAX
+} backend_balance_t;
+
+extern const char * backend_balance_t_str[BACKEND_BALANCE_MAX];
 
 typedef struct {
-    GPtrArray *backends;
+    GPtrArray *backends;           /**< read-mostly, replaced by a copy on add */
+	GMutex *backends_mutex;        /**< serializes the writers of backends */
 	
 	GTimeVal backend_last_check;
+
+	backend_balance_t balance;     /**< the policy of network_backends_balance() */
+	gint max_lag;                  /**< read-only backends which lag more seconds aren't picked, -1 for no limit */
 } network_backends_t;
 
 NETWORK_API network_backends_t *network_backends_new();
@@ -85,6 +111,8 @@ NETWORK_API int network_backends_check(network_backends_t *bs);
 NETWORK_API int network_backends_modify(network_backends_t *bs, guint ndx, backend_type_t type, backend_state_t state);
 NETWORK_API network_backend_t * network_backends_get(network_backends_t *bs, guint ndx);
 NETWORK_API guint network_backends_count(network_backends_t *bs);
+NETWORK_API int network_backends_set_balance(network_backends_t *bs, const gchar *name);
+NETWORK_API gint network_backends_balance(network_backends_t *bs, backend_type_t type, GString *idle_user, const network_gtid_set *read_after);
 
 #endif /* _BACKEND_H_ */
 
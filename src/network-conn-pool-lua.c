@@ -119,12 +119,12 @@ int network_connection_pool_users_getmetatable(lua_State *L) {
 static void proxy_pool_get_user_conn_info(gpointer key, gpointer value, gpointer Lp) 
 {
     GString * username = (GString *)key;
-    GQueue * conns = (GQueue *)value;
+    network_connection_pool_user * user = (network_connection_pool_user *)value;
     lua_State * L = *(lua_State**)Lp;
     
-    //g_message("%s, %s, %d, %p", __func__, username->str, conns->length, L);
+    //g_message("%s, %s, %d, %p", __func__, username->str, user->conns->length, L);
 	lua_pushstring(L, username->str);
-    lua_pushnumber(L, (double)conns->length);
+    lua_pushnumber(L, (double)user->conns->length);
     lua_settable(L, -3);
 }
 
@@ -139,6 +139,8 @@ static int proxy_pool_get(lua_State *L) {
         lua_pushinteger(L, pool->mid_idle_connections);
     } else if (strleq(key, keysize, C("min_idle_connections"))) {
         lua_pushinteger(L, pool->min_idle_connections);
+    } else if (strleq(key, keysize, C("idle_timeout"))) {
+        lua_pushinteger(L, pool->idle_timeout);
     } else if (strleq(key, keysize, C("serve_req_after_init"))) {
         lua_pushboolean(L, pool->serve_req_after_init == TRUE);
     } else if (strleq(key, keysize, C("stop_phase"))) {
@@ -185,6 +187,10 @@ static int proxy_pool_set(lua_State *L) {
 		pool->mid_idle_connections = lua_tointeger(L, -1);
 	} else if (strleq(key, keysize, C("min_idle_connections"))) {
 		pool->min_idle_connections = lua_tointeger(L, -1);
+	} else if (strleq(key, keysize, C("idle_timeout"))) {
+		g_mutex_lock(pool->mutex);
+		pool->idle_timeout = MAX(lua_tointeger(L, -1), 0);
+		g_mutex_unlock(pool->mutex);
 	} else if (strleq(key, keysize, C("max_init_time"))) {
 		pool->max_init_last_time = lua_tointeger(L, -1);
 	} else if (strleq(key, keysize, C("set_init_time"))) {
@@ -219,38 +225,6 @@ int network_connection_pool_getmetatable(lua_State *L) {
 	return proxy_getmetatable(L, methods);
 }
 
-/**
- * handle the events of a idling server connection in the pool 
- *
- * make sure we know about connection close from the server side
- * - wait_timeout
- */
-static void network_mysqld_con_idle_handle(int event_fd, short events, void *user_data) {
-	network_connection_pool_entry *pool_entry = user_data;
-	network_connection_pool *pool             = pool_entry->pool;
-
-	if (events == EV_READ) {
-		int b = -1;
-
-		/**
-		 * @todo we have to handle the case that the server really sent use something
-		 *        up to now we just ignore it
-		 */
-		if (ioctlsocket(event_fd, FIONREAD, &b)) {
-			g_critical("ioctl(%d, FIONREAD, ...) failed: %s", event_fd, g_strerror(errno));
-		} else if (b != 0) {
-			g_critical("ioctl(%d, FIONREAD, ...) said there is something to read, oops: %d", event_fd, b);
-		} else {
-			/* the server decided the close the connection (wait_timeout, crash, ... )
-			 *
-			 * remove us from the connection pool and close the connection */
-		
-			network_connection_pool_remove(pool, pool_entry);
-		}
-	}
-}
-
-
 /**
  * move the con->server into connection pool and disconnect the 
  * proxy from its backend 
@@ -345,13 +319,13 @@ int network_connection_pool_lua_add_connection(network_mysqld_con *con, int is_s
             }
 
             g_debug("%s: here add conn fd:%d to pool:%p ", G_STRLOC, server->fd, backend->pool); 
-            pool_entry = network_connection_pool_add(backend->pool, server, con->client->src->key);
-            event_set(&(server->event), server->fd, EV_READ, network_mysqld_con_idle_handle, pool_entry);
-            chassis_event_add_local(con->srv, &(server->event)); 
+            pool_entry = network_connection_pool_add(backend->pool, network_mysqld_con_get_event_loop(con), server, con->client->src->key);
+            event_set(&(server->event), server->fd, EV_READ, network_connection_pool_idle_handle, pool_entry);
+            chassis_event_add_to(network_mysqld_con_get_event_loop(con), &(server->event), NULL); 
 
-            backend->connected_clients--;
+            g_atomic_int_add(&(backend->connected_clients), -1);
             g_debug("%s, con:%p, backend ndx:%d:connected_clients--, clients:%d",
-                        G_STRLOC, con, st->backend_ndx_array[i], backend->connected_clients);
+                        G_STRLOC, con, st->backend_ndx_array[i], g_atomic_int_get(&(backend->connected_clients)));
             checked++;
             if (checked >= server_list->num) {
                 break;
@@ -373,15 +347,15 @@ int network_connection_pool_lua_add_connection(network_mysqld_con *con, int is_s
 
         g_debug("%s: add conn fd:%d to pool:%p", G_STRLOC, con->server->fd, st->backend->pool);
         /* insert the server socket into the connection pool */
-        pool_entry = network_connection_pool_add(st->backend->pool, con->server, con->client->src->key);
+        pool_entry = network_connection_pool_add(st->backend->pool, network_mysqld_con_get_event_loop(con), con->server, con->client->src->key);
 
         event_set(&(con->server->event), con->server->fd, EV_READ,
-                network_mysqld_con_idle_handle, pool_entry);
-        chassis_event_add_local(con->srv, &(con->server->event)); 
+                network_connection_pool_idle_handle, pool_entry);
+        chassis_event_add_to(network_mysqld_con_get_event_loop(con), &(con->server->event), NULL); 
 
-        st->backend->connected_clients--;
+        g_atomic_int_add(&(st->backend->connected_clients), -1);
          g_debug("%s, con:%p, backend ndx:%d:connected_clients--, clients:%d",
-                        G_STRLOC, con, st->backend_ndx, st->backend->connected_clients);
+                        G_STRLOC, con, st->backend_ndx, g_atomic_int_get(&(st->backend->connected_clients)));
     }
 
     st->backend = NULL;
@@ -509,11 +483,11 @@ network_socket *network_connection_pool_lua_swap(network_mysqld_con *con, int ba
 
     /* connect to the new backend */
     st->backend = backend;
-    st->backend->connected_clients++;
+    g_atomic_int_inc(&(st->backend->connected_clients));
     st->backend_ndx = backend_ndx;
 
     g_debug("%s, con:%p, backend ndx:%d:connected_clients++, clients:%d, sock:%p",
-                        G_STRLOC, con, backend_ndx, st->backend->connected_clients, send_sock);
+                        G_STRLOC, con, backend_ndx, g_atomic_int_get(&(st->backend->connected_clients)), send_sock);
 
     return send_sock;
 }
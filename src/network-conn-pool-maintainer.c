@@ -0,0 +1,638 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * the pool maintainer
+ *
+ * opens and authenticates the backend connections before a client asks for them
+ * and trims the pools which grew too large. A connection from the maintainer
+ * looks like any other connection in the pool: it is authed and has a challenge
+ * which is passed on to the client which takes it over by COM_CHANGE_USER.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+
+#include <glib.h>
+
+#include "network-conn-pool-maintainer.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "chassis-gtimeval.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * a connection which is opened by the maintainer
+ */
+typedef struct {
+	enum {
+		WARMUP_STATE_CONNECT,
+		WARMUP_STATE_READ_HANDSHAKE,
+		WARMUP_STATE_SEND_AUTH,
+		WARMUP_STATE_READ_AUTH_RESULT
+	} state;
+
+	network_connection_pool_maintainer_loop *ml;
+	network_connection_pool_maintainer_backend *mb;
+	network_backend_t *backend;
+
+	network_socket *sock;
+	GList *link;                  /** node in ml->pending */
+} network_connection_pool_warmup;
+
+network_connection_pool_maintainer *network_connection_pool_maintainer_new(void) {
+	network_connection_pool_maintainer *m;
+
+	m = g_new0(network_connection_pool_maintainer, 1);
+	m->username = g_string_new(NULL);
+	m->hashed_password = g_string_new(NULL);
+	m->interval.tv_sec = 1;
+	m->connect_timeout.tv_sec = 2;
+	m->max_connects = 16;
+	m->loops = g_ptr_array_new();
+
+	return m;
+}
+
+static void network_connection_pool_warmup_free(network_connection_pool_warmup *w) {
+	if (!w) return;
+
+	if (w->sock) {
+		event_del(&(w->sock->event));
+		network_socket_free(w->sock);
+	}
+
+	g_free(w);
+}
+
+static void network_connection_pool_maintainer_loop_free(network_connection_pool_maintainer_loop *ml) {
+	network_connection_pool_warmup *w;
+
+	if (!ml) return;
+
+	event_del(&(ml->timer));
+
+	while ((w = g_queue_pop_head(ml->pending))) network_connection_pool_warmup_free(w);
+	g_queue_free(ml->pending);
+
+	g_hash_table_destroy(ml->backends);
+
+	g_free(ml);
+}
+
+/**
+ * free the maintainer
+ *
+ * the event-threads have to be stopped already
+ */
+void network_connection_pool_maintainer_free(network_connection_pool_maintainer *m) {
+	guint i;
+
+	if (!m) return;
+
+	for (i = 0; i < m->loops->len; i++) {
+		network_connection_pool_maintainer_loop_free(m->loops->pdata[i]);
+	}
+	g_ptr_array_free(m->loops, TRUE);
+
+	g_string_free(m->username, TRUE);
+	g_string_free(m->hashed_password, TRUE);
+
+	g_free(m);
+}
+
+/**
+ * set the credentials the connections are opened with
+ *
+ * only the SHA1() of the password is kept, it is all we need for the scramble
+ */
+void network_connection_pool_maintainer_set_auth(network_connection_pool_maintainer *m, const gchar *username, const gchar *password) {
+	g_string_assign(m->username, username);
+
+	if (password && *password) {
+		network_mysqld_proto_password_hash(m->hashed_password, password, strlen(password));
+	} else {
+		g_string_truncate(m->hashed_password, 0);
+	}
+}
+
+/**
+ * the maintainer gave up on the connection
+ *
+ * the backend has to earn the ramp again
+ */
+static void network_connection_pool_warmup_failed(network_connection_pool_warmup *w, const char *reason) {
+	network_connection_pool_maintainer_loop *ml = w->ml;
+
+	g_debug("%s: warming up a connection to %s failed: %s",
+			G_STRLOC, w->backend->addr->name->str, reason);
+
+	w->mb->in_flight--;
+	w->mb->ramp = 1;
+
+	g_queue_delete_link(ml->pending, w->link);
+	network_connection_pool_warmup_free(w);
+}
+
+/**
+ * the connection is authed, hand it over to the pool of the backend
+ */
+static void network_connection_pool_warmup_done(network_connection_pool_warmup *w) {
+	network_connection_pool_maintainer_loop *ml = w->ml;
+	network_connection_pool_maintainer *m = ml->maintainer;
+	network_connection_pool_entry *pool_entry;
+	network_backend_t *backend = w->backend;
+	network_socket *sock = w->sock;
+
+	w->mb->in_flight--;
+	w->mb->ramp = MIN(w->mb->ramp + 1, m->max_connects);
+
+	g_queue_delete_link(ml->pending, w->link);
+	w->sock = NULL;
+	network_connection_pool_warmup_free(w);
+
+	if (backend->state != BACKEND_STATE_UP) {
+		backend->state = BACKEND_STATE_UP;
+		chassis_gtime_testset_now(&(backend->state_since), NULL);
+	}
+
+	sock->is_authed = 1;
+	network_mysqld_queue_reset(sock);
+
+	pool_entry = network_connection_pool_add(backend->pool, ml->loop, sock, 0);
+	event_set(&(sock->event), sock->fd, EV_READ, network_connection_pool_idle_handle, pool_entry);
+	chassis_event_add_to(ml->loop, &(sock->event), NULL);
+}
+
+/**
+ * get the next packet of the backend into sock->recv_queue
+ */
+static network_socket_retval_t network_connection_pool_warmup_read(network_connection_pool_warmup *w) {
+	network_socket *sock = w->sock;
+
+	if (NETWORK_SOCKET_SUCCESS == network_mysqld_con_get_packet(w->ml->maintainer->chas, sock)) {
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	sock->to_read = NETWORK_SOCKET_READ_MAX;
+	switch (network_socket_read(sock)) {
+	case NETWORK_SOCKET_SUCCESS:
+		break;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		if (sock->is_peer_closed) return NETWORK_SOCKET_ERROR;
+
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	default:
+		return NETWORK_SOCKET_ERROR;
+	}
+
+	return network_mysqld_con_get_packet(w->ml->maintainer->chas, sock);
+}
+
+/**
+ * build the auth-response for the challenge in the recv-queue
+ */
+static int network_connection_pool_warmup_auth(network_connection_pool_warmup *w) {
+	network_connection_pool_maintainer *m = w->ml->maintainer;
+	network_socket *sock = w->sock;
+	network_mysqld_auth_challenge *challenge;
+	network_mysqld_auth_response *auth;
+	network_packet packet;
+	GString *auth_packet;
+	guint8 status = 0;
+	int err = 0;
+
+	packet.data = g_queue_peek_tail(sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+	if (err || status == 0xff) return -1;
+
+	challenge = network_mysqld_auth_challenge_new();
+	if (network_mysqld_proto_get_auth_challenge(&packet, challenge)) {
+		network_mysqld_auth_challenge_free(challenge);
+		return -1;
+	}
+	g_string_free(g_queue_pop_tail(sock->recv_queue->chunks), TRUE);
+
+	/* the clients get this challenge, they can't do compression nor SSL through us */
+	challenge->capabilities &= ~(CLIENT_COMPRESS);
+	challenge->capabilities &= ~(CLIENT_SSL);
+	sock->challenge = challenge;
+
+	if (NULL == (auth = network_mysqld_auth_response_new_native(challenge, m->username, m->hashed_password))) {
+		return -1;
+	}
+
+	/* the clients of the pool get the resultsets without the EOFs, if they ask for it too */
+	auth->client_capabilities |= challenge->capabilities & CLIENT_DEPRECATE_EOF;
+	sock->is_eof_deprecated = (0 != (auth->client_capabilities & CLIENT_DEPRECATE_EOF));
+
+	sock->response = auth;
+
+	auth_packet = g_string_new(NULL);
+	network_mysqld_proto_append_auth_response(auth_packet, auth);
+	network_mysqld_queue_append(sock, sock->send_queue, S(auth_packet));
+	g_string_free(auth_packet, TRUE);
+
+	return 0;
+}
+
+/**
+ * check the auth-result in the recv-queue
+ */
+static int network_connection_pool_warmup_auth_result(network_connection_pool_warmup *w) {
+	network_socket *sock = w->sock;
+	network_packet packet;
+	guint8 status = 0;
+	int err = 0;
+
+	packet.data = g_queue_peek_tail(sock->recv_queue->chunks);
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+	err = err || network_mysqld_proto_peek_int8(&packet, &status);
+	if (err) return -1;
+
+	switch (status) {
+	case 0x00:
+		break;
+	case 0xff: {
+		network_mysqld_err_packet_t *err_packet;
+
+		err_packet = network_mysqld_err_packet_new();
+		if (0 == network_mysqld_proto_get_err_packet(&packet, err_packet)) {
+			g_critical("%s: authenticating '%s' at %s for the connection pool failed: %s",
+					G_STRLOC, sock->response->username->str, w->backend->addr->name->str,
+					err_packet->errmsg->str);
+		}
+		network_mysqld_err_packet_free(err_packet);
+		err = -1;
+		break; }
+	default:
+		/* 0xfe: the backend asks for another auth-method, only mysql_native_password is supported */
+		g_critical("%s: %s asks for another auth-method for '%s', the connection pool needs mysql_native_password",
+				G_STRLOC, w->backend->addr->name->str, sock->response->username->str);
+		err = -1;
+		break;
+	}
+
+	g_string_free(g_queue_pop_tail(sock->recv_queue->chunks), TRUE);
+
+	return err;
+}
+
+/**
+ * wait for the socket of the warm-up connection
+ */
+static void network_connection_pool_warmup_wait(network_connection_pool_warmup *w, short what);
+
+/**
+ * the state-machine of the connections opened by the maintainer
+ *
+ * connect -> read handshake -> send auth -> read auth result -> pool
+ */
+static void network_connection_pool_warmup_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_connection_pool_warmup *w = user_data;
+	network_socket *sock = w->sock;
+
+	if (events == EV_TIMEOUT) {
+		network_connection_pool_warmup_failed(w, "timed out");
+		return;
+	}
+
+	switch (w->state) {
+	case WARMUP_STATE_CONNECT:
+		if (NETWORK_SOCKET_SUCCESS != network_socket_connect_finish(sock)) {
+			w->backend->state = BACKEND_STATE_DOWN;
+			chassis_gtime_testset_now(&(w->backend->state_since), NULL);
+
+			network_connection_pool_warmup_failed(w, g_strerror(errno));
+			return;
+		}
+
+		w->state = WARMUP_STATE_READ_HANDSHAKE;
+		network_connection_pool_warmup_wait(w, EV_READ);
+		return;
+	case WARMUP_STATE_READ_HANDSHAKE:
+		switch (network_connection_pool_warmup_read(w)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_connection_pool_warmup_wait(w, EV_READ);
+			return;
+		default:
+			network_connection_pool_warmup_failed(w, "reading the handshake failed");
+			return;
+		}
+
+		if (0 != network_connection_pool_warmup_auth(w)) {
+			network_connection_pool_warmup_failed(w, "the handshake is invalid");
+			return;
+		}
+
+		w->state = WARMUP_STATE_SEND_AUTH;
+		/* fall through */
+	case WARMUP_STATE_SEND_AUTH:
+		switch (network_socket_write(sock, -1)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_connection_pool_warmup_wait(w, EV_WRITE);
+			return;
+		default:
+			network_connection_pool_warmup_failed(w, "sending the auth packet failed");
+			return;
+		}
+
+		w->state = WARMUP_STATE_READ_AUTH_RESULT;
+		network_connection_pool_warmup_wait(w, EV_READ);
+		return;
+	case WARMUP_STATE_READ_AUTH_RESULT:
+		switch (network_connection_pool_warmup_read(w)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_connection_pool_warmup_wait(w, EV_READ);
+			return;
+		default:
+			network_connection_pool_warmup_failed(w, "reading the auth result failed");
+			return;
+		}
+
+		if (0 != network_connection_pool_warmup_auth_result(w)) {
+			network_connection_pool_warmup_failed(w, "authentication failed");
+			return;
+		}
+
+		network_connection_pool_warmup_done(w);
+		return;
+	}
+}
+
+static void network_connection_pool_warmup_wait(network_connection_pool_warmup *w, short what) {
+	network_socket *sock = w->sock;
+
+	event_set(&(sock->event), sock->fd, what, network_connection_pool_warmup_handle, w);
+	chassis_event_add_to(w->ml->loop, &(sock->event), &(w->ml->maintainer->connect_timeout));
+}
+
+/**
+ * open a new connection to the backend
+ */
+static void network_connection_pool_warmup_start(network_connection_pool_maintainer_loop *ml,
+		network_backend_t *backend, network_connection_pool_maintainer_backend *mb) {
+	network_connection_pool_warmup *w;
+
+	w = g_new0(network_connection_pool_warmup, 1);
+	w->ml = ml;
+	w->mb = mb;
+	w->backend = backend;
+	w->sock = network_socket_new();
+	network_address_copy(w->sock->dst, backend->addr);
+
+	g_queue_push_tail(ml->pending, w);
+	w->link = ml->pending->tail;
+	mb->in_flight++;
+
+	switch (network_socket_connect(w->sock)) {
+	case NETWORK_SOCKET_ERROR_RETRY:
+		/* the socket is non-blocking, wait until it is writable */
+		w->state = WARMUP_STATE_CONNECT;
+		network_connection_pool_warmup_wait(w, EV_WRITE);
+		break;
+	case NETWORK_SOCKET_SUCCESS:
+		w->state = WARMUP_STATE_READ_HANDSHAKE;
+		network_connection_pool_warmup_wait(w, EV_READ);
+		break;
+	default:
+		backend->state = BACKEND_STATE_DOWN;
+		chassis_gtime_testset_now(&(backend->state_since), NULL);
+
+		network_connection_pool_warmup_failed(w, "connect() failed");
+		break;
+	}
+}
+
+/**
+ * the number of idle connections a pool should have right now
+ *
+ * after the start (or a set_init_time from the scripts) it ramps up from
+ * min_idle_connections to mid_idle_connections within max_init_time
+ */
+static guint network_connection_pool_maintainer_target(network_connection_pool *pool) {
+	gint elapsed = time(0) - pool->init_time;
+
+	if (pool->mid_idle_connections <= pool->min_idle_connections ||
+	    pool->max_init_last_time <= 0 ||
+	    elapsed >= pool->max_init_last_time) {
+		return MAX(pool->mid_idle_connections, pool->min_idle_connections);
+	}
+
+	if (elapsed < 0) elapsed = 0;
+
+	return pool->min_idle_connections +
+		(pool->mid_idle_connections - pool->min_idle_connections) * elapsed / pool->max_init_last_time;
+}
+
+/**
+ * the state of the backend in the event-loop
+ */
+static network_connection_pool_maintainer_backend *network_connection_pool_maintainer_backend_get(network_connection_pool_maintainer_loop *ml, network_backend_t *backend) {
+	network_connection_pool_maintainer_backend *mb;
+
+	if (NULL == (mb = g_hash_table_lookup(ml->backends, backend))) {
+		mb = g_new0(network_connection_pool_maintainer_backend, 1);
+		mb->ramp = 1;
+
+		g_hash_table_insert(ml->backends, backend, mb);
+	}
+
+	return mb;
+}
+
+/**
+ * open a connection to the backend in the current event-loop right away, for a client which waits for one
+ *
+ * the pool of the loop stays within its share of max_idle_connections
+ *
+ * @return TRUE if a connection is on its way
+ */
+gboolean network_connection_pool_maintainer_connect(network_connection_pool_maintainer *m, network_backend_t *backend) {
+	chassis_event_t *loop = chassis_event_get_current();
+	network_connection_pool_maintainer_loop *ml = NULL;
+	network_connection_pool_maintainer_backend *mb;
+	network_connection_pool *pool = backend->pool;
+	guint max_idle;
+	guint i;
+
+	for (i = 0; i < m->loops->len; i++) {
+		network_connection_pool_maintainer_loop *l = m->loops->pdata[i];
+
+		if (l->loop == loop) {
+			ml = l;
+			break;
+		}
+	}
+	if (NULL == ml) return FALSE;
+
+	switch (backend->state) {
+	case BACKEND_STATE_UP:
+	case BACKEND_STATE_UNKNOWN:
+		break;
+	default:
+		return FALSE;
+	}
+	if (pool->stop_phase) return FALSE;
+
+	mb = network_connection_pool_maintainer_backend_get(ml, backend);
+	if (mb->in_flight > 0) return TRUE;
+
+	max_idle = (pool->max_idle_connections + m->loops->len - 1) / m->loops->len;
+	if (max_idle > 0 && network_connection_pool_count(pool, loop) >= max_idle) return FALSE;
+
+	network_connection_pool_warmup_start(ml, backend, mb);
+
+	return mb->in_flight > 0;
+}
+
+/**
+ * check the pools of all backends in this event-loop
+ */
+static void network_connection_pool_maintainer_tick(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_connection_pool_maintainer_loop *ml = user_data;
+	network_connection_pool_maintainer *m = ml->maintainer;
+	guint nloops = m->loops->len;
+	guint i;
+
+	if (chassis_is_shutdown()) return;
+
+	network_backends_check(m->backends);
+
+	for (i = 0; i < network_backends_count(m->backends); i++) {
+		network_backend_t *backend = network_backends_get(m->backends, i);
+		network_connection_pool_maintainer_backend *mb;
+		network_connection_pool *pool = backend->pool;
+		guint target, max_idle, idle, want;
+
+		mb = network_connection_pool_maintainer_backend_get(ml, backend);
+
+		switch (backend->state) {
+		case BACKEND_STATE_UP:
+		case BACKEND_STATE_UNKNOWN:
+			break;
+		case BACKEND_STATE_MAINTAINING:
+		case BACKEND_STATE_DELETED:
+			network_connection_pool_trim(pool, ml->loop, 0);
+			/* fall through */
+		default:
+			/* start slow again once it is back */
+			mb->ramp = 1;
+			continue;
+		}
+
+		if (pool->stop_phase) continue;
+
+		/* each event-loop keeps its share of the pool */
+		target   = (network_connection_pool_maintainer_target(pool) + nloops - 1) / nloops;
+		max_idle = (pool->max_idle_connections + nloops - 1) / nloops;
+		idle     = network_connection_pool_count(pool, ml->loop);
+
+		if (max_idle > 0 && idle > max_idle) {
+			g_debug("%s: closing %u idle connections to %s",
+					G_STRLOC, idle - max_idle, backend->addr->name->str);
+			network_connection_pool_trim(pool, ml->loop, max_idle);
+			continue;
+		}
+
+		if (idle + mb->in_flight >= target) continue;
+
+		want = target - idle - mb->in_flight;
+		if (mb->in_flight >= mb->ramp) continue;
+		want = MIN(want, mb->ramp - mb->in_flight);
+
+		g_debug("%s: opening %u connections to %s (idle: %u, target: %u)",
+				G_STRLOC, want, backend->addr->name->str, idle, target);
+
+		while (want-- > 0) {
+			network_connection_pool_warmup_start(ml, backend, mb);
+
+			if (backend->state == BACKEND_STATE_DOWN) break;
+		}
+	}
+
+	chassis_event_add_to(ml->loop, &(ml->timer), &(m->interval));
+}
+
+/**
+ * start the timers in the event-threads, or in the main-loop if there are none
+ *
+ * has to be called from the main-thread, the timers are queued to their loops
+ * and armed once the loops dispatch
+ */
+int network_connection_pool_maintainer_start(network_connection_pool_maintainer *m, chassis *chas, network_backends_t *backends) {
+	guint i, n;
+
+	m->chas = chas;
+	m->backends = backends;
+
+	n = (chas->event_threads && chas->event_threads->len > 0) ? chas->event_threads->len : 1;
+
+	for (i = 0; i < n; i++) {
+		network_connection_pool_maintainer_loop *ml;
+
+		ml = g_new0(network_connection_pool_maintainer_loop, 1);
+		ml->maintainer = m;
+		ml->loop = (chas->event_threads && chas->event_threads->len > 0) ?
+			chas->event_threads->pdata[i] : chas->event_loop;
+		ml->backends = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+		ml->pending = g_queue_new();
+
+		if (NULL == ml->loop) {
+			g_critical("%s: no event-loop to run the pool maintainer in", G_STRLOC);
+			network_connection_pool_maintainer_loop_free(ml);
+			return -1;
+		}
+
+		g_ptr_array_add(m->loops, ml);
+	}
+
+	/* all loops are known before the first tick divides the targets */
+	for (i = 0; i < m->loops->len; i++) {
+		network_connection_pool_maintainer_loop *ml = m->loops->pdata[i];
+
+		evtimer_set(&(ml->timer), network_connection_pool_maintainer_tick, ml);
+		chassis_event_add_to(ml->loop, &(ml->timer), &(m->interval));
+	}
+
+	g_message("%s: maintaining the connection pools as '%s' in %u event-loops",
+			G_STRLOC, m->username->str, m->loops->len);
+
+	return 0;
+}
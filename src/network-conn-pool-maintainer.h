@@ -0,0 +1,83 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_CONN_POOL_MAINTAINER_H_
+#define _NETWORK_CONN_POOL_MAINTAINER_H_
+
+#include <glib.h>
+
+#include "network-backend.h"
+#include "chassis-mainloop.h"
+#include "chassis-event.h"
+
+#include "network-exports.h"
+
+/**
+ * keeps the connection pools of the backends warm
+ *
+ * each event-loop runs a timer which
+ * - opens and authenticates connections until the pool of the loop has its share
+ *   of mid_idle_connections
+ * - closes the oldest idle connections if there are more than max_idle_connections
+ *
+ * new connections to a backend are opened slow-start like: one per interval after
+ * the start or after the backend was down, one more for each success.
+ */
+typedef struct {
+	chassis *chas;
+	network_backends_t *backends;
+
+	GString *username;            /** the user the connections are authenticated as */
+	GString *hashed_password;     /** SHA1(password) */
+
+	struct timeval interval;      /** how often the pools are checked */
+	struct timeval connect_timeout; /** give up on a connection which isn't authed after this time */
+
+	guint max_connects;           /** max. connections opened per backend and event-loop in one interval */
+
+	GPtrArray *loops;             /** array(network_connection_pool_maintainer_loop) */
+} network_connection_pool_maintainer;
+
+/**
+ * the state of one event-loop, only touched by the thread running it
+ */
+typedef struct {
+	network_connection_pool_maintainer *maintainer;
+	chassis_event_t *loop;
+
+	struct event timer;
+
+	GHashTable *backends;         /** GHashTable<network_backend_t, network_connection_pool_maintainer_backend> */
+	GQueue *pending;              /** GQueue<network_connection_pool_warmup>, connections being authed */
+} network_connection_pool_maintainer_loop;
+
+typedef struct {
+	guint in_flight;              /** connections being opened */
+	guint ramp;                   /** connections we may open in the next interval */
+} network_connection_pool_maintainer_backend;
+
+NETWORK_API network_connection_pool_maintainer *network_connection_pool_maintainer_new(void);
+NETWORK_API void network_connection_pool_maintainer_free(network_connection_pool_maintainer *m);
+NETWORK_API void network_connection_pool_maintainer_set_auth(network_connection_pool_maintainer *m, const gchar *username, const gchar *password);
+NETWORK_API int network_connection_pool_maintainer_start(network_connection_pool_maintainer *m, chassis *chas, network_backends_t *backends);
+NETWORK_API gboolean network_connection_pool_maintainer_connect(network_connection_pool_maintainer *m, network_backend_t *backend);
+
+#endif
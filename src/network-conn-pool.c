@@ -18,6 +18,21 @@
 
  $%ENDLICENSE%$ */
  
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_FILIO_H
+/**
+ * required for FIONREAD on solaris
+ */
+#include <sys/filio.h>
+#endif
+
+#include <sys/ioctl.h>
+#define ioctlsocket ioctl
+
+#include <errno.h>
 
 #include <glib.h>
 
@@ -68,23 +83,87 @@ void network_connection_pool_entry_free(network_connection_pool_entry *e, gboole
 	g_free(e);
 }
 
+static guint network_connection_pool_bucket_key_hash(gconstpointer _key) {
+	const network_connection_pool_bucket_key *key = _key;
+
+	return g_direct_hash(key->loop) ^ (guint)key->key ^ (guint)(key->key >> 32);
+}
+
+static gboolean network_connection_pool_bucket_key_equal(gconstpointer _a, gconstpointer _b) {
+	const network_connection_pool_bucket_key *a = _a;
+	const network_connection_pool_bucket_key *b = _b;
+
+	return a->loop == b->loop && a->key == b->key;
+}
+
 /**
- * free all pool entries of the queue
+ * free a bucket
  *
- * used as GDestroyFunc in the user-hash of the pool
+ * the entries are owned by user->conns
+ */
+static void network_connection_pool_bucket_free(gpointer q) {
+	g_queue_free(q);
+}
+
+static network_connection_pool_user *network_connection_pool_user_new(GString *name) {
+	network_connection_pool_user *user;
+
+	user = g_new0(network_connection_pool_user, 1);
+	user->name = g_string_dup(name);
+	user->conns = g_queue_new();
+	user->by_key = g_hash_table_new_full(network_connection_pool_bucket_key_hash, network_connection_pool_bucket_key_equal,
+			g_free, network_connection_pool_bucket_free);
+	user->by_loop = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, network_connection_pool_bucket_free);
+
+	return user;
+}
+
+/**
+ * free all pool entries of a user
  *
- * @param q a GQueue to free
+ * used as GDestroyFunc in the user-hash of the pool
  *
  * @see network_connection_pool_new
  * @see GDestroyFunc
  */
-static void g_queue_free_all(gpointer q) {
-	GQueue *queue = q;
+static void network_connection_pool_user_free(gpointer _user) {
+	network_connection_pool_user *user = _user;
 	network_connection_pool_entry *entry;
 
-	while ((entry = g_queue_pop_head(queue))) network_connection_pool_entry_free(entry, TRUE);
+	while ((entry = g_queue_pop_head(user->conns))) {
+		if (entry->wheel_link) {
+			network_connection_pool_wheel *wheel = g_hash_table_lookup(entry->pool->wheels, entry->loop);
+
+			g_queue_delete_link(&(wheel->slots[entry->expire_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS]), entry->wheel_link);
+		}
+		network_connection_pool_entry_free(entry, TRUE);
+	}
+
+	g_queue_free(user->conns);
+	g_hash_table_destroy(user->by_key);
+	g_hash_table_destroy(user->by_loop);
+	g_string_free(user->name, TRUE);
+
+	g_free(user);
+}
+
+static void network_connection_pool_wheel_free(gpointer _wheel) {
+	network_connection_pool_wheel *wheel = _wheel;
+	guint i;
+
+	if (wheel->is_ticking) event_del(&(wheel->tick));
+
+	/* the entries are owned by the users */
+	for (i = 0; i < NETWORK_CONNECTION_POOL_WHEEL_SLOTS; i++) {
+		g_list_free(wheel->slots[i].head);
+	}
+
+	g_free(wheel);
+}
 
-	g_queue_free(queue);
+static void network_connection_pool_waiters_free(gpointer _waiters) {
+	/* the events are owned by the clients */
+	g_queue_free(_waiters);
 }
 
 /**
@@ -98,13 +177,17 @@ network_connection_pool *network_connection_pool_new(void) {
     pool->max_idle_connections = 100;
     pool->mid_idle_connections = 50;
     pool->min_idle_connections = 10;
+    pool->idle_timeout = 0;
     pool->use_mid_idle = TRUE;
     pool->init_time = time(0);
     pool->max_init_last_time = 60;
     pool->init_phase = TRUE;
     pool->serve_req_after_init = FALSE;
     pool->stop_phase = FALSE;
-	pool->users = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, g_hash_table_string_free, g_queue_free_all);
+	pool->users = g_hash_table_new_full(g_hash_table_string_hash, g_hash_table_string_equal, NULL, network_connection_pool_user_free);
+	pool->wheels = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, network_connection_pool_wheel_free);
+	pool->waiters = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, network_connection_pool_waiters_free);
+	pool->mutex = g_mutex_new();
 
 	return pool;
 }
@@ -119,35 +202,141 @@ void network_connection_pool_free(network_connection_pool *pool) {
 	g_hash_table_foreach_remove(pool->users, g_hash_table_true, NULL);
 
 	g_hash_table_destroy(pool->users);
+	g_hash_table_destroy(pool->wheels);
+	g_hash_table_destroy(pool->waiters);
+
+	g_mutex_free(pool->mutex);
 
 	g_free(pool);
 }
 
 /**
- * find the entry which has more than max_idle connections idling
+ * take the entry out of all lists of the pool
+ *
+ * the user is removed from the pool with its last entry
+ *
+ * has to be called with the pool->mutex held
+ */
+static void network_connection_pool_unlink(network_connection_pool *pool, network_connection_pool_entry *entry) {
+	network_connection_pool_user *user = entry->user;
+	network_connection_pool_bucket_key bucket_key;
+	GQueue *bucket;
+
+	bucket_key.loop = entry->loop;
+	bucket_key.key  = entry->key;
+
+	if (NULL != (bucket = g_hash_table_lookup(user->by_key, &bucket_key))) {
+		g_queue_delete_link(bucket, entry->key_link);
+		if (bucket->length == 0) g_hash_table_remove(user->by_key, &bucket_key);
+	}
+
+	if (NULL != (bucket = g_hash_table_lookup(user->by_loop, entry->loop))) {
+		g_queue_delete_link(bucket, entry->loop_link);
+		if (bucket->length == 0) g_hash_table_remove(user->by_loop, entry->loop);
+	}
+
+	if (entry->wheel_link) {
+		network_connection_pool_wheel *wheel = g_hash_table_lookup(pool->wheels, entry->loop);
+
+		g_queue_delete_link(&(wheel->slots[entry->expire_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS]), entry->wheel_link);
+		entry->wheel_link = NULL;
+	}
+
+	g_queue_delete_link(user->conns, entry->link);
+	entry->link = entry->key_link = entry->loop_link = NULL;
+	entry->user = NULL;
+
+	if (user->conns->length == 0) {
+		/**
+		 * all connections are gone, remove it from the hash
+		 */
+		g_hash_table_remove(pool->users, user->name);
+	}
+}
+
+/**
+ * close the connections of the current event-loop which idled for too long
+ *
+ * advances the timer-wheel of the loop up to now, each slot is only visited once
+ *
+ * has to be called with the pool->mutex held
+ */
+static void network_connection_pool_expire(network_connection_pool *pool, chassis_event_t *loop, time_t now) {
+	network_connection_pool_wheel *wheel;
+	time_t tick;
+
+	if (NULL == (wheel = g_hash_table_lookup(pool->wheels, loop))) return;
+
+	if (now - wheel->last_tick > NETWORK_CONNECTION_POOL_WHEEL_SLOTS) {
+		wheel->last_tick = now - NETWORK_CONNECTION_POOL_WHEEL_SLOTS;
+	}
+
+	for (tick = wheel->last_tick + 1; tick <= now; tick++) {
+		GQueue *slot = &(wheel->slots[tick % NETWORK_CONNECTION_POOL_WHEEL_SLOTS]);
+		GList *node, *next;
+
+		for (node = slot->head; node; node = next) {
+			network_connection_pool_entry *entry = node->data;
+
+			next = node->next;
+
+			if (entry->expire_at > now) continue; /* expires in a later round */
+
+			g_debug("%s: (expire) closing idle connection %p of user '%s'", G_STRLOC, entry->sock, entry->user->name->str);
+
+			network_connection_pool_unlink(pool, entry);
+			network_connection_pool_entry_free(entry, TRUE);
+		}
+	}
+
+	wheel->last_tick = now;
+}
+
+/**
+ * expire the idle connections of the loop once per second, even if nobody takes or adds one
+ *
+ * stops once the wheel is empty, network_connection_pool_add() starts it again
+ */
+static void network_connection_pool_wheel_tick(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_connection_pool_wheel *wheel = user_data;
+	network_connection_pool *pool = wheel->pool;
+	struct timeval tv = { 1, 0 };
+	guint i;
+
+	g_mutex_lock(pool->mutex);
+	network_connection_pool_expire(pool, wheel->loop, time(0));
+
+	for (i = 0; i < NETWORK_CONNECTION_POOL_WHEEL_SLOTS && wheel->slots[i].length == 0; i++);
+	wheel->is_ticking = (i < NETWORK_CONNECTION_POOL_WHEEL_SLOTS);
+
+	if (wheel->is_ticking) chassis_event_add_to(wheel->loop, &(wheel->tick), &tv);
+	g_mutex_unlock(pool->mutex);
+}
+
+/**
+ * find the user which has more than max_idle connections idling
  * 
  * @return TRUE for the first entry having more than _user_data idling connections
  * @see network_connection_pool_get_conns 
  */
 static gboolean find_idle_conns(gpointer UNUSED_PARAM(_key), gpointer _val, gpointer _user_data) {
 	guint idle_conns_threshold = *(gint *)_user_data;
-	GQueue *conns = _val;
+	network_connection_pool_user *user = _val;
 
-    g_debug("%s: conns length:%d, idle_conns_threshold:%d", G_STRLOC, conns->length, idle_conns_threshold);
-	return (conns->length > idle_conns_threshold);
+    g_debug("%s: conns length:%d, idle_conns_threshold:%d", G_STRLOC, user->conns->length, idle_conns_threshold);
+	return (user->conns->length > idle_conns_threshold);
 }
 
-GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *UNUSED_PARAM(default_db)) {
-	GQueue *conns = NULL;
-
+static network_connection_pool_user *network_connection_pool_get_user(network_connection_pool *pool, GString *username) {
+	network_connection_pool_user *user = NULL;
 
 	if (username && username->len > 0) {
-		conns = g_hash_table_lookup(pool->users, username);
+		user = g_hash_table_lookup(pool->users, username);
 		/**
 		 * if we know this use, return a authed connection 
 		 */
-		g_debug("%s: (get_conns) get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, conns);
-        if (conns) return conns;
+		g_debug("%s: (get_conns) get user-specific idling connection for '%s' -> %p", G_STRLOC, username->str, user);
+        if (user) return user;
 	}
 
 	/**
@@ -156,18 +345,43 @@ GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString
 	 */
 
     if (pool->use_mid_idle) {
-        conns = g_hash_table_find(pool->users, find_idle_conns, &(pool->mid_idle_connections));
-        if (conns && conns->length > pool->mid_idle_connections) {
+        user = g_hash_table_find(pool->users, find_idle_conns, &(pool->mid_idle_connections));
+        if (user && user->conns->length > pool->mid_idle_connections) {
             pool->use_mid_idle = FALSE;
-		    g_debug("%s: (get_conns) init phase complete for user '%s' -> %p", G_STRLOC, username->str, conns);
+		    g_debug("%s: (get_conns) init phase complete for user '%s' -> %p", G_STRLOC, username ? username->str : "", user);
         }
     } else {
-        conns = g_hash_table_find(pool->users, find_idle_conns, &(pool->min_idle_connections));
+        user = g_hash_table_find(pool->users, find_idle_conns, &(pool->min_idle_connections));
     }
 
-	g_debug("%s: (get_conns) try to find max-idling conns for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
+	g_debug("%s: (get_conns) try to find max-idling conns for user '%s' -> %p", G_STRLOC, username ? username->str : "", user);
 
-	return conns;
+	return user;
+}
+
+GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *UNUSED_PARAM(default_db)) {
+	network_connection_pool_user *user;
+
+	user = network_connection_pool_get_user(pool, username);
+
+	return user ? user->conns : NULL;
+}
+
+/**
+ * count the idle connections network_connection_pool_get() would pick from for a user
+ *
+ * unlike network_connection_pool_get_conns() it may be called from any thread
+ */
+guint network_connection_pool_get_idle_count(network_connection_pool *pool, GString *username) {
+	network_connection_pool_user *user;
+	guint count;
+
+	g_mutex_lock(pool->mutex);
+	user = network_connection_pool_get_user(pool, username);
+	count = user ? user->conns->length : 0;
+	g_mutex_unlock(pool->mutex);
+
+	return count;
 }
 
 /**
@@ -176,6 +390,12 @@ GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString
  * make sure we have at lease <min-conns> for each user
  * if we have more, reuse a connect to reauth it to another user
  *
+ * only sockets which idle in the event-loop of the calling thread are taken, the
+ * event-threads don't touch each others event-bases
+ *
+ * a connection with the same key is preferred, otherwise the longest idling one
+ * of the event-loop is taken
+ *
  * @param pool connection pool to get the connection from
  * @param username (optional) name of the auth connection
  * @param default_db (unused) unused name of the default-db
@@ -183,49 +403,41 @@ GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString
 network_socket *network_connection_pool_get(network_connection_pool *pool,
 		GString *username,
 		GString *UNUSED_PARAM(default_db), conn_ctl_info *info) {
-
-    guint32  cur;
-    guint    len, i;
 	network_socket *sock = NULL;
-	network_connection_pool_entry *entry, *found_entry = NULL;
+	network_connection_pool_entry *found_entry = NULL;
+	network_connection_pool_user *user;
+	network_connection_pool_bucket_key bucket_key;
+	chassis_event_t *owner = chassis_event_get_current();
+	GQueue *bucket;
 
-	GQueue *conns = network_connection_pool_get_conns(pool, username, NULL);
+	g_mutex_lock(pool->mutex);
 
-	/**
-	 * if we know this use, return a authed connection 
-	 */
-	if (conns) {
-        cur = time(0);
-        len = g_queue_get_length(conns);
-        for (i = 0; i < len; i++) {
-            entry = g_queue_peek_nth(conns, i);
-            if (entry->key == info->key) {
-                if (!entry->shared) {
-                    found_entry = entry;
-                    g_queue_pop_nth (conns, i);
-                    break;
-                }
-            }
-        }
+	network_connection_pool_expire(pool, owner, time(0));
 
-        if (!found_entry && len > 0) {
-            entry = g_queue_peek_nth(conns, 0);
-            found_entry = entry;
-            g_queue_pop_nth (conns, 0);
-            g_debug("%s: (get) entry for user '%s' -> %p, cur:%u",
-                    G_STRLOC, username ? username->str : "", entry, cur);
-        }
+	if (NULL != (user = network_connection_pool_get_user(pool, username))) {
+		bucket_key.loop = owner;
+		bucket_key.key  = info->key;
+
+		if (NULL != (bucket = g_hash_table_lookup(user->by_key, &bucket_key))) {
+			found_entry = g_queue_peek_head(bucket);
+
+			if (found_entry->shared) found_entry = NULL;
+		}
+
+		if (!found_entry && NULL != (bucket = g_hash_table_lookup(user->by_loop, owner))) {
+			found_entry = g_queue_peek_head(bucket); /* the first one we may take */
 
-		if (conns->length == 0) {
-			/**
-			 * all connections are gone, remove it from the hash
-			 */
-			g_hash_table_remove(pool->users, username);
+			g_debug("%s: (get) entry for user '%s' -> %p",
+					G_STRLOC, username ? username->str : "", found_entry);
 		}
+
+		if (found_entry) network_connection_pool_unlink(pool, found_entry);
 	}
 
+	g_mutex_unlock(pool->mutex);
+
     if (!found_entry) {
-		g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", conns);
+		g_debug("%s: (get) no entry for user '%s' -> %p", G_STRLOC, username ? username->str : "", user);
 		return NULL;
 	}
 
@@ -244,32 +456,153 @@ network_socket *network_connection_pool_get(network_connection_pool *pool,
 	return sock;
 }
 
+/**
+ * fire the event of the client of the loop which waits the longest for a connection
+ */
+static void network_connection_pool_wake(network_connection_pool *pool, chassis_event_t *loop) {
+	struct timeval now = { 0, 0 };
+	struct event *ev = NULL;
+	GQueue *waiters;
+
+	g_mutex_lock(pool->mutex);
+	if (NULL != (waiters = g_hash_table_lookup(pool->waiters, loop))) {
+		ev = g_queue_pop_head(waiters);
+	}
+	g_mutex_unlock(pool->mutex);
+
+	if (NULL == ev) return;
+
+	/* its timeout is pending, fire it now */
+	event_del(ev);
+	chassis_event_add_to(loop, ev, &now);
+}
+
+/**
+ * wait for the next connection added to the pool in the current event-loop
+ *
+ * @param ev a timer of the current event-loop, it is fired right away once a
+ *           connection is added. If it times out before, the caller has to
+ *           call network_connection_pool_unwait()
+ */
+void network_connection_pool_wait(network_connection_pool *pool, struct event *ev) {
+	chassis_event_t *loop = chassis_event_get_current();
+	GQueue *waiters;
+
+	g_mutex_lock(pool->mutex);
+	if (NULL == (waiters = g_hash_table_lookup(pool->waiters, loop))) {
+		waiters = g_queue_new();
+		g_hash_table_insert(pool->waiters, loop, waiters);
+	}
+	g_queue_push_tail(waiters, ev);
+	g_mutex_unlock(pool->mutex);
+}
+
+/**
+ * stop waiting for a connection, if we still do
+ */
+void network_connection_pool_unwait(network_connection_pool *pool, struct event *ev) {
+	GQueue *waiters;
+
+	g_mutex_lock(pool->mutex);
+	if (NULL != (waiters = g_hash_table_lookup(pool->waiters, chassis_event_get_current()))) {
+		g_queue_remove(waiters, ev);
+	}
+	g_mutex_unlock(pool->mutex);
+}
+
 /**
  * add a connection to the connection pool
  *
+ * @param loop the event-loop the idle-handler of the socket gets registered in,
+ *             it runs the timer-wheel which expires the connection
+ *
+ * a client of the event-loop which waits for a connection is woken up
  */
 network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, 
-        network_socket *sock, guint64 key) 
+        chassis_event_t *loop, network_socket *sock, guint64 key) 
 {
 	network_connection_pool_entry *entry;
-	GQueue *conns = NULL;
+	network_connection_pool_user *user;
+	network_connection_pool_bucket_key bucket_key;
+	GQueue *bucket;
+	time_t now = time(0);
+
+	g_assert(loop);
 
 	entry = network_connection_pool_entry_new();
 	entry->sock = sock;
 	entry->pool = pool;
     entry->key = key;
+	entry->loop = loop;
 
 	g_get_current_time(&(entry->added_ts));
 	
 	g_debug("%s: (add) adding socket to pool for user '%s' -> %p", G_STRLOC, sock->response->username->str, sock);
 
-	if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
-		conns = g_queue_new();
+	g_mutex_lock(pool->mutex);
 
-		g_hash_table_insert(pool->users, g_string_dup(sock->response->username), conns);
+	network_connection_pool_expire(pool, entry->loop, now);
+
+	if (NULL == (user = g_hash_table_lookup(pool->users, sock->response->username))) {
+		user = network_connection_pool_user_new(sock->response->username);
+
+		g_hash_table_insert(pool->users, user->name, user);
 	}
+	entry->user = user;
+
+	g_queue_push_tail(user->conns, entry);
+	entry->link = user->conns->tail;
 
-	g_queue_push_tail(conns, entry);
+	bucket_key.loop = entry->loop;
+	bucket_key.key  = key;
+	if (NULL == (bucket = g_hash_table_lookup(user->by_key, &bucket_key))) {
+		network_connection_pool_bucket_key *k = g_new(network_connection_pool_bucket_key, 1);
+
+		*k = bucket_key;
+		bucket = g_queue_new();
+		g_hash_table_insert(user->by_key, k, bucket);
+	}
+	g_queue_push_tail(bucket, entry);
+	entry->key_link = bucket->tail;
+
+	if (NULL == (bucket = g_hash_table_lookup(user->by_loop, entry->loop))) {
+		bucket = g_queue_new();
+		g_hash_table_insert(user->by_loop, entry->loop, bucket);
+	}
+	g_queue_push_tail(bucket, entry);
+	entry->loop_link = bucket->tail;
+
+	if (pool->idle_timeout > 0) {
+		network_connection_pool_wheel *wheel;
+
+		if (NULL == (wheel = g_hash_table_lookup(pool->wheels, entry->loop))) {
+			wheel = g_new0(network_connection_pool_wheel, 1);
+			wheel->last_tick = now;
+			wheel->pool = pool;
+			wheel->loop = entry->loop;
+			evtimer_set(&(wheel->tick), network_connection_pool_wheel_tick, wheel);
+
+			g_hash_table_insert(pool->wheels, entry->loop, wheel);
+		}
+
+		if (!wheel->is_ticking) {
+			struct timeval tv = { 1, 0 };
+
+			/* queued to the loop of the wheel if we aren't running in it */
+			chassis_event_add_to(wheel->loop, &(wheel->tick), &tv);
+			wheel->is_ticking = TRUE;
+		}
+
+		/* timeouts longer than the wheel stay in their slot for several rounds */
+		entry->expire_at = now + pool->idle_timeout;
+
+		g_queue_push_tail(&(wheel->slots[entry->expire_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS]), entry);
+		entry->wheel_link = wheel->slots[entry->expire_at % NETWORK_CONNECTION_POOL_WHEEL_SLOTS].tail;
+	}
+
+	g_mutex_unlock(pool->mutex);
+
+	network_connection_pool_wake(pool, entry->loop);
 
 	return entry;
 }
@@ -278,16 +611,104 @@ network_connection_pool_entry *network_connection_pool_add(network_connection_po
  * remove the connection referenced by entry from the pool 
  */
 void network_connection_pool_remove(network_connection_pool *pool, network_connection_pool_entry *entry) {
-	network_socket *sock = entry->sock;
-	GQueue *conns;
-
-	if (NULL == (conns = g_hash_table_lookup(pool->users, sock->response->username))) {
+	g_mutex_lock(pool->mutex);
+	if (!entry->user) {
+		g_mutex_unlock(pool->mutex);
 		return;
 	}
 
+	network_connection_pool_unlink(pool, entry);
+	g_mutex_unlock(pool->mutex);
+
 	network_connection_pool_entry_free(entry, TRUE);
+}
 
-	g_queue_remove(conns, entry);
+/**
+ * count the idle connections of all users in a event-loop
+ */
+guint network_connection_pool_count(network_connection_pool *pool, chassis_event_t *loop) {
+	GHashTableIter iter;
+	network_connection_pool_user *user;
+	GQueue *bucket;
+	guint count = 0;
+
+	g_mutex_lock(pool->mutex);
+	g_hash_table_iter_init(&iter, pool->users);
+	while (g_hash_table_iter_next(&iter, NULL, (void **)&user)) {
+		if (NULL != (bucket = g_hash_table_lookup(user->by_loop, loop))) count += bucket->length;
+	}
+	g_mutex_unlock(pool->mutex);
+
+	return count;
 }
 
+/**
+ * close idle connections of a event-loop until at most keep are left
+ *
+ * the oldest connection of the user with the most idle connections goes first 
+ *
+ * has to be called from the thread running the loop
+ *
+ * @return number of closed connections
+ */
+guint network_connection_pool_trim(network_connection_pool *pool, chassis_event_t *loop, guint keep) {
+	guint closed = 0;
+
+	g_mutex_lock(pool->mutex);
+	for (;;) {
+		GHashTableIter iter;
+		network_connection_pool_user *user;
+		GQueue *bucket, *largest = NULL;
+		network_connection_pool_entry *entry;
+		guint count = 0;
+
+		g_hash_table_iter_init(&iter, pool->users);
+		while (g_hash_table_iter_next(&iter, NULL, (void **)&user)) {
+			if (NULL == (bucket = g_hash_table_lookup(user->by_loop, loop))) continue;
+
+			count += bucket->length;
+			if (!largest || bucket->length > largest->length) largest = bucket;
+		}
+
+		if (count <= keep) break;
 
+		entry = g_queue_peek_head(largest);
+		network_connection_pool_unlink(pool, entry);
+		network_connection_pool_entry_free(entry, TRUE);
+		closed++;
+	}
+	g_mutex_unlock(pool->mutex);
+
+	return closed;
+}
+
+/**
+ * handle the events of a idling server connection in the pool 
+ *
+ * make sure we know about connection close from the server side
+ * - wait_timeout
+ */
+void network_connection_pool_idle_handle(int event_fd, short events, void *user_data) {
+	network_connection_pool_entry *pool_entry = user_data;
+	network_connection_pool *pool             = pool_entry->pool;
+
+	if (events == EV_READ) {
+		int b = -1;
+
+		/**
+		 * @todo we have to handle the case that the server really sent use something
+		 *        up to now we just ignore it
+		 */
+		if (ioctlsocket(event_fd, FIONREAD, &b)) {
+			g_critical("ioctl(%d, FIONREAD, ...) failed: %s", event_fd, g_strerror(errno));
+		} else if (b != 0) {
+			g_critical("ioctl(%d, FIONREAD, ...) said there is something to read, oops: %d", event_fd, b);
+		} else {
+			/* the server decided the close the connection (wait_timeout, crash, ... )
+			 *
+			 * remove us from the connection pool and close the connection */
+		
+			network_connection_pool_remove(pool, pool_entry);
+		}
+	}
+}
@@ -26,13 +26,22 @@
 
 #include "network-socket.h"
 #include "network-exports.h"
+#include "chassis-event.h"
+
+/**
+ * slots of the timer-wheel which expires idle connections, one slot per second
+ */
+#define NETWORK_CONNECTION_POOL_WHEEL_SLOTS 64
 
 typedef struct {
-	GHashTable *users; /** GHashTable<GString, GQueue<network_connection_pool_entry>> */
+	GHashTable *users; /** GHashTable<GString, network_connection_pool_user> */
+	GHashTable *wheels; /** GHashTable<chassis_event_t, network_connection_pool_wheel> */
+	GHashTable *waiters; /** GHashTable<chassis_event_t, GQueue<struct event>> clients of the event-loop which wait for a connection */
 	
 	guint max_idle_connections;
 	guint mid_idle_connections;
 	guint min_idle_connections;
+	guint idle_timeout;            /** close connections which idle longer than this many seconds, 0 to disable */
     
     time_t   init_time;
     int      max_init_last_time;
@@ -40,24 +49,77 @@ typedef struct {
     gboolean init_phase;
     gboolean use_mid_idle;
     gboolean stop_phase;
+
+	GMutex *mutex;                 /** protects users against the idle-handlers of the event-threads */
 } network_connection_pool;
 
+/**
+ * the idle connections of a user
+ *
+ * each entry is in the LRU list ->conns and in the buckets for the lookup by 
+ * (event-loop, key) and by event-loop. All lists have the oldest entry at the head.
+ */
+typedef struct {
+	GString *name;
+
+	GQueue *conns;                 /** GQueue<network_connection_pool_entry> */
+	GHashTable *by_key;            /** GHashTable<network_connection_pool_bucket_key, GQueue<network_connection_pool_entry>> */
+	GHashTable *by_loop;           /** GHashTable<chassis_event_t, GQueue<network_connection_pool_entry>> */
+} network_connection_pool_user;
+
+typedef struct {
+	chassis_event_t *loop;
+	guint64          key;
+} network_connection_pool_bucket_key;
+
+/**
+ * the idle connections of one event-loop ordered by the second they expire
+ *
+ * only the owning event-loop expires its connections, their events can't be 
+ * touched from other threads. A timer of the loop advances the wheel each second
+ * while it has entries.
+ */
+typedef struct {
+	GQueue slots[NETWORK_CONNECTION_POOL_WHEEL_SLOTS];
+	time_t last_tick;              /** the slots up to this second are expired */
+
+	network_connection_pool *pool; /** the pool the wheel belongs to */
+	chassis_event_t *loop;         /** the event-loop which owns the wheel */
+	struct event tick;             /** the timer of the loop which advances the wheel */
+	gboolean is_ticking;           /** the timer is pending */
+} network_connection_pool_wheel;
+
 typedef struct {
     guint64         key;
     guint           shared;
 	network_socket *sock;          /** the idling socket */
 	
 	network_connection_pool *pool; /** a pointer back to the pool */
+	network_connection_pool_user *user; /** the user the entry is listed for */
+
+	chassis_event_t *loop;         /** the event-loop the idle-handler of the socket is registered in */
 
 	GTimeVal added_ts;             /** added at ... we want to make sure we don't hit wait_timeout */
+	time_t   expire_at;            /** 0 if the entry doesn't expire */
+
+	GList *link;                   /** node in user->conns */
+	GList *key_link;               /** node in the bucket of (loop, key) */
+	GList *loop_link;              /** node in the bucket of the loop */
+	GList *wheel_link;             /** node in the slot of the timer-wheel */
 } network_connection_pool_entry;
 
 NETWORK_API network_socket *network_connection_pool_get(network_connection_pool *pool,
 		GString *username,
 		GString *default_db, conn_ctl_info *info);
-NETWORK_API network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, network_socket *sock, guint64 key);
+NETWORK_API network_connection_pool_entry *network_connection_pool_add(network_connection_pool *pool, chassis_event_t *loop, network_socket *sock, guint64 key);
 NETWORK_API void network_connection_pool_remove(network_connection_pool *pool, network_connection_pool_entry *entry);
 NETWORK_API GQueue *network_connection_pool_get_conns(network_connection_pool *pool, GString *username, GString *);
+NETWORK_API guint network_connection_pool_get_idle_count(network_connection_pool *pool, GString *username);
+NETWORK_API guint network_connection_pool_count(network_connection_pool *pool, chassis_event_t *loop);
+NETWORK_API guint network_connection_pool_trim(network_connection_pool *pool, chassis_event_t *loop, guint keep);
+NETWORK_API void network_connection_pool_idle_handle(int event_fd, short events, void *user_data);
+NETWORK_API void network_connection_pool_wait(network_connection_pool *pool, struct event *ev);
+NETWORK_API void network_connection_pool_unwait(network_connection_pool *pool, struct event *ev);
 
 NETWORK_API network_connection_pool *network_connection_pool_new(void);
 NETWORK_API void network_connection_pool_free(network_connection_pool *pool);
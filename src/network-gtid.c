@@ -0,0 +1,200 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-gtid.h"
+
+static void network_gtid_intervals_free(gpointer intervals) {
+	g_array_free(intervals, TRUE);
+}
+
+network_gtid_set *network_gtid_set_new(void) {
+	network_gtid_set *set;
+
+	set = g_new0(network_gtid_set, 1);
+	set->sids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, network_gtid_intervals_free);
+
+	return set;
+}
+
+void network_gtid_set_free(network_gtid_set *set) {
+	if (!set) return;
+
+	g_hash_table_destroy(set->sids);
+
+	g_free(set);
+}
+
+/**
+ * find the last interval which starts at or before gno
+ *
+ * @return the index of the interval or -1
+ */
+static gint network_gtid_intervals_find(GArray *intervals, guint64 gno) {
+	gint lo = 0, hi = (gint)intervals->len - 1;
+	gint found = -1;
+
+	while (lo <= hi) {
+		gint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index(intervals, network_gtid_interval, mid).start <= gno) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return found;
+}
+
+/**
+ * add a interval and merge it with its neighbours
+ */
+static void network_gtid_intervals_add(GArray *intervals, network_gtid_interval *iv) {
+	network_gtid_interval *cur;
+	gint ndx;
+
+	ndx = network_gtid_intervals_find(intervals, iv->start);
+
+	if (ndx >= 0 && g_array_index(intervals, network_gtid_interval, ndx).end + 1 >= iv->start) {
+		/* overlaps or touches the one before */
+		cur = &g_array_index(intervals, network_gtid_interval, ndx);
+		if (iv->end > cur->end) cur->end = iv->end;
+	} else {
+		ndx++;
+		g_array_insert_val(intervals, ndx, *iv);
+		cur = &g_array_index(intervals, network_gtid_interval, ndx);
+	}
+
+	/* swallow the ones it reaches now */
+	while ((guint)ndx + 1 < intervals->len &&
+	       g_array_index(intervals, network_gtid_interval, ndx + 1).start <= cur->end + 1) {
+		network_gtid_interval *next = &g_array_index(intervals, network_gtid_interval, ndx + 1);
+
+		if (next->end > cur->end) cur->end = next->end;
+		g_array_remove_index(intervals, ndx + 1);
+	}
+}
+
+/**
+ * add the GTIDs of a text-representation to the set
+ *
+ *   uuid:1-5:7[,uuid:...]
+ *
+ * @return 0 on success, -1 if the text can't be parsed
+ */
+int network_gtid_set_add(network_gtid_set *set, const gchar *s, gsize s_len) {
+	gchar *str = g_strndup(s, s_len);
+	gchar **sids;
+	int err = 0;
+	guint i;
+
+	sids = g_strsplit(str, ",", -1);
+
+	for (i = 0; !err && sids[i]; i++) {
+		gchar **parts;
+		GArray *intervals;
+		gchar *uuid;
+		guint j;
+
+		parts = g_strsplit(g_strstrip(sids[i]), ":", -1);
+
+		if (NULL == parts[0] || '\0' == *parts[0]) {
+			/* the empty set */
+			g_strfreev(parts);
+			continue;
+		}
+
+		if (NULL == parts[1]) {
+			g_strfreev(parts);
+			err = -1;
+			break;
+		}
+
+		uuid = g_ascii_strdown(parts[0], -1);
+		if (NULL == (intervals = g_hash_table_lookup(set->sids, uuid))) {
+			intervals = g_array_new(FALSE, FALSE, sizeof(network_gtid_interval));
+			g_hash_table_insert(set->sids, uuid, intervals);
+		} else {
+			g_free(uuid);
+		}
+
+		for (j = 1; !err && parts[j]; j++) {
+			network_gtid_interval iv;
+			gchar *end;
+
+			iv.start = g_ascii_strtoull(parts[j], &end, 10);
+			iv.end = iv.start;
+			if (*end == '-') iv.end = g_ascii_strtoull(end + 1, &end, 10);
+
+			if (end == parts[j] || *end != '\0' || iv.start == 0 || iv.end < iv.start) {
+				err = -1;
+				break;
+			}
+
+			network_gtid_intervals_add(intervals, &iv);
+		}
+
+		g_strfreev(parts);
+	}
+
+	g_strfreev(sids);
+	g_free(str);
+
+	return err;
+}
+
+gboolean network_gtid_set_is_empty(const network_gtid_set *set) {
+	return 0 == g_hash_table_size(set->sids);
+}
+
+/**
+ * check if all GTIDs of sub are in set
+ *
+ * e.g. if a replica has applied the transactions a client wrote
+ */
+gboolean network_gtid_set_is_subset(const network_gtid_set *sub, const network_gtid_set *set) {
+	GHashTableIter iter;
+	gpointer uuid, value;
+
+	g_hash_table_iter_init(&iter, sub->sids);
+	while (g_hash_table_iter_next(&iter, &uuid, &value)) {
+		GArray *sub_intervals = value;
+		GArray *intervals = g_hash_table_lookup(set->sids, uuid);
+		guint i;
+
+		for (i = 0; i < sub_intervals->len; i++) {
+			network_gtid_interval *iv = &g_array_index(sub_intervals, network_gtid_interval, i);
+			gint ndx;
+
+			if (NULL == intervals) return FALSE;
+
+			/* the intervals of the set are merged, one of them has to cover it */
+			ndx = network_gtid_intervals_find(intervals, iv->start);
+			if (ndx < 0 || g_array_index(intervals, network_gtid_interval, ndx).end < iv->end) return FALSE;
+		}
+	}
+
+	return TRUE;
+}
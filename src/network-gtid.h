@@ -0,0 +1,52 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_GTID_H_
+#define _NETWORK_GTID_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * a set of GTIDs as in @@GLOBAL.gtid_executed
+ *
+ *   3e11fa47-71ca-11e1-9e33-c80aa9429562:1-5:11,
+ *   4a8e6f2b-71ca-11e1-9e33-c80aa9429562:1-3
+ *
+ * the intervals of each server-uuid are kept sorted and merged
+ */
+typedef struct {
+	guint64 start;              /** first transaction */
+	guint64 end;                /** last transaction, including */
+} network_gtid_interval;
+
+typedef struct {
+	GHashTable *sids;           /** GHashTable<gchar *uuid, GArray<network_gtid_interval>>, the uuid in lower-case */
+} network_gtid_set;
+
+NETWORK_API network_gtid_set *network_gtid_set_new(void);
+NETWORK_API void network_gtid_set_free(network_gtid_set *set);
+NETWORK_API int network_gtid_set_add(network_gtid_set *set, const gchar *s, gsize s_len);
+NETWORK_API gboolean network_gtid_set_is_empty(const network_gtid_set *set);
+NETWORK_API gboolean network_gtid_set_is_subset(const network_gtid_set *sub, const network_gtid_set *set);
+
+#endif
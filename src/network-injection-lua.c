@@ -317,6 +317,223 @@ static int proxy_resultset_rows_iter(lua_State *L) {
 	return 1;
 }
 
+/**
+ * a row of a resultset which is decoded when a field is accessed
+ *
+ * the view points into the packet of the row, nothing is copied until a
+ * field is pushed. The iterators move the same view from row to row, copy
+ * the fields you want to keep.
+ */
+typedef struct {
+	GRef *ref;                    /** the resultset, keeps the packets alive */
+	GList *row;                   /** the current row-packet */
+	GList *next;                  /** the row-packet of the next step */
+	guint column;                 /** the field res:column() returns, based on 0 */
+	lua_Integer row_ndx;          /** steps taken, based on 1 */
+} proxy_resultset_row_view;
+
+/**
+ * check if the packet is a row and not the EOF or ERR which ends the rows
+ */
+static gboolean proxy_resultset_packet_is_row(GString *packet) {
+	guint8 status;
+
+	if (packet->len <= NET_HEADER_SIZE) return FALSE;
+
+	status = packet->str[NET_HEADER_SIZE];
+
+	if (status == MYSQLD_PACKET_ERR) return FALSE;
+	if (status == MYSQLD_PACKET_EOF && network_mysqld_proto_packet_is_eof(packet)) return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * find a field in a row-packet without copying it
+ *
+ * @param str  set to the start of the field, NULL if the field is NULL
+ * @return 0 on success, -1 if the row is invalid or has less fields
+ */
+static int proxy_resultset_row_get_field(GString *row, guint ndx, const char **str, gsize *len) {
+	network_packet packet;
+	network_mysqld_lenenc_type lenenc_type;
+	guint i;
+	int err = 0;
+
+	packet.data = row;
+	packet.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&packet);
+
+	for (i = 0; !err && i <= ndx; i++) {
+		guint64 field_len;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) break;
+
+		switch (lenenc_type) {
+		case NETWORK_MYSQLD_LENENC_TYPE_NULL:
+			err = err || network_mysqld_proto_skip(&packet, 1);
+
+			*str = NULL;
+			*len = 0;
+			break;
+		case NETWORK_MYSQLD_LENENC_TYPE_INT:
+			err = err || network_mysqld_proto_get_lenenc_int(&packet, &field_len);
+			err = err || !(field_len <= packet.data->len); /* just to check that we don't overrun by the addition */
+			err = err || !(packet.offset + field_len <= packet.data->len);
+			if (err) break;
+
+			*str = packet.data->str + packet.offset;
+			*len = field_len;
+
+			err = err || network_mysqld_proto_skip(&packet, field_len);
+			break;
+		default:
+			err = 1;
+			break;
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+/**
+ * push a field of the row, nil for NULL
+ */
+static int proxy_resultset_row_push_field(lua_State *L, GString *row, guint ndx) {
+	const char *str;
+	gsize len;
+
+	if (0 != proxy_resultset_row_get_field(row, ndx, &str, &len)) {
+		return luaL_error(L, "%s: row-data is invalid", G_STRLOC);
+	}
+
+	if (str) {
+		lua_pushlstring(L, str, len);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+/**
+ * move the view to the next row
+ *
+ * @return FALSE if there are no more rows
+ */
+static gboolean proxy_resultset_row_view_step(proxy_resultset_row_view *view) {
+	view->row = view->next;
+
+	if (!view->row || !proxy_resultset_packet_is_row(view->row->data)) {
+		view->row = view->next = NULL;
+		return FALSE;
+	}
+
+	view->next = view->row->next;
+	view->row_ndx++;
+
+	return TRUE;
+}
+
+/**
+ * row[ndx]
+ *
+ * decodes the field when it is accessed
+ */
+static int proxy_resultset_row_view_get(lua_State *L) {
+	proxy_resultset_row_view *view = luaL_checkself(L);
+	proxy_resultset_t *res = view->ref->udata;
+	lua_Integer ndx;
+
+	if (lua_type(L, 2) != LUA_TNUMBER) return 0;
+
+	ndx = lua_tointeger(L, 2);
+
+	if (!view->row || ndx < 1 || ndx > (lua_Integer)res->fields->len) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	return proxy_resultset_row_push_field(L, view->row->data, ndx - 1);
+}
+
+static int proxy_resultset_row_view_len(lua_State *L) {
+	proxy_resultset_row_view *view = luaL_checkself(L);
+	proxy_resultset_t *res = view->ref->udata;
+
+	lua_pushinteger(L, view->row ? res->fields->len : 0);
+
+	return 1;
+}
+
+static int proxy_resultset_row_view_gc(lua_State *L) {
+	proxy_resultset_row_view *view = luaL_checkself(L);
+
+	g_ref_unref(view->ref);
+
+	return 0;
+}
+
+static const struct luaL_reg methods_proxy_resultset_row_view[] = {
+	{ "__index", proxy_resultset_row_view_get },
+	{ "__len", proxy_resultset_row_view_len },
+	{ "__gc", proxy_resultset_row_view_gc },
+	{ NULL, NULL },
+};
+
+/**
+ * push a view which starts before the first row
+ */
+static proxy_resultset_row_view *proxy_resultset_row_view_lua_push(lua_State *L, GRef *ref) {
+	proxy_resultset_t *res = ref->udata;
+	proxy_resultset_row_view *view;
+
+	view = lua_newuserdata(L, sizeof(*view));
+	memset(view, 0, sizeof(*view));
+
+	g_ref_ref(ref);
+	view->ref = ref;
+	view->next = res->rows_chunk_head;
+
+	proxy_getmetatable(L, methods_proxy_resultset_row_view);
+	lua_setmetatable(L, -2);
+
+	return view;
+}
+
+/**
+ * get the next row of res.lazy_rows
+ *
+ * @return the view moved to the next row, nothing at the end
+ */
+static int proxy_resultset_lazy_rows_iter(lua_State *L) {
+	proxy_resultset_row_view *view = lua_touserdata(L, lua_upvalueindex(1));
+
+	if (!proxy_resultset_row_view_step(view)) return 0;
+
+	lua_pushvalue(L, lua_upvalueindex(1));
+
+	return 1;
+}
+
+/**
+ * get the next field of res:column(ndx)
+ *
+ * @return the row-number and the field (nil for NULL), nothing at the end
+ */
+static int proxy_resultset_column_iter(lua_State *L) {
+	proxy_resultset_row_view *view = lua_touserdata(L, lua_upvalueindex(1));
+
+	if (!proxy_resultset_row_view_step(view)) return 0;
+
+	lua_pushinteger(L, view->row_ndx);
+	proxy_resultset_row_push_field(L, view->row->data, view->column);
+
+	return 2;
+}
+
 /**
  * parse the result-set of the query
  *
@@ -374,6 +591,80 @@ static int proxy_resultset_fields_lua_push_ref(lua_State *L, GRef *ref) {
 	return 1;
 }
 
+/**
+ * check that the rows of the resultset can be read
+ */
+static void proxy_resultset_check_rows(lua_State *L, proxy_resultset_t *res) {
+	if (!res->result_queue) {
+		luaL_error(L, ".resultset.rows isn't available if 'resultset_is_needed ~= true'");
+	} else if (res->qstat.binary_encoded) {
+		luaL_error(L, ".resultset.rows isn't available for prepared statements");
+	}
+
+	parse_resultset_fields(res); /* set up the ->rows_chunk_head pointer */
+}
+
+/**
+ * res:column(ndx)
+ *
+ *   for row_ndx, value in res:column(2) do ... end
+ *
+ * @return a iterator over one field of each row, nil if there is no resultset
+ */
+static int proxy_resultset_column(lua_State *L) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+	lua_Integer ndx = luaL_checkinteger(L, 2);
+	proxy_resultset_row_view *view;
+
+	proxy_resultset_check_rows(L, res);
+
+	if (!res->rows_chunk_head) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	if (ndx < 1 || ndx > (lua_Integer)res->fields->len) {
+		return luaL_error(L, "res:column(%d): the resultset has %d fields", (int)ndx, res->fields->len);
+	}
+
+	view = proxy_resultset_row_view_lua_push(L, ref);
+	view->column = ndx - 1;
+
+	lua_pushcclosure(L, proxy_resultset_column_iter, 1);
+
+	return 1;
+}
+
+/**
+ * res:count()
+ *
+ * counts the row-packets without decoding them
+ *
+ * @return the number of rows, nil if there is no resultset
+ */
+static int proxy_resultset_count(lua_State *L) {
+	GRef *ref = *(GRef **)luaL_checkself(L);
+	proxy_resultset_t *res = ref->udata;
+	lua_Integer rows = 0;
+	GList *chunk;
+
+	proxy_resultset_check_rows(L, res);
+
+	if (!res->rows_chunk_head) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	for (chunk = res->rows_chunk_head; chunk && proxy_resultset_packet_is_row(chunk->data); chunk = chunk->next) {
+		rows++;
+	}
+
+	lua_pushinteger(L, rows);
+
+	return 1;
+}
+
 static int proxy_resultset_get(lua_State *L) {
 	GRef *ref = *(GRef **)luaL_checkself(L);
 	proxy_resultset_t *res = ref->udata;
@@ -412,6 +703,20 @@ static int proxy_resultset_get(lua_State *L) {
 				lua_pushnil(L);
 			}
 		}
+	} else if (strleq(key, keysize, C("lazy_rows"))) {
+		proxy_resultset_check_rows(L, res);
+
+		if (res->rows_chunk_head) {
+			proxy_resultset_row_view_lua_push(L, ref);
+
+			lua_pushcclosure(L, proxy_resultset_lazy_rows_iter, 1);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("column"))) {
+		lua_pushcfunction(L, proxy_resultset_column);
+	} else if (strleq(key, keysize, C("count"))) {
+		lua_pushcfunction(L, proxy_resultset_count);
 	} else if (strleq(key, keysize, C("row_count"))) {
 		lua_pushinteger(L, res->rows);
 	} else if (strleq(key, keysize, C("bytes"))) {
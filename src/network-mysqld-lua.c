@@ -34,13 +34,17 @@
 #include "network-mysqld.h"
 #include "network-mysqld-proto.h"
 #include "network-mysqld-lua.h"
+#include "network-mysqld-scatter.h"
 #include "network-socket-lua.h"
 #include "network-backend-lua.h"
 #include "network-conn-pool.h"
 #include "network-conn-pool-lua.h"
 #include "network-injection-lua.h"
+#include "network-shard-map-lua.h"
+#include "chassis-event.h"
 
 #define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
 
 network_mysqld_con_lua_t *network_mysqld_con_lua_new() {
 	network_mysqld_con_lua_t *st;
@@ -52,6 +56,56 @@ network_mysqld_con_lua_t *network_mysqld_con_lua_new() {
 	return st;
 }
 
+/**
+ * forget about the query-cache state of the current query
+ */
+void network_mysqld_con_lua_cache_reset(network_mysqld_con_lua_t *st) {
+	GString *packet;
+	guint i;
+
+	if (st->cache_key) {
+		g_string_free(st->cache_key, TRUE);
+		st->cache_key = NULL;
+	}
+
+	if (st->cache_query) {
+		g_string_free(st->cache_query, TRUE);
+		st->cache_query = NULL;
+	}
+
+	if (st->cache_tables) {
+		for (i = 0; i < st->cache_tables->len; i++) g_free(st->cache_tables->pdata[i]);
+		g_ptr_array_free(st->cache_tables, TRUE);
+		st->cache_tables = NULL;
+	}
+
+	if (st->cache_result) {
+		while ((packet = g_queue_pop_head(st->cache_result))) g_string_free(packet, TRUE);
+		g_queue_free(st->cache_result);
+		st->cache_result = NULL;
+	}
+	st->cache_result_size = 0;
+}
+
+/**
+ * forget the COM_STMT_PREPARE in flight
+ */
+void network_mysqld_con_lua_stmt_reset(network_mysqld_con_lua_t *st) {
+	GString *packet;
+
+	if (st->stmt_prepare_key) {
+		g_string_free(st->stmt_prepare_key, TRUE);
+		st->stmt_prepare_key = NULL;
+	}
+
+	if (st->stmt_prepare_result) {
+		while ((packet = g_queue_pop_head(st->stmt_prepare_result))) g_string_free(packet, TRUE);
+		g_queue_free(st->stmt_prepare_result);
+		st->stmt_prepare_result = NULL;
+	}
+	st->stmt_prepare_client_id = 0;
+}
+
 void network_mysqld_con_lua_free(network_mysqld_con *con, network_mysqld_con_lua_t *st) {
         g_debug("%s: call network_mysqld_con_lua_free con:%p", G_STRLOC, con);
 
@@ -59,6 +113,24 @@ void network_mysqld_con_lua_free(network_mysqld_con *con, network_mysqld_con_lua
 
 	network_injection_queue_free(st->injected.queries);
 
+	network_mysqld_con_lua_cache_reset(st);
+	if (st->cache_write_tables) {
+		guint i;
+
+		for (i = 0; i < st->cache_write_tables->len; i++) g_free(st->cache_write_tables->pdata[i]);
+		g_ptr_array_free(st->cache_write_tables, TRUE);
+	}
+
+	network_mysqld_con_lua_stmt_reset(st);
+	if (st->stmts) g_hash_table_destroy(st->stmts);
+	if (st->stmt_reprepare_db) g_string_free(st->stmt_reprepare_db, TRUE);
+	if (st->stmt_param_types) g_hash_table_destroy(st->stmt_param_types);
+	if (st->stmt_cursors) g_hash_table_destroy(st->stmt_cursors);
+
+	network_mysqld_session_free(st->session);
+	network_mysqld_session_free(st->cache_session);
+	if (st->last_write_gtids) g_string_free(st->last_write_gtids, TRUE);
+
     /* If con still has server list, then all are closed */
     if (con->server_list != NULL) {
         int i, checked = 0;
@@ -83,9 +155,9 @@ void network_mysqld_con_lua_free(network_mysqld_con *con, network_mysqld_con_lua
 			}
 
 			network_socket_free(server);
-			backend->connected_clients--;
+			g_atomic_int_add(&(backend->connected_clients), -1);
 			g_debug("%s: connected_clients sub, con:%p, now clients:%d", G_STRLOC, 
-					con, backend->connected_clients);
+					con, g_atomic_int_get(&(backend->connected_clients)));
 
 			checked++;
 
@@ -103,9 +175,9 @@ void network_mysqld_con_lua_free(network_mysqld_con *con, network_mysqld_con_lua
 		con->server = NULL;
 	} else {
 		if (con->server) {
-			st->backend->connected_clients--;
+			g_atomic_int_add(&(st->backend->connected_clients), -1);
 			g_debug("%s: connected_clients sub, con:%p, now clients:%d", G_STRLOC, 
-					con, st->backend->connected_clients);
+					con, g_atomic_int_get(&(st->backend->connected_clients)));
 		}
 	}
 
@@ -113,6 +185,187 @@ void network_mysqld_con_lua_free(network_mysqld_con *con, network_mysqld_con_lua
 }
 
 
+/**
+ * get the classification of the current query
+ *
+ * proxy.connection.classification.
+ *   type                => "select", "insert", "update", "delete", "replace", "load", "call",
+ *                          "ddl", "set", "use", "show", "describe", "begin", "commit", "rollback",
+ *                          "lock", "unlock", "other" or "unknown"
+ *   is_read_only        => may be sent to a read-only backend
+ *   is_locking          => FOR UPDATE, LOCK IN SHARE MODE, LOCK TABLES
+ *   is_multi_statement  => more than one statement
+ *   starts_transaction  => BEGIN, START TRANSACTION, SET autocommit = 0
+ *   ends_transaction    => COMMIT, ROLLBACK, SET autocommit = 1
+ *   autocommit          => true/false for SET autocommit = ..., nil otherwise
+ *   has_calc_found_rows => SELECT SQL_CALC_FOUND_ROWS
+ *   last_insert_id      => "LAST_INSERT_ID()" or "@@LAST_INSERT_ID" if it is selected, nil otherwise
+ *   hint                => "master", "slave" or "backend" from a comment, nil otherwise
+ *   hint_backend_ndx    => the <n> of a backend<n> comment
+ *   hint_in_transaction => a comment contains in_trans=<n> with n != 0
+ *
+ * @return nil or requested information
+ * @see sql_classification
+ */
+static int proxy_classification_get(lua_State *L) {
+	sql_classification *cl = luaL_checkself(L);
+	gsize keysize = 0;
+	const char *key = luaL_checklstring(L, 2, &keysize);
+
+	if (strleq(key, keysize, C("type"))) {
+		lua_pushstring(L, sql_statement_type_t_str[cl->type]);
+	} else if (strleq(key, keysize, C("is_read_only"))) {
+		lua_pushboolean(L, cl->is_read_only);
+	} else if (strleq(key, keysize, C("is_locking"))) {
+		lua_pushboolean(L, cl->is_locking);
+	} else if (strleq(key, keysize, C("is_multi_statement"))) {
+		lua_pushboolean(L, cl->is_multi_statement);
+	} else if (strleq(key, keysize, C("starts_transaction"))) {
+		lua_pushboolean(L, cl->starts_transaction);
+	} else if (strleq(key, keysize, C("ends_transaction"))) {
+		lua_pushboolean(L, cl->ends_transaction);
+	} else if (strleq(key, keysize, C("autocommit"))) {
+		if (cl->autocommit >= 0) {
+			lua_pushboolean(L, cl->autocommit);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("has_calc_found_rows"))) {
+		lua_pushboolean(L, cl->has_calc_found_rows);
+	} else if (strleq(key, keysize, C("last_insert_id"))) {
+		if (!cl->has_last_insert_id) {
+			lua_pushnil(L);
+		} else if (cl->last_insert_id_is_var) {
+			lua_pushliteral(L, "@@LAST_INSERT_ID");
+		} else {
+			lua_pushliteral(L, "LAST_INSERT_ID()");
+		}
+	} else if (strleq(key, keysize, C("hint"))) {
+		if (cl->hint != SQL_ROUTE_NONE) {
+			lua_pushstring(L, sql_route_hint_t_str[cl->hint]);
+		} else {
+			lua_pushnil(L);
+		}
+	} else if (strleq(key, keysize, C("hint_backend_ndx"))) {
+		lua_pushinteger(L, cl->hint_backend_ndx);
+	} else if (strleq(key, keysize, C("hint_in_transaction"))) {
+		lua_pushboolean(L, cl->hint_in_transaction);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int network_mysqld_classification_lua_getmetatable(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "__index", proxy_classification_get },
+		{ NULL, NULL },
+	};
+
+	return proxy_getmetatable(L, methods);
+}
+
+/**
+ * proxy.connection:scatter(packet, backends[, { options }])
+ *
+ *   packet:   the COM_QUERY to send to each shard (string)
+ *   backends: the backend_ndx of the shards (table)
+ *   options:  table of options (table)
+ *     order_by: the columns the shards sort their rows by, merges the rows instead of
+ *               concatenating them. Each is a column (based on 1) or { column = ..., desc = bool }
+ *     offset:   merged rows to skip (numeric)
+ *     limit:    merged rows to send (numeric)
+ *
+ * the client gets the merged resultset if read_query() returns proxy.PROXY_SEND_QUERY
+ */
+static int proxy_connection_scatter(lua_State *L) {
+	network_mysqld_con *con = *(network_mysqld_con **)luaL_checkself(L);
+	chassis_private *g = con->srv->priv;
+	network_mysqld_scatter *scatter;
+	size_t packet_len;
+	const char *packet = luaL_checklstring(L, 2, &packet_len);
+	int i;
+
+	luaL_argcheck(L, packet_len > 0 && packet[0] == COM_QUERY, 2, "expected a COM_QUERY");
+	luaL_checktype(L, 3, LUA_TTABLE);
+
+	scatter = network_mysqld_scatter_new();
+	g_string_assign_len(scatter->query, packet, packet_len);
+
+	for (i = 1; ; i++) {
+		network_backend_t *backend;
+
+		lua_rawgeti(L, 3, i);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+
+		if (!lua_isnumber(L, -1) ||
+		    NULL == (backend = network_backends_get(g->backends, lua_tointeger(L, -1) - 1)) ||
+		    scatter->backends->len >= MAX_SERVER_NUM) {
+			network_mysqld_scatter_free(scatter);
+			return luaL_argerror(L, 3, "expected up to 64 backend_ndx");
+		}
+		lua_pop(L, 1);
+
+		g_ptr_array_add(scatter->backends, backend);
+	}
+
+	if (lua_istable(L, 4)) {
+		lua_getfield(L, 4, "order_by");
+		if (lua_istable(L, -1)) {
+			for (i = 1; ; i++) {
+				network_mysqld_scatter_order order;
+				int column = 0;
+
+				lua_rawgeti(L, -1, i);
+				if (lua_isnil(L, -1)) {
+					lua_pop(L, 1);
+					break;
+				}
+
+				order.desc = FALSE;
+				if (lua_isnumber(L, -1)) {
+					column = lua_tointeger(L, -1);
+				} else if (lua_istable(L, -1)) {
+					lua_getfield(L, -1, "column");
+					column = lua_tointeger(L, -1);
+					lua_pop(L, 1);
+
+					lua_getfield(L, -1, "desc");
+					order.desc = lua_toboolean(L, -1);
+					lua_pop(L, 1);
+				}
+				lua_pop(L, 1);
+
+				if (column < 1) {
+					network_mysqld_scatter_free(scatter);
+					return luaL_argerror(L, 4, "order_by = { column | { column = ..., desc = bool }, ... }");
+				}
+
+				order.column = column - 1; /* lua is indexes from 1, C from 0 */
+				g_array_append_val(scatter->order, order);
+			}
+		}
+		lua_pop(L, 1);
+
+		lua_getfield(L, 4, "offset");
+		if (lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0) scatter->offset = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+
+		lua_getfield(L, 4, "limit");
+		if (lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 0) scatter->limit = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+	}
+
+	network_mysqld_scatter_free(con->scatter);
+	con->scatter = scatter;
+
+	return 0;
+}
+
 /**
  * get the connection information
  *
@@ -174,8 +427,56 @@ static int proxy_connection_get(lua_State *L) {
 
 		network_socket_lua_getmetatable(L);
 		lua_setmetatable(L, -2); /* tie the metatable to the table   (sp -= 1) */
+	} else if (strleq(key, keysize, C("classification"))) {
+		sql_classification *cl;
+
+		if (NULL == (cl = network_mysqld_con_get_classification(con))) {
+			lua_pushnil(L);
+		} else {
+			/* a copy, the script may keep it longer than the query lives */
+			sql_classification *cl_copy = lua_newuserdata(L, sizeof(*cl_copy));
+
+			*cl_copy = *cl;
+
+			network_mysqld_classification_lua_getmetatable(L);
+			lua_setmetatable(L, -2);
+		}
+	} else if (strleq(key, keysize, C("digest"))) {
+		sql_digest *digest;
+
+		/**
+		 * proxy.connection.digest
+		 *   text => the normalized query
+		 *   hash => the lower 53 bits of the 64bit hash, a lua-number can hold them exactly
+		 */
+		if (NULL == (digest = network_mysqld_con_get_digest(con))) {
+			lua_pushnil(L);
+		} else {
+			lua_newtable(L);
+
+			lua_pushlstring(L, S(digest->text));
+			lua_setfield(L, -2, "text");
+
+			lua_pushnumber(L, (lua_Number)(digest->hash & ((G_GUINT64_CONSTANT(1) << 53) - 1)));
+			lua_setfield(L, -2, "hash");
+		}
 	} else if(strleq(key, keysize, C("valid_prepare_stmt_cnt"))) {
 		lua_pushinteger(L, con->valid_prepare_stmt_cnt);
+	} else if (strleq(key, keysize, C("shared_prepared_stmts"))) {
+		/* the statements get prepared again on any connection, no need to stick to one */
+		lua_pushboolean(L, st->stmts != NULL);
+	} else if (strleq(key, keysize, C("multiplex"))) {
+		/* the server connection goes back to the pool at each transaction boundary */
+		lua_pushboolean(L, st->session != NULL);
+	} else if (strleq(key, keysize, C("scatter"))) {
+		lua_pushcfunction(L, proxy_connection_scatter);
+	} else if (strleq(key, keysize, C("last_write_gtids"))) {
+		/* for proxy.global.backends:balance(), to read from a backend which has our writes */
+		if (st->last_write_gtids && st->last_write_gtids->len > 0) {
+			lua_pushlstring(L, S(st->last_write_gtids));
+		} else {
+			lua_pushnil(L);
+		}
 	} else if(strleq(key, keysize, C("is_still_in_trans"))) {
         luaL_checktype(L, 3, LUA_TBOOLEAN);
         gboolean is_still_in_trans = lua_toboolean(L, 3);
@@ -349,6 +650,9 @@ void network_mysqld_lua_setup_global(lua_State *L , chassis_private *g) {
 	 *  - _G.proxy.global
 	 */
 	
+	/* register proxy.shard.* */
+	network_shard_map_lua_setup(L);
+
 	/**
 	 * register proxy.global.backends[]
 	 *
@@ -370,6 +674,400 @@ void network_mysqld_lua_setup_global(lua_State *L , chassis_private *g) {
 }
 
 
+static gint network_mysqld_lua_field_cmp(gconstpointer _a, gconstpointer _b) {
+	const GString *a = *(const GString **)_a;
+	const GString *b = *(const GString **)_b;
+
+	return strcmp(a->str, b->str);
+}
+
+/**
+ * append a lua value as lua-source
+ *
+ * only strings, numbers, booleans and tables of them can be shared, everything 
+ * else (functions, userdata, ...) is local to a lua_State and gets skipped
+ *
+ * @return 0 if the value was appended, -1 if it was skipped
+ */
+static int network_mysqld_lua_value_serialize(lua_State *L, int ndx, GString *out, int depth) {
+	if (ndx < 0) ndx = lua_gettop(L) + ndx + 1;
+
+	switch (lua_type(L, ndx)) {
+	case LUA_TBOOLEAN:
+		g_string_append(out, lua_toboolean(L, ndx) ? "true" : "false");
+		return 0;
+	case LUA_TNUMBER: {
+		lua_Number n = lua_tonumber(L, ndx);
+
+		if (n != n) {
+			g_string_append(out, "(0/0)");
+		} else if (n == n + 1 && n != 0) { /* +/- inf */
+			g_string_append(out, n > 0 ? "(1/0)" : "(-1/0)");
+		} else {
+			g_string_append_printf(out, "%.17g", n);
+		}
+		return 0; }
+	case LUA_TSTRING: {
+		size_t s_len = 0, i;
+		const char *s = lua_tolstring(L, ndx, &s_len);
+
+		g_string_append_c(out, '"');
+		for (i = 0; i < s_len; i++) {
+			unsigned char c = s[i];
+
+			if (c == '"' || c == '\\') {
+				g_string_append_c(out, '\\');
+				g_string_append_c(out, c);
+			} else if (c < 0x20 || c >= 0x7f) {
+				g_string_append_printf(out, "\\%03u", c);
+			} else {
+				g_string_append_c(out, c);
+			}
+		}
+		g_string_append_c(out, '"');
+		return 0; }
+	case LUA_TTABLE: {
+		GPtrArray *fields;
+		guint i;
+
+		if (depth > 16) return -1; /* looks like a cycle */
+
+		fields = g_ptr_array_new();
+
+		lua_pushnil(L);
+		while (lua_next(L, ndx)) {
+			int key_type = lua_type(L, -2);
+
+			/* lua_tolstring() on a number-key would confuse lua_next(), the serializer doesn't convert */
+			if (key_type == LUA_TSTRING || key_type == LUA_TNUMBER) {
+				GString *field = g_string_new("[");
+
+				network_mysqld_lua_value_serialize(L, -2, field, depth + 1);
+				g_string_append(field, "]=");
+
+				if (0 != network_mysqld_lua_value_serialize(L, -1, field, depth + 1)) {
+					g_string_free(field, TRUE);
+				} else {
+					g_ptr_array_add(fields, field);
+				}
+			}
+			lua_pop(L, 1); /* the value */
+		}
+
+		/* equal tables serialize equal, no matter in which order their keys were set */
+		g_ptr_array_sort(fields, network_mysqld_lua_field_cmp);
+
+		g_string_append_c(out, '{');
+		for (i = 0; i < fields->len; i++) {
+			GString *field = fields->pdata[i];
+
+			g_string_append_len(out, S(field));
+			g_string_append_c(out, ',');
+			g_string_free(field, TRUE);
+		}
+		g_string_append_c(out, '}');
+
+		g_ptr_array_free(fields, TRUE);
+		return 0; }
+	default:
+		return -1;
+	}
+}
+
+/**
+ * push proxy.global.config onto the stack
+ *
+ * @return 0 on success, -1 if it doesn't exist (nothing is pushed)
+ */
+static int network_mysqld_lua_push_global_config(lua_State *L) {
+	lua_getglobal(L, "proxy");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return -1;
+	}
+	lua_getfield(L, -1, "global");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 2);
+		return -1;
+	}
+	lua_getfield(L, -1, "config");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 3);
+		return -1;
+	}
+	lua_remove(L, -2); /* proxy.global */
+	lua_remove(L, -2); /* proxy */
+
+	return 0;
+}
+
+static void network_mysqld_lua_global_free(gpointer _snapshot) {
+	network_mysqld_lua_global_t *snapshot = _snapshot;
+
+	g_string_free(snapshot->config, TRUE);
+	g_free(snapshot);
+}
+
+/**
+ * serialize proxy.global.config of L into a lua-chunk returning it
+ *
+ * @return 0 on success, -1 if there is no proxy.global.config
+ */
+static int network_mysqld_lua_global_serialize(lua_State *L, GString *config) {
+	if (0 != network_mysqld_lua_push_global_config(L)) return -1;
+
+	g_string_assign(config, "return ");
+	network_mysqld_lua_value_serialize(L, -1, config, 0);
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+/**
+ * push the table a serialized proxy.global.config returns
+ *
+ * @return 0 on success, -1 on error (nothing is pushed)
+ */
+static int network_mysqld_lua_global_load(lua_State *L, GString *config) {
+	if (0 != luaL_loadbuffer(L, S(config), "=proxy.global.config") ||
+	    0 != lua_pcall(L, 0, 1, 0)) {
+		g_critical("%s: loading proxy.global.config failed: %s",
+				G_STRLOC, lua_tostring(L, -1));
+		lua_pop(L, 1); /* the errmsg */
+
+		return -1;
+	}
+
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * make the table at dst a copy of the table at src
+ *
+ * dst itself stays, scripts may hold a reference to proxy.global.config. Its
+ * sub-tables are replaced though.
+ */
+static void network_mysqld_lua_table_assign(lua_State *L, int dst, int src) {
+	/* remove the keys src doesn't have, clearing fields is fine for lua_next() */
+	lua_pushnil(L);
+	while (lua_next(L, dst)) {
+		lua_pop(L, 1); /* the value */
+
+		lua_pushvalue(L, -1);
+		lua_rawget(L, src);
+		if (lua_isnil(L, -1)) {
+			lua_pushvalue(L, -2);
+			lua_pushnil(L);
+			lua_rawset(L, dst);
+		}
+		lua_pop(L, 1);
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, src)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, dst);        /* dst[key] = value, leaves the key for lua_next() */
+	}
+}
+
+/**
+ * apply the writes the scripts did to the table at local since base onto the table at latest
+ *
+ * the top-level keys the scripts set, changed or removed take the value of local, all
+ * others keep the one of latest
+ */
+static void network_mysqld_lua_table_merge_writes(lua_State *L, int latest, int base, int local) {
+	GString *local_val = g_string_new(NULL);
+	GString *base_val = g_string_new(NULL);
+
+	lua_pushnil(L);
+	while (lua_next(L, local)) {
+		lua_pushvalue(L, -2);
+		lua_rawget(L, base);       /* base[key] */
+
+		g_string_truncate(local_val, 0);
+		g_string_truncate(base_val, 0);
+
+		if (0 == network_mysqld_lua_value_serialize(L, -2, local_val, 1) &&
+		    (0 != network_mysqld_lua_value_serialize(L, -1, base_val, 1) ||
+		     !g_string_equal(local_val, base_val))) {
+			lua_pushvalue(L, -3);
+			lua_pushvalue(L, -3);
+			lua_rawset(L, latest); /* latest[key] = local[key] */
+		}
+		lua_pop(L, 2); /* base[key] and the value */
+	}
+
+	lua_pushnil(L);
+	while (lua_next(L, base)) {
+		lua_pop(L, 1); /* the value */
+
+		lua_pushvalue(L, -1);
+		lua_rawget(L, local);
+		if (lua_isnil(L, -1)) {
+			lua_pushvalue(L, -2);
+			lua_pushnil(L);
+			lua_rawset(L, latest);
+		}
+		lua_pop(L, 1);
+	}
+
+	g_string_free(local_val, TRUE);
+	g_string_free(base_val, TRUE);
+}
+
+/**
+ * load the published snapshot into the proxy.global.config of L
+ */
+static void network_mysqld_lua_global_load_snapshot(lua_scope *sc, network_mysqld_lua_global_t *snapshot) {
+	lua_State *L = sc->L;
+
+	if (0 != network_mysqld_lua_push_global_config(L)) return;
+
+	if (0 == network_mysqld_lua_global_load(L, snapshot->config)) {
+		network_mysqld_lua_table_assign(L, lua_gettop(L) - 1, lua_gettop(L));
+		lua_pop(L, 1); /* the snapshot */
+	}
+	lua_pop(L, 1); /* proxy.global.config */
+
+	if (!sc->global_config) sc->global_config = g_string_new(NULL);
+	g_string_assign(sc->global_config, snapshot->config->str);
+	sc->global_version = snapshot->version;
+}
+
+/**
+ * apply the writes of the scripts of L since the last sync onto the snapshot
+ *
+ * afterwards proxy.global.config of L is the snapshot plus the writes
+ */
+static void network_mysqld_lua_global_merge_snapshot(lua_scope *sc, network_mysqld_lua_global_t *snapshot) {
+	lua_State *L = sc->L;
+	int local;
+
+	if (0 != network_mysqld_lua_push_global_config(L)) return;
+	local = lua_gettop(L);
+
+	if (sc->global_config) {
+		if (0 != network_mysqld_lua_global_load(L, sc->global_config)) lua_newtable(L);
+	} else {
+		lua_newtable(L); /* never synced, everything is a write */
+	}
+
+	if (0 == network_mysqld_lua_global_load(L, snapshot->config)) {
+		network_mysqld_lua_table_merge_writes(L, local + 2, local + 1, local);
+		network_mysqld_lua_table_assign(L, local, local + 2);
+		lua_pop(L, 1); /* the snapshot */
+	}
+	lua_pop(L, 2); /* the base and proxy.global.config */
+
+	if (!sc->global_config) sc->global_config = g_string_new(NULL);
+	g_string_assign(sc->global_config, snapshot->config->str);
+	sc->global_version = snapshot->version;
+}
+
+/**
+ * sync the proxy.global.config of the lua_State of the scope with the published one
+ *
+ * before the scripts ran the first time the published snapshot is just loaded. 
+ * Afterwards the writes of the scripts are published first, keys the scripts 
+ * didn't touch take the value of the snapshot, keys other threads removed are 
+ * gone. Scripts have to look up the sub-tables of proxy.global.config again.
+ *
+ * @see network_mysqld_lua_global_publish()
+ */
+void network_mysqld_lua_global_refresh(lua_scope *sc, chassis_private *g) {
+	network_mysqld_lua_global_t *snapshot;
+
+	if (sc->global_published) {
+		network_mysqld_lua_global_publish(sc, g);
+
+		return;
+	}
+
+	snapshot = g_atomic_pointer_get((gpointer *)&(g->lua_global));
+	if (!snapshot || snapshot->version == sc->global_version) return;
+
+	network_mysqld_lua_global_load_snapshot(sc, snapshot);
+}
+
+/**
+ * publish the writes to the proxy.global.config of the scope to the other lua_States
+ *
+ * the new snapshot replaces the old one with a pointer-swap. If another
+ * thread published since our last sync, our writes are applied onto its 
+ * version and we retry.
+ *
+ * costs a serialization of proxy.global.config to find the writes
+ *
+ * @return 0 on success, -1 if there is no proxy.global.config
+ */
+int network_mysqld_lua_global_publish(lua_scope *sc, chassis_private *g) {
+	lua_State *L = sc->L;
+	GString *config = g_string_new(NULL);
+
+	do {
+		network_mysqld_lua_global_t *old, *snapshot;
+
+		if (0 != network_mysqld_lua_global_serialize(L, config)) {
+			g_string_free(config, TRUE);
+			return -1;
+		}
+
+		old = g_atomic_pointer_get((gpointer *)&(g->lua_global));
+
+		if (sc->global_config && g_string_equal(sc->global_config, config)) {
+			/* the scripts didn't write, just pick up the newer snapshot */
+			if (old && old->version != sc->global_version) network_mysqld_lua_global_load_snapshot(sc, old);
+
+			g_string_free(config, TRUE);
+			return 0;
+		}
+
+		if (old && g_string_equal(old->config, config)) {
+			/* nothing to publish */
+			if (!sc->global_config) sc->global_config = g_string_new(NULL);
+			g_string_assign(sc->global_config, config->str);
+			sc->global_version = old->version;
+
+			g_string_free(config, TRUE);
+			return 0;
+		}
+
+		if (old && old->version != sc->global_version) {
+			/* another thread published in the meantime, apply our writes onto its version */
+			network_mysqld_lua_global_merge_snapshot(sc, old);
+			continue;
+		}
+
+		snapshot = g_new0(network_mysqld_lua_global_t, 1);
+		snapshot->config = g_string_new_len(S(config));
+		snapshot->version = old ? old->version + 1 : 1;
+
+		if (g_atomic_pointer_compare_and_exchange((gpointer *)&(g->lua_global), old, snapshot)) {
+			if (!sc->global_config) sc->global_config = g_string_new(NULL);
+			g_string_assign(sc->global_config, config->str);
+			sc->global_version = snapshot->version;
+
+			/* other event-threads may still read the old one */
+			if (old) chassis_event_defer_free(old, network_mysqld_lua_global_free);
+
+			g_debug("%s: published proxy.global.config version %d", G_STRLOC, snapshot->version);
+
+			g_string_free(config, TRUE);
+			return 0;
+		}
+
+		network_mysqld_lua_global_free(snapshot);
+	} while (1);
+}
+
 /**
  * Load a lua script and leave the wrapper function on the stack.
  *
@@ -429,7 +1127,7 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 	network_mysqld_con_lua_t *st   = con->plugin_con_state;
 	chassis_private *g = con->srv->priv; 
 
-	lua_scope  *sc = g->sc;
+	lua_scope  *sc = network_mysqld_con_get_lua_scope(con);
 
 	GQueue **q_p;
 	network_mysqld_con **con_p;
@@ -438,6 +1136,9 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 	if (!lua_script) return REGISTER_CALLBACK_SUCCESS;
 
 	if (st->L) {
+		/* publish the config writes of the last hooks, pick up the ones of the other lua_States */
+		network_mysqld_lua_global_refresh(sc, g);
+
 		/* we have to rewrite _G.proxy to point to the local proxy */
 		L = st->L;
 
@@ -470,6 +1171,7 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 
 	/* sets up global tables */
 	network_mysqld_lua_setup_global(sc->L, g);
+	network_mysqld_lua_global_refresh(sc, g);
 
 	/**
 	 * create a side thread for this connection
@@ -609,6 +1311,12 @@ network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(ne
 
 	st->L = L;
 
+	/* share the defaults the script set up with the lua_States of the other event-threads */
+	if (!sc->global_published) {
+		network_mysqld_lua_global_publish(sc, g);
+		sc->global_published = TRUE;
+	}
+
 	g_assert(lua_isfunction(L, -1));
 	g_assert(lua_gettop(L) - stack_top == 1);
 
@@ -24,6 +24,7 @@
 
 #include "network-backend.h" /* query-status */
 #include "network-injection.h" /* query-status */
+#include "network-mysqld-session.h"
 
 #include "network-exports.h"
 
@@ -33,7 +34,8 @@ typedef enum {
 	PROXY_SEND_RESULT,
 	PROXY_SEND_INJECTION,
 	PROXY_SEND_NONE,
-	PROXY_IGNORE_RESULT       /** for read_query_result */
+	PROXY_IGNORE_RESULT,      /** for read_query_result */
+	PROXY_SEND_SCATTER        /** internal: read_query used proxy.connection:scatter() */
 } network_mysqld_lua_stmt_ret;
 
 typedef enum {
@@ -46,6 +48,8 @@ NETWORK_API int network_mysqld_con_getmetatable(lua_State *L);
 NETWORK_API void network_mysqld_lua_init_global_fenv(lua_State *L);
 
 NETWORK_API void network_mysqld_lua_setup_global(lua_State *L, chassis_private *g);
+NETWORK_API void network_mysqld_lua_global_refresh(lua_scope *sc, chassis_private *g);
+NETWORK_API int network_mysqld_lua_global_publish(lua_scope *sc, chassis_private *g);
 
 /**
  * Encapsulates injected queries information passed back from the a Lua callback function.
@@ -55,6 +59,7 @@ NETWORK_API void network_mysqld_lua_setup_global(lua_State *L, chassis_private *
 struct network_mysqld_con_lua_injection {
 	network_injection_queue *queries;	/**< An ordered list of queries we want to have executed. */
 	int sent_resultset;					/**< Flag to make sure we send only one result back to the client. */
+	guint pipelined;					/**< The number of queries at the head of the list which were already sent along with the one before. */
 };
 /**
  * Contains extra connection state used for Lua-based plugins.
@@ -68,11 +73,44 @@ typedef struct {
 	network_backend_t *backend;
 	int backend_ndx;               /**< [lua] index into the backend-array */
 
+	network_backend_t *query_backend; /**< the backend the current query is in flight on, NULL if none */
+	guint64 query_started;         /**< when the current query was sent, in rel. microseconds */
+
+	GString *cache_key;            /**< the query-cache key of the current query if we want to cache its result, NULL if not */
+	GString *cache_query;          /**< the COM_QUERY of the current query, to find its injection */
+	GPtrArray *cache_tables;       /**< "db.tbl" the current query reads from */
+	guint64 cache_gen;             /**< the generation network_query_cache_lookup() returned */
+	GQueue *cache_result;          /**< copies of the packets of the result */
+	gsize cache_result_size;
+
+	GPtrArray *cache_write_tables; /**< "db.tbl" written since the last end of a transaction */
+	gboolean cache_write_all;      /**< we don't know which tables were written */
+	gboolean cache_in_trans;       /**< the server said we are in a transaction */
+
+	GHashTable *stmts;             /**< client stmt-id -> GString *, the key of its network_prepared_stmt. NULL if the statements aren't shared */
+	guint32 last_stmt_id;          /**< the last stmt-id we gave to the client */
+	GString *stmt_prepare_key;     /**< the key of the COM_STMT_PREPARE in flight, NULL if none */
+	guint32 stmt_prepare_client_id;/**< the stmt-id the client gets for it, 0 if we prepare it again on our own */
+	GQueue *stmt_prepare_result;   /**< copies of the packets of its response */
+	guint8 stmt_reprepare_command; /**< the command which waits for our COM_STMT_PREPARE */
+	GString *stmt_reprepare_db;    /**< the default-db of the client while we prepare in the default-db of the statement */
+	GHashTable *stmt_param_types;  /**< client stmt-id -> GString *, the parameter types its last COM_STMT_EXECUTE bound */
+	GHashTable *stmt_cursors;      /**< client stmt-ids with an open cursor, the server connection is pinned while there are any */
+	guint32 stmt_command_id;       /**< the client stmt-id of the COM_STMT_* in flight, 0 if none */
+
+	network_mysqld_session *session; /**< transaction- and session-state of the client if we multiplex, NULL if not */
+	network_mysqld_session *cache_session; /**< session-state of the client for the query-cache if we don't multiplex, NULL if not */
+	GString *last_write_gtids;     /**< [lua] the GTIDs of the last transaction the client wrote, NULL if the server doesn't track them */
+
 	gboolean connection_close;     /**< [lua] set by the lua code to close a connection */
 	gboolean to_be_closed_after_serve_req;
 
 	struct timeval interval;       /**< The interval to be used for evt_timer, currently unused. */
-	struct event evt_timer;        /**< The event structure used to implement the timer callback, currently unused. */
+	struct event evt_timer;        /**< The event structure used to implement the timer callback, waits for a pooled connection while we are parked */
+
+	network_backend_t *park_backend; /**< the backend we wait for a server connection of, NULL if we don't wait */
+	network_mysqld_lua_stmt_ret park_ret; /**< what the script decided for the query which waits in the recv-queue */
+	guint64 park_until;            /**< chassis_get_rel_microseconds() when we stop waiting and send an error */
 
 	gboolean is_reconnecting;      /**< if true, critical messages concerning failed connect() calls are suppressed, as they are expected errors */
 
@@ -88,6 +126,8 @@ typedef struct {
 
 NETWORK_API network_mysqld_con_lua_t *network_mysqld_con_lua_new();
 NETWORK_API void network_mysqld_con_lua_free(network_mysqld_con *con, network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_cache_reset(network_mysqld_con_lua_t *st);
+NETWORK_API void network_mysqld_con_lua_stmt_reset(network_mysqld_con_lua_t *st);
 
 /** be sure to include network-mysqld.h */
 NETWORK_API network_mysqld_register_callback_ret network_mysqld_con_lua_register_callback(network_mysqld_con *con, const char *lua_script);
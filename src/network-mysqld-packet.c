@@ -124,6 +124,7 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 		default:
 			query->query_status = MYSQLD_PACKET_OK;
 			/* looks like a result */
+			err = err || network_mysqld_proto_get_lenenc_int(packet, &query->fields_left);
 			query->state = PARSE_COM_QUERY_FIELD;
 			break;
 		}
@@ -132,6 +133,42 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 		err = err || network_mysqld_proto_peek_int8(packet, &status);
 		if (err) break;
 
+		if (query->fields_left > 0) {
+			/* a column-definition */
+			query->fields_left--;
+			break;
+		}
+
+		/**
+		 * with CLIENT_DEPRECATE_EOF there is no EOF after the column-definitions,
+		 * the first row or the OK which ends the rows follows right away
+		 */
+		if (status != MYSQLD_PACKET_EOF || packet->data->len != NET_HEADER_SIZE + 5) {
+			if (status == MYSQLD_PACKET_EOF && network_mysqld_proto_packet_is_eof(packet->data)) {
+				eof_packet = network_mysqld_eof_packet_new();
+
+				err = err || network_mysqld_proto_get_eof_packet(packet, eof_packet);
+
+				if (!err && use_binary_row_data &&
+				    eof_packet->server_status & SERVER_STATUS_CURSOR_EXISTS &&
+				    !(eof_packet->server_status & SERVER_MORE_RESULTS_EXISTS)) {
+					/* the field-definition-only resultset of a cursor */
+					query->server_status = eof_packet->server_status;
+					is_finished = 1;
+				}
+
+				network_mysqld_eof_packet_free(eof_packet);
+
+				if (err || is_finished) break;
+
+				packet->offset = NET_HEADER_SIZE;
+			}
+
+			query->state = PARSE_COM_QUERY_RESULT;
+
+			return network_mysqld_proto_get_com_query_result(packet, query, use_binary_row_data);
+		}
+
 		switch (status) {
 		case MYSQLD_PACKET_ERR:
 		case MYSQLD_PACKET_OK:
@@ -153,7 +190,7 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 			 * Other commands may have that flag set too, with no special meaning
 			 * 
 			 */
-			if (packet->data->len == 9) {
+			if (packet->data->len == NET_HEADER_SIZE + 5) {
 				eof_packet = network_mysqld_eof_packet_new();
 
 				err = err || network_mysqld_proto_get_eof_packet(packet, eof_packet);
@@ -204,7 +241,7 @@ int network_mysqld_proto_get_com_query_result(network_packet *packet, network_my
 
 		switch (status) {
 		case MYSQLD_PACKET_EOF:
-			if (packet->data->len == 9) {
+			if (network_mysqld_proto_packet_is_eof(packet->data)) {
 				eof_packet = network_mysqld_eof_packet_new();
 
 				err = err || network_mysqld_proto_get_eof_packet(packet, eof_packet);
@@ -339,24 +376,32 @@ int network_mysqld_proto_get_com_stmt_prepare_result(
 		udata->first_packet = 0;
 
 		switch (status) {
-		case MYSQLD_PACKET_OK:
+		case MYSQLD_PACKET_OK: {
+			guint16 num_columns, num_params;
+
 			g_assert(packet->data->len == 12 + NET_HEADER_SIZE); 
 
+			num_columns = (guint8)packet->data->str[NET_HEADER_SIZE + 5] | ((guint8)packet->data->str[NET_HEADER_SIZE + 6] << 8);
+			num_params  = (guint8)packet->data->str[NET_HEADER_SIZE + 7] | ((guint8)packet->data->str[NET_HEADER_SIZE + 8] << 8);
+
 			/* the header contains the number of EOFs we expect to see
 			 * - no params -> 0
 			 * - params | fields -> 1
 			 * - params + fields -> 2 
+			 *
+			 * with CLIENT_DEPRECATE_EOF the last definition ends the response
 			 */
 			udata->want_eofs = 0;
+			udata->want_defs = 0;
 
-			if (packet->data->str[NET_HEADER_SIZE + 5] != 0 || packet->data->str[NET_HEADER_SIZE + 6] != 0) {
-				udata->want_eofs++;
-			}
-			if (packet->data->str[NET_HEADER_SIZE + 7] != 0 || packet->data->str[NET_HEADER_SIZE + 8] != 0) {
-				udata->want_eofs++;
+			if (udata->eof_is_deprecated) {
+				udata->want_defs = num_columns + num_params;
+			} else {
+				if (num_columns != 0) udata->want_eofs++;
+				if (num_params != 0) udata->want_eofs++;
 			}
 
-			if (udata->want_eofs == 0) {
+			if (udata->want_eofs == 0 && udata->want_defs == 0) {
 				is_finished = 1;
                 con->valid_prepare_stmt_cnt++;
                 g_debug("%s: conn:%p, server:%p, fd:%d, now valid_prepare_stmt_cnt:%d", 
@@ -367,7 +412,7 @@ int network_mysqld_proto_get_com_stmt_prepare_result(
 					G_STRLOC,
 					udata->want_eofs);
 
-			break;
+			break; }
 		case MYSQLD_PACKET_ERR:
 			is_finished = 1;
             g_message("%s: network_mysqld_proto_get_com_stmt_prepare_result get packet err:%d",
@@ -381,6 +426,12 @@ int network_mysqld_proto_get_com_stmt_prepare_result(
 					status);
 			break;
 		}
+	} else if (udata->eof_is_deprecated) {
+		/* a param- or column-definition */
+		if (--udata->want_defs == 0) {
+			is_finished = 1;
+			con->valid_prepare_stmt_cnt++;
+		}
 	} else {
 		switch (status) {
 		case MYSQLD_PACKET_OK:
@@ -507,6 +558,12 @@ int network_mysqld_con_command_states_init(network_mysqld_con *con, network_pack
 
 	packet->offset = 0; /* reset the offset again for the next functions */
 
+	/* a new response, the server-status of the last one is kept */
+	con->eof_translate.state = EOF_TRANSLATE_INIT;
+	con->eof_translate.defs_left = 0;
+	con->eof_translate.columns = 0;
+	con->eof_translate.is_continued = FALSE;
+
 	/* init the parser for the commands */
 	switch (con->parse.command) {
 	case COM_QUERY:
@@ -518,6 +575,9 @@ int network_mysqld_con_command_states_init(network_mysqld_con *con, network_pack
 	case COM_STMT_PREPARE:
 		con->parse.data = network_mysqld_com_stmt_prepare_result_new();
 		con->parse.data_free = (GDestroyNotify)network_mysqld_com_stmt_prepare_result_free;
+
+		/* the response is parsed as the client gets it */
+		((network_mysqld_com_stmt_prepare_result_t *)con->parse.data)->eof_is_deprecated = con->client->is_eof_deprecated;
 		break;
 	case COM_INIT_DB:
 		con->parse.data = network_mysqld_com_init_db_result_new();
@@ -815,7 +875,8 @@ int network_mysqld_proto_get_fielddef(network_packet *packet, network_mysqld_pro
  * @param fields empty array where the fields shall be stored in
  *
  * @return NULL if there is no resultset
- *         pointer to the chunk after the fields (to the EOF packet)
+ *         pointer to the chunk after the fields (to the EOF packet), to the last field
+ *         if there is no EOF (CLIENT_DEPRECATE_EOF). The rows start at its ->next.
  */ 
 GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields) {
 	network_packet packet;
@@ -872,20 +933,21 @@ GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields) {
 		if (err) return NULL;
 	}
     
-	/* this should be EOF chunk */
-	chunk = chunk->next;
-
-	if (!chunk) return NULL;
+	/* this should be EOF chunk, unless the EOF is deprecated */
+	if (!chunk->next) return chunk;
 
-	packet.data = chunk->data;
+	packet.data = chunk->next->data;
 	packet.offset = 0;
 	
 	err = err || network_mysqld_proto_skip_network_header(&packet);
 
 	err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
-	err = err || (lenenc_type != NETWORK_MYSQLD_LENENC_TYPE_EOF);
 
 	if (err) return NULL;
+
+	if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_EOF && packet.data->len == NET_HEADER_SIZE + 5) {
+		chunk = chunk->next;
+	}
     
 	return chunk;
 }
@@ -946,6 +1008,64 @@ int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok
 	return err ? -1 : 0;
 }
 
+/**
+ * get the GTIDs from the session-state-info of a OK packet
+ *
+ * the server adds them with session_track_gtids = OWN_GTID if the connection
+ * announced CLIENT_SESSION_TRACK. With CLIENT_DEPRECATE_EOF the OK at the end
+ * of the rows has them too, it starts with 0xfe.
+ *
+ * @param gtids  the GTID-set of the last transaction is assigned to it
+ * @return 0 if the OK packet has GTIDs, 1 if it has none, -1 on a invalid packet
+ */
+int network_mysqld_proto_get_ok_packet_gtids(network_packet *packet, GString *gtids) {
+	guint8 field_count;
+	guint16 server_status, warning_count;
+	guint64 skip_len;
+	guint64 state_len;
+	gsize state_end;
+	int err = 0;
+
+	err = err || network_mysqld_proto_get_int8(packet, &field_count);
+	err = err || (field_count != 0 && field_count != MYSQLD_PACKET_EOF);
+	err = err || network_mysqld_proto_get_lenenc_int(packet, &skip_len); /* affected rows */
+	err = err || network_mysqld_proto_get_lenenc_int(packet, &skip_len); /* insert-id */
+	err = err || network_mysqld_proto_get_int16(packet, &server_status);
+	err = err || network_mysqld_proto_get_int16(packet, &warning_count);
+	if (err) return -1;
+
+	if (!(server_status & SERVER_SESSION_STATE_CHANGED)) return 1;
+
+	err = err || network_mysqld_proto_get_lenenc_int(packet, &skip_len); /* info */
+	err = err || network_mysqld_proto_skip(packet, skip_len);
+	err = err || network_mysqld_proto_get_lenenc_int(packet, &state_len);
+	if (err) return -1;
+
+	state_end = packet->offset + state_len;
+
+	while (!err && packet->offset < state_end) {
+		guint8 type, spec;
+		guint64 data_len;
+
+		err = err || network_mysqld_proto_get_int8(packet, &type);
+		err = err || network_mysqld_proto_get_lenenc_int(packet, &data_len);
+		if (err) break;
+
+		if (type != SESSION_TRACK_GTIDS) {
+			err = err || network_mysqld_proto_skip(packet, data_len);
+			continue;
+		}
+
+		err = err || network_mysqld_proto_get_int8(packet, &spec); /* the encoding, 0 is the text-format */
+		err = err || (spec != 0);
+		err = err || network_mysqld_proto_get_lenenc_gstring(packet, gtids);
+
+		return err ? -1 : 0;
+	}
+
+	return err ? -1 : 1;
+}
+
 int network_mysqld_proto_append_ok_packet(GString *packet, network_mysqld_ok_packet_t *ok_packet) {
 	guint32 capabilities = CLIENT_PROTOCOL_41;
 
@@ -1099,7 +1219,20 @@ int network_mysqld_proto_get_eof_packet(network_packet *packet, network_mysqld_e
 		return -1;
 	}
 
-	if (capabilities & CLIENT_PROTOCOL_41) {
+	if (packet->data->len - packet->offset > 4) {
+		guint64 affected, insert_id;
+
+		/* the OK format of CLIENT_DEPRECATE_EOF */
+		err = err || network_mysqld_proto_get_lenenc_int(packet, &affected);
+		err = err || network_mysqld_proto_get_lenenc_int(packet, &insert_id);
+		err = err || network_mysqld_proto_get_int16(packet, &server_status);
+		err = err || network_mysqld_proto_get_int16(packet, &warning_count);
+		if (!err) {
+			eof_packet->server_status = server_status;
+			eof_packet->warnings      = warning_count;
+			eof_packet->is_deprecated = TRUE;
+		}
+	} else if (capabilities & CLIENT_PROTOCOL_41) {
 		err = err || network_mysqld_proto_get_int16(packet, &warning_count);
 		err = err || network_mysqld_proto_get_int16(packet, &server_status);
 		if (!err) {
@@ -1126,7 +1259,12 @@ int network_mysqld_proto_append_eof_packet(GString *packet, network_mysqld_eof_p
 	guint32 capabilities = CLIENT_PROTOCOL_41;
 
 	network_mysqld_proto_append_int8(packet, MYSQLD_PACKET_EOF); /* no fields */
-	if (capabilities & CLIENT_PROTOCOL_41) {
+	if (eof_packet->is_deprecated) {
+		network_mysqld_proto_append_lenenc_int(packet, 0); /* affected rows */
+		network_mysqld_proto_append_lenenc_int(packet, 0); /* insert-id */
+		network_mysqld_proto_append_int16(packet, eof_packet->server_status);
+		network_mysqld_proto_append_int16(packet, eof_packet->warnings);
+	} else if (capabilities & CLIENT_PROTOCOL_41) {
 		network_mysqld_proto_append_int16(packet, eof_packet->warnings); /* no warnings */
 		network_mysqld_proto_append_int16(packet, eof_packet->server_status); /* autocommit */
 	}
@@ -1134,6 +1272,18 @@ int network_mysqld_proto_append_eof_packet(GString *packet, network_mysqld_eof_p
 	return 0;
 }
 
+/**
+ * check if a packet is a EOF, in the classic or the OK format
+ *
+ * a row can only start with 0xfe if its first field is 16M or longer, its
+ * first packet is PACKET_LEN_MAX then
+ */
+gboolean network_mysqld_proto_packet_is_eof(GString *packet) {
+	if (packet->len <= NET_HEADER_SIZE) return FALSE;
+
+	return (guint8)packet->str[NET_HEADER_SIZE] == MYSQLD_PACKET_EOF &&
+	       packet->len - NET_HEADER_SIZE < PACKET_LEN_MAX;
+}
 
 network_mysqld_auth_challenge *network_mysqld_auth_challenge_new() {
 	network_mysqld_auth_challenge *shake;
@@ -1610,6 +1760,46 @@ network_mysqld_auth_response *network_mysqld_auth_response_copy(network_mysqld_a
 	return dst;
 }
 
+/**
+ * the capabilities the proxy announces on its own connections to a backend
+ *
+ * the clients which take over such a connection expect the usual ones from libmysql
+ */
+#define NETWORK_MYSQLD_AUTH_NATIVE_CAPABILITIES \
+	(CLIENT_LONG_PASSWORD | CLIENT_LONG_FLAG | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | \
+	 CLIENT_SECURE_CONNECTION | CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS)
+
+/**
+ * create the auth-response for a challenge with mysql_native_password 
+ *
+ * used by the proxy to log into a backend on its own
+ *
+ * @param challenge       the challenge of the backend
+ * @param username        the user to login as
+ * @param hashed_password SHA1(password), empty for no password
+ * @return NULL if the challenge can't be scrambled
+ */
+network_mysqld_auth_response *network_mysqld_auth_response_new_native(network_mysqld_auth_challenge *challenge,
+		GString *username, GString *hashed_password) {
+	network_mysqld_auth_response *auth;
+
+	auth = network_mysqld_auth_response_new(challenge->capabilities);
+	auth->client_capabilities = challenge->capabilities & NETWORK_MYSQLD_AUTH_NATIVE_CAPABILITIES;
+	auth->max_packet_size = 0x01000000;
+	auth->charset = challenge->charset;
+	g_string_assign_len(auth->username, S(username));
+
+	if (hashed_password->len > 0 &&
+	    0 != network_mysqld_proto_password_scramble(auth->auth_plugin_data,
+				S(challenge->auth_plugin_data),
+				S(hashed_password))) {
+		network_mysqld_auth_response_free(auth);
+		return NULL;
+	}
+
+	return auth;
+}
+
 /*
  * prepared statements
  */
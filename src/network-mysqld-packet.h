@@ -62,6 +62,8 @@ typedef struct {
 	gboolean was_resultset;
 	gboolean binary_encoded;
 
+	guint64 fields_left;          /** column-definitions still to come, they aren't followed by a EOF with CLIENT_DEPRECATE_EOF */
+
 	guint64 rows;
 	guint64 bytes;
 
@@ -76,11 +78,14 @@ NETWORK_API int network_mysqld_proto_get_com_query_result(network_packet *packet
 /**
  * tracking the response of a COM_STMT_PREPARE command
  *
- * depending on the kind of statement that was prepare we will receive 0-2 EOF packets
+ * depending on the kind of statement that was prepare we will receive 0-2 EOF packets,
+ * with CLIENT_DEPRECATE_EOF we count the param- and column-definitions instead
  */
 typedef struct {
 	gboolean first_packet;
 	gint     want_eofs;
+	guint    want_defs;
+	gboolean eof_is_deprecated;
 } network_mysqld_com_stmt_prepare_result_t;
 
 NETWORK_API network_mysqld_com_stmt_prepare_result_t *network_mysqld_com_stmt_prepare_result_new(void);
@@ -110,6 +115,17 @@ NETWORK_API int network_mysqld_con_command_states_init(network_mysqld_con *con,
 
 NETWORK_API GList *network_mysqld_proto_get_fielddefs(GList *chunk, GPtrArray *fields);
 
+#ifndef CLIENT_SESSION_TRACK
+#define CLIENT_SESSION_TRACK (1 << 23)
+#endif
+#ifndef CLIENT_DEPRECATE_EOF
+#define CLIENT_DEPRECATE_EOF (1 << 24)
+#endif
+#ifndef SERVER_SESSION_STATE_CHANGED
+#define SERVER_SESSION_STATE_CHANGED (1 << 14)
+#endif
+#define SESSION_TRACK_GTIDS 3
+
 typedef struct {
 	guint64 affected_rows;
 	guint64 insert_id;
@@ -123,6 +139,7 @@ NETWORK_API network_mysqld_ok_packet_t *network_mysqld_ok_packet_new(void);
 NETWORK_API void network_mysqld_ok_packet_free(network_mysqld_ok_packet_t *udata);
 
 NETWORK_API int network_mysqld_proto_get_ok_packet(network_packet *packet, network_mysqld_ok_packet_t *ok_packet);
+NETWORK_API int network_mysqld_proto_get_ok_packet_gtids(network_packet *packet, GString *gtids);
 NETWORK_API int network_mysqld_proto_append_ok_packet(GString *packet, network_mysqld_ok_packet_t *ok_packet);
 
 typedef struct {
@@ -140,9 +157,18 @@ NETWORK_API void network_mysqld_err_packet_free(network_mysqld_err_packet_t *uda
 NETWORK_API int network_mysqld_proto_get_err_packet(network_packet *packet, network_mysqld_err_packet_t *err_packet);
 NETWORK_API int network_mysqld_proto_append_err_packet(GString *packet, network_mysqld_err_packet_t *err_packet);
 
+/**
+ * the EOF which ends the rows
+ *
+ * with CLIENT_DEPRECATE_EOF it is sent as a OK packet with a 0xfe header:
+ *
+ *   fe 00 00 <server-status> <warnings> [<info> [<session-state>]]
+ */
 typedef struct {
 	guint16 server_status;
 	guint16 warnings;
+
+	gboolean is_deprecated;       /** in the OK format of CLIENT_DEPRECATE_EOF */
 } network_mysqld_eof_packet_t;
 
 NETWORK_API network_mysqld_eof_packet_t *network_mysqld_eof_packet_new(void);
@@ -150,6 +176,7 @@ NETWORK_API void network_mysqld_eof_packet_free(network_mysqld_eof_packet_t *uda
 
 NETWORK_API int network_mysqld_proto_get_eof_packet(network_packet *packet, network_mysqld_eof_packet_t *eof_packet);
 NETWORK_API int network_mysqld_proto_append_eof_packet(GString *packet, network_mysqld_eof_packet_t *eof_packet);
+NETWORK_API gboolean network_mysqld_proto_packet_is_eof(GString *packet);
 
 struct network_mysqld_auth_challenge {
 	guint8    protocol_version;
@@ -186,6 +213,8 @@ NETWORK_API void network_mysqld_auth_response_free(network_mysqld_auth_response
 NETWORK_API int network_mysqld_proto_append_auth_response(GString *packet, network_mysqld_auth_response *auth);
 NETWORK_API int network_mysqld_proto_get_auth_response(network_packet *packet, network_mysqld_auth_response *auth);
 NETWORK_API network_mysqld_auth_response *network_mysqld_auth_response_copy(network_mysqld_auth_response *src);
+NETWORK_API network_mysqld_auth_response *network_mysqld_auth_response_new_native(network_mysqld_auth_challenge *challenge,
+		GString *username, GString *hashed_password);
 
 /* COM_STMT_* */
 
@@ -87,7 +87,8 @@ int network_mysqld_proto_peek_lenenc_type(network_packet *packet, network_mysqld
 		*type = NETWORK_MYSQLD_LENENC_TYPE_INT;
 	} else if (bytestream[off] == 254) { /* 8 byte OR EOF */
 		if (off == 4 && 
-		    packet->data->len - packet->offset < 8) {
+		    packet->data->len - packet->offset < PACKET_LEN_MAX) {
+			/* the classic EOF or the OK of CLIENT_DEPRECATE_EOF, a 8 byte length doesn't fit */
 			*type = NETWORK_MYSQLD_LENENC_TYPE_EOF;
 		} else {
 			*type = NETWORK_MYSQLD_LENENC_TYPE_INT;
@@ -758,6 +759,46 @@ guint8 network_mysqld_proto_get_packet_id(GString *_header) {
 }
 
 
+/**
+ * find the complete packets in a buffer
+ *
+ * walks the packet-headers of a recv-buffer in one pass, the packets stay
+ * where they are. The headers are a chain (each length leads to the next
+ * header), they can only be walked one after another.
+ *
+ * what a packet is (row, EOF, ERR, ...) depends on the state of the resultset
+ * and is left to the caller
+ *
+ * @param marks      filled with the packets in the order of the buffer
+ * @param marks_max  size of marks
+ * @param scanned    set to the end of the last packet in marks, may be NULL
+ * @return the number of packets in marks
+ */
+guint network_mysqld_proto_scan_packets(const gchar *buf, gsize buf_len,
+		network_mysqld_packet_mark *marks, guint marks_max, gsize *scanned) {
+	const guchar *p = (const guchar *)buf;
+	gsize off = 0;
+	guint n = 0;
+
+	while (n < marks_max && buf_len - off >= NET_HEADER_SIZE) {
+		network_mysqld_packet_mark *mark = &marks[n];
+		guint32 packet_len = p[off] | p[off + 1] << 8 | p[off + 2] << 16;
+
+		if (buf_len - off - NET_HEADER_SIZE < packet_len) break; /* incomplete */
+
+		mark->offset = off;
+		mark->len    = packet_len;
+		mark->id     = p[off + 3];
+
+		off += NET_HEADER_SIZE + packet_len;
+		n++;
+	}
+
+	if (scanned) *scanned = off;
+
+	return n;
+}
+
 /**
  * append the variable-length integer to the packet
  *
@@ -110,6 +110,18 @@ typedef GPtrArray network_mysqld_proto_fielddefs_t;
 NETWORK_API network_mysqld_proto_fielddefs_t *network_mysqld_proto_fielddefs_new(void);
 NETWORK_API void network_mysqld_proto_fielddefs_free(network_mysqld_proto_fielddefs_t *fielddefs);
 
+/**
+ * a complete packet found by network_mysqld_proto_scan_packets()
+ */
+typedef struct {
+	gsize offset;                 /** of the packet-header in the buffer */
+	guint32 len;                  /** of the payload */
+	guint8 id;
+} network_mysqld_packet_mark;
+
+NETWORK_API guint network_mysqld_proto_scan_packets(const gchar *buf, gsize buf_len,
+		network_mysqld_packet_mark *marks, guint marks_max, gsize *scanned);
+
 NETWORK_API guint32 network_mysqld_proto_get_packet_len(GString *_header);
 NETWORK_API guint8 network_mysqld_proto_get_packet_id(GString *_header);
 NETWORK_API int network_mysqld_proto_append_packet_len(GString *header, guint32 len);
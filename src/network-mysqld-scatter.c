@@ -0,0 +1,1228 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/** @file
+ * scatter-gather queries
+ *
+ * each shard takes a connection of the client's user from the pool of its
+ * backend and runs through
+ *
+ *   send [session-restore commands +] query -> read OK or ERR
+ *                                           -> read field-count, fields, [EOF,] rows, EOF
+ *
+ * on its own, all shards at the same time in the event-loop of the client
+ * connection. The packets for the client are queued as soon as the merge
+ * allows it and the state-machine of the client connection is called to send
+ * them. Once the client drained them network_mysqld_scatter_resume() gives us
+ * back the control.
+ *
+ * The first shard which has its column-definitions sends them to the client,
+ * the others only have to have as many. Without a order the rows of the shards
+ * are interleaved as they come in. With a order the smallest head-row of the
+ * shards is sent next, as long as all shards which aren't done have a row
+ * buffered.
+ *
+ * If the client or the merge doesn't keep up, a shard stops reading until the
+ * buffers are drained again.
+ *
+ * The shards which got their whole result go back to the pool, the others are
+ * closed once the merged result is finished: by a ERR of a shard or the limit.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include <mysql.h>
+
+#include "network-mysqld-scatter.h"
+#include "network-mysqld-session.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "network-conn-pool.h"
+#include "chassis-event.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+/**
+ * bytes queued for the client or held back by the merge for a shard before
+ * the shard stops reading
+ */
+#define NETWORK_MYSQLD_SCATTER_BUFFER_MAX (1 * 1024 * 1024)
+
+/**
+ * the charsetnr of binary strings and temporal columns
+ */
+#define NETWORK_MYSQLD_SCATTER_CHARSET_BINARY 63
+
+typedef enum {
+	SCATTER_KEY_SIGNED,
+	SCATTER_KEY_UNSIGNED,
+	SCATTER_KEY_DOUBLE,
+	SCATTER_KEY_DECIMAL,          /* by their digits, a double would round them */
+	SCATTER_KEY_BINARY,           /* byte-wise, also fits the text-form of dates and times and the *_bin collations */
+	SCATTER_KEY_STRING            /* ASCII case-insensitive, like the *_general_ci collations. We refuse to merge other bytes */
+} network_mysqld_scatter_key_type;
+
+typedef struct {
+	const gchar *s;               /* into the row-packet, NULL for a NULL */
+	gsize len;
+
+	union {
+		gint64 i;
+		guint64 u;
+		gdouble d;
+		struct {
+			gboolean is_negative; /* FALSE for a zero */
+			const gchar *i;       /* the integer digits without leading zeros */
+			gsize i_len;
+			const gchar *f;       /* the fraction digits without trailing zeros */
+			gsize f_len;
+		} dec;
+	} num;
+} network_mysqld_scatter_key;
+
+typedef struct {
+	GString *packet;
+	network_mysqld_scatter_key keys[1]; /* one for each ->order */
+} network_mysqld_scatter_row;
+
+struct network_mysqld_scatter_shard {
+	enum {
+		SHARD_STATE_SEND,
+		SHARD_STATE_READ_HEAD,    /* OK, ERR or the field-count */
+		SHARD_STATE_READ_FIELDS,
+		SHARD_STATE_READ_ROWS,
+		SHARD_STATE_DONE
+	} state;
+
+	network_mysqld_scatter *scatter;
+	network_backend_t *backend;
+	network_socket *sock;         /* NULL once it is back in the pool or closed */
+	guint ndx;
+
+	guint skip;                   /* results of the session-restore commands in front of the query */
+	gboolean init_db_is_pending;  /* the first of them is a COM_INIT_DB */
+	gboolean is_paused;           /* stopped reading until the buffers are drained */
+
+	GQueue *header;               /* GString *: field-count and fields, without the EOF */
+	guint64 field_count;
+
+	GQueue *rows;                 /* network_mysqld_scatter_row *, held back by the merge */
+	gsize rows_len;
+};
+
+static void network_mysqld_scatter_row_free(network_mysqld_scatter_row *row) {
+	g_string_free(row->packet, TRUE);
+	g_free(row);
+}
+
+network_mysqld_scatter *network_mysqld_scatter_new(void) {
+	network_mysqld_scatter *scatter;
+
+	scatter = g_new0(network_mysqld_scatter, 1);
+	scatter->query = g_string_new(NULL);
+	scatter->backends = g_ptr_array_new();
+	scatter->order = g_array_new(FALSE, FALSE, sizeof(network_mysqld_scatter_order));
+	scatter->limit = G_MAXUINT64;
+	scatter->shards = g_ptr_array_new();
+	scatter->heap = g_ptr_array_new();
+	scatter->key_types = g_array_new(FALSE, FALSE, sizeof(network_mysqld_scatter_key_type));
+
+	return scatter;
+}
+
+/**
+ * close the connection of a shard which didn't get its whole result
+ */
+static void network_mysqld_scatter_shard_close(network_mysqld_scatter_shard *shard) {
+	if (!shard->sock) return;
+
+	event_del(&(shard->sock->event));
+	network_socket_free(shard->sock);
+	shard->sock = NULL;
+
+	g_atomic_int_add(&(shard->backend->connected_clients), -1);
+}
+
+/**
+ * give the connection of a shard back to the pool, it got its whole result
+ */
+static void network_mysqld_scatter_shard_release(network_mysqld_scatter_shard *shard) {
+	network_mysqld_con *con = shard->scatter->con;
+	network_socket *sock = shard->sock;
+	network_connection_pool_entry *entry;
+
+	if (!sock) return;
+
+	event_del(&(sock->event));
+	network_mysqld_queue_reset(sock);
+
+	entry = network_connection_pool_add(shard->backend->pool, network_mysqld_con_get_event_loop(con), sock, con->client->src->key);
+	event_set(&(sock->event), sock->fd, EV_READ, network_connection_pool_idle_handle, entry);
+	chassis_event_add_to(network_mysqld_con_get_event_loop(con), &(sock->event), NULL);
+
+	shard->sock = NULL;
+	g_atomic_int_add(&(shard->backend->connected_clients), -1);
+}
+
+static void network_mysqld_scatter_shard_free(network_mysqld_scatter_shard *shard) {
+	GString *packet;
+	network_mysqld_scatter_row *row;
+
+	network_mysqld_scatter_shard_close(shard);
+
+	while ((packet = g_queue_pop_head(shard->header))) g_string_free(packet, TRUE);
+	g_queue_free(shard->header);
+
+	while ((row = g_queue_pop_head(shard->rows))) network_mysqld_scatter_row_free(row);
+	g_queue_free(shard->rows);
+
+	g_free(shard);
+}
+
+/**
+ * free the scatter-gather query
+ *
+ * the shards which still run are closed
+ */
+void network_mysqld_scatter_free(network_mysqld_scatter *scatter) {
+	guint i;
+
+	if (!scatter) return;
+
+	if (scatter->resume_is_pending) event_del(&(scatter->resume));
+
+	for (i = 0; i < scatter->shards->len; i++) {
+		network_mysqld_scatter_shard_free(scatter->shards->pdata[i]);
+	}
+	g_ptr_array_free(scatter->shards, TRUE);
+	g_ptr_array_free(scatter->heap, TRUE);
+
+	g_string_free(scatter->query, TRUE);
+	g_ptr_array_free(scatter->backends, TRUE);
+	g_array_free(scatter->order, TRUE);
+	g_array_free(scatter->key_types, TRUE);
+
+	g_free(scatter);
+}
+
+/**
+ * the last packet for the client is queued, the shards which still run aren't needed anymore
+ */
+static void network_mysqld_scatter_finished(network_mysqld_scatter *scatter) {
+	guint i;
+
+	scatter->is_finished = TRUE;
+	scatter->con->resultset_is_finished = TRUE;
+
+	for (i = 0; i < scatter->shards->len; i++) {
+		network_mysqld_scatter_shard_close(scatter->shards->pdata[i]);
+	}
+}
+
+/**
+ * end the result of the client with a ERR of our own
+ */
+static void network_mysqld_scatter_fail(network_mysqld_scatter *scatter, const gchar *msg, gsize msg_len) {
+	if (scatter->is_finished) return;
+
+	network_mysqld_con_send_error(scatter->con->client, msg, msg_len);
+
+	network_mysqld_scatter_finished(scatter);
+}
+
+static void network_mysqld_scatter_shard_fail(network_mysqld_scatter_shard *shard, const gchar *reason) {
+	GString *msg;
+
+	msg = g_string_new(NULL);
+	g_string_printf(msg, "(proxy) scatter-gather query on %s failed: %s",
+			shard->backend->addr->name->str, reason);
+
+	network_mysqld_scatter_fail(shard->scatter, S(msg));
+
+	g_string_free(msg, TRUE);
+}
+
+/**
+ * end the result of the client with the ERR of a shard
+ */
+static void network_mysqld_scatter_send_err(network_mysqld_scatter *scatter, GString *packet) {
+	network_socket *client = scatter->con->client;
+
+	network_mysqld_queue_append_raw(client, client->send_queue, packet);
+
+	network_mysqld_scatter_finished(scatter);
+}
+
+static void network_mysqld_scatter_send_eof(network_mysqld_scatter *scatter) {
+	network_socket *client = scatter->con->client;
+	network_mysqld_eof_packet_t *eof;
+	GString *packet;
+
+	eof = network_mysqld_eof_packet_new();
+	eof->warnings = scatter->warnings;
+	eof->server_status = scatter->server_status; /* shard_done() fails on more results */
+	eof->is_deprecated = client->is_eof_deprecated;
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_eof_packet(packet, eof);
+	network_mysqld_queue_append(client, client->send_queue, S(packet));
+	g_string_free(packet, TRUE);
+
+	network_mysqld_eof_packet_free(eof);
+
+	network_mysqld_scatter_finished(scatter);
+}
+
+/**
+ * one OK for the OKs of all shards
+ */
+static void network_mysqld_scatter_send_ok(network_mysqld_scatter *scatter) {
+	network_socket *client = scatter->con->client;
+	network_mysqld_ok_packet_t *ok;
+	GString *packet;
+
+	ok = network_mysqld_ok_packet_new();
+	ok->affected_rows = scatter->affected_rows;
+	ok->insert_id = scatter->insert_id;
+	ok->warnings = scatter->warnings;
+	ok->server_status = scatter->server_status; /* shard_done() fails on more results */
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_ok_packet(packet, ok);
+	network_mysqld_queue_append(client, client->send_queue, S(packet));
+	g_string_free(packet, TRUE);
+
+	network_mysqld_ok_packet_free(ok);
+
+	network_mysqld_scatter_finished(scatter);
+}
+
+/**
+ * send a merged row, unless it is before the offset
+ */
+static void network_mysqld_scatter_send_row(network_mysqld_scatter *scatter, GString *packet) {
+	network_socket *client = scatter->con->client;
+
+	if (scatter->rows_skipped < scatter->offset) {
+		scatter->rows_skipped++;
+		g_string_free(packet, TRUE);
+		return;
+	}
+
+	network_mysqld_queue_append_raw(client, client->send_queue, packet);
+
+	if (++scatter->rows_sent >= scatter->limit) {
+		network_mysqld_scatter_send_eof(scatter);
+	}
+}
+
+/**
+ * how a column compares, by its column-definition
+ */
+static network_mysqld_scatter_key_type network_mysqld_scatter_key_type_get(MYSQL_FIELD *field) {
+	switch ((guint)field->type) {
+	case MYSQL_TYPE_TINY:
+	case MYSQL_TYPE_SHORT:
+	case MYSQL_TYPE_INT24:
+	case MYSQL_TYPE_LONG:
+	case MYSQL_TYPE_LONGLONG:
+	case MYSQL_TYPE_YEAR:
+		return (field->flags & UNSIGNED_FLAG) ? SCATTER_KEY_UNSIGNED : SCATTER_KEY_SIGNED;
+	case MYSQL_TYPE_DECIMAL:
+	case MYSQL_TYPE_NEWDECIMAL:
+		return SCATTER_KEY_DECIMAL;
+	case MYSQL_TYPE_FLOAT:
+	case MYSQL_TYPE_DOUBLE:
+		return SCATTER_KEY_DOUBLE;
+	default:
+		break;
+	}
+
+	switch (field->charsetnr) {
+	case NETWORK_MYSQLD_SCATTER_CHARSET_BINARY:
+	case 46:  /* utf8mb4_bin */
+	case 47:  /* latin1_bin */
+	case 65:  /* ascii_bin */
+	case 83:  /* utf8_bin */
+	case 309: /* utf8mb4_0900_bin */
+		/* UTF-8 sorts by code-point if compared byte-wise */
+		return SCATTER_KEY_BINARY;
+	default:
+		return SCATTER_KEY_STRING;
+	}
+}
+
+/**
+ * queue the column-definitions of a shard for the client
+ *
+ * the first shard which has them complete sends them
+ */
+static int network_mysqld_scatter_send_header(network_mysqld_scatter *scatter, network_mysqld_scatter_shard *shard) {
+	network_socket *client = scatter->con->client;
+	GPtrArray *fields;
+	GString *packet;
+	guint i;
+
+	fields = network_mysqld_proto_fielddefs_new();
+
+	if (NULL == network_mysqld_proto_get_fielddefs(shard->header->head, fields)) {
+		network_mysqld_proto_fielddefs_free(fields);
+		network_mysqld_scatter_shard_fail(shard, "invalid column-definitions");
+		return -1;
+	}
+
+	for (i = 0; i < scatter->order->len; i++) {
+		network_mysqld_scatter_order *order = &g_array_index(scatter->order, network_mysqld_scatter_order, i);
+		network_mysqld_scatter_key_type key_type;
+
+		if (order->column >= fields->len) {
+			network_mysqld_proto_fielddefs_free(fields);
+			network_mysqld_scatter_fail(scatter, C("(proxy) the resultset of the scatter-gather query doesn't have the column to merge by"));
+			return -1;
+		}
+
+		key_type = network_mysqld_scatter_key_type_get(fields->pdata[order->column]);
+		g_array_append_val(scatter->key_types, key_type);
+	}
+
+	network_mysqld_proto_fielddefs_free(fields);
+
+	scatter->field_count = shard->field_count;
+	scatter->header_sent = TRUE;
+
+	while ((packet = g_queue_pop_head(shard->header))) {
+		network_mysqld_queue_append_raw(client, client->send_queue, packet);
+	}
+
+	if (!client->is_eof_deprecated) {
+		/* the EOF after the column-definitions */
+		network_mysqld_eof_packet_t *eof = network_mysqld_eof_packet_new();
+
+		eof->server_status = SERVER_STATUS_AUTOCOMMIT;
+
+		packet = g_string_new(NULL);
+		network_mysqld_proto_append_eof_packet(packet, eof);
+		network_mysqld_queue_append(client, client->send_queue, S(packet));
+		g_string_free(packet, TRUE);
+
+		network_mysqld_eof_packet_free(eof);
+	}
+
+	if (scatter->limit == 0) network_mysqld_scatter_send_eof(scatter);
+
+	return 0;
+}
+
+#define SCATTER_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+/**
+ * split the text of a DECIMAL into its sign and its significant digits
+ */
+static void network_mysqld_scatter_key_decimal(network_mysqld_scatter_key *key) {
+	const gchar *s = key->s, *end = key->s + key->len;
+	const gchar *dot;
+
+	key->num.dec.is_negative = FALSE;
+
+	if (s < end && *s == '-') {
+		key->num.dec.is_negative = TRUE;
+		s++;
+	}
+
+	while (s < end && *s == '0') s++;
+	for (dot = s; dot < end && *dot != '.'; dot++);
+
+	key->num.dec.i = s;
+	key->num.dec.i_len = dot - s;
+
+	if (dot < end) dot++;
+	while (end > dot && *(end - 1) == '0') end--;
+
+	key->num.dec.f = dot;
+	key->num.dec.f_len = end - dot;
+
+	/* -0.00 */
+	if (key->num.dec.i_len == 0 && key->num.dec.f_len == 0) key->num.dec.is_negative = FALSE;
+}
+
+/**
+ * compare two DECIMALs by their digits
+ */
+static gint network_mysqld_scatter_key_decimal_cmp(network_mysqld_scatter_key *a, network_mysqld_scatter_key *b) {
+	gint r;
+
+	if (a->num.dec.is_negative != b->num.dec.is_negative) {
+		return a->num.dec.is_negative ? -1 : 1;
+	}
+
+	/* more integer digits, larger number */
+	r = SCATTER_CMP(a->num.dec.i_len, b->num.dec.i_len);
+	if (r == 0) r = memcmp(a->num.dec.i, b->num.dec.i, a->num.dec.i_len);
+	if (r == 0) r = memcmp(a->num.dec.f, b->num.dec.f, MIN(a->num.dec.f_len, b->num.dec.f_len));
+	if (r == 0) r = SCATTER_CMP(a->num.dec.f_len, b->num.dec.f_len);
+
+	return a->num.dec.is_negative ? -r : r;
+}
+
+/**
+ * point the keys of a row to the columns we merge by
+ *
+ * @return -1 if the row is broken, -2 if a string is outside of the ASCII we can compare
+ */
+static int network_mysqld_scatter_row_keys(network_mysqld_scatter *scatter, network_mysqld_scatter_row *row) {
+	network_packet packet;
+	guint col, i, last_col = 0;
+	guint64 j;
+	int err = 0;
+
+	for (i = 0; i < scatter->order->len; i++) {
+		last_col = MAX(last_col, g_array_index(scatter->order, network_mysqld_scatter_order, i).column);
+	}
+
+	packet.data = row->packet;
+	packet.offset = NET_HEADER_SIZE;
+
+	for (col = 0; !err && col <= last_col; col++) {
+		network_mysqld_lenenc_type lenenc_type;
+		const gchar *s = NULL;
+		guint64 len = 0;
+
+		err = err || network_mysqld_proto_peek_lenenc_type(&packet, &lenenc_type);
+		if (err) break;
+
+		if (lenenc_type == NETWORK_MYSQLD_LENENC_TYPE_NULL) {
+			err = err || network_mysqld_proto_skip(&packet, 1);
+		} else {
+			err = err || network_mysqld_proto_get_lenenc_int(&packet, &len);
+			s = packet.data->str + packet.offset;
+			err = err || network_mysqld_proto_skip(&packet, len);
+		}
+		if (err) break;
+
+		for (i = 0; i < scatter->order->len; i++) {
+			network_mysqld_scatter_key *key = &(row->keys[i]);
+			gchar num[128];
+
+			if (g_array_index(scatter->order, network_mysqld_scatter_order, i).column != col) continue;
+
+			key->s = s;
+			key->len = len;
+
+			if (!s) continue;
+
+			/* the numbers are compared as numbers, their text is short */
+			switch (g_array_index(scatter->key_types, network_mysqld_scatter_key_type, i)) {
+			case SCATTER_KEY_SIGNED:
+			case SCATTER_KEY_UNSIGNED:
+			case SCATTER_KEY_DOUBLE:
+				g_strlcpy(num, s, MIN(len + 1, sizeof(num)));
+				break;
+			case SCATTER_KEY_DECIMAL:
+				network_mysqld_scatter_key_decimal(key);
+				continue;
+			case SCATTER_KEY_STRING:
+				/* without the collation we only know how ASCII sorts */
+				for (j = 0; j < len; j++) {
+					if ((guchar)s[j] & 0x80) return -2;
+				}
+				continue;
+			default:
+				continue;
+			}
+
+			switch (g_array_index(scatter->key_types, network_mysqld_scatter_key_type, i)) {
+			case SCATTER_KEY_SIGNED:
+				key->num.i = g_ascii_strtoll(num, NULL, 10);
+				break;
+			case SCATTER_KEY_UNSIGNED:
+				key->num.u = g_ascii_strtoull(num, NULL, 10);
+				break;
+			default:
+				key->num.d = g_ascii_strtod(num, NULL);
+				break;
+			}
+		}
+	}
+
+	return err ? -1 : 0;
+}
+
+static gint network_mysqld_scatter_row_cmp(network_mysqld_scatter *scatter, network_mysqld_scatter_row *a, network_mysqld_scatter_row *b) {
+	guint i;
+
+	for (i = 0; i < scatter->order->len; i++) {
+		network_mysqld_scatter_key *ka = &(a->keys[i]);
+		network_mysqld_scatter_key *kb = &(b->keys[i]);
+		gint r = 0;
+
+		if (!ka->s || !kb->s) {
+			/* NULLs come first */
+			r = SCATTER_CMP(ka->s != NULL, kb->s != NULL);
+		} else {
+			gsize j;
+
+			switch (g_array_index(scatter->key_types, network_mysqld_scatter_key_type, i)) {
+			case SCATTER_KEY_SIGNED:
+				r = SCATTER_CMP(ka->num.i, kb->num.i);
+				break;
+			case SCATTER_KEY_UNSIGNED:
+				r = SCATTER_CMP(ka->num.u, kb->num.u);
+				break;
+			case SCATTER_KEY_DOUBLE:
+				r = SCATTER_CMP(ka->num.d, kb->num.d);
+				break;
+			case SCATTER_KEY_DECIMAL:
+				r = network_mysqld_scatter_key_decimal_cmp(ka, kb);
+				break;
+			case SCATTER_KEY_BINARY:
+				r = memcmp(ka->s, kb->s, MIN(ka->len, kb->len));
+				if (r == 0) r = SCATTER_CMP(ka->len, kb->len);
+				break;
+			case SCATTER_KEY_STRING:
+				/* the *_general_ci collations sort by the upper-case letter: 'a' > '_' */
+				for (j = 0; r == 0 && j < MIN(ka->len, kb->len); j++) {
+					r = SCATTER_CMP(g_ascii_toupper(ka->s[j]), g_ascii_toupper(kb->s[j]));
+				}
+				if (r == 0) r = SCATTER_CMP(ka->len, kb->len);
+				break;
+			}
+		}
+
+		if (r != 0) {
+			return g_array_index(scatter->order, network_mysqld_scatter_order, i).desc ? -r : r;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * compare the head-rows of two shards, the order of the shards breaks ties
+ */
+static gint network_mysqld_scatter_shard_cmp(network_mysqld_scatter *scatter, network_mysqld_scatter_shard *a, network_mysqld_scatter_shard *b) {
+	gint r;
+
+	r = network_mysqld_scatter_row_cmp(scatter, g_queue_peek_head(a->rows), g_queue_peek_head(b->rows));
+
+	return r != 0 ? r : SCATTER_CMP(a->ndx, b->ndx);
+}
+
+#define HEAP_SHARD(ndx) ((network_mysqld_scatter_shard *)(scatter->heap->pdata[ndx]))
+
+static void network_mysqld_scatter_heap_swap(network_mysqld_scatter *scatter, guint a, guint b) {
+	gpointer tmp = scatter->heap->pdata[a];
+
+	scatter->heap->pdata[a] = scatter->heap->pdata[b];
+	scatter->heap->pdata[b] = tmp;
+}
+
+static void network_mysqld_scatter_heap_push(network_mysqld_scatter *scatter, network_mysqld_scatter_shard *shard) {
+	guint ndx;
+
+	g_ptr_array_add(scatter->heap, shard);
+
+	for (ndx = scatter->heap->len - 1; ndx > 0; ndx = (ndx - 1) / 2) {
+		guint parent = (ndx - 1) / 2;
+
+		if (network_mysqld_scatter_shard_cmp(scatter, HEAP_SHARD(parent), HEAP_SHARD(ndx)) <= 0) break;
+
+		network_mysqld_scatter_heap_swap(scatter, parent, ndx);
+	}
+}
+
+/**
+ * move the head of the heap down after its row changed
+ */
+static void network_mysqld_scatter_heap_sift_down(network_mysqld_scatter *scatter) {
+	guint ndx = 0;
+
+	for (;;) {
+		guint smallest = ndx;
+		guint left = 2 * ndx + 1, right = 2 * ndx + 2;
+
+		if (left < scatter->heap->len &&
+		    network_mysqld_scatter_shard_cmp(scatter, HEAP_SHARD(left), HEAP_SHARD(smallest)) < 0) smallest = left;
+		if (right < scatter->heap->len &&
+		    network_mysqld_scatter_shard_cmp(scatter, HEAP_SHARD(right), HEAP_SHARD(smallest)) < 0) smallest = right;
+
+		if (smallest == ndx) break;
+
+		network_mysqld_scatter_heap_swap(scatter, ndx, smallest);
+		ndx = smallest;
+	}
+}
+
+static void network_mysqld_scatter_heap_pop(network_mysqld_scatter *scatter) {
+	gpointer last = g_ptr_array_remove_index(scatter->heap, scatter->heap->len - 1);
+
+	if (scatter->heap->len == 0) return;
+
+	scatter->heap->pdata[0] = last;
+	network_mysqld_scatter_heap_sift_down(scatter);
+}
+
+static void network_mysqld_scatter_kick(network_mysqld_scatter *scatter);
+
+/**
+ * send the rows the merge allows and end the result once all shards are done
+ *
+ * without a order the rows are sent as they come in, there is nothing to merge
+ */
+static void network_mysqld_scatter_merge(network_mysqld_scatter *scatter) {
+	gboolean was_drained = FALSE;
+
+	while (!scatter->is_finished && scatter->waiting == 0 && scatter->heap->len > 0) {
+		network_mysqld_scatter_shard *shard = HEAP_SHARD(0);
+		network_mysqld_scatter_row *row;
+		GString *packet;
+
+		row = g_queue_pop_head(shard->rows);
+		shard->rows_len -= row->packet->len;
+
+		if (shard->rows->length > 0) {
+			network_mysqld_scatter_heap_sift_down(scatter);
+		} else {
+			network_mysqld_scatter_heap_pop(scatter);
+
+			/* we can't go on without its next row */
+			if (shard->state != SHARD_STATE_DONE) scatter->waiting++;
+		}
+
+		if (shard->is_paused) was_drained = TRUE;
+
+		packet = row->packet;
+		g_free(row);
+
+		network_mysqld_scatter_send_row(scatter, packet);
+	}
+
+	if (scatter->is_finished) return;
+
+	if (scatter->running == 0 && scatter->heap->len == 0) {
+		if (scatter->header_sent) {
+			network_mysqld_scatter_send_eof(scatter);
+		} else {
+			network_mysqld_scatter_send_ok(scatter);
+		}
+		return;
+	}
+
+	if (was_drained) network_mysqld_scatter_kick(scatter);
+}
+
+/**
+ * the shard got its whole result
+ *
+ * the connection only goes back to the pool if nothing is left on it: a shard
+ * with more results (CALL, multi-statements) fails the query, an open transaction
+ * is rolled back by closing the connection
+ *
+ * @param server_status  of the OK or EOF which ended the result of the shard
+ */
+static void network_mysqld_scatter_shard_done(network_mysqld_scatter_shard *shard, guint16 server_status) {
+	network_mysqld_scatter *scatter = shard->scatter;
+
+	if (server_status & SERVER_MORE_RESULTS_EXISTS) {
+		/* closes the connections of all shards, the unread results with them */
+		network_mysqld_scatter_shard_fail(shard, "more than one result can't be merged");
+		return;
+	}
+
+	shard->state = SHARD_STATE_DONE;
+
+	if (server_status & SERVER_STATUS_IN_TRANS) {
+		network_mysqld_scatter_shard_close(shard);
+	} else {
+		network_mysqld_scatter_shard_release(shard);
+	}
+
+	scatter->running--;
+	if (scatter->order->len > 0 && shard->rows->length == 0) scatter->waiting--;
+
+	network_mysqld_scatter_merge(scatter);
+}
+
+static void network_mysqld_scatter_shard_row(network_mysqld_scatter_shard *shard, GString *packet) {
+	network_mysqld_scatter *scatter = shard->scatter;
+	network_mysqld_scatter_row *row;
+
+	if (scatter->order->len == 0) {
+		network_mysqld_scatter_send_row(scatter, packet);
+		return;
+	}
+
+	row = g_malloc0(sizeof(*row) + (scatter->order->len - 1) * sizeof(network_mysqld_scatter_key));
+	row->packet = packet;
+
+	switch (network_mysqld_scatter_row_keys(scatter, row)) {
+	case 0:
+		break;
+	case -2:
+		network_mysqld_scatter_row_free(row);
+		network_mysqld_scatter_shard_fail(shard, "strings with non-ASCII characters can't be merged without their collation");
+		return;
+	default:
+		network_mysqld_scatter_row_free(row);
+		network_mysqld_scatter_shard_fail(shard, "invalid row");
+		return;
+	}
+
+	g_queue_push_tail(shard->rows, row);
+	shard->rows_len += packet->len;
+
+	if (shard->rows->length == 1) {
+		scatter->waiting--;
+		network_mysqld_scatter_heap_push(scatter, shard);
+	}
+
+	network_mysqld_scatter_merge(scatter);
+}
+
+/**
+ * handle a packet of the result of a shard
+ */
+static void network_mysqld_scatter_shard_packet(network_mysqld_scatter_shard *shard, GString *packet) {
+	network_mysqld_scatter *scatter = shard->scatter;
+	network_packet p;
+	guint8 status;
+	int err = 0;
+
+	p.data = packet;
+	p.offset = 0;
+
+	err = err || network_mysqld_proto_skip_network_header(&p);
+	err = err || network_mysqld_proto_peek_int8(&p, &status);
+	if (err) {
+		g_string_free(packet, TRUE);
+		network_mysqld_scatter_shard_fail(shard, "invalid packet");
+		return;
+	}
+
+	if (packet->len == PACKET_LEN_MAX + NET_HEADER_SIZE) {
+		g_string_free(packet, TRUE);
+		network_mysqld_scatter_shard_fail(shard, "rows of 16M and more can't be merged");
+		return;
+	}
+
+	if (status == MYSQLD_PACKET_ERR) {
+		/* the first ERR is the result */
+		network_mysqld_scatter_send_err(scatter, packet);
+		return;
+	}
+
+	switch (shard->state) {
+	case SHARD_STATE_READ_HEAD:
+		if (shard->skip > 0) {
+			/* the result of a session-restore command */
+			g_string_free(packet, TRUE);
+
+			if (status != MYSQLD_PACKET_OK) {
+				network_mysqld_scatter_shard_fail(shard, "restoring the session failed");
+				return;
+			}
+
+			if (shard->init_db_is_pending) {
+				g_string_assign_len(shard->sock->default_db, S(scatter->con->client->default_db));
+				shard->init_db_is_pending = FALSE;
+			}
+
+			shard->skip--;
+			network_mysqld_queue_reset(shard->sock);
+			return;
+		}
+
+		if (status == MYSQLD_PACKET_OK) {
+			network_mysqld_ok_packet_t *ok = network_mysqld_ok_packet_new();
+
+			err = err || network_mysqld_proto_get_ok_packet(&p, ok);
+			if (!err) {
+				scatter->affected_rows += ok->affected_rows;
+				if (ok->insert_id) scatter->insert_id = ok->insert_id;
+				scatter->warnings += ok->warnings;
+				scatter->server_status = ok->server_status;
+			}
+			network_mysqld_ok_packet_free(ok);
+			g_string_free(packet, TRUE);
+
+			if (err) {
+				network_mysqld_scatter_shard_fail(shard, "invalid OK packet");
+				return;
+			}
+
+			if (scatter->header_sent) {
+				network_mysqld_scatter_shard_fail(shard, "got a OK, the other shards a resultset");
+				return;
+			}
+			scatter->oks++;
+
+			network_mysqld_scatter_shard_done(shard, scatter->server_status);
+			return;
+		}
+
+		if (status == MYSQLD_PACKET_NULL) {
+			g_string_free(packet, TRUE);
+			network_mysqld_scatter_shard_fail(shard, "LOAD DATA LOCAL INFILE can't be scattered");
+			return;
+		}
+
+		err = err || network_mysqld_proto_get_lenenc_int(&p, &(shard->field_count));
+		if (err || shard->field_count == 0) {
+			g_string_free(packet, TRUE);
+			network_mysqld_scatter_shard_fail(shard, "invalid field-count");
+			return;
+		}
+
+		g_queue_push_tail(shard->header, packet);
+		shard->state = SHARD_STATE_READ_FIELDS;
+		return;
+	case SHARD_STATE_READ_FIELDS:
+		if (shard->header->length < shard->field_count + 1) {
+			g_queue_push_tail(shard->header, packet);
+
+			/* field-count and the fields, the EOF follows unless the shard has CLIENT_DEPRECATE_EOF */
+			if (shard->header->length < shard->field_count + 1 || !shard->sock->is_eof_deprecated) return;
+		} else {
+			/* the EOF of a classic shard, the client gets one in its own format */
+			g_string_free(packet, TRUE);
+
+			if (status != MYSQLD_PACKET_EOF) {
+				network_mysqld_scatter_shard_fail(shard, "invalid column-definitions");
+				return;
+			}
+		}
+
+		if (scatter->oks > 0) {
+			network_mysqld_scatter_shard_fail(shard, "got a resultset, the other shards a OK");
+			return;
+		}
+
+		if (!scatter->header_sent) {
+			if (0 != network_mysqld_scatter_send_header(scatter, shard)) return;
+		} else if (shard->field_count != scatter->field_count) {
+			network_mysqld_scatter_shard_fail(shard, "got a different number of columns than the other shards");
+			return;
+		} else {
+			while ((packet = g_queue_pop_head(shard->header))) g_string_free(packet, TRUE);
+		}
+
+		shard->state = SHARD_STATE_READ_ROWS;
+		return;
+	case SHARD_STATE_READ_ROWS:
+		if (status == MYSQLD_PACKET_EOF && network_mysqld_proto_packet_is_eof(packet)) {
+			network_mysqld_eof_packet_t *eof = network_mysqld_eof_packet_new();
+
+			err = err || network_mysqld_proto_get_eof_packet(&p, eof);
+			if (!err) {
+				scatter->warnings += eof->warnings;
+				scatter->server_status = eof->server_status;
+			}
+			network_mysqld_eof_packet_free(eof);
+			g_string_free(packet, TRUE);
+
+			if (err) {
+				network_mysqld_scatter_shard_fail(shard, "invalid EOF packet");
+				return;
+			}
+
+			network_mysqld_scatter_shard_done(shard, scatter->server_status);
+			return;
+		}
+
+		network_mysqld_scatter_shard_row(shard, packet);
+		return;
+	default:
+		g_string_free(packet, TRUE);
+		network_mysqld_scatter_shard_fail(shard, "unexpected packet");
+		return;
+	}
+}
+
+/**
+ * the client or the merge has enough of the rows of this shard for now
+ */
+static gboolean network_mysqld_scatter_shard_is_full(network_mysqld_scatter_shard *shard) {
+	network_socket *client = shard->scatter->con->client;
+
+	return client->send_queue->len >= NETWORK_MYSQLD_SCATTER_BUFFER_MAX ||
+	       shard->rows_len >= NETWORK_MYSQLD_SCATTER_BUFFER_MAX;
+}
+
+static void network_mysqld_scatter_shard_handle(int event_fd, short events, void *user_data);
+
+static void network_mysqld_scatter_shard_wait(network_mysqld_scatter_shard *shard, short what) {
+	network_mysqld_con *con = shard->scatter->con;
+	network_socket *sock = shard->sock;
+
+	event_set(&(sock->event), sock->fd, what, network_mysqld_scatter_shard_handle, shard);
+	chassis_event_add_with_timeout(con->srv, &(sock->event), &(con->read_timeout));
+}
+
+/**
+ * get the next packet of the shard into sock->recv_queue
+ */
+static network_socket_retval_t network_mysqld_scatter_shard_read(network_mysqld_scatter_shard *shard) {
+	network_mysqld_con *con = shard->scatter->con;
+	network_socket *sock = shard->sock;
+
+	if (NETWORK_SOCKET_SUCCESS == network_mysqld_con_get_packet(con->srv, sock)) {
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	sock->to_read = NETWORK_SOCKET_READ_MAX;
+	switch (network_socket_read(sock)) {
+	case NETWORK_SOCKET_SUCCESS:
+		break;
+	case NETWORK_SOCKET_WAIT_FOR_EVENT:
+		if (sock->is_peer_closed) return NETWORK_SOCKET_ERROR;
+
+		return NETWORK_SOCKET_WAIT_FOR_EVENT;
+	default:
+		return NETWORK_SOCKET_ERROR;
+	}
+
+	return network_mysqld_con_get_packet(con->srv, sock);
+}
+
+/**
+ * send the query and read the result of a shard until it has to wait
+ */
+static void network_mysqld_scatter_shard_run(network_mysqld_scatter_shard *shard) {
+	network_mysqld_scatter *scatter = shard->scatter;
+
+	if (shard->state == SHARD_STATE_SEND) {
+		switch (network_socket_write(shard->sock, -1)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_mysqld_scatter_shard_wait(shard, EV_WRITE);
+			return;
+		default:
+			network_mysqld_scatter_shard_fail(shard, "sending the query failed");
+			return;
+		}
+
+		shard->state = SHARD_STATE_READ_HEAD;
+	}
+
+	while (!scatter->is_finished && shard->state != SHARD_STATE_DONE) {
+		if (network_mysqld_scatter_shard_is_full(shard)) {
+			shard->is_paused = TRUE;
+			return;
+		}
+
+		switch (network_mysqld_scatter_shard_read(shard)) {
+		case NETWORK_SOCKET_SUCCESS:
+			break;
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			network_mysqld_scatter_shard_wait(shard, EV_READ);
+			return;
+		default:
+			network_mysqld_scatter_shard_fail(shard, "reading the result failed");
+			return;
+		}
+
+		network_mysqld_scatter_shard_packet(shard, g_queue_pop_head(shard->sock->recv_queue->chunks));
+	}
+}
+
+/**
+ * let the state-machine of the client connection send what we queued
+ *
+ * it calls network_mysqld_scatter_resume() once the send-queue is drained, or
+ * frees us if the result is finished. Nothing of the scatter-gather query can
+ * be touched afterwards.
+ */
+static void network_mysqld_scatter_flush(network_mysqld_scatter *scatter) {
+	network_mysqld_con *con = scatter->con;
+
+	if (scatter->in_con_handle) return;
+	if (!scatter->is_finished && con->client->send_queue->chunks->length == 0) return;
+
+	scatter->in_con_handle = TRUE;
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+static void network_mysqld_scatter_shard_handle(int G_GNUC_UNUSED event_fd, short events, void *user_data) {
+	network_mysqld_scatter_shard *shard = user_data;
+	network_mysqld_scatter *scatter = shard->scatter;
+
+	if (events == EV_TIMEOUT) {
+		network_mysqld_scatter_shard_fail(shard, "timed out");
+	} else {
+		network_mysqld_scatter_shard_run(shard);
+	}
+
+	network_mysqld_scatter_flush(scatter);
+}
+
+static void network_mysqld_scatter_resume_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_scatter *scatter = user_data;
+	guint i;
+
+	scatter->resume_is_pending = FALSE;
+
+	for (i = 0; i < scatter->shards->len && !scatter->is_finished; i++) {
+		network_mysqld_scatter_shard *shard = scatter->shards->pdata[i];
+
+		if (!shard->is_paused) continue;
+
+		shard->is_paused = FALSE;
+		network_mysqld_scatter_shard_run(shard);
+	}
+
+	network_mysqld_scatter_flush(scatter);
+}
+
+/**
+ * restart the paused shards from the event-loop, if the buffers have room for them
+ */
+static void network_mysqld_scatter_kick(network_mysqld_scatter *scatter) {
+	struct timeval now = { 0, 0 };
+	guint i;
+
+	if (scatter->resume_is_pending || scatter->is_finished) return;
+
+	for (i = 0; i < scatter->shards->len; i++) {
+		network_mysqld_scatter_shard *shard = scatter->shards->pdata[i];
+
+		if (shard->is_paused && !network_mysqld_scatter_shard_is_full(shard)) break;
+	}
+	if (i == scatter->shards->len) return;
+
+	evtimer_set(&(scatter->resume), network_mysqld_scatter_resume_handle, scatter);
+	chassis_event_add_with_timeout(scatter->con->srv, &(scatter->resume), &now);
+	scatter->resume_is_pending = TRUE;
+}
+
+/**
+ * the client drained what we queued, go on with the shards
+ *
+ * called by the state-machine of the client connection
+ */
+void network_mysqld_scatter_resume(network_mysqld_scatter *scatter) {
+	scatter->in_con_handle = FALSE;
+
+	network_mysqld_scatter_kick(scatter);
+}
+
+/**
+ * send the query to all shards
+ *
+ * called by the state-machine of the client connection which sends the result
+ * afterwards. If the query can't be started, a ERR is queued for the client.
+ *
+ * @return 0 on success, -1 if the query couldn't be started
+ */
+int network_mysqld_scatter_start(network_mysqld_scatter *scatter, network_mysqld_con *con) {
+	GString empty_username = { "", 0, 0 };
+	conn_ctl_info info = {0, 0, 0};
+	guint i;
+
+	scatter->con = con;
+	scatter->in_con_handle = TRUE;
+	con->resultset_is_finished = FALSE;
+
+	if (scatter->backends->len == 0 || scatter->query->len == 0) {
+		network_mysqld_scatter_fail(scatter, C("(proxy) scatter-gather query without a query or shards"));
+		return -1;
+	}
+
+	info.key = con->client->src->key;
+	info.state = con->state;
+
+	/* take all connections first, we don't start what we can't finish */
+	for (i = 0; i < scatter->backends->len; i++) {
+		network_backend_t *backend = scatter->backends->pdata[i];
+		network_mysqld_scatter_shard *shard;
+		network_socket *sock;
+
+		if (backend->state == BACKEND_STATE_DOWN ||
+		    NULL == (sock = network_connection_pool_get(backend->pool,
+				    con->client->response ? con->client->response->username : &empty_username,
+				    con->client->default_db, &info))) {
+			GString *msg = g_string_new(NULL);
+			guint j;
+
+			/* nothing was sent on the ones we got */
+			for (j = 0; j < scatter->shards->len; j++) {
+				network_mysqld_scatter_shard_release(scatter->shards->pdata[j]);
+			}
+
+			g_string_printf(msg, "(proxy) no idle server connection to %s for the scatter-gather query",
+					backend->addr->name->str);
+			network_mysqld_scatter_fail(scatter, S(msg));
+			g_string_free(msg, TRUE);
+
+			return -1;
+		}
+
+		g_atomic_int_inc(&(backend->connected_clients));
+
+		shard = g_new0(network_mysqld_scatter_shard, 1);
+		shard->scatter = scatter;
+		shard->backend = backend;
+		shard->sock = sock;
+		shard->ndx = i;
+		shard->header = g_queue_new();
+		shard->rows = g_queue_new();
+
+		g_ptr_array_add(scatter->shards, shard);
+	}
+
+	scatter->running = scatter->shards->len;
+	scatter->waiting = scatter->order->len > 0 ? scatter->shards->len : 0;
+
+	for (i = 0; i < scatter->shards->len && !scatter->is_finished; i++) {
+		network_mysqld_scatter_shard *shard = scatter->shards->pdata[i];
+		GQueue *cmds = g_queue_new();
+		GString *cmd;
+
+		/* the pooled connection may have been used by a different session */
+		network_mysqld_session_restore(cmds, con->client, shard->sock);
+
+		cmd = g_queue_peek_head(cmds);
+		shard->init_db_is_pending = (cmd && cmd->len > 0 && cmd->str[0] == COM_INIT_DB);
+		shard->skip = cmds->length;
+
+		while ((cmd = g_queue_pop_head(cmds))) {
+			network_mysqld_queue_reset(shard->sock);
+			network_mysqld_queue_append(shard->sock, shard->sock->send_queue, S(cmd));
+			g_string_free(cmd, TRUE);
+		}
+		g_queue_free(cmds);
+
+		network_mysqld_queue_reset(shard->sock);
+		network_mysqld_queue_append(shard->sock, shard->sock->send_queue, S(scatter->query));
+
+		shard->state = SHARD_STATE_SEND;
+		network_mysqld_scatter_shard_run(shard);
+	}
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_MYSQLD_SCATTER_H_
+#define _NETWORK_MYSQLD_SCATTER_H_
+
+#include <glib.h>
+
+#include "network-mysqld.h"
+#include "network-backend.h"
+#include "network-exports.h"
+
+/**
+ * a column the shards sort their rows by
+ */
+typedef struct {
+	guint column;                 /** index of the column in the resultset, based on 0 */
+	gboolean desc;
+} network_mysqld_scatter_order;
+
+typedef struct network_mysqld_scatter_shard network_mysqld_scatter_shard;
+
+/**
+ * one COM_QUERY on several backends, one resultset for the client
+ *
+ * the query is sent to all shards at once, the rows are forwarded while
+ * they arrive. With a ->order the shards have to return their rows in that
+ * order (ORDER BY in the query) and are merged, otherwise they are
+ * concatenated.
+ *
+ * ->offset and ->limit apply to the merged rows. The shards have to return
+ * at least offset + limit rows each for that, e.g. LIMIT 10, 5 becomes
+ * LIMIT 15 on each shard.
+ */
+struct network_mysqld_scatter {
+	GString *query;               /** the COM_QUERY, including the command-byte */
+	GPtrArray *backends;          /** network_backend_t *, one shard each */
+	GArray *order;                /** network_mysqld_scatter_order, empty to concatenate the rows */
+	guint64 offset;               /** merged rows to skip */
+	guint64 limit;                /** merged rows to send, G_MAXUINT64 for all */
+
+	network_mysqld_con *con;
+	GPtrArray *shards;            /** network_mysqld_scatter_shard * */
+
+	guint running;                /** shards which haven't got their whole result yet */
+	guint waiting;                /** shards without a buffered row which hold the merge back */
+	GPtrArray *heap;              /** shards with buffered rows, the one with the smallest row first */
+	GArray *key_types;            /** how the ->order columns compare, taken from the column-definitions */
+
+	gboolean header_sent;         /** the column-definitions are queued for the client */
+	guint64 field_count;
+	guint oks;                    /** shards which answered with a OK instead of a resultset */
+
+	guint64 rows_skipped;
+	guint64 rows_sent;
+
+	guint64 affected_rows;        /** summed up over the OKs of the shards */
+	guint64 insert_id;
+	guint16 warnings;             /** summed up over the OKs or the EOFs of the shards */
+	guint16 server_status;        /** of the last OK or EOF */
+
+	gboolean is_finished;         /** the last packet is queued for the client */
+	gboolean in_con_handle;       /** the state-machine of the connection runs, don't call it again */
+
+	struct event resume;          /** restarts the paused shards once the client drained its send-queue */
+	gboolean resume_is_pending;
+};
+
+typedef struct network_mysqld_scatter network_mysqld_scatter;
+
+NETWORK_API network_mysqld_scatter *network_mysqld_scatter_new(void);
+NETWORK_API void network_mysqld_scatter_free(network_mysqld_scatter *scatter);
+NETWORK_API int network_mysqld_scatter_start(network_mysqld_scatter *scatter, network_mysqld_con *con);
+NETWORK_API void network_mysqld_scatter_resume(network_mysqld_scatter *scatter);
+
+#endif
@@ -0,0 +1,608 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-session.h"
+#include "network-mysqld-proto.h"
+#include "sql-tokenizer.h"
+#include "glib-ext.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+static void network_mysqld_session_change_free(network_mysqld_session_change *change) {
+	if (!change) return;
+
+	if (change->query) g_string_free(change->query, TRUE);
+	if (change->default_db) g_string_free(change->default_db, TRUE);
+	if (change->charset) g_string_free(change->charset, TRUE);
+	if (change->charset_client) g_string_free(change->charset_client, TRUE);
+	if (change->charset_connection) g_string_free(change->charset_connection, TRUE);
+	if (change->charset_results) g_string_free(change->charset_results, TRUE);
+	if (change->sql_mode) g_string_free(change->sql_mode, TRUE);
+
+	g_free(change);
+}
+
+network_mysqld_session *network_mysqld_session_new(void) {
+	network_mysqld_session *session;
+
+	session = g_new0(network_mysqld_session, 1);
+	session->server_status = SERVER_STATUS_AUTOCOMMIT;
+
+	return session;
+}
+
+void network_mysqld_session_free(network_mysqld_session *session) {
+	if (!session) return;
+
+	network_mysqld_session_change_free(session->change);
+
+	g_free(session);
+}
+
+/**
+ * forget the state, the server dropped it
+ *
+ * used on COM_CHANGE_USER
+ */
+void network_mysqld_session_reset(network_mysqld_session *session) {
+	network_mysqld_session_change_free(session->change);
+	session->change = NULL;
+
+	session->server_status = SERVER_STATUS_AUTOCOMMIT;
+	session->pins = 0;
+}
+
+static gboolean span_is(const gchar *query, sql_token_span *span, const gchar *word, gsize word_len) {
+	return span->len == word_len && 0 == g_ascii_strncasecmp(query + span->offset, word, word_len);
+}
+
+static gboolean span_is_user_var(const gchar *query, sql_token_span *span) {
+	return span->token_id == TK_LITERAL &&
+		span->len > 1 &&
+		query[span->offset] == '@' &&
+		query[span->offset + 1] != '@';
+}
+
+/**
+ * check if a value is a plain name we can put into a SET statement
+ */
+static gboolean span_is_name(const gchar *query, sql_token_span *span) {
+	guint i;
+
+	if (span->token_id != TK_LITERAL && span->token_id != TK_STRING) return FALSE;
+	if (span->len == 0) return FALSE;
+
+	for (i = 0; i < span->len; i++) {
+		gchar c = query[span->offset + i];
+
+		if (!g_ascii_isalnum(c) && c != '_') return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void session_change_set(GString **field, const gchar *query, sql_token_span *span) {
+	if (NULL == *field) *field = g_string_new(NULL);
+
+	g_string_assign_len(*field, query + span->offset, span->len);
+}
+
+static network_mysqld_session_change *session_change_get(network_mysqld_session *session) {
+	if (NULL == session->change) session->change = g_new0(network_mysqld_session_change, 1);
+
+	return session->change;
+}
+
+/**
+ * the end of the expression which starts at spans[ndx]
+ *
+ * @return the index of the , or ; which ends it, or end
+ */
+static guint session_expr_end(GArray *spans, guint ndx, guint end) {
+	gint depth = 0;
+
+	for (; ndx < end; ndx++) {
+		sql_token_span *tk = &g_array_index(spans, sql_token_span, ndx);
+
+		switch (tk->token_id) {
+		case TK_OBRACE:
+		case TK_FUNCTION: /* the ( is part of the function */
+			depth++;
+			break;
+		case TK_CBRACE:
+			depth--;
+			break;
+		case TK_COMMA:
+			if (depth <= 0) return ndx;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return end;
+}
+
+/**
+ * track a SET statement
+ *
+ * @param ndx the index of the token after the SET
+ * @param end the index of the token after the statement
+ */
+static void session_track_set(network_mysqld_session *session, const gchar *query, GArray *spans, guint ndx, guint end) {
+	while (ndx < end) {
+		sql_token_span *name, *value;
+		const gchar *var;
+		gsize var_len;
+		gboolean is_global = FALSE;
+		guint value_end;
+
+		name = &g_array_index(spans, sql_token_span, ndx);
+
+		if (span_is(query, name, C("GLOBAL")) ||
+		    span_is(query, name, C("PERSIST")) ||
+		    span_is(query, name, C("PERSIST_ONLY"))) {
+			is_global = TRUE;
+			ndx++;
+		} else if (span_is(query, name, C("SESSION")) ||
+		           span_is(query, name, C("LOCAL"))) {
+			ndx++;
+		}
+
+		if (ndx >= end) return;
+
+		name = &g_array_index(spans, sql_token_span, ndx);
+
+		if (span_is(query, name, C("NAMES"))) {
+			value_end = session_expr_end(spans, ndx + 1, end);
+
+			if (value_end == ndx + 2 &&
+			    span_is_name(query, (value = &g_array_index(spans, sql_token_span, ndx + 1))) &&
+			    value->token_id != TK_SQL_DEFAULT) {
+				network_mysqld_session_change *change = session_change_get(session);
+
+				session_change_set(&(change->charset), query, value);
+				session_change_set(&(change->charset_client), query, value);
+				session_change_set(&(change->charset_connection), query, value);
+				session_change_set(&(change->charset_results), query, value);
+			} else {
+				/* SET NAMES ... COLLATE ..., SET NAMES DEFAULT */
+				session->pins |= NETWORK_SESSION_PIN_SESSION_VARS;
+			}
+
+			ndx = value_end + 1;
+			continue;
+		}
+
+		if (name->token_id != TK_LITERAL) {
+			/* SET CHARACTER SET, SET TRANSACTION, SET PASSWORD, ... we don't parse */
+			if (!is_global && !span_is(query, name, C("PASSWORD"))) {
+				session->pins |= NETWORK_SESSION_PIN_SESSION_VARS;
+			}
+
+			return;
+		}
+
+		var = query + name->offset;
+		var_len = name->len;
+
+		if (span_is_user_var(query, name)) {
+			session->pins |= NETWORK_SESSION_PIN_USER_VARS;
+		} else if (var_len > 2 && var[0] == '@' && var[1] == '@') {
+			var += 2;
+			var_len -= 2;
+
+			if (var_len > sizeof("global.") - 1 && 0 == g_ascii_strncasecmp(var, C("global."))) {
+				is_global = TRUE;
+			} else if (var_len > sizeof("session.") - 1 && 0 == g_ascii_strncasecmp(var, C("session."))) {
+				var += sizeof("session.") - 1;
+				var_len -= sizeof("session.") - 1;
+			} else if (var_len > sizeof("local.") - 1 && 0 == g_ascii_strncasecmp(var, C("local."))) {
+				var += sizeof("local.") - 1;
+				var_len -= sizeof("local.") - 1;
+			}
+		}
+
+		value_end = session_expr_end(spans, ndx + 1, end);
+
+		if (is_global || span_is_user_var(query, name)) {
+			ndx = value_end + 1;
+			continue;
+		}
+
+		value = NULL;
+		if (value_end == ndx + 3) {
+			sql_token_span *op = &g_array_index(spans, sql_token_span, ndx + 1);
+
+			if (op->token_id == TK_EQ || op->token_id == TK_ASSIGN) {
+				value = &g_array_index(spans, sql_token_span, ndx + 2);
+			}
+		}
+
+#define VAR_IS(x) (var_len == sizeof(x) - 1 && 0 == g_ascii_strncasecmp(var, C(x)))
+		if (VAR_IS("autocommit")) {
+			/* the server_status tells us */
+		} else if (VAR_IS("sql_mode") && value &&
+		           (value->token_id == TK_STRING ||
+		            (value->token_id == TK_LITERAL && query[value->offset] != '@'))) {
+			session_change_set(&(session_change_get(session)->sql_mode), query, value);
+		} else if (VAR_IS("character_set_client") && value && span_is_name(query, value)) {
+			session_change_set(&(session_change_get(session)->charset_client), query, value);
+		} else if (VAR_IS("character_set_connection") && value && span_is_name(query, value)) {
+			session_change_set(&(session_change_get(session)->charset_connection), query, value);
+		} else if (VAR_IS("character_set_results") && value &&
+		           (value->token_id == TK_SQL_NULL || span_is_name(query, value))) {
+			session_change_set(&(session_change_get(session)->charset_results), query, value);
+		} else {
+			session->pins |= NETWORK_SESSION_PIN_SESSION_VARS;
+		}
+#undef VAR_IS
+
+		ndx = value_end + 1;
+	}
+}
+
+/**
+ * look at a /&lowast;!<version> ... &lowast;/ comment
+ *
+ * we don't scan its content, but a statement in it which changes the session pins us
+ */
+static void session_track_mysql_comment(network_mysqld_session *session, const gchar *text, gsize text_len) {
+	gsize i = 0;
+
+	while (i < text_len && (g_ascii_isdigit(text[i]) || g_ascii_isspace(text[i]))) i++;
+
+	text += i;
+	text_len -= i;
+
+	if ((text_len >= 4 && 0 == g_ascii_strncasecmp(text, C("SET "))) ||
+	    (text_len >= 4 && 0 == g_ascii_strncasecmp(text, C("USE "))) ||
+	    (text_len >= 5 && 0 == g_ascii_strncasecmp(text, C("LOCK "))) ||
+	    (text_len >= 7 && 0 == g_ascii_strncasecmp(text, C("CREATE ")))) {
+		session->pins |= NETWORK_SESSION_PIN_SESSION_VARS;
+	}
+}
+
+/**
+ * track a statement of a COM_QUERY
+ *
+ * @param start the index of the first token of the statement
+ * @param end   the index of the token after the statement
+ */
+static void session_track_statement(network_mysqld_session *session, const gchar *query, GArray *spans, guint start, guint end) {
+	sql_token_span *first = NULL;
+	guint first_ndx = end;
+	guint i;
+
+	for (i = start; i < end; i++) {
+		sql_token_span *tk = &g_array_index(spans, sql_token_span, i);
+		sql_token_span *next = (i + 1 < end) ? &g_array_index(spans, sql_token_span, i + 1) : NULL;
+
+		switch (tk->token_id) {
+		case TK_COMMENT:
+			continue;
+		case TK_COMMENT_MYSQL:
+			session_track_mysql_comment(session, query + tk->offset, tk->len);
+			continue;
+		case TK_SQL_SQL_CALC_FOUND_ROWS:
+			session->pins |= NETWORK_SESSION_PIN_FOUND_ROWS;
+			break;
+		case TK_SQL_INTO:
+			if (next && span_is_user_var(query, next)) session->pins |= NETWORK_SESSION_PIN_USER_VARS;
+			break;
+		case TK_FUNCTION:
+			if (span_is(query, tk, C("GET_LOCK"))) session->pins |= NETWORK_SESSION_PIN_LOCKS;
+			break;
+		case TK_LITERAL:
+			if (next && next->token_id == TK_ASSIGN && span_is_user_var(query, tk)) {
+				session->pins |= NETWORK_SESSION_PIN_USER_VARS;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if (NULL == first) {
+			first = tk;
+			first_ndx = i;
+		}
+	}
+
+	if (NULL == first) return;
+
+	switch (first->token_id) {
+	case TK_SQL_SET:
+		session_track_set(session, query, spans, first_ndx + 1, end);
+		break;
+	case TK_SQL_USE: {
+		sql_token_span *db;
+
+		if (first_ndx + 2 == end && (db = &g_array_index(spans, sql_token_span, first_ndx + 1))->token_id == TK_LITERAL) {
+			session_change_set(&(session_change_get(session)->default_db), query, db);
+		}
+		break; }
+	case TK_SQL_INSERT:
+	case TK_SQL_UPDATE:
+	case TK_SQL_DELETE:
+	case TK_SQL_REPLACE:
+	case TK_SQL_LOAD:
+		session->pins |= NETWORK_SESSION_PIN_LAST_WRITE;
+		break;
+	case TK_SQL_LOCK:
+		session->pins |= NETWORK_SESSION_PIN_TABLE_LOCKS;
+		break;
+	case TK_SQL_UNLOCK:
+		session->pins &= ~NETWORK_SESSION_PIN_TABLE_LOCKS;
+		break;
+	case TK_SQL_CREATE:
+		if (first_ndx + 1 < end && span_is(query, &g_array_index(spans, sql_token_span, first_ndx + 1), C("TEMPORARY"))) {
+			session->pins |= NETWORK_SESSION_PIN_TEMP_TABLES;
+		}
+		break;
+	case TK_LITERAL:
+		if (span_is(query, first, C("PREPARE"))) {
+			session->pins |= NETWORK_SESSION_PIN_PREPARE;
+		} else if (span_is(query, first, C("XA"))) {
+			session->pins |= NETWORK_SESSION_PIN_LOCKS;
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * track the command the client sends
+ *
+ * the pins are set right away, the session-variables are applied when the
+ * server accepted them, see network_mysqld_session_track_result()
+ *
+ * @param packet the command
+ * @param offset where the payload starts in the packet
+ */
+void network_mysqld_session_track_query(network_mysqld_session *session, GString *packet, gsize offset) {
+	const gchar *query;
+	gsize query_len;
+	GArray *spans;
+	guint i, start;
+
+	network_mysqld_session_change_free(session->change);
+	session->change = NULL;
+
+	if (packet->len < offset + 1) return;
+
+	switch ((guchar)packet->str[offset]) {
+	case COM_CHANGE_USER:
+		network_mysqld_session_reset(session);
+		return;
+	case COM_QUERY:
+		break;
+	case COM_STMT_EXECUTE:
+		/* the client gets the insert-id and the affected rows from its OK packet */
+		session->pins &= ~NETWORK_SESSION_PIN_LAST_WRITE;
+		return;
+	default:
+		return;
+	}
+
+	/* FOUND_ROWS() was the statement right after the SQL_CALC_FOUND_ROWS,
+	 * LAST_INSERT_ID() and ROW_COUNT() the one right after the write */
+	session->pins &= ~(NETWORK_SESSION_PIN_FOUND_ROWS | NETWORK_SESSION_PIN_LAST_WRITE);
+
+	query = packet->str + offset + 1;
+	query_len = packet->len - offset - 1;
+
+	if (NULL == (spans = sql_scanner_thread_scan(query, query_len))) {
+		/* we don't know what it does */
+		session->pins |= NETWORK_SESSION_PIN_SESSION_VARS;
+
+		return;
+	}
+
+	for (i = 0, start = 0; i <= spans->len; i++) {
+		if (i == spans->len || g_array_index(spans, sql_token_span, i).token_id == TK_SEMICOLON) {
+			session_track_statement(session, query, spans, start, i);
+			start = i + 1;
+		}
+	}
+
+	if (session->change) {
+		session->change->query = g_string_new_len(packet->str + offset, packet->len - offset);
+	}
+}
+
+static void session_apply(GString *field, const GString *value) {
+	if (value) g_string_assign_len(field, S(value));
+}
+
+/**
+ * the server finished a COM_QUERY
+ *
+ * if it is the one the pending change belongs to and it succeeded, the
+ * client and the server have the new session-variables
+ *
+ * @param query  the COM_QUERY, NULL if it was the command of the client
+ * @param server the server connection, may be NULL
+ */
+void network_mysqld_session_track_result(network_mysqld_session *session, const GString *query, gboolean is_ok, network_socket *client, network_socket *server) {
+	network_mysqld_session_change *change = session->change;
+
+	if (NULL == change) return;
+	if (query && !g_string_equal(query, change->query)) return;
+
+	if (is_ok) {
+		session_apply(client->default_db, change->default_db);
+		session_apply(client->charset, change->charset);
+		session_apply(client->charset_client, change->charset_client);
+		session_apply(client->charset_connection, change->charset_connection);
+		session_apply(client->charset_results, change->charset_results);
+		session_apply(client->sql_mode, change->sql_mode);
+
+		if (server) {
+			session_apply(server->default_db, change->default_db);
+			session_apply(server->charset, change->charset);
+			session_apply(server->charset_client, change->charset_client);
+			session_apply(server->charset_connection, change->charset_connection);
+			session_apply(server->charset_results, change->charset_results);
+			session_apply(server->sql_mode, change->sql_mode);
+		}
+	}
+
+	network_mysqld_session_change_free(change);
+	session->change = NULL;
+}
+
+/**
+ * check if the server connection can go back to the pool
+ *
+ * we have to be outside of a transaction, in autocommit mode and have no
+ * state on the server which we can't restore on another connection
+ */
+gboolean network_mysqld_session_is_idle(network_mysqld_session *session) {
+	if (session->pins) return FALSE;
+	if (session->server_status & SERVER_STATUS_IN_TRANS) return FALSE;
+	if (!(session->server_status & SERVER_STATUS_AUTOCOMMIT)) return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * check if the results of the session only depend on what the key of the query-cache covers
+ *
+ * a temporary table shadows the table of the same name for all other sessions,
+ * the session-variables we don't track (time_zone, ...) change the results
+ */
+gboolean network_mysqld_session_is_cacheable(network_mysqld_session *session) {
+	if (session->pins & NETWORK_SESSION_PIN_TEMP_TABLES) return FALSE;
+	if (session->pins & NETWORK_SESSION_PIN_SESSION_VARS) return FALSE;
+
+	return TRUE;
+}
+
+static gboolean session_is_name(const GString *s) {
+	gsize i;
+
+	if (s->len == 0) return FALSE;
+
+	for (i = 0; i < s->len; i++) {
+		if (!g_ascii_isalnum(s->str[i]) && s->str[i] != '_') return FALSE;
+	}
+
+	return TRUE;
+}
+
+static GString *session_query_new(guchar command) {
+	GString *query = g_string_sized_new(64);
+
+	g_string_append_c(query, command);
+
+	return query;
+}
+
+/**
+ * add a assignment to the SET statement, start it if it is the first one
+ */
+static void session_restore_append(GString **set, const gchar *assignment) {
+	if (NULL == *set) {
+		*set = session_query_new(COM_QUERY);
+		g_string_append(*set, "SET ");
+	} else {
+		g_string_append(*set, ", ");
+	}
+
+	g_string_append(*set, assignment);
+}
+
+static void session_restore_charset(GString **set, const gchar *var, GString *client_value, GString *server_value) {
+	if (g_string_equal(client_value, server_value)) return;
+	if (!session_is_name(client_value)) return;
+
+	session_restore_append(set, var);
+	g_string_append(*set, " = ");
+	g_string_append_len(*set, S(client_value));
+
+	g_string_assign_len(server_value, S(client_value));
+}
+
+/**
+ * the commands which give the server connection the session of the client
+ *
+ * only what differs between the client and the server connection is sent:
+ * the default-db as COM_INIT_DB and the charsets and the sql_mode as one
+ * SET statement. Both don't depend on each other and can be sent without
+ * waiting for the first result.
+ *
+ * the charsets and the sql_mode of the server are set right away, the
+ * default-db once the server accepted the COM_INIT_DB
+ *
+ * @param queries GString *, the commands are appended to it
+ */
+void network_mysqld_session_restore(GQueue *queries, network_socket *client, network_socket *server) {
+	GString *query;
+	GString *set = NULL;
+
+	if (client->default_db->len > 0 && !g_string_equal(client->default_db, server->default_db)) {
+		query = session_query_new(COM_INIT_DB);
+		g_string_append_len(query, S(client->default_db));
+		g_queue_push_tail(queries, query);
+	}
+
+	if (session_is_name(client->charset_client) &&
+	    g_string_equal(client->charset_client, client->charset_connection) &&
+	    g_string_equal(client->charset_client, client->charset_results) &&
+	    (!g_string_equal(client->charset_client, server->charset_client) ||
+	     !g_string_equal(client->charset_connection, server->charset_connection) ||
+	     !g_string_equal(client->charset_results, server->charset_results))) {
+		/* one assignment for all three */
+		session_restore_append(&set, "NAMES ");
+		g_string_append_len(set, S(client->charset_client));
+
+		g_string_assign_len(server->charset_client, S(client->charset_client));
+		g_string_assign_len(server->charset_connection, S(client->charset_connection));
+		g_string_assign_len(server->charset_results, S(client->charset_results));
+	} else {
+		session_restore_charset(&set, "character_set_client", client->charset_client, server->charset_client);
+		session_restore_charset(&set, "character_set_connection", client->charset_connection, server->charset_connection);
+		session_restore_charset(&set, "character_set_results", client->charset_results, server->charset_results);
+	}
+	g_string_assign_len(server->charset, S(client->charset));
+
+	if (!g_string_equal(client->sql_mode, server->sql_mode)) {
+		gsize i;
+
+		session_restore_append(&set, "sql_mode = '");
+		for (i = 0; i < client->sql_mode->len; i++) {
+			gchar c = client->sql_mode->str[i];
+
+			if (c == '\'' || c == '\\') g_string_append_c(set, '\\');
+			g_string_append_c(set, c);
+		}
+		g_string_append_c(set, '\'');
+
+		g_string_assign_len(server->sql_mode, S(client->sql_mode));
+	}
+
+	if (set) g_queue_push_tail(queries, set);
+}
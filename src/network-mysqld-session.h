@@ -0,0 +1,84 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_MYSQLD_SESSION_H_
+#define _NETWORK_MYSQLD_SESSION_H_
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-exports.h"
+
+/** @file
+ *
+ * the transaction- and session-state of a client, to multiplex the clients
+ * over the pooled server connections
+ *
+ * the server connection can go back to the pool if the client isn't in a
+ * transaction and the session has no state we can't restore on another
+ * connection. The default-db, the charsets and the sql_mode are restored,
+ * everything else pins the client to its connection.
+ */
+
+typedef enum {
+	NETWORK_SESSION_PIN_USER_VARS    = 1 << 0, /**< SET @a = ..., @a := ..., ... INTO @a */
+	NETWORK_SESSION_PIN_TEMP_TABLES  = 1 << 1, /**< CREATE TEMPORARY TABLE */
+	NETWORK_SESSION_PIN_TABLE_LOCKS  = 1 << 2, /**< LOCK TABLES, until UNLOCK TABLES */
+	NETWORK_SESSION_PIN_LOCKS        = 1 << 3, /**< GET_LOCK(), XA */
+	NETWORK_SESSION_PIN_SESSION_VARS = 1 << 4, /**< SET of a variable we don't restore */
+	NETWORK_SESSION_PIN_PREPARE      = 1 << 5, /**< PREPARE ... FROM, the statement lives on the server */
+	NETWORK_SESSION_PIN_FOUND_ROWS   = 1 << 6, /**< SQL_CALC_FOUND_ROWS, FOUND_ROWS() follows on the same connection */
+	NETWORK_SESSION_PIN_LAST_WRITE   = 1 << 7  /**< INSERT, UPDATE, ..., LAST_INSERT_ID() and ROW_COUNT() follow on the same connection */
+} network_mysqld_session_pin_t;
+
+/**
+ * the session-variables a COM_QUERY changes, NULL if it doesn't change them
+ *
+ * they are applied to both sides of the connection once the server said OK
+ */
+typedef struct {
+	GString *query;               /**< the COM_QUERY, to find its result */
+
+	GString *default_db;          /**< USE <db> */
+	GString *charset;             /**< SET NAMES <charset> */
+	GString *charset_client;
+	GString *charset_connection;
+	GString *charset_results;
+	GString *sql_mode;
+} network_mysqld_session_change;
+
+typedef struct {
+	guint16 server_status;        /**< of the last OK or EOF, we look at SERVER_STATUS_IN_TRANS and SERVER_STATUS_AUTOCOMMIT */
+	guint pins;                   /**< network_mysqld_session_pin_t */
+
+	network_mysqld_session_change *change; /**< of the COM_QUERY in flight, NULL if it changes nothing */
+} network_mysqld_session;
+
+NETWORK_API network_mysqld_session *network_mysqld_session_new(void);
+NETWORK_API void network_mysqld_session_free(network_mysqld_session *session);
+NETWORK_API void network_mysqld_session_reset(network_mysqld_session *session);
+NETWORK_API void network_mysqld_session_track_query(network_mysqld_session *session, GString *packet, gsize offset);
+NETWORK_API void network_mysqld_session_track_result(network_mysqld_session *session, const GString *query, gboolean is_ok, network_socket *client, network_socket *server);
+NETWORK_API gboolean network_mysqld_session_is_idle(network_mysqld_session *session);
+NETWORK_API gboolean network_mysqld_session_is_cacheable(network_mysqld_session *session);
+NETWORK_API void network_mysqld_session_restore(GQueue *queries, network_socket *client, network_socket *server);
+
+#endif
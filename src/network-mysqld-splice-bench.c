@@ -0,0 +1,190 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/**
+ * compare copying each row-packet of a recv-chunk into a GString with
+ * the header-scan of network_mysqld_proto_scan_packets() the splice-path uses
+ *
+ *   $ network-mysqld-splice-bench [<rows> [<row-size> [<rounds>]]]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+
+#define DEFAULT_ROWS     100000
+#define DEFAULT_ROW_SIZE 64
+#define DEFAULT_ROUNDS   20
+
+#define CHUNK_SIZE       (16 * 1024) /* what a read() of the server-socket returns at most */
+#define MARKS_MAX        64          /* NETWORK_MYSQLD_SPLICE_MARKS_MAX */
+
+typedef struct {
+	guint64 rows;
+	gdouble secs;
+} bench_result;
+
+/**
+ * fill recv-chunks with complete packets of a resultset
+ */
+static GPtrArray *bench_chunks_new(guint rows, guint row_size) {
+	GPtrArray *chunks = g_ptr_array_new();
+	GString *chunk = NULL;
+	guint i, j;
+
+	for (i = 0; i < rows; i++) {
+		if (!chunk || chunk->len + NET_HEADER_SIZE + row_size > CHUNK_SIZE) {
+			chunk = g_string_sized_new(CHUNK_SIZE);
+			g_ptr_array_add(chunks, chunk);
+		}
+
+		network_mysqld_proto_append_int8(chunk, row_size & 0xff);
+		network_mysqld_proto_append_int8(chunk, (row_size >> 8) & 0xff);
+		network_mysqld_proto_append_int8(chunk, (row_size >> 16) & 0xff);
+		network_mysqld_proto_append_int8(chunk, (i + 2) & 0xff);
+
+		/* only the headers get looked at */
+		for (j = 0; j < row_size; j++) {
+			g_string_append_c(chunk, 'x');
+		}
+	}
+
+	return chunks;
+}
+
+/**
+ * the way network_mysqld_con_get_packet() takes the packets: a GString each
+ */
+static void bench_get_packet(GPtrArray *chunks, guint rounds, bench_result *res) {
+	GTimer *timer = g_timer_new();
+	guint r, i;
+
+	res->rows = 0;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < chunks->len; i++) {
+			GString *chunk = chunks->pdata[i];
+			gsize off = 0;
+
+			while (chunk->len - off >= NET_HEADER_SIZE) {
+				GString header;
+				GString *packet;
+				guint32 packet_len;
+
+				header.str = chunk->str + off;
+				header.len = NET_HEADER_SIZE;
+				header.allocated_len = NET_HEADER_SIZE;
+
+				packet_len = network_mysqld_proto_get_packet_len(&header);
+				if (chunk->len - off - NET_HEADER_SIZE < packet_len) break;
+
+				packet = g_string_new_len(chunk->str + off, NET_HEADER_SIZE + packet_len);
+				g_string_free(packet, TRUE);
+
+				off += NET_HEADER_SIZE + packet_len;
+				res->rows++;
+			}
+		}
+	}
+
+	res->secs = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+}
+
+/**
+ * the way network_mysqld_con_splice_query_result() takes the packets: views into the chunk
+ */
+static void bench_scan_packets(GPtrArray *chunks, guint rounds, bench_result *res) {
+	GTimer *timer = g_timer_new();
+	guint r, i;
+
+	res->rows = 0;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < chunks->len; i++) {
+			GString *chunk = chunks->pdata[i];
+			network_mysqld_packet_mark marks[MARKS_MAX];
+			gsize off = 0, scanned;
+			guint marks_len;
+
+			while ((marks_len = network_mysqld_proto_scan_packets(chunk->str + off, chunk->len - off, marks, MARKS_MAX, &scanned))) {
+				off += scanned;
+				res->rows += marks_len;
+			}
+		}
+	}
+
+	res->secs = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+}
+
+static void bench_report(const char *name, bench_result *res) {
+	printf("%-16s %12"G_GUINT64_FORMAT" rows %8.3f s %12.0f rows/s\n",
+			name,
+			res->rows,
+			res->secs,
+			res->secs > 0 ? res->rows / res->secs : 0.0);
+}
+
+int main(int argc, char **argv) {
+	GPtrArray *chunks;
+	bench_result get_res, scan_res;
+	guint rows = DEFAULT_ROWS;
+	guint row_size = DEFAULT_ROW_SIZE;
+	guint rounds = DEFAULT_ROUNDS;
+	guint i;
+
+	if (argc > 1) rows = strtoul(argv[1], NULL, 10);
+	if (argc > 2) row_size = strtoul(argv[2], NULL, 10);
+	if (argc > 3) rounds = strtoul(argv[3], NULL, 10);
+
+	if (row_size < 1 || row_size > CHUNK_SIZE - NET_HEADER_SIZE) {
+		fprintf(stderr, "<row-size> has to be between 1 and %d\n", CHUNK_SIZE - NET_HEADER_SIZE);
+
+		return EXIT_FAILURE;
+	}
+
+	chunks = bench_chunks_new(rows, row_size);
+
+	printf("%u rows of %u bytes in %u chunks, %u rounds\n", rows, row_size, chunks->len, rounds);
+
+	bench_get_packet(chunks, rounds, &get_res);
+	bench_scan_packets(chunks, rounds, &scan_res);
+
+	bench_report("get_packet", &get_res);
+	bench_report("scan_packets", &scan_res);
+
+	if (get_res.rows != scan_res.rows) {
+		fprintf(stderr, "row count differs: %"G_GUINT64_FORMAT" != %"G_GUINT64_FORMAT"\n", get_res.rows, scan_res.rows);
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < chunks->len; i++) {
+		g_string_free(chunks->pdata[i], TRUE);
+	}
+	g_ptr_array_free(chunks, TRUE);
+
+	return EXIT_SUCCESS;
+}
@@ -62,8 +62,10 @@
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
 #include "network-conn-pool.h"
+#include "network-mysqld-scatter.h"
 #include "chassis-mainloop.h"
 #include "chassis-event.h"
+#include "chassis-stats.h"
 #include "lua-scope.h"
 #include "glib-ext.h"
 #include "network-asn1.h"
@@ -103,6 +105,24 @@
 #define C(x) x, sizeof(x) - 1
 #define S(x) x->str, x->len
 
+/**
+ * max. number of connections accept()ed per wakeup of a listen-socket
+ */
+#define NETWORK_MYSQLD_ACCEPT_BATCH 64
+
+/**
+ * default watermarks of the resultset flush policy
+ *
+ * @see network_mysqld_resultset_flush_t
+ */
+#define NETWORK_MYSQLD_RESULTSET_FLUSH_BYTES (64 * 1024)
+#define NETWORK_MYSQLD_RESULTSET_FLUSH_LATENCY_US (10 * 1000)
+
+/**
+ * how often a connection checks if the global resultset budget has room again
+ */
+#define NETWORK_MYSQLD_RESULTSET_WAIT_US (10 * 1000)
+
 /**
  * call the cleanup callback for the current connection
  *
@@ -121,9 +141,9 @@ network_socket_retval_t plugin_call_cleanup(chassis *srv, network_mysqld_con *co
 	
 	if (!func) return retval;
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(network_mysqld_con_get_lua_scope(con));
 	retval = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	UNLOCK_LUA(network_mysqld_con_get_lua_scope(con));
 
 	return retval;
 }
@@ -159,9 +179,9 @@ plugin_call_timeout(chassis *srv, network_mysqld_con *con) {
         return NETWORK_SOCKET_SUCCESS; 
     }
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(network_mysqld_con_get_lua_scope(con));
 	retval = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	UNLOCK_LUA(network_mysqld_con_get_lua_scope(con));
 
 	return retval;
 }
@@ -173,6 +193,7 @@ chassis_private *network_mysqld_priv_init(void) {
 	priv = g_new0(chassis_private, 1);
 
 	priv->cons = g_ptr_array_new();
+	priv->cons_mutex = g_mutex_new();
 	priv->sc = lua_scope_new();
 	priv->backends  = network_backends_new();
 
@@ -237,9 +258,17 @@ void network_mysqld_priv_free(chassis G_GNUC_UNUSED *chas, chassis_private *priv
 	if (!priv) return;
 
 	g_ptr_array_free(priv->cons, TRUE);
+	g_mutex_free(priv->cons_mutex);
 
 	network_backends_free(priv->backends);
 
+	if (priv->lua_global) {
+		g_string_free(priv->lua_global->config, TRUE);
+		g_free(priv->lua_global);
+	}
+
+	network_shard_map_free(priv->shard_map);
+
 	lua_scope_free(priv->sc);
 
 	g_free(priv);
@@ -275,6 +304,7 @@ network_mysqld_con *network_mysqld_con_new() {
 	con = g_new0(network_mysqld_con, 1);
 	con->timestamps = chassis_timestamps_new();
 	con->parse.command = -1;
+	con->eof_translate.server_status = SERVER_STATUS_AUTOCOMMIT;
 
 	con->auth_switch_to_method = g_string_new(NULL);
 	con->auth_switch_to_round  = 0;
@@ -295,6 +325,9 @@ network_mysqld_con *network_mysqld_con_new() {
 
     con->wait_clt_next_sql.tv_sec = 1;
 	con->wait_clt_next_sql.tv_usec = 0;
+
+	con->resultset_flush.max_bytes = NETWORK_MYSQLD_RESULTSET_FLUSH_BYTES;
+	con->resultset_flush.max_latency_us = NETWORK_MYSQLD_RESULTSET_FLUSH_LATENCY_US;
 #undef SECONDS
 #undef MINUTES
 #undef HOURS
@@ -302,10 +335,102 @@ network_mysqld_con *network_mysqld_con_new() {
 	return con;
 }
 
+/**
+ * get the lua-scope the scripts of this connection run in
+ *
+ * connections owned by a event-thread use the lua_State of that thread
+ */
+lua_scope *network_mysqld_con_get_lua_scope(network_mysqld_con *con) {
+	if (con->event_loop && con->event_loop->sc) return con->event_loop->sc;
+
+	return con->srv->priv->sc;
+}
+
+/**
+ * get the event-loop which owns the sockets of this connection
+ *
+ * without --event-threads that is the main-loop
+ */
+chassis_event_t *network_mysqld_con_get_event_loop(network_mysqld_con *con) {
+	if (con->event_loop) return con->event_loop;
+
+	return con->srv->event_loop;
+}
+
 void network_mysqld_add_connection(chassis *srv, network_mysqld_con *con) {
 	con->srv = srv;
 
+	g_mutex_lock(srv->priv->cons_mutex);
 	g_ptr_array_add(srv->priv->cons, con);
+	g_mutex_unlock(srv->priv->cons_mutex);
+}
+
+/**
+ * classify the query the client sent, once per query
+ *
+ * the query is only around until it is forwarded, ask for it in read_query()
+ *
+ * @return NULL if the current packet isn't a COM_QUERY or COM_STMT_PREPARE
+ * @see sql_classify
+ */
+sql_classification *network_mysqld_con_get_classification(network_mysqld_con *con) {
+	network_packet packet;
+	guint8 command;
+
+	if (con->classification_is_valid) return &(con->classification);
+	if (NULL == con->client) return NULL;
+
+	packet.data = g_queue_peek_head(con->client->recv_queue->chunks);
+	packet.offset = 0;
+
+	if (NULL == packet.data) return NULL;
+
+	if (0 != network_mysqld_proto_skip_network_header(&packet) ||
+	    0 != network_mysqld_proto_get_int8(&packet, &command)) {
+		return NULL;
+	}
+
+	if (command != COM_QUERY && command != COM_STMT_PREPARE) return NULL;
+
+	sql_classify(&(con->classification), packet.data->str + packet.offset, packet.data->len - packet.offset);
+	con->classification_is_valid = TRUE;
+
+	return &(con->classification);
+}
+
+/**
+ * build the digest of the query the client sent, once per query
+ *
+ * the query is only around until it is forwarded, ask for it in read_query()
+ *
+ * @return NULL if the current packet isn't a COM_QUERY or COM_STMT_PREPARE
+ * @see sql_digest_compute
+ */
+sql_digest *network_mysqld_con_get_digest(network_mysqld_con *con) {
+	network_packet packet;
+	guint8 command;
+
+	if (con->digest_is_valid) return con->digest;
+	if (NULL == con->client) return NULL;
+
+	packet.data = g_queue_peek_head(con->client->recv_queue->chunks);
+	packet.offset = 0;
+
+	if (NULL == packet.data) return NULL;
+
+	if (0 != network_mysqld_proto_skip_network_header(&packet) ||
+	    0 != network_mysqld_proto_get_int8(&packet, &command)) {
+		return NULL;
+	}
+
+	if (command != COM_QUERY && command != COM_STMT_PREPARE) return NULL;
+
+	if (NULL == con->digest) con->digest = sql_digest_new();
+
+	sql_digest_compute(con->digest, packet.data->str + packet.offset, packet.data->len - packet.offset);
+	con->digest_is_valid = TRUE;
+
+	return con->digest;
 }
 
 /**
@@ -322,17 +447,29 @@ void network_mysqld_con_free(network_mysqld_con *con) {
 		con->parse.data_free(con->parse.data);
 	}
 
+	if (con->scatter) network_mysqld_scatter_free(con->scatter);
+
+	if (con->resultset_is_waiting) event_del(&(con->resultset_wait));
+
 	if (con->server) network_socket_free(con->server);
 	if (con->client) network_socket_free(con->client);
 
 	g_string_free(con->auth_switch_to_method, TRUE);
 	g_string_free(con->auth_switch_to_data, TRUE);
 
+	if (con->digest) sql_digest_free(con->digest);
+
 	/* we are still in the conns-array */
 
+	g_mutex_lock(con->srv->priv->cons_mutex);
 	g_ptr_array_remove_fast(con->srv->priv->cons, con);
+	g_mutex_unlock(con->srv->priv->cons_mutex);
 	chassis_timestamps_free(con->timestamps);
 
+	if (con->event_loop) g_atomic_int_add(&(con->event_loop->con_count), -1);
+
+	if (con->resultset_buffered) CHASSIS_STATS_ADD_INT64_NAME(resultset_bytes, -(gint64)con->resultset_buffered);
+
 	g_debug("%s: connections total: %d, free con:%p",
             G_STRLOC, con->srv->priv->cons->len, con);
 	g_free(con);
@@ -415,6 +552,9 @@ int network_mysqld_queue_append_raw(network_socket *sock, network_queue *queue,
 		/* the ->last_packet_id is undefined, accept what we get */
 		sock->last_packet_id = packet_id;
 		sock->packet_id_is_reset = FALSE;
+
+		/* a command we forward */
+		if (queue == sock->send_queue && packet_id == 0) network_socket_start_command(sock);
 	} else if (packet_id != (guint8)(sock->last_packet_id + 1)) {
 		sock->last_packet_id++;
 #if 0
@@ -451,6 +591,9 @@ int network_mysqld_queue_append(network_socket *sock, network_queue *queue, cons
 		if (sock->packet_id_is_reset) {
 			sock->packet_id_is_reset = FALSE;
 			sock->last_packet_id = 0xff; /** the ++last_packet_id will make sure we send a 0 */
+
+			/* a command we send */
+			if (queue == sock->send_queue) network_socket_start_command(sock);
 		}
 
 		network_mysqld_proto_append_packet_len(s, cur_packet_len);
@@ -858,7 +1001,7 @@ network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int s
 				 * FIXME: the 2-packet win-auth protocol enhancements aren't properly tested yet.
 				 * therefore they are disabled for now.
 				 */
-				g_string_free(g_queue_pop_head(recv_sock->recv_queue->chunks), TRUE);
+				network_queue_chunk_free(g_queue_pop_head(recv_sock->recv_queue->chunks));
 
 				network_mysqld_con_send_error(recv_sock, C("long packets for windows-authentication aren't completely handled yet. Please use another auth-method for now."));
 
@@ -952,13 +1095,526 @@ network_socket_retval_t plugin_call(chassis *srv, network_mysqld_con *con, int s
         return NETWORK_SOCKET_SUCCESS; 
     }
 
-	LOCK_LUA(srv->priv->sc);
+	LOCK_LUA(network_mysqld_con_get_lua_scope(con));
 	ret = (*func)(srv, con);
-	UNLOCK_LUA(srv->priv->sc);
+	UNLOCK_LUA(network_mysqld_con_get_lua_scope(con));
 
 	return ret;
 }
 
+/**
+ * check if client and server disagree about CLIENT_DEPRECATE_EOF
+ *
+ * a pooled connection may have negotiated it, while the client didn't or the other way around
+ */
+static gboolean network_mysqld_con_eof_is_translated(network_mysqld_con *con) {
+	return con->server && con->client->is_eof_deprecated != con->server->is_eof_deprecated;
+}
+
+/**
+ * rewrite a EOF into the format of the client
+ *
+ * tracks the server-status of the EOF
+ */
+static int network_mysqld_con_eof_convert(network_mysqld_con *con, GString *packet) {
+	network_mysqld_eof_packet_t *eof;
+	network_packet p;
+	int err = 0;
+
+	p.data = packet;
+	p.offset = NET_HEADER_SIZE;
+
+	eof = network_mysqld_eof_packet_new();
+
+	err = err || network_mysqld_proto_get_eof_packet(&p, eof);
+	if (!err) {
+		con->eof_translate.server_status = eof->server_status;
+
+		eof->is_deprecated = con->client->is_eof_deprecated;
+
+		g_string_truncate(packet, NET_HEADER_SIZE);
+		network_mysqld_proto_append_eof_packet(packet, eof);
+		network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+	}
+
+	network_mysqld_eof_packet_free(eof);
+
+	return err ? -1 : 0;
+}
+
+/**
+ * a classic EOF for the end of the definitions
+ *
+ * the server didn't send it, we take the status of the last OK or EOF
+ */
+static GString *network_mysqld_con_eof_new(network_mysqld_con *con, guint8 packet_id) {
+	network_mysqld_eof_packet_t *eof;
+	GString *packet;
+
+	eof = network_mysqld_eof_packet_new();
+	eof->server_status = con->eof_translate.server_status;
+
+	packet = g_string_sized_new(NET_HEADER_SIZE + 5);
+	network_mysqld_proto_append_int24(packet, 0);
+	network_mysqld_proto_append_int8(packet, packet_id);
+	network_mysqld_proto_append_eof_packet(packet, eof);
+	network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+	network_mysqld_eof_packet_free(eof);
+
+	return packet;
+}
+
+/**
+ * the field-definition-only resultset of a cursor, its EOF ends the response
+ */
+static gboolean network_mysqld_con_eof_is_cursor(network_mysqld_con *con) {
+	return con->parse.command == COM_STMT_EXECUTE &&
+		(con->eof_translate.server_status & SERVER_STATUS_CURSOR_EXISTS) &&
+		!(con->eof_translate.server_status & SERVER_MORE_RESULTS_EXISTS);
+}
+
+/**
+ * the column-definitions of a COM_STMT_PREPARE follow its params
+ */
+static void network_mysqld_con_eof_next_defs(network_mysqld_eof_translate_t *tr) {
+	tr->defs_left = tr->columns;
+	tr->columns = 0;
+	tr->state = tr->defs_left > 0 ? EOF_TRANSLATE_DEFS : EOF_TRANSLATE_INIT;
+}
+
+/**
+ * rewrite the EOFs of a response for a client which disagrees with the server about CLIENT_DEPRECATE_EOF
+ *
+ * handles the last packet of the server's recv-queue:
+ * - a classic server: the EOF after the definitions is dropped, the EOF at the end
+ *   of the rows becomes a OK with a 0xfe header
+ * - a server with CLIENT_DEPRECATE_EOF: a EOF is put after the definitions, the
+ *   OK at the end of the rows becomes a classic EOF
+ *
+ * the field-definition-only resultset of a cursor has only one EOF in both formats
+ *
+ * @param next  set to a packet the plugin has to see after the last one of the recv-queue
+ * @return FALSE if the packet got dropped
+ */
+static gboolean network_mysqld_con_eof_translate(network_mysqld_con *con, GString **next) {
+	network_mysqld_eof_translate_t *tr = &con->eof_translate;
+	GQueue *chunks = con->server->recv_queue->chunks;
+	GString *packet = g_queue_peek_tail(chunks);
+	gboolean is_continued = tr->is_continued;
+	network_packet p;
+	guint8 status;
+	int err = 0;
+
+	*next = NULL;
+
+	tr->is_continued = (packet->len == NET_HEADER_SIZE + PACKET_LEN_MAX);
+
+	/* the rest of a packet of 16M and more */
+	if (is_continued || packet->len <= NET_HEADER_SIZE) return TRUE;
+
+	status = packet->str[NET_HEADER_SIZE];
+
+	switch (con->parse.command) {
+	case COM_QUERY:
+	case COM_PROCESS_INFO:
+	case COM_STMT_EXECUTE:
+	case COM_STMT_PREPARE:
+		break;
+	case COM_FIELD_LIST:
+	case COM_STMT_FETCH:
+	case COM_DEBUG:
+	case COM_SET_OPTION:
+	case COM_SHUTDOWN:
+		/* only the EOF at the end */
+		if (network_mysqld_proto_packet_is_eof(packet)) network_mysqld_con_eof_convert(con, packet);
+
+		return TRUE;
+	default:
+		/* e.g. the 0xfe of COM_CHANGE_USER is a auth-method-switch */
+		return TRUE;
+	}
+
+	if (status == MYSQLD_PACKET_ERR) {
+		tr->state = EOF_TRANSLATE_INIT;
+		return TRUE;
+	}
+
+	p.data = packet;
+	p.offset = NET_HEADER_SIZE;
+
+	switch (tr->state) {
+	case EOF_TRANSLATE_INIT:
+		if (con->parse.command == COM_STMT_PREPARE) {
+			network_mysqld_stmt_prepare_ok_packet_t *prepare_ok;
+
+			prepare_ok = network_mysqld_stmt_prepare_ok_packet_new();
+
+			err = err || network_mysqld_proto_get_stmt_prepare_ok_packet(&p, prepare_ok);
+			if (!err) {
+				/* the params come first */
+				tr->defs_left = prepare_ok->num_params;
+				tr->columns   = prepare_ok->num_columns;
+				if (tr->defs_left == 0) {
+					tr->defs_left = tr->columns;
+					tr->columns = 0;
+				}
+				if (tr->defs_left > 0) tr->state = EOF_TRANSLATE_DEFS;
+			}
+
+			network_mysqld_stmt_prepare_ok_packet_free(prepare_ok);
+		} else if (status == MYSQLD_PACKET_OK) {
+			network_mysqld_ok_packet_t *ok;
+
+			ok = network_mysqld_ok_packet_new();
+			if (0 == network_mysqld_proto_get_ok_packet(&p, ok)) {
+				tr->server_status = ok->server_status;
+			}
+			network_mysqld_ok_packet_free(ok);
+		} else if (status != MYSQLD_PACKET_NULL && status != MYSQLD_PACKET_EOF) {
+			/* the field-count of a resultset */
+			err = err || network_mysqld_proto_get_lenenc_int(&p, &tr->defs_left);
+			if (!err) tr->state = EOF_TRANSLATE_DEFS;
+		}
+
+		return TRUE;
+	case EOF_TRANSLATE_DEFS:
+		if (tr->defs_left > 0) {
+			/* a param- or column-definition */
+			if (--tr->defs_left > 0 || con->parse.command != COM_STMT_PREPARE) return TRUE;
+
+			if (con->client->is_eof_deprecated) {
+				/* the EOF of the server follows */
+				tr->state = EOF_TRANSLATE_DEFS_EOF;
+			} else {
+				*next = network_mysqld_con_eof_new(con, network_mysqld_proto_get_packet_id(packet) + 1);
+				network_mysqld_con_eof_next_defs(tr);
+			}
+
+			return TRUE;
+		}
+
+		if (con->client->is_eof_deprecated) {
+			/* the EOF after the column-definitions */
+			if (0 != network_mysqld_con_eof_convert(con, packet)) return TRUE;
+
+			if (network_mysqld_con_eof_is_cursor(con)) {
+				tr->state = EOF_TRANSLATE_INIT;
+				return TRUE;
+			}
+
+			g_string_free(g_queue_pop_tail(chunks), TRUE);
+			tr->state = EOF_TRANSLATE_ROWS;
+
+			return FALSE;
+		}
+
+		/* the first row or the end of the rows, the EOF of the column-definitions goes before it */
+		tr->state = EOF_TRANSLATE_ROWS;
+
+		if (network_mysqld_proto_packet_is_eof(packet)) {
+			if (0 != network_mysqld_con_eof_convert(con, packet)) return TRUE;
+
+			tr->state = EOF_TRANSLATE_INIT;
+
+			if (network_mysqld_con_eof_is_cursor(con)) return TRUE;
+		}
+
+		*next = g_queue_pop_tail(chunks);
+		g_queue_push_tail(chunks, network_mysqld_con_eof_new(con, network_mysqld_proto_get_packet_id(packet)));
+
+		return TRUE;
+	case EOF_TRANSLATE_DEFS_EOF:
+		if (!network_mysqld_proto_packet_is_eof(packet)) return TRUE;
+
+		g_string_free(g_queue_pop_tail(chunks), TRUE);
+		network_mysqld_con_eof_next_defs(tr);
+
+		return FALSE;
+	case EOF_TRANSLATE_ROWS:
+		if (network_mysqld_proto_packet_is_eof(packet)) {
+			network_mysqld_con_eof_convert(con, packet);
+
+			/* SERVER_MORE_RESULTS_EXISTS: the next result starts */
+			tr->state = EOF_TRANSLATE_INIT;
+		}
+
+		return TRUE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * packets network_mysqld_con_splice_query_result() scans at once
+ */
+#define NETWORK_MYSQLD_SPLICE_MARKS_MAX 64
+
+/**
+ * forward the complete packets of a resultset from the server's raw recv-queue to the client
+ *
+ * if the plugin doesn't need the resultset, the packets don't have to be copied into a 
+ * GString each (network_mysqld_con_get_packet()) before they are appended to the send-queue. 
+ * Only the packet-headers are scanned, each packet is handed to the plugin as view into the 
+ * recv-chunk to track the end of the resultset and the recv-chunk is moved to the client's 
+ * send-queue as it is.
+ *
+ * packets which span several recv-chunks have to be taken the usual way
+ *
+ * @return NETWORK_SOCKET_SUCCESS if packets got forwarded, 
+ *         NETWORK_SOCKET_WAIT_FOR_EVENT if the head chunk has no complete packet
+ */
+static network_socket_retval_t network_mysqld_con_splice_query_result(chassis *srv, network_mysqld_con *con) {
+	network_socket *recv_sock = con->server;
+	network_socket *send_sock = con->client;
+	network_queue *raw = recv_sock->recv_queue_raw;
+	network_socket_retval_t ret = NETWORK_SOCKET_SUCCESS;
+	int ostate = con->state;
+	GString *chunk;
+	gsize off, end;
+
+	/* drop the empty chunks of failed reads */
+	while ((chunk = g_queue_peek_head(raw->chunks)) && chunk->len == raw->offset) {
+		network_queue_chunk_free(g_queue_pop_head(raw->chunks)); /* a slab goes back into the pool */
+		raw->offset = 0;
+	}
+
+	if (!chunk) return NETWORK_SOCKET_WAIT_FOR_EVENT;
+
+	off = end = raw->offset;
+
+	while (con->state == ostate) {
+		network_mysqld_packet_mark marks[NETWORK_MYSQLD_SPLICE_MARKS_MAX];
+		guint marks_len, i;
+
+		/* find the complete packets of the chunk in one pass, the rest continues in the next chunk */
+		marks_len = network_mysqld_proto_scan_packets(chunk->str + end, chunk->len - end, marks, G_N_ELEMENTS(marks), NULL);
+		if (marks_len == 0) break;
+
+		for (i = 0; i < marks_len && con->state == ostate; i++) {
+			network_mysqld_packet_mark *mark = &marks[i];
+			GString packet;
+
+			packet.str = chunk->str + end;
+			packet.len = mark->len + NET_HEADER_SIZE;
+			packet.allocated_len = packet.len;
+
+			if (recv_sock->packet_id_is_reset) {
+				recv_sock->last_packet_id = mark->id;
+				recv_sock->packet_id_is_reset = FALSE;
+			} else if (mark->id != (guint8)(recv_sock->last_packet_id + 1)) {
+				g_critical("%s: received packet-id %d, but expected %d ... out of sync.",
+						G_STRLOC,
+						mark->id,
+						recv_sock->last_packet_id + 1);
+				return NETWORK_SOCKET_ERROR;
+			} else {
+				recv_sock->last_packet_id = mark->id;
+			}
+
+			/* the same packet-id tracking as network_mysqld_queue_append_raw() does for the client-side */
+			if (send_sock->packet_id_is_reset) {
+				send_sock->last_packet_id = mark->id;
+				send_sock->packet_id_is_reset = FALSE;
+			} else {
+				send_sock->last_packet_id++;
+				if (mark->id != send_sock->last_packet_id) {
+					network_mysqld_proto_set_packet_id(&packet, send_sock->last_packet_id);
+				}
+			}
+
+			g_queue_push_tail(recv_sock->recv_queue->chunks, &packet);
+
+			con->resultset_is_spliced = TRUE;
+			ret = plugin_call(srv, con, con->state);
+			con->resultset_is_spliced = FALSE;
+
+			/* don't leave the view behind, whatever the plugin did */
+			g_queue_remove(recv_sock->recv_queue->chunks, &packet);
+
+			if (ret != NETWORK_SOCKET_SUCCESS) return NETWORK_SOCKET_ERROR;
+
+			end += packet.len;
+		}
+	}
+
+	if (end == off) return NETWORK_SOCKET_WAIT_FOR_EVENT;
+
+	g_queue_pop_head(raw->chunks);
+
+	if (end < chunk->len) {
+		/* keep the start of the next packet in the raw queue, the next read fills up the slab */
+		GString *rest = network_queue_slab_new();
+
+		g_string_append_len(rest, chunk->str + end, chunk->len - end);
+		g_queue_push_head(raw->chunks, rest);
+		g_string_truncate(chunk, end);
+	}
+
+	if (off > 0) {
+		/* the head of the chunk was already taken by network_mysqld_con_get_packet() */
+		g_string_erase(chunk, 0, off);
+	}
+
+	raw->offset = 0;
+	raw->len -= end - off;
+
+	network_queue_append(send_sock->send_queue, chunk);
+
+	return NETWORK_SOCKET_SUCCESS;
+}
+
+/**
+ * account the data a resultset added to the client's send-queue
+ *
+ * @param queued_before  length of the send-queue before the packets were forwarded
+ */
+static void network_mysqld_con_resultset_queued(network_mysqld_con *con, gsize queued_before) {
+	network_mysqld_resultset_flush_t *flush = &(con->resultset_flush);
+	gsize queued = con->client->send_queue->len;
+
+	if (queued > queued_before) {
+		flush->bytes += queued - queued_before;
+
+		if (flush->first_queued_at == 0) flush->first_queued_at = chassis_get_rel_microseconds();
+	}
+
+	if (con->resultset_is_finished) {
+		/* weight the last resultset with 1/8 */
+		flush->avg_bytes = flush->avg_bytes - flush->avg_bytes / 8 + flush->bytes / 8;
+		flush->bytes = 0;
+	}
+}
+
+/**
+ * check if the queued part of a resultset should be sent to the client before we read more
+ *
+ * @param at_batch_end  TRUE if all received packets are processed and we would wait for the server next
+ * @see network_mysqld_resultset_flush_t
+ */
+static gboolean network_mysqld_con_resultset_flush_is_due(network_mysqld_con *con, gboolean at_batch_end) {
+	network_mysqld_resultset_flush_t *flush = &(con->resultset_flush);
+	gsize queued;
+
+	if (con->resultset_is_needed || con->resultset_is_finished) return FALSE;
+
+	queued = con->client->send_queue->len;
+
+	if (queued == 0) return FALSE;
+	if (queued >= flush->max_bytes) return TRUE;
+	if (!at_batch_end) return FALSE;
+
+	/* streaming consumers get each batch right away */
+	if (flush->avg_bytes >= flush->max_bytes) return TRUE;
+
+	/* we have about as much as the resultsets of this connection usually have */
+	if (flush->avg_bytes > 0 && queued >= flush->avg_bytes) return TRUE;
+
+	if (flush->max_latency_us > 0 && 
+	    chassis_get_rel_microseconds() - flush->first_queued_at >= flush->max_latency_us) return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * get the timeout for waiting on the server while a part of the resultset is queued
+ *
+ * the read-timeout, but not longer than the queued data may wait for the client. When
+ * it fires, network_mysqld_con_handle() flushes the queue.
+ *
+ * @see network_mysqld_con_resultset_flush_is_due()
+ */
+static void network_mysqld_con_resultset_read_timeout(network_mysqld_con *con, struct timeval *timeout) {
+	network_mysqld_resultset_flush_t *flush = &(con->resultset_flush);
+	guint64 read_timeout_us, waited_us, left_us;
+
+	*timeout = con->read_timeout;
+
+	if (con->resultset_is_needed || con->resultset_is_finished) return;
+	if (flush->max_latency_us == 0 || flush->first_queued_at == 0) return;
+	if (con->client->send_queue->len == 0) return;
+
+	read_timeout_us = (guint64)con->read_timeout.tv_sec * G_USEC_PER_SEC + con->read_timeout.tv_usec;
+	waited_us = chassis_get_rel_microseconds() - flush->first_queued_at;
+	left_us = (waited_us < flush->max_latency_us) ? flush->max_latency_us - waited_us : 0;
+
+	if (left_us >= read_timeout_us) return;
+
+	timeout->tv_sec = left_us / G_USEC_PER_SEC;
+	timeout->tv_usec = left_us % G_USEC_PER_SEC;
+}
+
+/**
+ * update the resultset_bytes stats with the data queued for the connection
+ *
+ * @return the bytes queued for the connection
+ */
+static gsize network_mysqld_con_resultset_buffered_update(network_mysqld_con *con) {
+	gsize buffered = 0;
+	gint64 cur_size;
+
+	if (con->server) buffered += con->server->recv_queue->len + con->server->recv_queue_raw->len;
+	if (con->server && con->server->is_compressed) buffered += con->server->recv_queue_compressed->len;
+	if (con->client) buffered += con->client->send_queue->len;
+	if (con->client && con->client->is_compressed) buffered += con->client->send_queue_compressed->len;
+
+	if (buffered == con->resultset_buffered) return buffered;
+
+	cur_size = CHASSIS_STATS_ADD_INT64_NAME(resultset_bytes, (gint64)buffered - (gint64)con->resultset_buffered);
+	con->resultset_buffered = buffered;
+
+	CHASSIS_STATS_MAX_INT64_NAME(resultset_bytes_max, cur_size);
+
+	return buffered;
+}
+
+/**
+ * check if the connection or all connections together have queued too much resultset data
+ */
+static gboolean network_mysqld_con_resultset_buffer_is_full(network_mysqld_con *con, gsize buffered) {
+	gsize global_max = con->srv->priv->resultset_buffer_max;
+
+	if (con->resultset_buffer_max > 0 && buffered >= con->resultset_buffer_max) return TRUE;
+	if (global_max > 0 && CHASSIS_STATS_GET_INT64_NAME(resultset_bytes) >= (gint64)global_max) return TRUE;
+
+	return FALSE;
+}
+
+static void network_mysqld_con_resultset_wait_handle(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	network_mysqld_con *con = user_data;
+
+	con->resultset_is_waiting = FALSE;
+
+	network_mysqld_con_handle(-1, 0, con);
+}
+
+/**
+ * stop reading the server until the global resultset budget has room again
+ *
+ * other connections drain it. If they don't within the read-timeout, we give up
+ * as all of them may wait for each other.
+ *
+ * @return FALSE if we waited long enough
+ */
+static gboolean network_mysqld_con_resultset_wait(network_mysqld_con *con) {
+	struct timeval retry = { 0, NETWORK_MYSQLD_RESULTSET_WAIT_US };
+	guint64 now = chassis_get_rel_microseconds();
+
+	if (0 == con->resultset_wait_since) {
+		con->resultset_wait_since = now;
+	} else if (now - con->resultset_wait_since >= (guint64)con->read_timeout.tv_sec * G_USEC_PER_SEC + con->read_timeout.tv_usec) {
+		return FALSE;
+	}
+
+	event_del(&(con->server->event));
+
+	evtimer_set(&(con->resultset_wait), network_mysqld_con_resultset_wait_handle, con);
+	chassis_event_add_with_timeout(con->srv, &(con->resultset_wait), &retry);
+	con->resultset_is_waiting = TRUE;
+
+	return TRUE;
+}
+
 /**
  * reset the command-response parsing
  *
@@ -1106,53 +1762,42 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 	chassis_event_add_with_timeout(srv, &(ev_struct->event), timeout); 
 
 	if (events == EV_READ) {
-		int b = -1;
+		network_socket *sock = NULL;
+
+		if (con->client && event_fd == con->client->fd) {
+			sock = con->client;
+		} else if (con->server && event_fd == con->server->fd) {
+			sock = con->server;
+		} else {
+			g_error("%s.%d: neither nor", __FILE__, __LINE__);
+		}
 
 		/**
-		 * check how much data there is to read
+		 * read what is there right away
 		 *
-		 * ioctl()
-		 * - returns 0 if connection is closed
-		 * - or -1 and ECONNRESET on solaris
-		 *   or -1 and EPIPE on HP/UX
+		 * recv() returns 0 (or -1 and ECONNRESET) if the connection is closed,
+		 * no need to ask ioctl(FIONREAD) first
 		 */
-		if (ioctl(event_fd, FIONREAD, &b)) {
-			switch (errno) {
-			case E_NET_CONNRESET: /* solaris */
-			case EPIPE: /* hp/ux */
-				if (con->client && event_fd == con->client->fd) {
-					/* the client closed the connection, let's keep the server side open */
-                    con->prev_state = con->state;
-					con->state = CON_STATE_CLOSE_CLIENT;
-				} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
-					con->state = CON_STATE_CLOSE_SERVER;
-				} else {
-                    con->prev_state = con->state;
-					/* server side closed on use, oops, close both sides */
-					con->state = CON_STATE_ERROR;
-				}
-				break;
-			default:
-				g_critical("ioctl(%d, FIONREAD, ...) failed: %s", event_fd, g_strerror(errno));
+		sock->to_read = NETWORK_SOCKET_READ_MAX;
 
-                con->prev_state = con->state;
-				con->state = CON_STATE_ERROR;
-				break;
-			}
-		} else if (b != 0) {
-			if (con->client && event_fd == con->client->fd) {
-				con->client->to_read = b;
-			} else if (con->server && event_fd == con->server->fd) {
-				con->server->to_read = b;
-			} else {
-				g_error("%s.%d: neither nor", __FILE__, __LINE__);
-			}
-		} else { /* Linux */
-			if (con->client && event_fd == con->client->fd) {
+		switch (network_socket_read(sock)) {
+		case NETWORK_SOCKET_SUCCESS:
+		case NETWORK_SOCKET_WAIT_FOR_EVENT:
+			break;
+		default:
+			g_critical("%s: network_socket_read(%d) failed: %s", G_STRLOC, event_fd, g_strerror(errno));
+
+			con->prev_state = con->state;
+			con->state = CON_STATE_ERROR;
+			break;
+		}
+
+		if (sock->is_peer_closed) {
+			if (sock == con->client) {
 				/* the client closed the connection, let's keep the server side open */
                 con->prev_state = con->state;
 				con->state = CON_STATE_CLOSE_CLIENT;
-			} else if (con->server && event_fd == con->server->fd && con->com_quit_seen) {
+			} else if (con->com_quit_seen) {
 				con->state = CON_STATE_CLOSE_SERVER;
 			} else {
                 con->prev_state = con->state;
@@ -1160,6 +1805,11 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				con->state = CON_STATE_ERROR;
 			}
 		}
+	} else if (events == EV_TIMEOUT &&
+	           con->state == CON_STATE_READ_QUERY_RESULT &&
+	           network_mysqld_con_resultset_flush_is_due(con, TRUE)) {
+		/* the server was too slow for the queued part of the resultset, send it before we wait on */
+		con->state = CON_STATE_SEND_QUERY_RESULT;
 	} else if (events == EV_TIMEOUT) {
 		/* if we got a timeout on CON_STATE_CONNECT_SERVER we should pick another backend */
 		switch ((retval = plugin_call_timeout(srv, con))) {
@@ -1566,6 +2216,11 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				break;
 			}
 
+			/* the packets after the OK are compressed if the auth negotiated it */
+			if (con->auth_result_state == MYSQLD_PACKET_OK && recv_sock->compress_after_auth) {
+				network_socket_set_compressed(recv_sock);
+			}
+
 			switch (plugin_call(srv, con, con->state)) {
 			case NETWORK_SOCKET_SUCCESS:
 				break;
@@ -1609,6 +2264,11 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				con->state = CON_STATE_ERROR;
 				break;
 			}
+
+			/* the client got the OK, the commands are compressed if the auth negotiated it */
+			if (con->state == CON_STATE_READ_QUERY && con->client->compress_after_auth) {
+				network_socket_set_compressed(con->client);
+			}
 				
 			break; }
 		case CON_STATE_READ_AUTH_OLD_PASSWORD: 
@@ -1741,6 +2401,10 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				}
 			}
 
+			/* a new query, classify it again if someone asks */
+			con->classification_is_valid = FALSE;
+			con->digest_is_valid = FALSE;
+
 			switch (plugin_call(srv, con, con->state)) {
 			case NETWORK_SOCKET_SUCCESS:
 				break;
@@ -1855,6 +2519,7 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			 */
 			do {
 				network_socket *recv_sock;
+				gsize queued_before;
 
 				recv_sock = con->server;
 
@@ -1869,11 +2534,97 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
                 g_debug("%s: read query result, con:%p, socket:%p, fd:%d",
                             G_STRLOC, con, con->server, recv_sock->fd);
 
+				queued_before = con->client->send_queue->len;
+
+				/**
+				 * backpressure: don't read more from the server while too much is queued
+				 */
+				if (network_mysqld_con_resultset_buffer_is_full(con, network_mysqld_con_resultset_buffered_update(con))) {
+					if (!con->resultset_is_needed && queued_before > 0) {
+						/* wait until the client drained the send-queue */
+						con->state = CON_STATE_SEND_QUERY_RESULT;
+						break;
+					} else if (con->resultset_is_needed && con->resultset_buffer_max > 0 && 
+					           con->resultset_buffered >= con->resultset_buffer_max) {
+						/* the plugin buffers the resultset, nothing we can drain */
+						g_critical("%s: the buffered resultset of con:%p exceeds %"G_GSIZE_FORMAT" bytes, closing the connection",
+								G_STRLOC, con, con->resultset_buffer_max);
+						con->prev_state = con->state;
+						con->state = CON_STATE_ERROR;
+						break;
+					} else if (con->resultset_is_needed) {
+						/* the other connections filled the global budget, wait until they drained it */
+						if (network_mysqld_con_resultset_wait(con)) return;
+
+						g_critical("%s: the resultset budget of all connections stayed exhausted, closing con:%p",
+								G_STRLOC, con);
+						con->prev_state = con->state;
+						con->state = CON_STATE_ERROR;
+						break;
+					}
+				} else {
+					con->resultset_wait_since = 0;
+				}
+
+				/**
+				 * if the plugin doesn't need the resultset, move the received chunks
+				 * to the client without copying them packet by packet
+				 */
+				if (con->resultset_splice_is_supported && !con->resultset_is_needed &&
+				    !network_mysqld_con_eof_is_translated(con)) {
+					switch (network_socket_read(recv_sock)) {
+					case NETWORK_SOCKET_SUCCESS:
+						break;
+					case NETWORK_SOCKET_WAIT_FOR_EVENT:
+						if (network_mysqld_con_resultset_flush_is_due(con, TRUE)) {
+							/* send what we have before we wait for the server */
+							con->state = CON_STATE_SEND_QUERY_RESULT;
+							break;
+						}
+
+						network_mysqld_con_resultset_read_timeout(con, &timeout);
+
+						WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
+						NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
+						return;
+					case NETWORK_SOCKET_ERROR_RETRY:
+					case NETWORK_SOCKET_ERROR:
+						g_critical("%s.%d: network_socket_read(CON_STATE_READ_QUERY_RESULT) returned an error", __FILE__, __LINE__);
+						con->prev_state = con->state;
+						con->state = CON_STATE_ERROR;
+						break;
+					}
+					if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
+
+					switch (network_mysqld_con_splice_query_result(srv, con)) {
+					case NETWORK_SOCKET_SUCCESS:
+						network_mysqld_con_resultset_queued(con, queued_before);
+
+						if (con->state == ostate && network_mysqld_con_resultset_flush_is_due(con, FALSE)) {
+							con->state = CON_STATE_SEND_QUERY_RESULT;
+						}
+						continue;
+					case NETWORK_SOCKET_WAIT_FOR_EVENT:
+						/* the next packet spans several chunks, take the usual way */
+						break;
+					default:
+						con->prev_state = con->state;
+						con->state = CON_STATE_ERROR;
+						continue;
+					}
+				}
+
 				switch (network_mysqld_read(srv, recv_sock)) {
 				case NETWORK_SOCKET_SUCCESS:
 					break;
 				case NETWORK_SOCKET_WAIT_FOR_EVENT:
-					timeout = con->read_timeout;
+					if (network_mysqld_con_resultset_flush_is_due(con, TRUE)) {
+						/* send what we have before we wait for the server */
+						con->state = CON_STATE_SEND_QUERY_RESULT;
+						break;
+					}
+
+					network_mysqld_con_resultset_read_timeout(con, &timeout);
 
 					WAIT_FOR_EVENT(con->server, EV_READ, &timeout);
 				NETWORK_MYSQLD_CON_TRACK_TIME(con, "wait_for_event::read_query_result");
@@ -1887,14 +2638,32 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 				}
 				if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
 
-				switch (plugin_call(srv, con, con->state)) {
+				if (network_mysqld_con_eof_is_translated(con)) {
+					GString *next;
+
+					if (!network_mysqld_con_eof_translate(con, &next)) continue; /* dropped */
+
+					call_ret = plugin_call(srv, con, con->state);
+
+					if (next) {
+						if (call_ret == NETWORK_SOCKET_SUCCESS && con->state == ostate) {
+							g_queue_push_tail(recv_sock->recv_queue->chunks, next);
+							call_ret = plugin_call(srv, con, con->state);
+						} else {
+							g_string_free(next, TRUE);
+						}
+					}
+				} else {
+					call_ret = plugin_call(srv, con, con->state);
+				}
+
+				switch (call_ret) {
 				case NETWORK_SOCKET_SUCCESS:
+					network_mysqld_con_resultset_queued(con, queued_before);
+
 					/* if we don't need the resultset, forward it to the client */
-					if (!con->resultset_is_finished && !con->resultset_is_needed) {
-						/* check how much data we have in the queue waiting, no need to try to send 5 bytes */
-						if (con->client->send_queue->len > 64 * 1024) {
-							con->state = CON_STATE_SEND_QUERY_RESULT;
-						}
+					if (con->state == ostate && network_mysqld_con_resultset_flush_is_due(con, FALSE)) {
+						con->state = CON_STATE_SEND_QUERY_RESULT;
 					}
 					break;
 				case NETWORK_SOCKET_ERROR:
@@ -1918,6 +2687,8 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			 * send the query result-set to the client */
 			switch (network_mysqld_write(srv, con->client)) {
 			case NETWORK_SOCKET_SUCCESS:
+				con->resultset_flush.first_queued_at = 0; /* all flushed */
+				network_mysqld_con_resultset_buffered_update(con);
 				break;
 			case NETWORK_SOCKET_WAIT_FOR_EVENT:
 				timeout = con->write_timeout;
@@ -1940,6 +2711,12 @@ void network_mysqld_con_handle(int event_fd, short events, void *user_data) {
 			/* if the write failed, don't call the plugin handlers */
 			if (con->state != ostate) break; /* the state has changed (e.g. CON_STATE_ERROR) */
 
+			/* the shards of a scatter-gather query call us again when they have more */
+			if (!con->resultset_is_finished && con->scatter) {
+				network_mysqld_scatter_resume(con->scatter);
+				return;
+			}
+
 			/* in case we havn't read the full resultset from the server yet, go back and read more
 			 */
 			if (!con->resultset_is_finished && con->server) {
@@ -2245,35 +3022,70 @@ void network_mysqld_con_accept(int G_GNUC_UNUSED event_fd, short events, void *u
 	network_mysqld_con *listen_con = user_data;
 	network_mysqld_con *client_con;
 	network_socket *client;
+	chassis_event_t *loop;
+	chassis_event_t *current = chassis_event_get_current();
+	guint n;
 
 	g_assert(events == EV_READ);
 	g_assert(listen_con->server);
 
-	client = network_socket_accept(listen_con->server);
-	if (!client) return;
+	/**
+	 * the listen-socket is non-blocking, drain the backlog until accept()
+	 * fails with EAGAIN or the batch is full and give the loop back to the
+	 * other events then
+	 */
+	for (n = 0; n < NETWORK_MYSQLD_ACCEPT_BATCH; n++) {
+		client = network_socket_accept(listen_con->server);
+		if (!client) return;
 
-	/* looks like we open a client connection */
-	client_con = network_mysqld_con_new();
-	client_con->client = client;
+		/* looks like we open a client connection */
+		client_con = network_mysqld_con_new();
+		client_con->client = client;
 
-        g_debug("%s: add a new client connection: %p",
-            G_STRLOC, client_con);
+		g_debug("%s: add a new client connection: %p",
+				G_STRLOC, client_con);
 
-	NETWORK_MYSQLD_CON_TRACK_TIME(client_con, "accept");
+		NETWORK_MYSQLD_CON_TRACK_TIME(client_con, "accept");
 
-	network_mysqld_add_connection(listen_con->srv, client_con);
+		network_mysqld_add_connection(listen_con->srv, client_con);
 
-	
-	/**
-	 * inherit the config to the new connection 
-	 */
+		/**
+		 * inherit the config to the new connection 
+		 */
 
-	client_con->plugins = listen_con->plugins;
-	client_con->config  = listen_con->config;
-	
-	network_mysqld_con_handle(-1, 0, client_con);
+		client_con->plugins = listen_con->plugins;
+		client_con->config  = listen_con->config;
 
-	return;
+		/**
+		 * a SO_REUSEPORT listen-socket is served by a event-thread itself,
+		 * the thread keeps the connections it accepted
+		 */
+		if (current && current->is_worker) {
+			client_con->event_loop = current;
+			g_atomic_int_inc(&(current->con_count));
+
+			network_mysqld_con_handle(-1, 0, client_con);
+
+			continue;
+		}
+
+		/**
+		 * with --event-threads the connection is handed to a worker which owns it
+		 * from now on. A fresh socket is writable right away, the EV_WRITE event
+		 * starts the state-machine in CON_STATE_INIT in the worker.
+		 */
+		if (NULL != (loop = chassis_event_threads_pick(listen_con->srv))) {
+			client_con->event_loop = loop;
+			g_atomic_int_inc(&(loop->con_count));
+
+			event_set(&(client->event), client->fd, EV_WRITE, network_mysqld_con_handle, client_con);
+			chassis_event_add_to(loop, &(client->event), NULL);
+
+			continue;
+		}
+
+		network_mysqld_con_handle(-1, 0, client_con);
+	}
 }
 
 /**
@@ -2347,12 +3159,14 @@ int network_mysqld_con_send_resultset(network_socket *con, GPtrArray *fields, GP
 
 	g_string_truncate(s, 0);
 	
-	/* EOF */	
-	g_string_append_len(s, "\xfe", 1); /* EOF */
-	g_string_append_len(s, "\x00\x00", 2); /* warning count */
-	g_string_append_len(s, "\x02\x00", 2); /* flags */
+	/* EOF, unless the client has CLIENT_DEPRECATE_EOF */
+	if (!con->is_eof_deprecated) {
+		g_string_append_len(s, "\xfe", 1); /* EOF */
+		g_string_append_len(s, "\x00\x00", 2); /* warning count */
+		g_string_append_len(s, "\x02\x00", 2); /* flags */
 	
-	network_mysqld_queue_append(con, con->send_queue, S(s));
+		network_mysqld_queue_append(con, con->send_queue, S(s));
+	}
 
 	for (i = 0; i < rows->len; i++) {
 		GPtrArray *row = rows->pdata[i];
@@ -2370,8 +3184,15 @@ int network_mysqld_con_send_resultset(network_socket *con, GPtrArray *fields, GP
 
 	/* EOF */	
 	g_string_append_len(s, "\xfe", 1); /* EOF */
-	g_string_append_len(s, "\x00\x00", 2); /* warning count */
-	g_string_append_len(s, "\x02\x00", 2); /* flags */
+	if (con->is_eof_deprecated) {
+		/* the OK of CLIENT_DEPRECATE_EOF */
+		g_string_append_len(s, "\x00\x00", 2); /* affected rows, insert-id */
+		g_string_append_len(s, "\x02\x00", 2); /* flags */
+		g_string_append_len(s, "\x00\x00", 2); /* warning count */
+	} else {
+		g_string_append_len(s, "\x00\x00", 2); /* warning count */
+		g_string_append_len(s, "\x02\x00", 2); /* flags */
+	}
 
 	network_mysqld_queue_append(con, con->send_queue, S(s));
 	network_mysqld_queue_reset(con);
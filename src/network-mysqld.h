@@ -47,11 +47,15 @@
 #include "network-conn-pool.h"
 #include "chassis-plugin.h"
 #include "chassis-mainloop.h"
+#include "chassis-event.h"
 #include "chassis-timings.h"
 #include "sys-pedantic.h"
 #include "lua-scope.h"
 #include "network-backend.h"
 #include "lua-registry-keys.h"
+#include "sql-classifier.h"
+#include "sql-digest.h"
+#include "network-shard-map.h"
 
 typedef struct network_mysqld_con network_mysqld_con; /* forward declaration */
 
@@ -228,6 +232,46 @@ typedef enum {
  */
 NETWORK_API const char *network_mysqld_con_state_get_name(network_mysqld_con_state_t state);
 
+/**
+ * when to send the queued part of a resultset the plugin doesn't need to the client
+ *
+ * the queued data is flushed if
+ * - max_bytes are queued
+ * - all received packets are processed and 
+ *   - the connection usually has resultsets larger than max_bytes (streaming) or
+ *   - we have about as much as the resultsets of the connection usually have or
+ *   - the first queued byte waits for longer than max_latency_us
+ *
+ * while data is queued the read of the server times out with the latency watermark
+ */
+typedef struct {
+	gsize   max_bytes;       /**< bytes watermark */
+	guint64 max_latency_us;  /**< latency watermark in microseconds, 0 to disable */
+
+	gsize   avg_bytes;       /**< moving average of the size of the last resultsets */
+	gsize   bytes;           /**< bytes of the current resultset so far */
+	guint64 first_queued_at; /**< when the oldest unsent byte was queued, 0 if nothing is queued */
+} network_mysqld_resultset_flush_t;
+
+/**
+ * rewriting the EOFs of a response for a client which disagrees with the server about CLIENT_DEPRECATE_EOF
+ *
+ * reset for each command by network_mysqld_con_command_states_init()
+ */
+typedef struct {
+	enum {
+		EOF_TRANSLATE_INIT,      /**< the first packet of a result */
+		EOF_TRANSLATE_DEFS,      /**< the param- or column-definitions */
+		EOF_TRANSLATE_DEFS_EOF,  /**< the EOF after the definitions of a COM_STMT_PREPARE */
+		EOF_TRANSLATE_ROWS       /**< the rows until the EOF */
+	} state;
+
+	guint64 defs_left;           /**< definitions before the EOF */
+	guint64 columns;             /**< column-definitions of a COM_STMT_PREPARE after the params */
+	guint16 server_status;       /**< of the last OK or EOF, for the EOFs we have to add */
+	gboolean is_continued;       /**< the last packet was PACKET_LEN_MAX, the next continues it */
+} network_mysqld_eof_translate_t;
+
 /**
  * Encapsulates the state and callback functions for a MySQL protocol-based connection to and from MySQL Proxy.
  * 
@@ -271,6 +315,14 @@ struct network_mysqld_con {
      */
     server_list_t *server_list;
 
+	/**
+	 * the scatter-gather query which sends the result to the client, NULL if none
+	 *
+	 * its shards queue the packets for the client and call network_mysqld_con_handle()
+	 * to send them. Once they are sent network_mysqld_scatter_resume() is called.
+	 */
+	struct network_mysqld_scatter *scatter;
+
 	/**
 	 * The client side of the connection as it pertains to the low-level network implementation.
 	 */
@@ -338,6 +390,54 @@ struct network_mysqld_con {
 	 */
 	gboolean resultset_is_finished;
 
+	/**
+	 * Flag indicating that the plugin's con_read_query_result can handle spliced packets.
+	 *
+	 * If set and resultset_is_needed is FALSE, the packets of a resultset aren't copied out of
+	 * the raw recv-queue, but forwarded to the client as they were received.
+	 *
+	 * @see network_mysqld_con::resultset_is_spliced
+	 */
+	gboolean resultset_splice_is_supported;
+	/**
+	 * Flag indicating that the packet in the recv-queue is only a view into the raw recv-queue.
+	 *
+	 * The core forwards the packet to the client itself, con_read_query_result has to remove it
+	 * from the recv-queue without freeing or forwarding it.
+	 */
+	gboolean resultset_is_spliced;
+
+	/**
+	 * the flush policy for resultsets which aren't needed by the plugin
+	 */
+	network_mysqld_resultset_flush_t resultset_flush;
+
+	/**
+	 * the state of the EOF rewriting if client and server disagree about CLIENT_DEPRECATE_EOF
+	 *
+	 * such resultsets aren't spliced
+	 */
+	network_mysqld_eof_translate_t eof_translate;
+
+	/**
+	 * max. bytes of a resultset queued for this connection, 0 for no limit
+	 *
+	 * if the limit is reached, we stop reading from the server until the client 
+	 * drained the send-queue. A resultset the plugin buffers can't be drained, the 
+	 * connection is closed.
+	 */
+	gsize resultset_buffer_max;
+	gsize resultset_buffered; /**< bytes of the connection accounted in the resultset_bytes stats */
+
+	/**
+	 * retries reading the server while other connections fill the global resultset budget
+	 *
+	 * only for resultsets the plugin buffers, the others drain their send-queue instead
+	 */
+	struct event resultset_wait;
+	gboolean resultset_is_waiting;  /**< resultset_wait is pending */
+	guint64 resultset_wait_since;   /**< chassis_get_rel_microseconds() we started waiting, 0 if we don't */
+
 	/**
 	 * Flag indicating that we have received a COM_QUIT command.
 	 * 
@@ -358,6 +458,18 @@ struct network_mysqld_con {
 	 */
 	struct network_mysqld_con_parse parse;
 
+	/**
+	 * The classification of the current query, see network_mysqld_con_get_classification()
+	 */
+	sql_classification classification;
+	gboolean classification_is_valid;
+
+	/**
+	 * The digest of the current query, see network_mysqld_con_get_digest()
+	 */
+	sql_digest *digest;
+	gboolean digest_is_valid;
+
 	/**
 	 * An opaque pointer to a structure describing extra connection state needed by the plugin.
 	 * 
@@ -379,6 +491,13 @@ struct network_mysqld_con {
 	struct timeval read_timeout;
 	struct timeval write_timeout;
 	struct timeval wait_clt_next_sql;
+
+	/**
+	 * the event-thread owning this connection, NULL if it is handled by the main-loop
+	 *
+	 * @see network_mysqld_con_accept()
+	 */
+	chassis_event_t *event_loop;
 };
 
 
@@ -388,7 +507,11 @@ NETWORK_API gboolean g_hash_table_true(gpointer UNUSED_PARAM(key), gpointer UNUS
 
 NETWORK_API network_mysqld_con *network_mysqld_con_init(void) G_GNUC_DEPRECATED;
 NETWORK_API network_mysqld_con *network_mysqld_con_new(void);
+NETWORK_API sql_classification *network_mysqld_con_get_classification(network_mysqld_con *con);
+NETWORK_API sql_digest *network_mysqld_con_get_digest(network_mysqld_con *con);
 NETWORK_API void network_mysqld_con_free(network_mysqld_con *con);
+NETWORK_API lua_scope *network_mysqld_con_get_lua_scope(network_mysqld_con *con);
+NETWORK_API chassis_event_t *network_mysqld_con_get_event_loop(network_mysqld_con *con);
 
 /** 
  * should be socket 
@@ -412,13 +535,32 @@ NETWORK_API network_socket_retval_t network_mysqld_write(chassis *srv, network_s
 NETWORK_API network_socket_retval_t network_mysqld_write_len(chassis *srv, network_socket *con, int send_chunks);
 NETWORK_API network_socket_retval_t network_mysqld_con_get_packet(chassis G_GNUC_UNUSED*chas, network_socket *con);
 
+/**
+ * a published snapshot of proxy.global.config
+ *
+ * snapshots are immutable. A new version is published by swapping the pointer 
+ * in chassis_private, the old one is freed through chassis_event_defer_free().
+ *
+ * @see network_mysqld_lua_global_publish(), network_mysqld_lua_global_refresh()
+ */
+typedef struct {
+	gint version;
+	GString *config;                          /**< proxy.global.config as lua-chunk returning a table */
+} network_mysqld_lua_global_t;
+
 struct chassis_private {
 
 	GPtrArray *cons;                          /**< array(network_mysqld_con) */
+	GMutex *cons_mutex;                       /**< protects cons, connections are added and freed from all event-threads */
 
 	lua_scope *sc;
 
+	network_mysqld_lua_global_t *lua_global; /**< the published snapshot of proxy.global.config, swapped atomically */
+	network_shard_map *shard_map;             /**< the partitions of the sharded tables, swapped atomically by proxy.shard.load() */
+
 	network_backends_t *backends;
+
+	gsize resultset_buffer_max;               /**< max. bytes of resultsets queued over all connections, 0 for no limit */
 };
 
 NETWORK_API int network_mysqld_init(chassis *srv);
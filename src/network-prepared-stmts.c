@@ -0,0 +1,252 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-prepared-stmts.h"
+#include "network-mysqld-proto.h"
+#include "glib-ext.h"
+
+#define DEFAULT_MAX_STMTS 256
+
+static void network_prepared_stmt_free(network_prepared_stmt *stmt) {
+	GString *packet;
+
+	if (!stmt) return;
+
+	while ((packet = g_queue_pop_head(stmt->response))) g_string_free(packet, TRUE);
+	g_queue_free(stmt->response);
+
+	g_string_free(stmt->key, TRUE);
+	g_string_free(stmt->bound_types, TRUE);
+
+	g_free(stmt);
+}
+
+network_prepared_stmts *network_prepared_stmts_new(void) {
+	network_prepared_stmts *stmts;
+
+	stmts = g_new0(network_prepared_stmts, 1);
+	stmts->stmts = g_hash_table_new(g_hash_table_string_hash, g_hash_table_string_equal);
+	stmts->lru = g_queue_new();
+	stmts->closed = g_array_new(FALSE, FALSE, sizeof(guint32));
+	stmts->max_stmts = DEFAULT_MAX_STMTS;
+
+	return stmts;
+}
+
+/**
+ * forget all statements
+ *
+ * used when the server dropped them, e.g. on COM_CHANGE_USER
+ */
+void network_prepared_stmts_reset(network_prepared_stmts *stmts) {
+	network_prepared_stmt *stmt;
+
+	while ((stmt = g_queue_pop_head(stmts->lru))) {
+		g_hash_table_remove(stmts->stmts, stmt->key);
+		network_prepared_stmt_free(stmt);
+	}
+
+	g_array_set_size(stmts->closed, 0);
+}
+
+void network_prepared_stmts_free(network_prepared_stmts *stmts) {
+	if (!stmts) return;
+
+	network_prepared_stmts_reset(stmts);
+
+	g_hash_table_destroy(stmts->stmts);
+	g_queue_free(stmts->lru);
+	g_array_free(stmts->closed, TRUE);
+
+	g_free(stmts);
+}
+
+/**
+ * build the key of a statement
+ *
+ * the tables of a statement are resolved against the default-db at prepare-time
+ */
+void network_prepared_stmts_key(GString *key, const GString *db, const gchar *query, gsize query_len) {
+	g_string_truncate(key, 0);
+
+	if (db) g_string_append_len(key, db->str, db->len);
+	g_string_append_c(key, '\0');
+	g_string_append_len(key, query, query_len);
+}
+
+/**
+ * find a statement and mark it as used
+ */
+network_prepared_stmt *network_prepared_stmts_get(network_prepared_stmts *stmts, const GString *key) {
+	network_prepared_stmt *stmt;
+
+	if (NULL == (stmt = g_hash_table_lookup(stmts->stmts, key))) return NULL;
+
+	g_queue_unlink(stmts->lru, stmt->lru_link);
+	g_queue_push_head_link(stmts->lru, stmt->lru_link);
+
+	return stmt;
+}
+
+/**
+ * remove a statement and remember to close it on the server
+ */
+static void network_prepared_stmts_remove(network_prepared_stmts *stmts, network_prepared_stmt *stmt) {
+	g_hash_table_remove(stmts->stmts, stmt->key);
+	g_queue_delete_link(stmts->lru, stmt->lru_link);
+
+	g_array_append_val(stmts->closed, stmt->stmt_id);
+
+	network_prepared_stmt_free(stmt);
+}
+
+/**
+ * add a statement the server prepared
+ *
+ * a statement with the same key is replaced, the least recently used
+ * statements are removed if we have more than ->max_stmts
+ *
+ * @param response the packets of the COM_STMT_PREPARE response, we take them over
+ */
+network_prepared_stmt *network_prepared_stmts_add(network_prepared_stmts *stmts, const GString *key, guint32 stmt_id, GQueue *response) {
+	network_prepared_stmt *stmt, *old;
+
+	if (NULL != (old = g_hash_table_lookup(stmts->stmts, key))) {
+		network_prepared_stmts_remove(stmts, old);
+	}
+
+	stmt = g_new0(network_prepared_stmt, 1);
+	stmt->key = g_string_new_len(key->str, key->len);
+	stmt->stmt_id = stmt_id;
+	stmt->response = response;
+	stmt->bound_types = g_string_new(NULL);
+
+	/* 0x00, stmt-id, num-columns, num-params */
+	if (response->head) {
+		network_packet p;
+
+		p.data = response->head->data;
+		p.offset = NET_HEADER_SIZE + 1 + 4 + 2;
+
+		if (0 != network_mysqld_proto_get_int16(&p, &(stmt->num_params))) stmt->num_params = 0;
+	}
+
+	g_hash_table_insert(stmts->stmts, stmt->key, stmt);
+	g_queue_push_head(stmts->lru, stmt);
+	stmt->lru_link = stmts->lru->head;
+
+	while (stmts->max_stmts > 0 &&
+	       stmts->lru->length > stmts->max_stmts &&
+	       NULL != (old = g_queue_peek_tail(stmts->lru))) {
+		network_prepared_stmts_remove(stmts, old);
+	}
+
+	return stmt;
+}
+
+/**
+ * get the stmt-id of a COM_STMT_* packet or a COM_STMT_PREPARE response
+ *
+ * both carry it as int4 right after the first byte
+ *
+ * @param offset where the payload starts in the packet
+ */
+int network_prepared_stmts_get_packet_stmt_id(GString *packet, gsize offset, guint32 *stmt_id) {
+	network_packet p;
+
+	p.data = packet;
+	p.offset = offset + 1;
+
+	return network_mysqld_proto_get_int32(&p, stmt_id);
+}
+
+/**
+ * overwrite the stmt-id of a COM_STMT_* packet or a COM_STMT_PREPARE response
+ */
+int network_prepared_stmts_set_packet_stmt_id(GString *packet, gsize offset, guint32 stmt_id) {
+	guchar *p;
+
+	if (packet->len < offset + 1 + 4) return -1;
+
+	p = (guchar *)packet->str + offset + 1;
+
+	p[0] = (stmt_id >>  0) & 0xff;
+	p[1] = (stmt_id >>  8) & 0xff;
+	p[2] = (stmt_id >> 16) & 0xff;
+	p[3] = (stmt_id >> 24) & 0xff;
+
+	return 0;
+}
+
+/**
+ * where the new-params-bound-flag of a COM_STMT_EXECUTE is
+ *
+ * 0x17, stmt-id, flags, iteration-count, null-bitmap
+ */
+static gsize network_prepared_stmts_packet_bound_flag_offset(gsize offset, guint num_params) {
+	return offset + 1 + 4 + 1 + 4 + (num_params + 7) / 8;
+}
+
+/**
+ * get the parameter types of a COM_STMT_EXECUTE
+ *
+ * @param types  gets the types, if the client sent them
+ * @return 0 if the client sent the types, 1 if it relies on the bound ones, -1 if the packet is too short
+ */
+int network_prepared_stmts_get_packet_param_types(GString *packet, gsize offset, guint num_params, GString *types) {
+	gsize flag_offset = network_prepared_stmts_packet_bound_flag_offset(offset, num_params);
+
+	if (0 == num_params) return 1;
+	if (packet->len < flag_offset + 1) return -1;
+	if (0 == packet->str[flag_offset]) return 1;
+	if (packet->len < flag_offset + 1 + 2 * num_params) return -1;
+
+	g_string_truncate(types, 0);
+	g_string_append_len(types, packet->str + flag_offset + 1, 2 * num_params);
+
+	return 0;
+}
+
+/**
+ * send the parameter types along with a COM_STMT_EXECUTE which relies on the bound ones
+ *
+ * sets the new-params-bound-flag and inserts the types after it
+ *
+ * @param offset where the payload starts in the packet, if it is NET_HEADER_SIZE the packet-length is updated
+ * @return 0 on success, -1 if the packet doesn't rely on the bound types or would get too large
+ */
+int network_prepared_stmts_set_packet_param_types(GString *packet, gsize offset, guint num_params, const GString *types) {
+	gsize flag_offset = network_prepared_stmts_packet_bound_flag_offset(offset, num_params);
+
+	if (0 == num_params || types->len != 2 * num_params) return -1;
+	if (packet->len < flag_offset + 1 || 0 != packet->str[flag_offset]) return -1;
+	if (packet->len - offset + types->len >= PACKET_LEN_MAX) return -1;
+
+	packet->str[flag_offset] = 1;
+	g_string_insert_len(packet, flag_offset + 1, types->str, types->len);
+
+	if (offset == NET_HEADER_SIZE) network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+	return 0;
+}
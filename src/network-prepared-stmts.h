@@ -0,0 +1,74 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_PREPARED_STMTS_H_
+#define _NETWORK_PREPARED_STMTS_H_
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-exports.h"
+
+/**
+ * the statements prepared on a server connection
+ *
+ * the statements are keyed by (default-db, query) and stay prepared while the
+ * connection sits in the pool. A client which gets the connection later and
+ * prepares the same query gets the existing statement.
+ *
+ * statements which are pushed out of the registry are remembered in ->closed
+ * until a COM_STMT_CLOSE for them is sent along with the next command
+ *
+ * the parameter types a COM_STMT_EXECUTE binds stay with the statement on the
+ * server, a client which relies on the ones it bound on another connection gets
+ * them sent along
+ */
+typedef struct {
+	GString *key;           /** default-db \0 query */
+	guint32 stmt_id;        /** the id the server assigned */
+	GQueue *response;       /** GString *, the packets of the COM_STMT_PREPARE response */
+	guint16 num_params;     /** from the COM_STMT_PREPARE response */
+	GString *bound_types;   /** the parameter types the last COM_STMT_EXECUTE bound, 2 bytes per parameter */
+
+	GList *lru_link;        /** our link in network_prepared_stmts::lru */
+} network_prepared_stmt;
+
+struct network_prepared_stmts {
+	GHashTable *stmts;      /** GHashTable<key, network_prepared_stmt> */
+	GQueue *lru;            /** network_prepared_stmt, most recently used first */
+
+	guint max_stmts;        /** statements kept open on the server, 0 for no limit */
+
+	GArray *closed;         /** guint32, stmt-ids which are still open on the server */
+};
+
+NETWORK_API network_prepared_stmts *network_prepared_stmts_new(void);
+NETWORK_API void network_prepared_stmts_free(network_prepared_stmts *stmts);
+NETWORK_API void network_prepared_stmts_reset(network_prepared_stmts *stmts);
+NETWORK_API void network_prepared_stmts_key(GString *key, const GString *db, const gchar *query, gsize query_len);
+NETWORK_API network_prepared_stmt *network_prepared_stmts_get(network_prepared_stmts *stmts, const GString *key);
+NETWORK_API network_prepared_stmt *network_prepared_stmts_add(network_prepared_stmts *stmts, const GString *key, guint32 stmt_id, GQueue *response);
+NETWORK_API int network_prepared_stmts_get_packet_stmt_id(GString *packet, gsize offset, guint32 *stmt_id);
+NETWORK_API int network_prepared_stmts_set_packet_stmt_id(GString *packet, gsize offset, guint32 stmt_id);
+NETWORK_API int network_prepared_stmts_get_packet_param_types(GString *packet, gsize offset, guint num_params, GString *types);
+NETWORK_API int network_prepared_stmts_set_packet_param_types(GString *packet, gsize offset, guint num_params, const GString *types);
+
+#endif
@@ -0,0 +1,326 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-query-cache.h"
+#include "network-mysqld-packet.h"
+#include "chassis-timings.h"
+#include "glib-ext.h"
+
+static void network_query_cache_entry_free(network_query_cache_entry *entry) {
+	GString *packet;
+	guint i;
+
+	if (!entry) return;
+
+	while ((packet = g_queue_pop_head(entry->packets))) g_string_free(packet, TRUE);
+	g_queue_free(entry->packets);
+
+	for (i = 0; i < entry->tables->len; i++) {
+		g_free(entry->tables->pdata[i]);
+	}
+	g_ptr_array_free(entry->tables, TRUE);
+
+	g_string_free(entry->key, TRUE);
+
+	g_free(entry);
+}
+
+network_query_cache *network_query_cache_new(void) {
+	network_query_cache *cache;
+
+	cache = g_new0(network_query_cache, 1);
+	cache->mutex = g_mutex_new();
+	cache->entries = g_hash_table_new(g_hash_table_string_hash, g_hash_table_string_equal);
+	cache->tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_hash_table_destroy);
+	cache->table_gens = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	cache->lru = g_queue_new();
+
+	cache->max_size = 0;
+	cache->ttl_us = 1000 * 1000;
+	cache->max_entry_size = 1024 * 1024;
+
+	return cache;
+}
+
+/**
+ * unlink a entry from all indexes and free it
+ *
+ * @note the cache has to be locked
+ */
+static void network_query_cache_remove_entry(network_query_cache *cache, network_query_cache_entry *entry) {
+	guint i;
+
+	g_hash_table_remove(cache->entries, entry->key);
+
+	for (i = 0; i < entry->tables->len; i++) {
+		GHashTable *table_entries;
+
+		if (NULL == (table_entries = g_hash_table_lookup(cache->tables, entry->tables->pdata[i]))) continue;
+
+		g_hash_table_remove(table_entries, entry);
+		if (0 == g_hash_table_size(table_entries)) {
+			g_hash_table_remove(cache->tables, entry->tables->pdata[i]);
+		}
+	}
+
+	g_queue_delete_link(cache->lru, entry->lru_link);
+	cache->size -= entry->size;
+
+	network_query_cache_entry_free(entry);
+}
+
+void network_query_cache_free(network_query_cache *cache) {
+	network_query_cache_entry *entry;
+
+	if (!cache) return;
+
+	while ((entry = g_queue_peek_tail(cache->lru))) {
+		network_query_cache_remove_entry(cache, entry);
+	}
+
+	g_queue_free(cache->lru);
+	g_hash_table_destroy(cache->entries);
+	g_hash_table_destroy(cache->tables);
+	g_hash_table_destroy(cache->table_gens);
+	g_mutex_free(cache->mutex);
+
+	g_free(cache);
+}
+
+static void network_query_cache_key_append(GString *key, const GString *part) {
+	if (part) g_string_append_len(key, part->str, part->len);
+	g_string_append_c(key, '\0');
+}
+
+/**
+ * build the key of a query of a client
+ *
+ * the same query returns other bytes with other charsets, another sql_mode
+ * (ANSI_QUOTES, PAD_CHAR_TO_FULL_LENGTH, ...) or with or without the EOFs of
+ * CLIENT_DEPRECATE_EOF. They are all part of the key.
+ *
+ * the parts are separated by \0 which can't be part of a name
+ */
+void network_query_cache_key(GString *key, network_socket *client, const gchar *query, gsize query_len) {
+	g_string_truncate(key, 0);
+
+	network_query_cache_key_append(key, client->response ? client->response->username : NULL);
+	network_query_cache_key_append(key, client->default_db);
+	network_query_cache_key_append(key, client->charset);
+	network_query_cache_key_append(key, client->charset_client);
+	network_query_cache_key_append(key, client->charset_connection);
+	network_query_cache_key_append(key, client->charset_results);
+	network_query_cache_key_append(key, client->sql_mode);
+	g_string_append_c(key, client->is_eof_deprecated ? 'D' : 'E');
+	g_string_append_len(key, query, query_len);
+}
+
+/**
+ * copy the packets of a cached resultset
+ *
+ * @param packets  the copies of the packets are appended to it
+ * @param gen      on a miss, the generation to pass to network_query_cache_insert()
+ * @return TRUE on a hit
+ */
+gboolean network_query_cache_lookup(network_query_cache *cache, const GString *key, GQueue *packets, guint64 *gen) {
+	network_query_cache_entry *entry;
+	GList *node;
+
+	g_mutex_lock(cache->mutex);
+
+	entry = g_hash_table_lookup(cache->entries, key);
+
+	if (entry && entry->expires < chassis_get_rel_microseconds()) {
+		network_query_cache_remove_entry(cache, entry);
+		entry = NULL;
+	}
+
+	if (!entry) {
+		cache->misses++;
+		*gen = cache->gen;
+
+		g_mutex_unlock(cache->mutex);
+
+		return FALSE;
+	}
+
+	/* move it to the front of the LRU */
+	g_queue_unlink(cache->lru, entry->lru_link);
+	g_queue_push_head_link(cache->lru, entry->lru_link);
+
+	for (node = entry->packets->head; node; node = node->next) {
+		GString *packet = node->data;
+
+		g_queue_push_tail(packets, g_string_new_len(packet->str, packet->len));
+	}
+	cache->hits++;
+
+	g_mutex_unlock(cache->mutex);
+
+	return TRUE;
+}
+
+/**
+ * add a resultset
+ *
+ * the cache takes over the packets and the table-names in any case
+ *
+ * @param packets  GString *, the packets of the resultset
+ * @param tables   gchar *, the "db.tbl" the result was read from
+ * @param gen      the generation network_query_cache_lookup() returned
+ * @return TRUE if it was added, FALSE if it was too large or one of its tables
+ *         was invalidated in the meantime
+ */
+gboolean network_query_cache_insert(network_query_cache *cache, const GString *key, GQueue *packets, GPtrArray *tables, guint64 gen) {
+	network_query_cache_entry *entry, *old;
+	gboolean is_stale = FALSE;
+	GList *node;
+	guint i;
+
+	entry = g_new0(network_query_cache_entry, 1);
+	entry->key = g_string_new_len(key->str, key->len);
+	entry->packets = packets;
+	entry->tables = tables;
+	entry->size = key->len;
+
+	for (node = packets->head; node; node = node->next) {
+		entry->size += ((GString *)node->data)->len;
+	}
+
+	g_mutex_lock(cache->mutex);
+
+	if (gen < cache->flush_gen) is_stale = TRUE;
+
+	for (i = 0; !is_stale && i < tables->len; i++) {
+		guint64 *table_gen = g_hash_table_lookup(cache->table_gens, tables->pdata[i]);
+
+		if (table_gen && *table_gen > gen) is_stale = TRUE;
+	}
+
+	if (is_stale ||
+	    entry->size > cache->max_entry_size ||
+	    entry->size > cache->max_size) {
+		g_mutex_unlock(cache->mutex);
+
+		network_query_cache_entry_free(entry);
+
+		return FALSE;
+	}
+
+	if (NULL != (old = g_hash_table_lookup(cache->entries, entry->key))) {
+		network_query_cache_remove_entry(cache, old);
+	}
+
+	entry->expires = chassis_get_rel_microseconds() + cache->ttl_us;
+
+	g_hash_table_insert(cache->entries, entry->key, entry);
+
+	for (i = 0; i < tables->len; i++) {
+		GHashTable *table_entries;
+
+		if (NULL == (table_entries = g_hash_table_lookup(cache->tables, tables->pdata[i]))) {
+			table_entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+			g_hash_table_insert(cache->tables, g_strdup(tables->pdata[i]), table_entries);
+		}
+
+		g_hash_table_insert(table_entries, entry, entry);
+	}
+
+	g_queue_push_head(cache->lru, entry);
+	entry->lru_link = cache->lru->head;
+	cache->size += entry->size;
+
+	/* make room, the least recently used go first */
+	while (cache->size > cache->max_size &&
+	       NULL != (old = g_queue_peek_tail(cache->lru))) {
+		network_query_cache_remove_entry(cache, old);
+		cache->evictions++;
+	}
+
+	g_mutex_unlock(cache->mutex);
+
+	return TRUE;
+}
+
+static void network_query_cache_collect(gpointer key, gpointer G_GNUC_UNUSED value, gpointer udata) {
+	GPtrArray *entries = udata;
+
+	g_ptr_array_add(entries, key);
+}
+
+/**
+ * drop all entries which were read from a table
+ *
+ * @param table    "db.tbl"
+ */
+void network_query_cache_invalidate_table(network_query_cache *cache, const gchar *table) {
+	GHashTable *table_entries;
+	guint64 *table_gen;
+
+	g_mutex_lock(cache->mutex);
+
+	cache->gen++;
+	cache->invalidations++;
+
+	if (NULL == (table_gen = g_hash_table_lookup(cache->table_gens, table))) {
+		table_gen = g_new0(guint64, 1);
+		g_hash_table_insert(cache->table_gens, g_strdup(table), table_gen);
+	}
+	*table_gen = cache->gen;
+
+	if (NULL != (table_entries = g_hash_table_lookup(cache->tables, table))) {
+		GPtrArray *entries = g_ptr_array_new();
+		guint i;
+
+		/* removing the entries modifies the table_entries, take a copy first */
+		g_hash_table_foreach(table_entries, network_query_cache_collect, entries);
+
+		for (i = 0; i < entries->len; i++) {
+			network_query_cache_remove_entry(cache, entries->pdata[i]);
+		}
+
+		g_ptr_array_free(entries, TRUE);
+	}
+
+	g_mutex_unlock(cache->mutex);
+}
+
+/**
+ * drop all entries, used if we don't know which tables were written
+ */
+void network_query_cache_invalidate_all(network_query_cache *cache) {
+	network_query_cache_entry *entry;
+
+	g_mutex_lock(cache->mutex);
+
+	cache->gen++;
+	cache->flush_gen = cache->gen;
+	cache->invalidations++;
+
+	while ((entry = g_queue_peek_tail(cache->lru))) {
+		network_query_cache_remove_entry(cache, entry);
+	}
+
+	g_mutex_unlock(cache->mutex);
+}
@@ -0,0 +1,84 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_QUERY_CACHE_H_
+#define _NETWORK_QUERY_CACHE_H_
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-exports.h"
+
+/**
+ * a cache of complete resultsets
+ *
+ * the entries are keyed by (user, default-db, charsets, sql_mode, query) and hold
+ * the packets of the resultset as the client got them. Each entry knows the tables it was read
+ * from, a write to one of the tables drops the entry.
+ *
+ * To not cache a result which was read before a concurrent write finished, each
+ * invalidation stamps the table with a new generation. A result is only added if
+ * none of its tables was invalidated since the query was looked up.
+ *
+ * the cache is shared by all event-threads
+ */
+typedef struct {
+	GString *key;
+	GQueue *packets;              /** GString *, the packets of the resultset */
+	gsize size;                   /** bytes of the key and the packets */
+
+	guint64 expires;              /** chassis_get_rel_microseconds() when it is stale */
+
+	GPtrArray *tables;            /** gchar *, "db.tbl" */
+	GList *lru_link;              /** our link in network_query_cache::lru */
+} network_query_cache_entry;
+
+typedef struct {
+	GMutex *mutex;
+
+	GHashTable *entries;          /** GHashTable<key, network_query_cache_entry> */
+	GHashTable *tables;           /** GHashTable<"db.tbl", GHashTable<network_query_cache_entry>> */
+	GHashTable *table_gens;       /** GHashTable<"db.tbl", guint64 *> generation of the last invalidation */
+	GQueue *lru;                  /** network_query_cache_entry, most recently used first */
+
+	guint64 gen;                  /** bumped on each invalidation */
+	guint64 flush_gen;            /** generation of the last invalidation of all tables */
+
+	gsize size;
+	gsize max_size;               /** in bytes, 0 disables the cache */
+	guint64 ttl_us;
+	gsize max_entry_size;         /** results larger than this aren't cached */
+
+	guint64 hits;
+	guint64 misses;
+	guint64 evictions;
+	guint64 invalidations;
+} network_query_cache;
+
+NETWORK_API network_query_cache *network_query_cache_new(void);
+NETWORK_API void network_query_cache_free(network_query_cache *cache);
+NETWORK_API void network_query_cache_key(GString *key, network_socket *client, const gchar *query, gsize query_len);
+NETWORK_API gboolean network_query_cache_lookup(network_query_cache *cache, const GString *key, GQueue *packets, guint64 *gen);
+NETWORK_API gboolean network_query_cache_insert(network_query_cache *cache, const GString *key, GQueue *packets, GPtrArray *tables, guint64 gen);
+NETWORK_API void network_query_cache_invalidate_table(network_query_cache *cache, const gchar *table);
+NETWORK_API void network_query_cache_invalidate_all(network_query_cache *cache);
+
+#endif
@@ -25,6 +25,80 @@
 
 #include "network-queue.h"
 
+/**
+ * max. number of free slabs a thread keeps for reuse
+ */
+#define NETWORK_QUEUE_SLAB_POOL_MAX 64
+
+/**
+ * the free slabs of the current thread
+ *
+ * each event-thread reads into its own slabs, no locking needed
+ */
+static GStaticPrivate slab_pool_key = G_STATIC_PRIVATE_INIT;
+
+static void network_queue_slab_pool_free(gpointer data) {
+	GQueue *pool = data;
+	GString *slab;
+
+	while ((slab = g_queue_pop_head(pool))) g_string_free(slab, TRUE);
+
+	g_queue_free(pool);
+}
+
+static GQueue *network_queue_slab_pool_get(void) {
+	GQueue *pool;
+
+	if (NULL == (pool = g_static_private_get(&slab_pool_key))) {
+		pool = g_queue_new();
+
+		g_static_private_set(&slab_pool_key, pool, network_queue_slab_pool_free);
+	}
+
+	return pool;
+}
+
+/**
+ * get a empty receive buffer of NETWORK_QUEUE_SLAB_SIZE bytes
+ *
+ * @see network_queue_chunk_free()
+ */
+GString *network_queue_slab_new(void) {
+	GString *slab;
+
+	if (NULL != (slab = g_queue_pop_head(network_queue_slab_pool_get()))) {
+		return slab;
+	}
+
+	/* g_string_sized_new() rounds up to the next power of 2 including the trailing \0 */
+	return g_string_sized_new(NETWORK_QUEUE_SLAB_SIZE - 1);
+}
+
+gboolean network_queue_chunk_is_slab(GString *chunk) {
+	return chunk->allocated_len == NETWORK_QUEUE_SLAB_SIZE;
+}
+
+/**
+ * free a chunk of a queue
+ *
+ * slabs are put back into the pool of the current thread
+ */
+void network_queue_chunk_free(GString *chunk) {
+	GQueue *pool;
+
+	if (!chunk) return;
+
+	if (network_queue_chunk_is_slab(chunk) &&
+	    (pool = network_queue_slab_pool_get())->length < NETWORK_QUEUE_SLAB_POOL_MAX) {
+		g_string_truncate(chunk, 0);
+		g_queue_push_head(pool, chunk);
+
+		return;
+	}
+
+	g_string_free(chunk, TRUE);
+}
+
 #ifndef DISABLE_DEPRECATED_DECL
 network_queue *network_queue_init() {
 	return network_queue_new();
@@ -46,7 +120,7 @@ void network_queue_free(network_queue *queue) {
 
 	if (!queue) return;
 
-	while ((packet = g_queue_pop_head(queue->chunks))) g_string_free(packet, TRUE);
+	while ((packet = g_queue_pop_head(queue->chunks))) network_queue_chunk_free(packet);
 
 	g_queue_free(queue->chunks);
 
@@ -122,11 +196,11 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 	while ((chunk = g_queue_peek_head(queue->chunks))) {
 		gsize we_have = we_want < (chunk->len - queue->offset) ? we_want : (chunk->len - queue->offset);
 
-		if (!dest && (queue->offset == 0) && (chunk->len == steal_len)) {
+		if (!dest && (queue->offset == 0) && (chunk->len == steal_len) && !network_queue_chunk_is_slab(chunk)) {
 			/* optimize the common case that we want to have to full chunk
 			 *
 			 * if dest is null, we can remove the GString from the queue and return it directly without
-			 * copying it
+			 * copying it. Slabs are copied and recycled, they would waste their free space.
 			 */
 			dest = g_queue_pop_head(queue->chunks);
 			queue->len -= we_have;
@@ -145,7 +219,7 @@ GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString
 
 		if (chunk->len == queue->offset) {
 			/* the chunk is done, remove it */
-			g_string_free(g_queue_pop_head(queue->chunks), TRUE);
+			network_queue_chunk_free(g_queue_pop_head(queue->chunks));
 			queue->offset = 0;
 		} else {
 			break;
@@ -34,11 +34,21 @@ typedef struct {
 	size_t offset; /* offset in the first chunk */
 } network_queue;
 
+/**
+ * size of the receive buffers including the trailing \0
+ *
+ * sockets read into slabs of this size, consumed slabs are recycled in a per-thread pool
+ */
+#define NETWORK_QUEUE_SLAB_SIZE (16 * 1024)
+
 NETWORK_API network_queue *network_queue_init(void) G_GNUC_DEPRECATED;
 NETWORK_API network_queue *network_queue_new(void);
 NETWORK_API void network_queue_free(network_queue *queue);
 NETWORK_API int network_queue_append(network_queue *queue, GString *chunk);
 NETWORK_API GString *network_queue_pop_string(network_queue *queue, gsize steal_len, GString *dest);
 NETWORK_API GString *network_queue_peek_string(network_queue *queue, gsize peek_len, GString *dest);
+NETWORK_API GString *network_queue_slab_new(void);
+NETWORK_API gboolean network_queue_chunk_is_slab(GString *chunk);
+NETWORK_API void network_queue_chunk_free(GString *chunk);
 
 #endif
@@ -0,0 +1,324 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lua-env.h"
+#include "lua-registry-keys.h"
+#include "glib-ext.h"
+#include "chassis-mainloop.h"
+#include "chassis-event.h"
+
+#define C(x) x, sizeof(x) - 1
+#define S(x) x->str, x->len
+
+#include "network-mysqld.h"
+#include "network-shard-map.h"
+#include "network-shard-map-lua.h"
+
+/**
+ * get the chassis_private of the lua_State
+ */
+static chassis_private *network_shard_map_lua_get_priv(lua_State *L) {
+	chassis *chas;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, CHASSIS_LUA_REGISTRY_KEY);
+	chas = lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	if (!chas) luaL_error(L, "proxy.shard: the chassis isn't registered");
+
+	return chas->priv;
+}
+
+/**
+ * get the table from the current shard-map
+ *
+ * the map stays valid until the lua-function returns
+ */
+static network_shard_table *network_shard_map_lua_get_table(lua_State *L, int ndx) {
+	chassis_private *g = network_shard_map_lua_get_priv(L);
+	const char *name = luaL_checkstring(L, ndx);
+
+	return network_shard_map_get_table(g_atomic_pointer_get((gpointer *)&(g->shard_map)), name);
+}
+
+/**
+ * get the partition-key at ndx, open ends are nil
+ */
+static gint64 network_shard_map_lua_check_bound(lua_State *L, int ndx, gint64 open_end) {
+	if (lua_isnoneornil(L, ndx)) return open_end;
+
+	return (gint64)luaL_checknumber(L, ndx);
+}
+
+/**
+ * proxy.shard.lookup(table, key)
+ *
+ * @return the group of the partition holding key or nil
+ */
+static int proxy_shard_lookup(lua_State *L) {
+	network_shard_table *table = network_shard_map_lua_get_table(L, 1);
+	const gchar *group = NULL;
+
+	if (table) {
+		if (lua_type(L, 2) == LUA_TNUMBER) {
+			group = network_shard_table_lookup(table, (gint64)lua_tonumber(L, 2));
+		} else {
+			size_t key_len;
+			const char *key = luaL_checklstring(L, 2, &key_len);
+
+			group = network_shard_table_lookup_string(table, key, key_len);
+		}
+	}
+
+	if (group) {
+		lua_pushstring(L, group);
+	} else {
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static void network_shard_map_lua_push_groups(lua_State *L, GPtrArray *groups) {
+	guint i;
+
+	lua_createtable(L, groups->len, 0);
+	for (i = 0; i < groups->len; i++) {
+		lua_pushstring(L, groups->pdata[i]);
+		lua_rawseti(L, -2, i + 1);
+	}
+}
+
+/**
+ * proxy.shard.lookup_range(table, min, max)
+ *
+ * min and max are including, nil for open ends
+ *
+ * @return the groups of the partitions which overlap the range, nil for unknown tables
+ */
+static int proxy_shard_lookup_range(lua_State *L) {
+	network_shard_table *table = network_shard_map_lua_get_table(L, 1);
+	gint64 min = network_shard_map_lua_check_bound(L, 2, G_MININT64);
+	gint64 max = network_shard_map_lua_check_bound(L, 3, G_MAXINT64);
+	GPtrArray *groups;
+
+	if (!table) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	groups = g_ptr_array_new();
+	network_shard_table_lookup_range(table, min, max, groups);
+	network_shard_map_lua_push_groups(L, groups);
+	g_ptr_array_free(groups, TRUE);
+
+	return 1;
+}
+
+/**
+ * proxy.shard.groups(table)
+ *
+ * @return the groups of all partitions in the order they were configured, nil for unknown tables
+ */
+static int proxy_shard_groups(lua_State *L) {
+	network_shard_table *table = network_shard_map_lua_get_table(L, 1);
+
+	if (!table) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	network_shard_map_lua_push_groups(L, table->groups);
+
+	return 1;
+}
+
+/**
+ * add the table at the top of the stack to the map
+ *
+ *   { table = "t1", type = "range", partitions = { { group = "t1_0", value = 1000 }, ... } }
+ *
+ * type is "range" (default), "hash" or "consistent", value is only used by "range"
+ *
+ * @return NULL on success, the error otherwise
+ */
+static const char *network_shard_map_lua_add_table(lua_State *L, network_shard_map *map, const char *name) {
+	network_shard_map_type_t type = NETWORK_SHARD_MAP_RANGE;
+	network_shard_table *table;
+	const char *err = NULL;
+	int i;
+
+	lua_getfield(L, -1, "table");
+	if (lua_isstring(L, -1)) name = lua_tostring(L, -1);
+	if (!name) {
+		lua_pop(L, 1);
+		return "a table has no name";
+	}
+
+	lua_getfield(L, -2, "type");
+	if (lua_isstring(L, -1)) {
+		size_t type_len;
+		const char *type_name = lua_tolstring(L, -1, &type_len);
+
+		if (strleq(type_name, type_len, C("range"))) {
+			type = NETWORK_SHARD_MAP_RANGE;
+		} else if (strleq(type_name, type_len, C("hash"))) {
+			type = NETWORK_SHARD_MAP_HASH;
+		} else if (strleq(type_name, type_len, C("consistent"))) {
+			type = NETWORK_SHARD_MAP_CONSISTENT;
+		} else {
+			lua_pop(L, 2);
+			return "type has to be 'range', 'hash' or 'consistent'";
+		}
+	}
+	lua_pop(L, 1);
+
+	table = network_shard_map_add_table(map, name, type);
+	lua_pop(L, 1); /* .table, name isn't used anymore */
+
+	lua_getfield(L, -1, "partitions");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return "partitions has to be a table";
+	}
+
+	for (i = 1; !err; i++) {
+		gint64 max = 0;
+
+		lua_rawgeti(L, -1, i);
+		if (lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+
+		if (!lua_istable(L, -1)) {
+			err = "a partition has to be a table";
+		} else {
+			lua_getfield(L, -1, "value");
+			if (lua_isnumber(L, -1)) {
+				max = (gint64)lua_tonumber(L, -1);
+			} else if (type == NETWORK_SHARD_MAP_RANGE) {
+				err = "the partitions of a 'range' table need a .value";
+			}
+			lua_pop(L, 1);
+
+			lua_getfield(L, -1, "group");
+			if (!lua_isstring(L, -1)) {
+				if (!err) err = "a partition needs a .group";
+			} else if (!err) {
+				network_shard_table_add_partition(table, lua_tostring(L, -1), max);
+			}
+			lua_pop(L, 1);
+		}
+		lua_pop(L, 1); /* the partition */
+	}
+	lua_pop(L, 1); /* .partitions */
+
+	if (!err && 0 != network_shard_table_prepare(table)) {
+		err = "a table needs partitions and the .value of 'range' partitions have to differ";
+	}
+
+	return err;
+}
+
+static void network_shard_map_lua_free(gpointer map) {
+	network_shard_map_free(map);
+}
+
+/**
+ * proxy.shard.load(tables)
+ *
+ * replaces the shard-map of all event-threads. The new map is built first and
+ * published with a pointer-swap, lookups running in parallel see either
+ * the old or the new one.
+ *
+ * tables is a list (or a table keyed by the table-name) of table-definitions,
+ * e.g. hscale's sharding_list
+ *
+ * @return the version of the map, nil and a error-msg if the tables are invalid
+ */
+static int proxy_shard_load(lua_State *L) {
+	chassis_private *g = network_shard_map_lua_get_priv(L);
+	network_shard_map *map, *old;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	map = network_shard_map_new();
+
+	lua_pushnil(L);
+	while (lua_next(L, 1) != 0) {
+		const char *err;
+		const char *name = NULL;
+
+		/* don't lua_tostring() the key, it would confuse lua_next() */
+		if (lua_type(L, -2) == LUA_TSTRING) name = lua_tostring(L, -2);
+
+		if (!lua_istable(L, -1)) {
+			err = "a table-definition has to be a table";
+		} else {
+			err = network_shard_map_lua_add_table(L, map, name);
+		}
+
+		if (err) {
+			network_shard_map_free(map);
+
+			lua_pushnil(L);
+			lua_pushfstring(L, "proxy.shard.load(): %s", err);
+			return 2;
+		}
+
+		lua_pop(L, 1);
+	}
+
+	do {
+		old = g_atomic_pointer_get((gpointer *)&(g->shard_map));
+		map->version = old ? old->version + 1 : 1;
+	} while (!g_atomic_pointer_compare_and_exchange((gpointer *)&(g->shard_map), old, map));
+
+	/* other event-threads may still look up in the old one */
+	if (old) chassis_event_defer_free(old, network_shard_map_lua_free);
+
+	g_debug("%s: loaded shard-map version %d", G_STRLOC, map->version);
+
+	lua_pushinteger(L, map->version);
+
+	return 1;
+}
+
+/**
+ * register proxy.shard.* in the proxy-table at the top of the stack
+ */
+void network_shard_map_lua_setup(lua_State *L) {
+	static const struct luaL_reg methods[] = {
+		{ "load", proxy_shard_load },
+		{ "lookup", proxy_shard_lookup },
+		{ "lookup_range", proxy_shard_lookup_range },
+		{ "groups", proxy_shard_groups },
+		{ NULL, NULL },
+	};
+
+	lua_newtable(L);
+	luaL_register(L, NULL, methods);
+	lua_setfield(L, -2, "shard");
+}
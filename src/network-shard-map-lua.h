@@ -1,5 +1,5 @@
 /* $%BEGINLICENSE%$
- Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
 
  This program is free software; you can redistribute it and/or
  modify it under the terms of the GNU General Public License as
@@ -17,10 +17,13 @@
  02110-1301  USA
 
  $%ENDLICENSE%$ */
-#ifndef __SQL_TOKENIZER_KEYWORDS_H__
-#define __SQL_TOKENIZER_KEYWORDS_H__
+#ifndef __NETWORK_SHARD_MAP_LUA_H__
+#define __NETWORK_SHARD_MAP_LUA_H__
 
-int *sql_keywords_get(void);
-int sql_keywords_get_count(void);
+#include <lua.h>
+
+#include "network-exports.h"
+
+NETWORK_API void network_shard_map_lua_setup(lua_State *L);
 
 #endif
@@ -0,0 +1,295 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/**
+ * @file
+ * the partitions of sharded tables, looked up in C
+ *
+ * RANGE tables keep their partitions sorted by the upper bound, a lookup is a
+ * binary search. HASH and CONSISTENT tables pick the partition from the
+ * key directly.
+ *
+ * string keys which are integers are looked up as integers, others are
+ * hashed with FNV-1a (RANGE tables have no partition for them)
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "network-shard-map.h"
+
+static void network_shard_table_free(gpointer _table) {
+	network_shard_table *table = _table;
+
+	g_free(table->name);
+	g_ptr_array_foreach(table->groups, (GFunc)g_free, NULL);
+	g_ptr_array_free(table->groups, TRUE);
+	g_array_free(table->ranges, TRUE);
+
+	g_free(table);
+}
+
+network_shard_map *network_shard_map_new(void) {
+	network_shard_map *map;
+
+	map = g_new0(network_shard_map, 1);
+	map->tables = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, network_shard_table_free);
+
+	return map;
+}
+
+void network_shard_map_free(network_shard_map *map) {
+	if (!map) return;
+
+	g_hash_table_destroy(map->tables);
+
+	g_free(map);
+}
+
+/**
+ * add a table to the map, replaces a table of the same name
+ */
+network_shard_table *network_shard_map_add_table(network_shard_map *map, const gchar *name, network_shard_map_type_t type) {
+	network_shard_table *table;
+
+	table = g_new0(network_shard_table, 1);
+	table->name = g_strdup(name);
+	table->type = type;
+	table->groups = g_ptr_array_new();
+	table->ranges = g_array_new(FALSE, FALSE, sizeof(network_shard_range));
+
+	g_hash_table_replace(map->tables, table->name, table);
+
+	return table;
+}
+
+network_shard_table *network_shard_map_get_table(network_shard_map *map, const gchar *name) {
+	if (!map) return NULL;
+
+	return g_hash_table_lookup(map->tables, name);
+}
+
+/**
+ * add a partition
+ *
+ * @param max  the upper bound of the keys of the partition (including), RANGE tables only
+ * @return 0
+ */
+int network_shard_table_add_partition(network_shard_table *table, const gchar *group, gint64 max) {
+	gchar *name = g_strdup(group);
+
+	g_ptr_array_add(table->groups, name);
+
+	if (table->type == NETWORK_SHARD_MAP_RANGE) {
+		network_shard_range range;
+
+		range.max = max;
+		range.group = name;
+
+		g_array_append_val(table->ranges, range);
+	}
+
+	return 0;
+}
+
+static gint network_shard_range_cmp(gconstpointer _a, gconstpointer _b) {
+	const network_shard_range *a = _a;
+	const network_shard_range *b = _b;
+
+	if (a->max < b->max) return -1;
+	if (a->max > b->max) return 1;
+
+	return 0;
+}
+
+/**
+ * sort the partitions for the lookups
+ *
+ * @return 0 on success, -1 if the table has no partitions or two ranges end at the same key
+ */
+int network_shard_table_prepare(network_shard_table *table) {
+	guint i;
+
+	if (table->groups->len == 0) return -1;
+
+	g_array_sort(table->ranges, network_shard_range_cmp);
+
+	for (i = 1; i < table->ranges->len; i++) {
+		if (g_array_index(table->ranges, network_shard_range, i - 1).max ==
+		    g_array_index(table->ranges, network_shard_range, i).max) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * find the first range which ends at or after key
+ *
+ * @return the index of the range, ->len if key is after the last one
+ */
+static guint network_shard_table_find_range(network_shard_table *table, gint64 key) {
+	guint lo = 0, hi = table->ranges->len;
+
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index(table->ranges, network_shard_range, mid).max < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * jump consistent hash
+ *
+ * maps the key to one of num_buckets buckets. Growing num_buckets by one
+ * moves 1/num_buckets of the keys to the new bucket, the others stay.
+ *
+ * see "A Fast, Minimal Memory, Consistent Hash Algorithm", Lamping, Veach
+ */
+static guint network_shard_jump_hash(guint64 key, guint num_buckets) {
+	gint64 b = -1, j = 0;
+
+	while (j < num_buckets) {
+		b = j;
+		key = key * G_GUINT64_CONSTANT(2862933555777941757) + 1;
+		j = (b + 1) * ((double)(G_GINT64_CONSTANT(1) << 31) / (double)((key >> 33) + 1));
+	}
+
+	return b;
+}
+
+static const gchar *network_shard_table_lookup_hash(network_shard_table *table, guint64 hash) {
+	guint n = table->groups->len;
+
+	if (n == 0) return NULL;
+
+	if (table->type == NETWORK_SHARD_MAP_CONSISTENT) {
+		return table->groups->pdata[network_shard_jump_hash(hash, n)];
+	}
+
+	return table->groups->pdata[hash % n];
+}
+
+/**
+ * get the partition of a key
+ *
+ * @return the group of the partition, NULL if no partition covers the key
+ */
+const gchar *network_shard_table_lookup(network_shard_table *table, gint64 key) {
+	guint ndx;
+	gint64 r;
+
+	switch (table->type) {
+	case NETWORK_SHARD_MAP_RANGE:
+		ndx = network_shard_table_find_range(table, key);
+		if (ndx == table->ranges->len) return NULL;
+
+		return g_array_index(table->ranges, network_shard_range, ndx).group;
+	case NETWORK_SHARD_MAP_HASH:
+		if (table->groups->len == 0) return NULL;
+
+		/* like key % n in lua, never negative */
+		r = key % (gint64)table->groups->len;
+		if (r < 0) r += table->groups->len;
+
+		return table->groups->pdata[r];
+	case NETWORK_SHARD_MAP_CONSISTENT:
+		return network_shard_table_lookup_hash(table, (guint64)key);
+	}
+
+	return NULL;
+}
+
+/**
+ * get the partition of a string key
+ *
+ * @see network_shard_table_lookup()
+ */
+const gchar *network_shard_table_lookup_string(network_shard_table *table, const gchar *key, gsize key_len) {
+	guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+	gchar buf[32];
+	gsize i;
+
+	if (key_len > 0 && key_len < sizeof(buf)) {
+		gchar *end;
+		gint64 n;
+
+		memcpy(buf, key, key_len);
+		buf[key_len] = '\0';
+
+		errno = 0;
+		n = g_ascii_strtoll(buf, &end, 10);
+		if (errno == 0 && end != buf && *end == '\0') {
+			return network_shard_table_lookup(table, n);
+		}
+	}
+
+	if (table->type == NETWORK_SHARD_MAP_RANGE) return NULL;
+
+	for (i = 0; i < key_len; i++) {
+		hash ^= (guchar)key[i];
+		hash *= G_GUINT64_CONSTANT(1099511628211);
+	}
+
+	return network_shard_table_lookup_hash(table, hash);
+}
+
+/**
+ * get the partitions which may hold keys between min and max (including)
+ *
+ * only RANGE tables can narrow it down, the others return all partitions. Use
+ * G_MININT64 and G_MAXINT64 for open ends.
+ *
+ * @param groups  the groups are appended to it, not copied
+ * @return 0
+ */
+int network_shard_table_lookup_range(network_shard_table *table, gint64 min, gint64 max, GPtrArray *groups) {
+	guint i;
+
+	if (table->type != NETWORK_SHARD_MAP_RANGE) {
+		for (i = 0; i < table->groups->len; i++) {
+			g_ptr_array_add(groups, table->groups->pdata[i]);
+		}
+
+		return 0;
+	}
+
+	if (min > max) return 0;
+
+	for (i = network_shard_table_find_range(table, min); i < table->ranges->len; i++) {
+		network_shard_range *range = &g_array_index(table->ranges, network_shard_range, i);
+
+		g_ptr_array_add(groups, (gpointer)range->group);
+
+		if (range->max >= max) break;
+	}
+
+	return 0;
+}
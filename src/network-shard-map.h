@@ -0,0 +1,81 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _NETWORK_SHARD_MAP_H_
+#define _NETWORK_SHARD_MAP_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/**
+ * how the key of a sharded table is mapped to its partitions
+ */
+typedef enum {
+	NETWORK_SHARD_MAP_RANGE,      /** partitions cover key-ranges, found by binary search */
+	NETWORK_SHARD_MAP_HASH,       /** key modulo the number of partitions */
+	NETWORK_SHARD_MAP_CONSISTENT  /** jump consistent hash, adding a partition moves only 1/n of the keys */
+} network_shard_map_type_t;
+
+/**
+ * a partition of a RANGE table
+ *
+ * it covers the keys from the max of the partition before (excluding) to
+ * its own max (including)
+ */
+typedef struct {
+	gint64 max;
+	const gchar *group;           /** points into ->groups of the table */
+} network_shard_range;
+
+typedef struct {
+	gchar *name;
+	network_shard_map_type_t type;
+
+	GPtrArray *groups;            /** gchar *, the partitions in the order they were added */
+	GArray *ranges;               /** network_shard_range sorted by ->max, RANGE only */
+} network_shard_table;
+
+/**
+ * the partitions of all sharded tables
+ *
+ * a map is immutable once it is published. A reload builds a new map and
+ * swaps the pointer, readers of the old one are done with it before it is
+ * freed through chassis_event_defer_free().
+ */
+typedef struct {
+	gint version;
+	GHashTable *tables;           /** GHashTable<gchar *name, network_shard_table *> */
+} network_shard_map;
+
+NETWORK_API network_shard_map *network_shard_map_new(void);
+NETWORK_API void network_shard_map_free(network_shard_map *map);
+NETWORK_API network_shard_table *network_shard_map_add_table(network_shard_map *map, const gchar *name, network_shard_map_type_t type);
+NETWORK_API network_shard_table *network_shard_map_get_table(network_shard_map *map, const gchar *name);
+
+NETWORK_API int network_shard_table_add_partition(network_shard_table *table, const gchar *group, gint64 max);
+NETWORK_API int network_shard_table_prepare(network_shard_table *table);
+
+NETWORK_API const gchar *network_shard_table_lookup(network_shard_table *table, gint64 key);
+NETWORK_API const gchar *network_shard_table_lookup_string(network_shard_table *table, const gchar *key, gsize key_len);
+NETWORK_API int network_shard_table_lookup_range(network_shard_table *table, gint64 min, gint64 max, GPtrArray *groups);
+
+#endif
@@ -51,6 +51,10 @@
 #include <errno.h>
 #include <fcntl.h>
 
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #ifdef HAVE_WRITEV
 #define USE_BUFFERED_NETIO 
 #else
@@ -72,10 +76,20 @@
 #define E_NET_WOULDBLOCK EWOULDBLOCK
 #endif
 
+/**
+ * header of a frame of the compressed protocol
+ *
+ *   3 bytes  length of the payload
+ *   1 byte   sequence-id
+ *   3 bytes  length of the uncompressed payload, 0 if it is sent uncompressed
+ */
+#define NETWORK_SOCKET_COMPRESSED_HEADER_SIZE 7
+
 #include "network-debug.h"
 #include "network-socket.h"
 #include "network-mysqld-proto.h"
 #include "network-mysqld-packet.h"
+#include "network-prepared-stmts.h"
 #include "string-len.h"
 #include "glib-ext.h"
 
@@ -118,6 +132,8 @@ void network_socket_free(network_socket *s) {
 	network_queue_free(s->send_queue);
 	network_queue_free(s->recv_queue);
 	network_queue_free(s->recv_queue_raw);
+	network_queue_free(s->recv_queue_compressed);
+	network_queue_free(s->send_queue_compressed);
 
 	if (s->response) network_mysqld_auth_response_free(s->response);
 	if (s->challenge) network_mysqld_auth_challenge_free(s->challenge);
@@ -140,6 +156,8 @@ void network_socket_free(network_socket *s) {
     g_string_free(s->charset_results, TRUE);
     g_string_free(s->sql_mode, TRUE);
 
+	if (s->prepared_stmts) network_prepared_stmts_free(s->prepared_stmts);
+
 	g_free(s);
 }
 
@@ -176,7 +194,7 @@ network_socket *network_socket_accept(network_socket *srv) {
 	g_return_val_if_fail(srv->socket_type == SOCK_STREAM, NULL); /* accept() only works on stream sockets */
 
 	client = network_socket_new();
-    if (-1 == (client->fd = accept4(srv->fd, &client->src->addr.common, &(client->src->len), SOCK_NONBLOCK))) {
+    if (-1 == (client->fd = accept4(srv->fd, &client->src->addr.common, &(client->src->len), SOCK_NONBLOCK | SOCK_CLOEXEC))) {
         network_socket_free(client);
 
         return NULL;
@@ -280,18 +298,14 @@ network_socket_retval_t network_socket_connect(network_socket *sock) {
 	 *
 	 * if the dst->addr isn't set yet, socket() will fail with unsupported type
 	 */
-	if (-1 == (sock->fd = socket(sock->dst->addr.common.sa_family, sock->socket_type, 0))) {
+	if (-1 == (sock->fd = socket(sock->dst->addr.common.sa_family, sock->socket_type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))) {
 		g_critical("%s.%d: socket(%s) failed: %s (%d)", 
 				__FILE__, __LINE__,
 				sock->dst->name->str, g_strerror(errno), errno);
 		return NETWORK_SOCKET_ERROR;
 	}
 
-	/**
-	 * make the connect() call non-blocking
-	 *
-	 */
-	network_socket_set_non_blocking(sock);
+	/* the socket is created non-blocking, the connect() call won't block */
 
 	if (-1 == connect(sock->fd, &sock->dst->addr.common, sock->dst->len)) {
 		/**
@@ -340,7 +354,7 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 		g_return_val_if_fail(con->dst, NETWORK_SOCKET_ERROR);
 		g_return_val_if_fail(con->dst->name->len > 0, NETWORK_SOCKET_ERROR);
 
-		if (-1 == (con->fd = socket(con->dst->addr.common.sa_family, con->socket_type, 0))) {
+		if (-1 == (con->fd = socket(con->dst->addr.common.sa_family, con->socket_type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))) {
 			g_critical("%s: socket(%s) failed: %s (%d)", 
 					G_STRLOC,
 					con->dst->name->str,
@@ -370,6 +384,22 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 						g_strerror(errno), errno);
 				return NETWORK_SOCKET_ERROR;
 			}
+
+			if (con->reuse_port) {
+#ifdef SO_REUSEPORT
+				/* SO_REUSEPORT is int on unix */
+				if (0 != setsockopt(con->fd, SOL_SOCKET, SO_REUSEPORT, SETSOCKOPT_OPTVAL_CAST &val, sizeof(val))) {
+					g_critical("%s: setsockopt(%s, SOL_SOCKET, SO_REUSEPORT) failed: %s (%d)", 
+							G_STRLOC,
+							con->dst->name->str,
+							g_strerror(errno), errno);
+					return NETWORK_SOCKET_ERROR;
+				}
+#else
+				g_critical("%s: SO_REUSEPORT isn't supported on this platform", G_STRLOC);
+				return NETWORK_SOCKET_ERROR;
+#endif
+			}
 		}
 
 		if (con->dst->addr.common.sa_family == AF_INET6) {
@@ -513,59 +543,300 @@ network_socket_retval_t network_socket_bind(network_socket * con) {
 	return NETWORK_SOCKET_SUCCESS;
 }
 
+/**
+ * switch the socket to the compressed protocol
+ *
+ * called once the auth-phase which negotiated CLIENT_COMPRESS is over, the
+ * queues have to be empty
+ */
+void network_socket_set_compressed(network_socket *sock) {
+	if (sock->is_compressed) return;
+
+	g_assert_cmpint(sock->recv_queue_raw->len, ==, 0);
+	g_assert_cmpint(sock->send_queue->len, ==, 0);
+
+	if (!sock->recv_queue_compressed) sock->recv_queue_compressed = network_queue_new();
+	if (!sock->send_queue_compressed) sock->send_queue_compressed = network_queue_new();
+	if (!sock->compress_min_len) sock->compress_min_len = NETWORK_SOCKET_COMPRESS_MIN_LEN;
+
+	sock->is_compressed = TRUE;
+	sock->compress_after_auth = FALSE;
+	sock->compressed_packet_id = 0;
+	sock->compressed_packet_id_is_reset = FALSE;
+}
+
+/**
+ * unpack the complete frames of ->recv_queue_compressed into ->recv_queue_raw
+ *
+ * the frames carry a stream of packets, a packet may span several frames
+ */
+static network_socket_retval_t network_socket_uncompress(network_socket *sock) {
+#ifdef HAVE_ZLIB_H
+	network_queue *compressed = sock->recv_queue_compressed;
+	char header_str[NETWORK_SOCKET_COMPRESSED_HEADER_SIZE + 1];
+	GString header;
+
+	header.str = header_str;
+	header.allocated_len = sizeof(header_str);
+
+	for (;;) {
+		GString *frame, *payload;
+		guint32 frame_len;
+		guint32 payload_len;
+		uLongf dest_len;
+		unsigned char *p;
+
+		header.len = 0;
+
+		if (!network_queue_peek_string(compressed, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE, &header)) break;
+
+		frame_len = network_mysqld_proto_get_packet_len(&header);
+		p = (unsigned char *)header.str;
+		payload_len = p[4] | p[5] << 8 | p[6] << 16;
+
+		if (NULL == (frame = network_queue_pop_string(compressed, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE + frame_len, NULL))) break;
+
+		sock->compressed_packet_id = network_mysqld_proto_get_packet_id(frame);
+
+		if (payload_len == 0) {
+			/* the payload is sent uncompressed */
+			g_string_erase(frame, 0, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE);
+			if (frame->len > 0) {
+				network_queue_append(sock->recv_queue_raw, frame);
+			} else {
+				g_string_free(frame, TRUE);
+			}
+
+			continue;
+		}
+
+		payload = g_string_sized_new(payload_len);
+		dest_len = payload_len;
+
+		if (Z_OK != uncompress((Bytef *)payload->str, &dest_len, 
+					(const Bytef *)frame->str + NETWORK_SOCKET_COMPRESSED_HEADER_SIZE, frame_len) ||
+		    dest_len != payload_len) {
+			g_critical("%s: uncompressing a frame of %u bytes from %s failed",
+					G_STRLOC,
+					frame_len,
+					sock->dst->name->str);
+
+			g_string_free(payload, TRUE);
+			g_string_free(frame, TRUE);
+
+			return NETWORK_SOCKET_ERROR;
+		}
+		g_string_free(frame, TRUE);
+
+		payload->len = payload_len;
+		payload->str[payload->len] = '\0';
+
+		network_queue_append(sock->recv_queue_raw, payload);
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+#else
+	g_critical("%s: the compressed protocol isn't supported, built without zlib", G_STRLOC);
+
+	return NETWORK_SOCKET_ERROR;
+#endif
+}
+
+/**
+ * pack the packets of ->send_queue into frames on ->send_queue_compressed
+ *
+ * a frame carries up to PACKET_LEN_MAX bytes. Payloads shorter than 
+ * ->compress_min_len and payloads which don't shrink are sent uncompressed. 
+ *
+ * the sequence-id of the frames restarts at 0 for a new command (see 
+ * network_socket_start_command()) and follows the frames of the other side otherwise
+ */
+static network_socket_retval_t network_socket_compress(network_socket *sock) {
+#ifdef HAVE_ZLIB_H
+	network_queue *queue = sock->send_queue;
+
+	while (queue->len > 0) {
+		GString *payload, *frame;
+		guint32 payload_len = 0; /* 0 if sent uncompressed */
+		unsigned char *p;
+
+		payload = network_queue_pop_string(queue, MIN(queue->len, PACKET_LEN_MAX), NULL);
+
+		if (sock->compressed_packet_id_is_reset) {
+			sock->compressed_packet_id = 0;
+			sock->compressed_packet_id_is_reset = FALSE;
+		} else {
+			sock->compressed_packet_id++;
+		}
+
+		frame = g_string_sized_new(NETWORK_SOCKET_COMPRESSED_HEADER_SIZE + payload->len);
+		g_string_set_size(frame, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE);
+
+		if (payload->len >= sock->compress_min_len) {
+			uLongf dest_len = compressBound(payload->len);
+
+			g_string_set_size(frame, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE + dest_len);
+
+			if (Z_OK == compress((Bytef *)frame->str + NETWORK_SOCKET_COMPRESSED_HEADER_SIZE, &dest_len, 
+						(const Bytef *)payload->str, payload->len) &&
+			    dest_len < payload->len) {
+				payload_len = payload->len;
+
+				g_string_truncate(frame, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE + dest_len);
+			} else {
+				g_string_truncate(frame, NETWORK_SOCKET_COMPRESSED_HEADER_SIZE);
+			}
+		}
+
+		if (payload_len == 0) g_string_append_len(frame, S(payload));
+
+		network_mysqld_proto_set_packet_len(frame, frame->len - NETWORK_SOCKET_COMPRESSED_HEADER_SIZE);
+		network_mysqld_proto_set_packet_id(frame, sock->compressed_packet_id);
+		p = (unsigned char *)frame->str;
+		p[4] = (payload_len >>  0) & 0xFF;
+		p[5] = (payload_len >>  8) & 0xFF;
+		p[6] = (payload_len >> 16) & 0xFF;
+
+		network_queue_chunk_free(payload);
+
+		network_queue_append(sock->send_queue_compressed, frame);
+	}
+
+	return NETWORK_SOCKET_SUCCESS;
+#else
+	g_critical("%s: the compressed protocol isn't supported, built without zlib", G_STRLOC);
+
+	return NETWORK_SOCKET_ERROR;
+#endif
+}
+
+/**
+ * the next packet appended to ->send_queue starts a new command
+ *
+ * on compressed sockets the packets queued so far are packed into frames
+ * right away, the frames of the new command start at sequence-id 0. The
+ * packet-ids can't tell: they wrap through 0 in large resultsets.
+ *
+ * @see network_mysqld_queue_append()
+ */
+void network_socket_start_command(network_socket *sock) {
+	if (!sock->is_compressed) return;
+
+	if (sock->send_queue->len > 0) network_socket_compress(sock);
+
+	sock->compressed_packet_id_is_reset = TRUE;
+}
+
 /**
  * read a data from the socket
  *
+ * stream sockets are read into slabs until the socket is drained or ->to_read 
+ * bytes are read. The free space of the last slab in the raw queue is filled up first.
+ *
+ * if the other side closed the connection and nothing was read, ->is_peer_closed is set
+ *
+ * on compressed sockets the frames are read into ->recv_queue_compressed first
+ *
  * @param sock the socket
  */
 network_socket_retval_t network_socket_read(network_socket *sock) {
 	gssize len;
+	gsize have_read = 0;
+	network_queue *raw = sock->is_compressed ? sock->recv_queue_compressed : sock->recv_queue_raw;
+	GString *chunk;
 
-	if (sock->to_read > 0) {
+	if (sock->to_read <= 0) return NETWORK_SOCKET_SUCCESS;
+
+	if (sock->socket_type != SOCK_STREAM) {
+		/* UDP, ->to_read is the size of the datagram */
+		network_socklen_t dst_len = sizeof(sock->dst->addr.common);
 		GString *packet = g_string_sized_new(sock->to_read);
 
-		g_queue_push_tail(sock->recv_queue_raw->chunks, packet);
-        g_debug("%s: recv queue length:%d, sock:%p, client addr:%s",
-                G_STRLOC, sock->recv_queue_raw->chunks->length, 
-                sock, sock->src->name->str);
+		g_queue_push_tail(raw->chunks, packet);
 
-		if (sock->socket_type == SOCK_STREAM) {
-			len = recv(sock->fd, packet->str, sock->to_read, 0);
-		} else {
-			/* UDP */
-			network_socklen_t dst_len = sizeof(sock->dst->addr.common);
-			len = recvfrom(sock->fd, packet->str, sock->to_read, 0, &(sock->dst->addr.common), &(dst_len));
-			sock->dst->len = dst_len;
+		len = recvfrom(sock->fd, packet->str, sock->to_read, 0, &(sock->dst->addr.common), &(dst_len));
+		sock->dst->len = dst_len;
+
+		if (-1 == len) {
+			switch (errno) {
+			case E_NET_WOULDBLOCK: /** the buffers are empty, try again later */
+			case EAGAIN:     
+				return NETWORK_SOCKET_WAIT_FOR_EVENT;
+			default:
+				g_debug("%s: recvfrom() failed: %s (errno=%d)", G_STRLOC, g_strerror(errno), errno);
+				return NETWORK_SOCKET_ERROR;
+			}
+		}
+
+		sock->to_read -= len;
+		raw->len += len;
+		packet->len = len;
+
+		return NETWORK_SOCKET_SUCCESS;
+	}
+
+	while (sock->to_read > 0) {
+		gsize avail;
+
+		chunk = g_queue_peek_tail(raw->chunks);
+		if (!chunk || !network_queue_chunk_is_slab(chunk) || chunk->len + 1 >= chunk->allocated_len) {
+			chunk = network_queue_slab_new();
+
+			g_queue_push_tail(raw->chunks, chunk);
 		}
+
+		avail = chunk->allocated_len - chunk->len - 1;
+		if ((gsize)sock->to_read < avail) avail = sock->to_read;
+
+		len = recv(sock->fd, chunk->str + chunk->len, avail, 0);
 		if (-1 == len) {
 			switch (errno) {
 			case E_NET_CONNABORTED:
-			case E_NET_CONNRESET: /** nothing to read, let's let ioctl() handle the close for us */
+			case E_NET_CONNRESET: /** the connection got reset, handle it like a close */
+				if (have_read == 0) sock->is_peer_closed = TRUE;
+				break;
 			case E_NET_WOULDBLOCK: /** the buffers are empty, try again later */
 			case EAGAIN:     
-				return NETWORK_SOCKET_WAIT_FOR_EVENT;
+				break;
 			default:
 				g_debug("%s: recv() failed: %s (errno=%d)", G_STRLOC, g_strerror(errno), errno);
 				return NETWORK_SOCKET_ERROR;
 			}
+
+			break;
 		} else if (len == 0) {
 			/**
 			 * connection close
 			 *
-			 * let's call the ioctl() and let it handle it for use
+			 * if we have read something already, let the caller handle that first
 			 */
-			return NETWORK_SOCKET_WAIT_FOR_EVENT;
+			if (have_read == 0) sock->is_peer_closed = TRUE;
+
+			break;
 		}
 
-		sock->to_read -= len;
-		sock->recv_queue_raw->len += len;
-#if 0
-		sock->recv_queue_raw->offset = 0; /* offset into the first packet */
-#endif
-		packet->len = len;
+		chunk->len += len;
+		chunk->str[chunk->len] = '\0';
+
+		raw->len       += len;
+		sock->to_read  -= len;
+		have_read      += len;
+
+		if ((gsize)len < avail) break; /* a short read, the socket is drained */
 	}
 
-	return NETWORK_SOCKET_SUCCESS;
+	sock->to_read = 0;
+
+	/* don't leave a empty slab behind */
+	if (NULL != (chunk = g_queue_peek_tail(raw->chunks)) && chunk->len == 0) {
+		network_queue_chunk_free(g_queue_pop_tail(raw->chunks));
+	}
+
+	if (have_read > 0 && sock->is_compressed) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_uncompress(sock)) return NETWORK_SOCKET_ERROR;
+	}
+
+	return have_read > 0 ? NETWORK_SOCKET_SUCCESS : NETWORK_SOCKET_WAIT_FOR_EVENT;
 }
 
 #ifdef HAVE_WRITEV
@@ -573,7 +844,7 @@ network_socket_retval_t network_socket_read(network_socket *sock) {
  * write data to the socket
  *
  */
-static network_socket_retval_t network_socket_write_writev(network_socket *con, int send_chunks) {
+static network_socket_retval_t network_socket_write_writev(network_socket *con, network_queue *queue, int send_chunks) {
 	/* send the whole queue */
 	GList *chunk;
 	struct iovec *iov;
@@ -585,7 +856,7 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
 
 	if (send_chunks == 0) return NETWORK_SOCKET_SUCCESS;
 
-	chunk_count = send_chunks > 0 ? send_chunks : (gint)con->send_queue->chunks->length;
+	chunk_count = send_chunks > 0 ? send_chunks : (gint)queue->chunks->length;
 	
 	if (chunk_count == 0) return NETWORK_SOCKET_SUCCESS;
 
@@ -607,16 +878,16 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
 
 	iov = g_new0(struct iovec, chunk_count);
 
-	for (chunk = con->send_queue->chunks->head, chunk_id = 0; 
+	for (chunk = queue->chunks->head, chunk_id = 0; 
 	     chunk && chunk_id < chunk_count; 
 	     chunk_id++, chunk = chunk->next) {
 		GString *s = chunk->data;
 	
 		if (chunk_id == 0) {
-			g_assert(con->send_queue->offset < s->len);
+			g_assert(queue->offset < s->len);
 
-			iov[chunk_id].iov_base = s->str + con->send_queue->offset;
-			iov[chunk_id].iov_len  = s->len - con->send_queue->offset;
+			iov[chunk_id].iov_base = s->str + queue->offset;
+			iov[chunk_id].iov_len  = s->len - queue->offset;
 		} else {
 			iov[chunk_id].iov_base = s->str;
 			iov[chunk_id].iov_len  = s->len;
@@ -656,24 +927,24 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
 		return NETWORK_SOCKET_ERROR;
 	}
 
-	con->send_queue->offset += len;
-	con->send_queue->len    -= len;
+	queue->offset += len;
+	queue->len    -= len;
 
 	/* check all the chunks which we have sent out */
-	for (chunk = con->send_queue->chunks->head; chunk; ) {
+	for (chunk = queue->chunks->head; chunk; ) {
 		GString *s = chunk->data;
 
-		if (con->send_queue->offset >= s->len) {
-			con->send_queue->offset -= s->len;
+		if (queue->offset >= s->len) {
+			queue->offset -= s->len;
 #ifdef NETWORK_DEBUG_TRACE_IO
 			/* to trace the data we sent to the socket, enable this */
 			g_debug_hexdump(G_STRLOC, S(s));
 #endif
-			g_string_free(s, TRUE);
+			network_queue_chunk_free(s);
 			
-			g_queue_delete_link(con->send_queue->chunks, chunk);
+			g_queue_delete_link(queue->chunks, chunk);
 
-			chunk = con->send_queue->chunks->head;
+			chunk = queue->chunks->head;
 		} else {
 			return NETWORK_SOCKET_WAIT_FOR_EVENT;
 		}
@@ -687,22 +958,22 @@ static network_socket_retval_t network_socket_write_writev(network_socket *con,
  * write data to the socket
  *
  */
-static network_socket_retval_t network_socket_write_send(network_socket *con, int send_chunks) {
+static network_socket_retval_t network_socket_write_send(network_socket *con, network_queue *queue, int send_chunks) {
 	/* send the whole queue */
 	GList *chunk;
 
 	if (send_chunks == 0) return NETWORK_SOCKET_SUCCESS;
 
-	for (chunk = con->send_queue->chunks->head; chunk; ) {
+	for (chunk = queue->chunks->head; chunk; ) {
 		GString *s = chunk->data;
 		gssize len;
 
-		g_assert(con->send_queue->offset < s->len);
+		g_assert(queue->offset < s->len);
 
 		if (con->socket_type == SOCK_STREAM) {
-			len = send(con->fd, s->str + con->send_queue->offset, s->len - con->send_queue->offset, 0);
+			len = send(con->fd, s->str + queue->offset, s->len - queue->offset, 0);
 		} else {
-			len = sendto(con->fd, s->str + con->send_queue->offset, s->len - con->send_queue->offset, 0, &(con->dst->addr.common), con->dst->len);
+			len = sendto(con->fd, s->str + queue->offset, s->len - queue->offset, 0, &(con->dst->addr.common), con->dst->len);
 		}
 		if (-1 == len) {
 			switch (errno) {
@@ -718,7 +989,7 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 				g_message("%s: send(%s, %"G_GSIZE_FORMAT") failed: %s", 
 						G_STRLOC, 
 						con->dst->name->str, 
-						s->len - con->send_queue->offset, 
+						s->len - queue->offset, 
 						g_strerror(errno));
 				return NETWORK_SOCKET_ERROR;
 			}
@@ -726,17 +997,17 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 			return NETWORK_SOCKET_ERROR;
 		}
 
-		con->send_queue->offset += len;
+		queue->offset += len;
 
-		if (con->send_queue->offset == s->len) {
-			g_string_free(s, TRUE);
+		if (queue->offset == s->len) {
+			network_queue_chunk_free(s);
 			
-			g_queue_delete_link(con->send_queue->chunks, chunk);
-			con->send_queue->offset = 0;
+			g_queue_delete_link(queue->chunks, chunk);
+			queue->offset = 0;
 
 			if (send_chunks > 0 && --send_chunks == 0) break;
 
-			chunk = con->send_queue->chunks->head;
+			chunk = queue->chunks->head;
 		} else {
 			return NETWORK_SOCKET_WAIT_FOR_EVENT;
 		}
@@ -748,20 +1019,32 @@ static network_socket_retval_t network_socket_write_send(network_socket *con, in
 /**
  * write a content of con->send_queue to the socket
  *
+ * on compressed sockets the send-queue is packed into frames first
+ *
  * @param con         socket to read from
  * @param send_chunks number of chunks to send, if < 0 send all
  *
  * @returns NETWORK_SOCKET_SUCCESS on success, NETWORK_SOCKET_ERROR on error and NETWORK_SOCKET_WAIT_FOR_EVENT if the call would have blocked 
  */
 network_socket_retval_t network_socket_write(network_socket *con, int send_chunks) {
+	network_queue *queue = con->send_queue;
+
+	if (con->is_compressed && send_chunks != 0) {
+		if (NETWORK_SOCKET_SUCCESS != network_socket_compress(con)) return NETWORK_SOCKET_ERROR;
+
+		/* the frames don't match the chunks of the send-queue */
+		queue = con->send_queue_compressed;
+		send_chunks = -1;
+	}
+
 	if (con->socket_type == SOCK_STREAM) {
 #ifdef HAVE_WRITEV
-		return network_socket_write_writev(con, send_chunks);
+		return network_socket_write_writev(con, queue, send_chunks);
 #else
-		return network_socket_write_send(con, send_chunks);
+		return network_socket_write_send(con, queue, send_chunks);
 #endif
 	} else {
-		return network_socket_write_send(con, send_chunks);
+		return network_socket_write_send(con, queue, send_chunks);
 	}
 }
 
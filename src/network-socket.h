@@ -53,6 +53,16 @@
 
 #include "network-address.h"
 
+/**
+ * max. bytes read from a readable socket per event
+ */
+#define NETWORK_SOCKET_READ_MAX (16 * NETWORK_QUEUE_SLAB_SIZE)
+
+/**
+ * payloads of the compressed protocol shorter than this are sent uncompressed
+ */
+#define NETWORK_SOCKET_COMPRESS_MIN_LEN 50
+
 typedef enum {
 	NETWORK_SOCKET_SUCCESS,
 	NETWORK_SOCKET_WAIT_FOR_EVENT,
@@ -62,6 +72,7 @@ typedef enum {
 
 typedef struct network_mysqld_auth_challenge network_mysqld_auth_challenge;
 typedef struct network_mysqld_auth_response network_mysqld_auth_response;
+typedef struct network_prepared_stmts network_prepared_stmts;
 
 typedef struct {
     guint64  key;
@@ -90,7 +101,8 @@ typedef struct {
 	network_queue *send_queue;
 
 	off_t header_read;
-	off_t to_read;
+	off_t to_read;          /**< max. bytes network_socket_read() reads in one go */
+	gboolean is_peer_closed; /**< recv() saw the end of the stream */
 	
 	/**
 	 * data extracted from the handshake  
@@ -118,6 +130,29 @@ typedef struct {
     GString *charset_results;
     GString *sql_mode;
 
+	gboolean reuse_port;     /** set SO_REUSEPORT on bind() to share the listen-address with other sockets */
+
+	network_prepared_stmts *prepared_stmts; /** the statements prepared on this server-side connection */
+
+	/**
+	 * the compressed protocol (CLIENT_COMPRESS)
+	 *
+	 * the frames are unpacked into ->recv_queue_raw and ->send_queue is packed
+	 * into frames on write, the packet-handling doesn't see them
+	 */
+	gboolean is_compressed;
+	gboolean compress_after_auth;   /** CLIENT_COMPRESS got negotiated, switch once the auth succeeded */
+	gsize compress_min_len;         /** payloads shorter than this are sent uncompressed */
+	guint8 compressed_packet_id;    /** sequence-id of the last frame */
+	gboolean compressed_packet_id_is_reset; /** the next frame starts a new command, set by network_socket_start_command() */
+	network_queue *recv_queue_compressed;
+	network_queue *send_queue_compressed;
+
+	/**
+	 * CLIENT_DEPRECATE_EOF got negotiated: no EOF after the column-definitions,
+	 * the rows end with a OK packet with a 0xfe header
+	 */
+	gboolean is_eof_deprecated;
 } network_socket;
 
 #define MAX_SERVER_NUM 64
@@ -138,6 +173,8 @@ NETWORK_API network_socket_retval_t network_socket_connect(network_socket *con);
 NETWORK_API network_socket_retval_t network_socket_connect_finish(network_socket *sock);
 NETWORK_API network_socket_retval_t network_socket_bind(network_socket *con);
 NETWORK_API network_socket *network_socket_accept(network_socket *srv);
+NETWORK_API void network_socket_set_compressed(network_socket *sock);
+NETWORK_API void network_socket_start_command(network_socket *sock);
 
 #endif
 
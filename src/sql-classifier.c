@@ -0,0 +1,556 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <glib.h>
+
+#include "sql-classifier.h"
+#include "sql-tokenizer.h"
+
+#define C(x) x, sizeof(x) - 1
+
+const char * sql_statement_type_t_str[SQL_STATEMENT_MAX] = {
+"unknown",
+"select",
+"insert",
+"update",
+"delete",
+"replace",
+"load",
+"call",
+"ddl",
+"set",
+"use",
+"show",
+"describe",
+"begin",
+"commit",
+"rollback",
+"lock",
+"unlock",
+"other"
+};
+
+const char * sql_route_hint_t_str[SQL_ROUTE_MAX] = {
+"none",
+"master",
+"slave",
+"backend"
+};
+
+void sql_classification_reset(sql_classification *cl) {
+	memset(cl, 0, sizeof(*cl));
+
+	cl->type = SQL_STATEMENT_UNKNOWN;
+	cl->hint = SQL_ROUTE_NONE;
+	cl->autocommit = -1;
+}
+
+/**
+ * check if the token is the (case-insensitive) literal
+ */
+static gboolean sql_token_is_literal(const gchar *query, sql_token_span *span, const char *s, gsize s_len) {
+	return (span->token_id == TK_LITERAL || span->token_id == TK_FUNCTION) &&
+		span->len == s_len &&
+		0 == g_ascii_strncasecmp(query + span->offset, s, s_len);
+}
+
+static sql_token_span *sql_spans_get(GArray *spans, guint ndx) {
+	return ndx < spans->len ? &g_array_index(spans, sql_token_span, ndx) : NULL;
+}
+
+/**
+ * look for routing hints in a comment
+ *
+ * "master" wins over "slave" which wins over "backend<n>", the last
+ * "backend<n>" counts
+ */
+static void sql_classify_comment(sql_classification *cl, const gchar *text, gsize text_len) {
+	gchar *lower;
+	const gchar *p;
+
+	lower = g_ascii_strdown(text, text_len);
+
+	if (strstr(lower, "master")) {
+		cl->hint = SQL_ROUTE_MASTER;
+	} else if (cl->hint == SQL_ROUTE_MASTER) {
+		/* keep it */
+	} else if (strstr(lower, "slave")) {
+		cl->hint = SQL_ROUTE_SLAVE;
+	} else if (cl->hint != SQL_ROUTE_SLAVE &&
+	           NULL != (p = strstr(lower, "backend")) &&
+	           g_ascii_isdigit(p[sizeof("backend") - 1])) {
+		cl->hint = SQL_ROUTE_BACKEND;
+		cl->hint_backend_ndx = strtoul(p + sizeof("backend") - 1, NULL, 10);
+	}
+
+	if (NULL != (p = strstr(lower, "in_trans="))) {
+		for (p += sizeof("in_trans=") - 1; g_ascii_isspace(*p); p++);
+
+		if (g_ascii_isdigit(*p) && *p != '0') {
+			cl->hint_in_transaction = TRUE;
+		}
+	}
+
+	g_free(lower);
+}
+
+/**
+ * SET [SESSION] autocommit = {0|1|ON|OFF}
+ */
+static void sql_classify_set(sql_classification *cl, const gchar *query, GArray *spans, guint ndx) {
+	sql_token_span *tk;
+
+	if (NULL == (tk = sql_spans_get(spans, ndx))) return;
+
+	if (sql_token_is_literal(query, tk, C("SESSION")) ||
+	    sql_token_is_literal(query, tk, C("@@SESSION"))) {
+		if (NULL == (tk = sql_spans_get(spans, ++ndx))) return;
+		/* @@session.autocommit */
+		if (tk->token_id == TK_DOT && NULL == (tk = sql_spans_get(spans, ++ndx))) return;
+	}
+
+	if (!sql_token_is_literal(query, tk, C("autocommit")) &&
+	    !sql_token_is_literal(query, tk, C("@@autocommit"))) return;
+
+	if (NULL == (tk = sql_spans_get(spans, ++ndx))) return;
+	if (tk->token_id != TK_EQ && tk->token_id != TK_ASSIGN) return;
+
+	if (NULL == (tk = sql_spans_get(spans, ++ndx))) return;
+
+	if ((tk->token_id == TK_INTEGER && tk->len == 1 && query[tk->offset] == '0') ||
+	    tk->token_id == TK_SQL_FALSE ||
+	    sql_token_is_literal(query, tk, C("OFF"))) {
+		cl->autocommit = 0;
+		cl->starts_transaction = TRUE;
+	} else if ((tk->token_id == TK_INTEGER && tk->len == 1 && query[tk->offset] == '1') ||
+	    tk->token_id == TK_SQL_TRUE ||
+	    sql_token_is_literal(query, tk, C("ON"))) {
+		cl->autocommit = 1;
+		/* switching autocommit on commits the open transaction */
+		cl->ends_transaction = TRUE;
+	}
+}
+
+/**
+ * the functions which make a result depend on more than the tables
+ */
+static const char *volatile_functions[] = {
+	"NOW",
+	"SYSDATE",
+	"CURDATE",
+	"CURTIME",
+	"CURRENT_DATE",
+	"CURRENT_TIME",
+	"CURRENT_TIMESTAMP",
+	"LOCALTIME",
+	"LOCALTIMESTAMP",
+	"UTC_DATE",
+	"UTC_TIME",
+	"UTC_TIMESTAMP",
+	"UNIX_TIMESTAMP",
+	"RAND",
+	"UUID",
+	"UUID_SHORT",
+	"USER",
+	"CURRENT_USER",
+	"SESSION_USER",
+	"SYSTEM_USER",
+	"DATABASE",
+	"SCHEMA",
+	"CONNECTION_ID",
+	"FOUND_ROWS",
+	"ROW_COUNT",
+	"LAST_INSERT_ID",
+	"GET_LOCK",
+	"RELEASE_LOCK",
+	"IS_FREE_LOCK",
+	"IS_USED_LOCK",
+	"SLEEP",
+	"BENCHMARK",
+	NULL
+};
+
+static gboolean sql_token_is_volatile(const gchar *query, sql_token_span *span) {
+	int i;
+
+	switch (span->token_id) {
+	case TK_SQL_CURRENT_DATE:
+	case TK_SQL_CURRENT_TIME:
+	case TK_SQL_CURRENT_TIMESTAMP:
+	case TK_SQL_CURRENT_USER:
+	case TK_SQL_LOCALTIME:
+	case TK_SQL_LOCALTIMESTAMP:
+	case TK_SQL_UTC_DATE:
+	case TK_SQL_UTC_TIME:
+	case TK_SQL_UTC_TIMESTAMP:
+		return TRUE;
+	case TK_LITERAL:
+		/* user and session variables */
+		return span->len > 0 && query[span->offset] == '@';
+	case TK_FUNCTION:
+		for (i = 0; volatile_functions[i]; i++) {
+			if (span->len == strlen(volatile_functions[i]) &&
+			    0 == g_ascii_strncasecmp(query + span->offset, volatile_functions[i], span->len)) {
+				return TRUE;
+			}
+		}
+		return FALSE;
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean sql_span_is_name(sql_token_span *span) {
+	return span && (span->token_id == TK_LITERAL || span->token_id == TK_FUNCTION);
+}
+
+/**
+ * read a list of table references: tbl [[AS] alias] [, db.tbl [[AS] alias] ...]
+ *
+ * @return the index of the first token after the list
+ */
+static guint sql_classify_table_list(sql_classification *cl, const gchar *query, GArray *spans, guint ndx) {
+	sql_token_span *tk;
+
+	while (NULL != (tk = sql_spans_get(spans, ndx))) {
+		sql_token_span *dot = sql_spans_get(spans, ndx + 1);
+		sql_token_span *name = sql_spans_get(spans, ndx + 2);
+		sql_table_ref *ref;
+
+		if (tk->token_id == TK_OBRACE) {
+			/* a derived table, we see its FROM on the way */
+			return ndx;
+		} else if (!sql_span_is_name(tk)) {
+			cl->tables_incomplete = TRUE;
+			return ndx;
+		} else if (tk->len > 0 && query[tk->offset] == '@') {
+			/* SELECT ... INTO @var */
+			return ndx;
+		}
+
+		if (cl->n_tables == SQL_CLASSIFICATION_MAX_TABLES) {
+			cl->tables_incomplete = TRUE;
+			return ndx;
+		}
+
+		ref = &(cl->tables[cl->n_tables++]);
+
+		if (dot && dot->token_id == TK_DOT && sql_span_is_name(name)) {
+			ref->db_offset = tk->offset;
+			ref->db_len = tk->len;
+			ref->name_offset = name->offset;
+			ref->name_len = name->len;
+
+			tk = name;
+			ndx += 3;
+		} else {
+			ref->db_offset = 0;
+			ref->db_len = 0;
+			ref->name_offset = tk->offset;
+			ref->name_len = tk->len;
+
+			ndx += 1;
+		}
+
+		/* INSERT INTO tbl(a, b) */
+		if (tk->token_id == TK_FUNCTION) return ndx;
+
+		/* the alias */
+		if (NULL == (tk = sql_spans_get(spans, ndx))) return ndx;
+
+		if (tk->token_id == TK_SQL_AS) {
+			ndx += 2;
+		} else if (tk->token_id == TK_LITERAL) {
+			ndx += 1;
+		}
+
+		if (NULL == (tk = sql_spans_get(spans, ndx)) || tk->token_id != TK_COMMA) return ndx;
+
+		ndx++;
+	}
+
+	return ndx;
+}
+
+/**
+ * collect the tables of the first statement
+ *
+ * FROM, JOIN, INTO and [INTO] TABLE are followed by tables, so is UPDATE and
+ * a INSERT or REPLACE without INTO
+ */
+static void sql_classify_tables(sql_classification *cl, const gchar *query, GArray *spans, guint first) {
+	guint i = first;
+	sql_token_span *tk;
+
+	while (NULL != (tk = sql_spans_get(spans, i))) {
+		sql_token_span *next;
+
+		if (tk->token_id == TK_SEMICOLON) break;
+
+		switch (tk->token_id) {
+		case TK_SQL_INSERT:
+		case TK_SQL_REPLACE:
+		case TK_SQL_UPDATE:
+			if (i != first) break;
+
+			/* skip the modifiers */
+			for (i++; NULL != (next = sql_spans_get(spans, i)); i++) {
+				if (next->token_id != TK_SQL_LOW_PRIORITY &&
+				    next->token_id != TK_SQL_HIGH_PRIORITY &&
+				    next->token_id != TK_SQL_DELAYED &&
+				    next->token_id != TK_SQL_IGNORE) break;
+			}
+
+			if (sql_span_is_name(next)) {
+				i = sql_classify_table_list(cl, query, spans, i);
+			}
+			continue;
+		case TK_SQL_FROM:
+		case TK_SQL_JOIN:
+		case TK_SQL_STRAIGHT_JOIN:
+		case TK_SQL_TABLE:
+			i = sql_classify_table_list(cl, query, spans, i + 1);
+			continue;
+		case TK_SQL_INTO:
+			/* INTO TABLE is handled by TABLE, INTO OUTFILE has no table */
+			if (sql_span_is_name(sql_spans_get(spans, i + 1))) {
+				i = sql_classify_table_list(cl, query, spans, i + 1);
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+
+		i++;
+	}
+}
+
+/**
+ * SELECT ... : look for the clauses which keep it on the master or on this connection
+ */
+static void sql_classify_select(sql_classification *cl, const gchar *query, GArray *spans, guint ndx) {
+	guint i;
+
+	cl->is_read_only = TRUE;
+
+	for (i = ndx + 1; i < spans->len; i++) {
+		sql_token_span *tk = sql_spans_get(spans, i);
+		sql_token_span *next = sql_spans_get(spans, i + 1);
+
+		switch (tk->token_id) {
+		case TK_SQL_SQL_CALC_FOUND_ROWS:
+			/* SQL_CALC_FOUND_ROWS + FOUND_ROWS() have to be executed on the same connection */
+			cl->has_calc_found_rows = TRUE;
+			break;
+		case TK_SQL_FOR:
+			if (next && next->token_id == TK_SQL_UPDATE) cl->is_locking = TRUE;
+			break;
+		case TK_SQL_LOCK:
+			/* LOCK IN SHARE MODE */
+			if (next && next->token_id == TK_SQL_IN) cl->is_locking = TRUE;
+			break;
+		case TK_SQL_INTO:
+			/* INTO OUTFILE or INTO @var, the effects have to stay on the master */
+			cl->is_read_only = FALSE;
+			break;
+		case TK_LITERAL:
+			if (tk->len > 0 && query[tk->offset] == '@') cl->has_volatile = TRUE;
+
+			if (sql_token_is_literal(query, tk, C("@@LAST_INSERT_ID"))) {
+				cl->has_last_insert_id = TRUE;
+				cl->last_insert_id_is_var = TRUE;
+			}
+			break;
+		case TK_FUNCTION:
+			if (sql_token_is_literal(query, tk, C("LAST_INSERT_ID"))) {
+				cl->has_last_insert_id = TRUE;
+			}
+			if (sql_token_is_volatile(query, tk)) cl->has_volatile = TRUE;
+			break;
+		default:
+			if (sql_token_is_volatile(query, tk)) cl->has_volatile = TRUE;
+			break;
+		}
+	}
+
+	if (cl->is_locking) cl->is_read_only = FALSE;
+}
+
+/**
+ * classify a scanned statement
+ *
+ * @param query    the statement the spans point into
+ * @param spans    the sql_token_span of the statement
+ */
+void sql_classify_spans(sql_classification *cl, const gchar *query, GArray *spans) {
+	guint i;
+	guint first = spans->len;
+	sql_token_span *tk, *next;
+
+	sql_classification_reset(cl);
+
+	for (i = 0; i < spans->len; i++) {
+		tk = sql_spans_get(spans, i);
+
+		if (tk->token_id == TK_COMMENT) {
+			sql_classify_comment(cl, query + tk->offset, tk->len);
+		} else if (first == spans->len && tk->token_id != TK_COMMENT_MYSQL && tk->token_id != TK_OBRACE) {
+			/* the first token which isn't a comment or the ( of a (SELECT ...) UNION ... */
+			first = i;
+		} else if (tk->token_id == TK_SEMICOLON && first != spans->len) {
+			guint j;
+
+			/* a trailing ; or comment doesn't make it a multi-statement */
+			for (j = i + 1; j < spans->len; j++) {
+				sql_token_span *after = sql_spans_get(spans, j);
+
+				if (after->token_id != TK_COMMENT &&
+				    after->token_id != TK_COMMENT_MYSQL &&
+				    after->token_id != TK_SEMICOLON) {
+					cl->is_multi_statement = TRUE;
+					break;
+				}
+			}
+		}
+	}
+
+	if (first == spans->len) return;
+
+	tk = sql_spans_get(spans, first);
+	next = sql_spans_get(spans, first + 1);
+
+	switch (tk->token_id) {
+	case TK_SQL_SELECT:
+		cl->type = SQL_STATEMENT_SELECT;
+		sql_classify_select(cl, query, spans, first);
+		break;
+	case TK_SQL_INSERT:
+		cl->type = SQL_STATEMENT_INSERT;
+		break;
+	case TK_SQL_UPDATE:
+		cl->type = SQL_STATEMENT_UPDATE;
+		break;
+	case TK_SQL_DELETE:
+		cl->type = SQL_STATEMENT_DELETE;
+		break;
+	case TK_SQL_REPLACE:
+		cl->type = SQL_STATEMENT_REPLACE;
+		break;
+	case TK_SQL_LOAD:
+		cl->type = SQL_STATEMENT_LOAD;
+		break;
+	case TK_SQL_CALL:
+		cl->type = SQL_STATEMENT_CALL;
+		break;
+	case TK_SQL_CREATE:
+	case TK_SQL_ALTER:
+	case TK_SQL_DROP:
+	case TK_SQL_RENAME:
+	case TK_SQL_GRANT:
+	case TK_SQL_REVOKE:
+		cl->type = SQL_STATEMENT_DDL;
+		break;
+	case TK_SQL_SET:
+		cl->type = SQL_STATEMENT_SET;
+		sql_classify_set(cl, query, spans, first + 1);
+		break;
+	case TK_SQL_USE:
+		cl->type = SQL_STATEMENT_USE;
+		cl->is_read_only = TRUE;
+		break;
+	case TK_SQL_SHOW:
+		cl->type = SQL_STATEMENT_SHOW;
+		cl->is_read_only = TRUE;
+		break;
+	case TK_SQL_DESC:
+	case TK_SQL_DESCRIBE:
+	case TK_SQL_EXPLAIN:
+		cl->type = SQL_STATEMENT_DESCRIBE;
+		cl->is_read_only = TRUE;
+		break;
+	case TK_SQL_LOCK:
+		cl->type = SQL_STATEMENT_LOCK;
+		cl->is_locking = TRUE;
+		break;
+	case TK_SQL_UNLOCK:
+		cl->type = SQL_STATEMENT_UNLOCK;
+		break;
+	case TK_LITERAL:
+		/* the transaction statements aren't keywords of the tokenizer */
+		if (sql_token_is_literal(query, tk, C("BEGIN"))) {
+			cl->type = SQL_STATEMENT_BEGIN;
+			cl->starts_transaction = TRUE;
+		} else if (sql_token_is_literal(query, tk, C("START")) &&
+		           next && sql_token_is_literal(query, next, C("TRANSACTION"))) {
+			cl->type = SQL_STATEMENT_BEGIN;
+			cl->starts_transaction = TRUE;
+		} else if (sql_token_is_literal(query, tk, C("COMMIT"))) {
+			cl->type = SQL_STATEMENT_COMMIT;
+			cl->ends_transaction = TRUE;
+		} else if (sql_token_is_literal(query, tk, C("ROLLBACK"))) {
+			cl->type = SQL_STATEMENT_ROLLBACK;
+			cl->ends_transaction = TRUE;
+
+			/* ROLLBACK [WORK] TO [SAVEPOINT] ... keeps the transaction open */
+			for (i = first + 1; i < spans->len; i++) {
+				if (sql_spans_get(spans, i)->token_id == TK_SQL_TO) {
+					cl->ends_transaction = FALSE;
+					break;
+				}
+			}
+		} else if (sql_token_is_literal(query, tk, C("TRUNCATE"))) {
+			cl->type = SQL_STATEMENT_DDL;
+		} else {
+			cl->type = SQL_STATEMENT_OTHER;
+		}
+		break;
+	default:
+		cl->type = SQL_STATEMENT_OTHER;
+		break;
+	}
+
+	sql_classify_tables(cl, query, spans, first);
+
+	/* we only looked at the first statement */
+	if (cl->is_multi_statement) cl->is_read_only = FALSE;
+}
+
+/**
+ * tokenize and classify a statement
+ *
+ * @return 0 on success, -1 if the statement couldn't be tokenized
+ */
+int sql_classify(sql_classification *cl, const gchar *query, gsize query_len) {
+	GArray *spans;
+
+	if (NULL == (spans = sql_scanner_thread_scan(query, query_len))) {
+		sql_classification_reset(cl);
+
+		return -1;
+	}
+
+	sql_classify_spans(cl, query, spans);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _SQL_CLASSIFIER_H_
+#define _SQL_CLASSIFIER_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/** @file
+ *
+ * classify a statement for read/write splitting
+ *
+ * the statement is scanned once into token spans with the sql-tokenizer, the
+ * scripts only look at the result instead of walking the tokens themselves
+ */
+
+typedef enum {
+	SQL_STATEMENT_UNKNOWN,
+	SQL_STATEMENT_SELECT,
+	SQL_STATEMENT_INSERT,
+	SQL_STATEMENT_UPDATE,
+	SQL_STATEMENT_DELETE,
+	SQL_STATEMENT_REPLACE,
+	SQL_STATEMENT_LOAD,
+	SQL_STATEMENT_CALL,
+	SQL_STATEMENT_DDL,        /**< CREATE, ALTER, DROP, RENAME, TRUNCATE, GRANT, REVOKE */
+	SQL_STATEMENT_SET,
+	SQL_STATEMENT_USE,
+	SQL_STATEMENT_SHOW,
+	SQL_STATEMENT_DESCRIBE,   /**< DESC, DESCRIBE, EXPLAIN */
+	SQL_STATEMENT_BEGIN,      /**< BEGIN, START TRANSACTION */
+	SQL_STATEMENT_COMMIT,
+	SQL_STATEMENT_ROLLBACK,
+	SQL_STATEMENT_LOCK,       /**< LOCK TABLES */
+	SQL_STATEMENT_UNLOCK,     /**< UNLOCK TABLES */
+	SQL_STATEMENT_OTHER,
+	SQL_STATEMENT_MAX
+} sql_statement_type_t;
+
+extern const char * sql_statement_type_t_str[SQL_STATEMENT_MAX];
+
+/**
+ * where a comment in the statement asks us to send it
+ */
+typedef enum {
+	SQL_ROUTE_NONE,
+	SQL_ROUTE_MASTER,         /**< a comment contains "master" */
+	SQL_ROUTE_SLAVE,          /**< a comment contains "slave" */
+	SQL_ROUTE_BACKEND,        /**< a comment contains "backend<n>" */
+	SQL_ROUTE_MAX
+} sql_route_hint_t;
+
+extern const char * sql_route_hint_t_str[SQL_ROUTE_MAX];
+
+#define SQL_CLASSIFICATION_MAX_TABLES 8
+
+/**
+ * a table the statement refers to, as offsets into the query
+ */
+typedef struct {
+	guint db_offset;
+	guint db_len;                 /**< 0 if the table isn't qualified with a database */
+	guint name_offset;
+	guint name_len;
+} sql_table_ref;
+
+typedef struct {
+	sql_statement_type_t type;
+
+	gboolean is_read_only;        /**< may be sent to a read-only backend */
+	gboolean is_locking;          /**< SELECT ... FOR UPDATE, LOCK IN SHARE MODE, LOCK TABLES */
+	gboolean is_multi_statement;  /**< more than one statement, separated by ; */
+
+	gboolean starts_transaction;  /**< BEGIN, START TRANSACTION, SET autocommit = 0 */
+	gboolean ends_transaction;    /**< COMMIT, ROLLBACK, SET autocommit = 1 */
+	gint autocommit;              /**< the value of SET autocommit = ..., -1 if not set */
+
+	gboolean has_calc_found_rows; /**< SELECT SQL_CALC_FOUND_ROWS ... */
+	gboolean has_last_insert_id;  /**< SELECT LAST_INSERT_ID() or @@LAST_INSERT_ID */
+	gboolean last_insert_id_is_var; /**< it was @@LAST_INSERT_ID */
+	gboolean has_volatile;        /**< NOW(), RAND(), @vars, ... the result doesn't only depend on the tables */
+
+	sql_table_ref tables[SQL_CLASSIFICATION_MAX_TABLES]; /**< the tables of the first statement */
+	guint n_tables;
+	gboolean tables_incomplete;   /**< there were more tables or some we couldn't parse */
+
+	sql_route_hint_t hint;
+	guint hint_backend_ndx;       /**< the <n> of backend<n>, for SQL_ROUTE_BACKEND */
+	gboolean hint_in_transaction; /**< a comment contains "in_trans=<n>" with n != 0 */
+} sql_classification;
+
+NETWORK_API void sql_classification_reset(sql_classification *cl);
+NETWORK_API void sql_classify_spans(sql_classification *cl, const gchar *query, GArray *spans);
+NETWORK_API int sql_classify(sql_classification *cl, const gchar *query, gsize query_len);
+
+#endif
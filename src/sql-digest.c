@@ -0,0 +1,208 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "sql-digest.h"
+#include "sql-tokenizer.h"
+
+#define C(x) x, sizeof(x) - 1
+
+#define FNV64_OFFSET_BASIS G_GUINT64_CONSTANT(14695981039346656037)
+#define FNV64_PRIME        G_GUINT64_CONSTANT(1099511628211)
+
+sql_digest *sql_digest_new(void) {
+	sql_digest *digest;
+
+	digest = g_new0(sql_digest, 1);
+	digest->text = g_string_sized_new(128);
+	digest->hash = FNV64_OFFSET_BASIS;
+
+	return digest;
+}
+
+void sql_digest_free(sql_digest *digest) {
+	if (!digest) return;
+
+	g_string_free(digest->text, TRUE);
+
+	g_free(digest);
+}
+
+void sql_digest_reset(sql_digest *digest) {
+	g_string_truncate(digest->text, 0);
+	digest->hash = FNV64_OFFSET_BASIS;
+}
+
+/**
+ * append to the text and hash it on the way
+ */
+static void sql_digest_append(sql_digest *digest, const gchar *s, gsize s_len, gboolean upper) {
+	gsize i;
+
+	for (i = 0; i < s_len; i++) {
+		gchar c = upper ? g_ascii_toupper(s[i]) : s[i];
+
+		g_string_append_c(digest->text, c);
+
+		digest->hash ^= (guchar)c;
+		digest->hash *= FNV64_PRIME;
+	}
+}
+
+static gboolean sql_span_is_value(sql_token_span *span) {
+	return span->token_id == TK_STRING ||
+		span->token_id == TK_INTEGER ||
+		span->token_id == TK_FLOAT;
+}
+
+/**
+ * check if spans[ndx] starts a IN ( <value>, ... )
+ *
+ * @return the index of the ) or 0 if it isn't a list of values
+ */
+static guint sql_digest_in_list_end(const gchar *query, GArray *spans, guint ndx) {
+	sql_token_span *tk = &g_array_index(spans, sql_token_span, ndx);
+	guint i;
+
+	/* IN( is tokenized as function */
+	if (tk->token_id != TK_SQL_IN &&
+	    !(tk->token_id == TK_FUNCTION && tk->len == 2 && 0 == g_ascii_strncasecmp(query + tk->offset, C("IN")))) {
+		return 0;
+	}
+
+	if (ndx + 1 >= spans->len || g_array_index(spans, sql_token_span, ndx + 1).token_id != TK_OBRACE) return 0;
+
+	for (i = ndx + 2; i + 1 < spans->len; i += 2) {
+		sql_token_span *value = &g_array_index(spans, sql_token_span, i);
+		sql_token_span *sep = &g_array_index(spans, sql_token_span, i + 1);
+
+		if (!sql_span_is_value(value)) return 0;
+
+		if (sep->token_id == TK_CBRACE) return i + 1;
+		if (sep->token_id != TK_COMMA) return 0;
+	}
+
+	return 0;
+}
+
+/**
+ * the literals which are statements if they are the first token
+ */
+static gboolean sql_digest_is_literal_keyword(const gchar *text, gsize text_len) {
+	return (text_len == sizeof("COMMIT") - 1 && 0 == g_ascii_strncasecmp(text, C("COMMIT"))) ||
+		(text_len == sizeof("ROLLBACK") - 1 && 0 == g_ascii_strncasecmp(text, C("ROLLBACK"))) ||
+		(text_len == sizeof("BEGIN") - 1 && 0 == g_ascii_strncasecmp(text, C("BEGIN"))) ||
+		(text_len == sizeof("START") - 1 && 0 == g_ascii_strncasecmp(text, C("START")));
+}
+
+/**
+ * build the digest of a scanned statement
+ *
+ * @param query    the statement the spans point into
+ * @param spans    the sql_token_span of the statement
+ */
+void sql_digest_spans(sql_digest *digest, const gchar *query, GArray *spans) {
+	guint i;
+	guint emitted = 0; /* tokens in the digest so far */
+	gboolean first_is_start = FALSE;
+
+	sql_digest_reset(digest);
+
+	for (i = 0; i < spans->len; i++) {
+		sql_token_span *tk = &g_array_index(spans, sql_token_span, i);
+		const gchar *text = query + tk->offset;
+		guint end;
+
+		switch (tk->token_id) {
+		case TK_COMMENT:
+			continue;
+		case TK_COMMENT_MYSQL:
+			/* we don't know which version we talk to, keep it verbatim */
+			sql_digest_append(digest, C("/*!"), FALSE);
+			sql_digest_append(digest, text, tk->len, FALSE);
+			sql_digest_append(digest, C("*/ "), FALSE);
+			break;
+		case TK_LITERAL:
+			if (tk->len > 0 && text[0] == '@') {
+				/* session variables as is */
+				sql_digest_append(digest, text, tk->len, FALSE);
+				sql_digest_append(digest, C(" "), FALSE);
+			} else if ((emitted == 0 && sql_digest_is_literal_keyword(text, tk->len)) ||
+			           (emitted == 1 && first_is_start && tk->len == sizeof("TRANSACTION") - 1 &&
+			            0 == g_ascii_strncasecmp(text, C("TRANSACTION")))) {
+				if (emitted == 0) first_is_start = (tk->len == sizeof("START") - 1 && 0 == g_ascii_strncasecmp(text, C("START")));
+
+				sql_digest_append(digest, text, tk->len, TRUE);
+				sql_digest_append(digest, C(" "), FALSE);
+			} else {
+				sql_digest_append(digest, C("`"), FALSE);
+				sql_digest_append(digest, text, tk->len, FALSE);
+				sql_digest_append(digest, C("` "), FALSE);
+			}
+			break;
+		case TK_STRING:
+		case TK_INTEGER:
+		case TK_FLOAT:
+			sql_digest_append(digest, C("? "), FALSE);
+			break;
+		case TK_FUNCTION:
+		case TK_SQL_IN:
+			if (0 != (end = sql_digest_in_list_end(query, spans, i))) {
+				/* the number of values doesn't matter */
+				sql_digest_append(digest, C("IN ( ?+ ) "), FALSE);
+				i = end;
+			} else if (tk->token_id == TK_FUNCTION) {
+				sql_digest_append(digest, text, tk->len, TRUE);
+			} else {
+				sql_digest_append(digest, text, tk->len, TRUE);
+				sql_digest_append(digest, C(" "), FALSE);
+			}
+			break;
+		default:
+			sql_digest_append(digest, text, tk->len, TRUE);
+			sql_digest_append(digest, C(" "), FALSE);
+			break;
+		}
+
+		emitted++;
+	}
+}
+
+/**
+ * tokenize a statement and build its digest
+ *
+ * @return 0 on success, -1 if the statement couldn't be tokenized
+ */
+int sql_digest_compute(sql_digest *digest, const gchar *query, gsize query_len) {
+	GArray *spans;
+
+	if (NULL == (spans = sql_scanner_thread_scan(query, query_len))) {
+		sql_digest_reset(digest);
+
+		return -1;
+	}
+
+	sql_digest_spans(digest, query, spans);
+
+	return 0;
+}
@@ -0,0 +1,54 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+
+#ifndef _SQL_DIGEST_H_
+#define _SQL_DIGEST_H_
+
+#include <glib.h>
+
+#include "network-exports.h"
+
+/** @file
+ *
+ * the normalized fingerprint of a statement
+ *
+ * the text follows the normalize() of lib/proxy/tokenizer.lua:
+ * - comments are dropped
+ * - strings and numbers are replaced by ?
+ * - keywords and operators are upper-cased, literals are quoted with `
+ * - IN ( ?, ?, ... ) is collapsed to IN ( ?+ )
+ *
+ * the hash is a FNV-1a of the text, statements which only differ in
+ * their values share the same digest
+ */
+
+typedef struct {
+	GString *text;
+	guint64 hash;
+} sql_digest;
+
+NETWORK_API sql_digest *sql_digest_new(void);
+NETWORK_API void sql_digest_free(sql_digest *digest);
+NETWORK_API void sql_digest_reset(sql_digest *digest);
+NETWORK_API void sql_digest_spans(sql_digest *digest, const gchar *query, GArray *spans);
+NETWORK_API int sql_digest_compute(sql_digest *digest, const gchar *query, gsize query_len);
+
+#endif
@@ -0,0 +1,164 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+/**
+ * compare the token-list of sql_tokenizer() with the spans of sql_scanner_scan()
+ *
+ *   $ sql-tokenizer-bench [<file with one query per line> [<rounds>]]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sql-tokenizer.h"
+
+#define DEFAULT_ROUNDS 100000
+
+static const char *default_queries[] = {
+	"SELECT 1",
+	"SELECT id, name, email FROM users WHERE id = 42",
+	"SELECT SQL_CALC_FOUND_ROWS * FROM orders o JOIN customers c ON o.customer_id = c.id WHERE c.country IN ('de', 'fr', 'it') ORDER BY o.created DESC LIMIT 10",
+	"/* slave */ SELECT COUNT(*) FROM `db`.`tbl` WHERE a >= 1.5e3 AND b <> 'it''s' AND c LIKE \"%x%\"",
+	"INSERT INTO log (ts, level, msg) VALUES (NOW(), 3, 'connection reset by peer'), (NOW(), 1, 'retrying')",
+	"UPDATE accounts SET balance = balance - 100 WHERE id = 7 AND balance >= 100",
+	"SET autocommit = 0",
+	"COMMIT",
+	NULL
+};
+
+typedef struct {
+	guint64 tokens;
+	gdouble secs;
+} bench_result;
+
+static void bench_tokenizer(GPtrArray *queries, guint rounds, bench_result *res) {
+	GTimer *timer = g_timer_new();
+	guint r, i;
+
+	res->tokens = 0;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < queries->len; i++) {
+			GString *q = queries->pdata[i];
+			GPtrArray *tokens = sql_tokens_new();
+
+			sql_tokenizer(tokens, q->str, q->len);
+			res->tokens += tokens->len;
+
+			sql_tokens_free(tokens);
+		}
+	}
+
+	res->secs = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+}
+
+static void bench_scanner(GPtrArray *queries, guint rounds, bench_result *res) {
+	GTimer *timer = g_timer_new();
+	sql_scanner *sc = sql_scanner_new();
+	GArray *spans = g_array_new(FALSE, FALSE, sizeof(sql_token_span));
+	guint r, i;
+
+	res->tokens = 0;
+
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < queries->len; i++) {
+			GString *q = queries->pdata[i];
+
+			sql_scanner_scan(sc, spans, q->str, q->len);
+			res->tokens += spans->len;
+		}
+	}
+
+	res->secs = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	g_array_free(spans, TRUE);
+	sql_scanner_free(sc);
+}
+
+static void bench_report(const char *name, bench_result *res) {
+	printf("%-16s %12"G_GUINT64_FORMAT" tokens %8.3f s %12.0f tokens/s\n",
+			name,
+			res->tokens,
+			res->secs,
+			res->secs > 0 ? res->tokens / res->secs : 0.0);
+}
+
+int main(int argc, char **argv) {
+	GPtrArray *queries = g_ptr_array_new();
+	bench_result tk_res, sc_res;
+	guint rounds = DEFAULT_ROUNDS;
+	guint i;
+
+	if (argc > 1) {
+		gchar *contents;
+		gchar **lines;
+		GError *gerr = NULL;
+
+		if (!g_file_get_contents(argv[1], &contents, NULL, &gerr)) {
+			fprintf(stderr, "%s: %s\n", argv[1], gerr->message);
+			g_error_free(gerr);
+
+			return EXIT_FAILURE;
+		}
+
+		lines = g_strsplit(contents, "\n", -1);
+		for (i = 0; lines[i]; i++) {
+			if (lines[i][0] == '\0') continue;
+
+			g_ptr_array_add(queries, g_string_new(lines[i]));
+		}
+		g_strfreev(lines);
+		g_free(contents);
+
+		rounds = 10;
+	} else {
+		for (i = 0; default_queries[i]; i++) {
+			g_ptr_array_add(queries, g_string_new(default_queries[i]));
+		}
+	}
+
+	if (argc > 2) rounds = strtoul(argv[2], NULL, 10);
+
+	printf("%u queries, %u rounds\n", queries->len, rounds);
+
+	bench_tokenizer(queries, rounds, &tk_res);
+	bench_scanner(queries, rounds, &sc_res);
+
+	bench_report("sql_tokenizer", &tk_res);
+	bench_report("sql_scanner_scan", &sc_res);
+
+	if (tk_res.tokens != sc_res.tokens) {
+		fprintf(stderr, "token count differs: %"G_GUINT64_FORMAT" != %"G_GUINT64_FORMAT"\n", tk_res.tokens, sc_res.tokens);
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < queries->len; i++) {
+		g_string_free(queries->pdata[i], TRUE);
+	}
+	g_ptr_array_free(queries, TRUE);
+
+	return EXIT_SUCCESS;
+}
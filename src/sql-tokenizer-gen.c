@@ -0,0 +1,178 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#include <glib.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sql-tokenizer.h"
+#include "sql-tokenizer-keywords.h"
+
+/**
+ * generate a perfect hash for the keywords
+ *
+ * hash and displace: the keywords are spread over buckets with seed 0. Starting
+ * with the largest bucket we search a seed (the displacement) for each bucket
+ * which moves all its keywords into free slots. The tokenizer then needs two
+ * hashes and one compare per lookup.
+ */
+
+#define MAX_DISPLACEMENT 65536
+
+typedef struct {
+	gint id;
+	const gchar *name;
+	gsize name_len;
+} keyword;
+
+static gint bucket_cmp(gconstpointer _a, gconstpointer _b) {
+	const GPtrArray *a = *(GPtrArray **)_a;
+	const GPtrArray *b = *(GPtrArray **)_b;
+
+	return b->len - a->len; /* largest first */
+}
+
+int main() {
+	GArray *keywords;
+	GPtrArray *buckets, *sorted;
+	guint32 n_buckets, size, *disp, *tried;
+	gint16 *slots;
+	guint i, j;
+	gint id;
+
+	keywords = g_array_new(FALSE, FALSE, sizeof(keyword));
+
+	for (id = 0; id < sql_token_get_last_id(); id++) {
+		keyword kw;
+		size_t name_len;
+
+		/** only tokens with TK_SQL_* are keyworks */
+		if (0 != strncmp(sql_token_get_name(id, NULL), "TK_SQL_", sizeof("TK_SQL_") - 1)) continue;
+
+		kw.id = id;
+		kw.name = sql_token_get_name(id, &name_len) + sizeof("TK_SQL_") - 1;
+		kw.name_len = name_len - (sizeof("TK_SQL_") - 1);
+
+		g_array_append_val(keywords, kw);
+	}
+
+	if (keywords->len >= G_MAXINT16) {
+		fprintf(stderr, "%s: too many keywords (%u)\n", G_STRLOC, keywords->len);
+		return 1;
+	}
+
+	for (size = 1; size < keywords->len * 2; size <<= 1);
+	n_buckets = keywords->len / 4 + 1;
+
+	buckets = g_ptr_array_new();
+	for (i = 0; i < n_buckets; i++) {
+		g_ptr_array_add(buckets, g_ptr_array_new());
+	}
+
+	for (i = 0; i < keywords->len; i++) {
+		keyword *kw = &g_array_index(keywords, keyword, i);
+
+		g_ptr_array_add(buckets->pdata[sql_keywords_hash(kw->name, kw->name_len, 0) % n_buckets], kw);
+	}
+
+	/* keep the bucket numbers, sort a copy */
+	sorted = g_ptr_array_sized_new(n_buckets);
+	for (i = 0; i < n_buckets; i++) {
+		g_ptr_array_add(sorted, buckets->pdata[i]);
+	}
+	g_ptr_array_sort(sorted, bucket_cmp);
+
+	disp = g_new0(guint32, n_buckets);
+	tried = g_new0(guint32, size);
+	slots = g_new(gint16, size);
+	for (i = 0; i < size; i++) slots[i] = -1;
+
+	for (i = 0; i < n_buckets; i++) {
+		GPtrArray *bucket = sorted->pdata[i];
+		guint32 d;
+		guint b;
+
+		if (bucket->len == 0) break;
+
+		for (b = 0; buckets->pdata[b] != bucket; b++);
+
+		for (d = 1; d < MAX_DISPLACEMENT; d++) {
+			gboolean fits = TRUE;
+
+			/* tried[] marks the slots taken by this bucket in this round */
+			for (j = 0; j < bucket->len && fits; j++) {
+				keyword *kw = bucket->pdata[j];
+				guint32 s = sql_keywords_hash(kw->name, kw->name_len, d) & (size - 1);
+
+				if (slots[s] != -1 || tried[s] == d) {
+					fits = FALSE;
+				} else {
+					tried[s] = d;
+				}
+			}
+
+			if (fits) break;
+		}
+
+		if (d == MAX_DISPLACEMENT) {
+			fprintf(stderr, "%s: no displacement found for bucket %u\n", G_STRLOC, b);
+			return 1;
+		}
+
+		disp[b] = d;
+		for (j = 0; j < bucket->len; j++) {
+			keyword *kw = bucket->pdata[j];
+
+			slots[sql_keywords_hash(kw->name, kw->name_len, d) & (size - 1)] = kw->id;
+		}
+	}
+
+	printf("#include <glib.h>\n\n");
+	printf("const guint32 sql_keywords_hash_buckets = %u;\n", n_buckets);
+	printf("const guint32 sql_keywords_hash_size = %u;\n", size);
+
+	printf("const guint32 sql_keywords_hash_disp[] = {");
+	for (i = 0; i < n_buckets; i++) {
+		printf("%s%s%u", i ? "," : "", (i % 16) ? " " : "\n\t", disp[i]);
+	}
+	printf("\n};\n");
+
+	printf("const gint16 sql_keywords_hash_slots[] = {");
+	for (i = 0; i < size; i++) {
+		if (slots[i] == -1) {
+			printf("%s\n\t-1", i ? "," : "");
+		} else {
+			printf("%s\n\t%d /* %s */", i ? "," : "", slots[i], sql_token_get_name(slots[i], NULL) + sizeof("TK_SQL_") - 1);
+		}
+	}
+	printf("\n};\n");
+
+	for (i = 0; i < n_buckets; i++) {
+		g_ptr_array_free(buckets->pdata[i], TRUE);
+	}
+	g_ptr_array_free(buckets, TRUE);
+	g_ptr_array_free(sorted, TRUE);
+	g_array_free(keywords, TRUE);
+	g_free(disp);
+	g_free(tried);
+	g_free(slots);
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2010, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+#ifndef __SQL_TOKENIZER_KEYWORDS_H__
+#define __SQL_TOKENIZER_KEYWORDS_H__
+
+#include <glib.h>
+
+/**
+ * the perfect hash of the keywords, generated by sql-tokenizer-gen
+ *
+ * sql_keywords_hash_slots[] maps the slots to the TK_SQL_* token-ids, -1 if empty
+ */
+extern const guint32 sql_keywords_hash_buckets;
+extern const guint32 sql_keywords_hash_size; /* a power of 2 */
+extern const guint32 sql_keywords_hash_disp[];
+extern const gint16 sql_keywords_hash_slots[];
+
+/**
+ * case-insensitive FNV-1a of a keyword
+ */
+guint32 sql_keywords_hash(const gchar *name, gsize name_len, guint32 seed);
+
+#endif
@@ -18,6 +18,7 @@
 
  $%ENDLICENSE%$ */
 #include "sql-tokenizer.h"
+#include "sql-tokenizer-keywords.h"
 
 #define S(x) { #x, sizeof(#x) - 1 }
 
@@ -322,3 +323,24 @@ int sql_token_get_last_id() {
 	return (sizeof(token_names)/sizeof(token_names[0])) - 1; /* the last one is not a token */
 }
 
+/**
+ * case-insensitive FNV-1a, the seed picks one of a family of hash functions
+ *
+ * shared by sql-tokenizer-gen and the lookup in the tokenizer
+ */
+guint32 sql_keywords_hash(const gchar *name, gsize name_len, guint32 seed) {
+	guint32 h = 2166136261U ^ (seed * 16777619U);
+	gsize i;
+
+	for (i = 0; i < name_len; i++) {
+		h ^= (guchar)g_ascii_tolower(name[i]);
+		h *= 16777619U;
+	}
+
+	/* FNV is weak in the low bits, mix them before they are masked */
+	h ^= h >> 15;
+	h *= 0x2c1b3c6dU;
+	h ^= h >> 12;
+
+	return h;
+}
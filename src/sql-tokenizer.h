@@ -24,6 +24,8 @@
 
 #include <glib.h>
 
+#include "network-exports.h"
+
 /** @file
  *
  * a tokenizer for MySQLs SQL dialect
@@ -321,6 +323,23 @@ typedef struct {
 	GString *text;
 } sql_token;
 
+/**
+ * a token as position in the scanned string
+ *
+ * for strings, literals and comments the span covers the raw text between the
+ * quotes or comment markers, escapes are not resolved
+ */
+typedef struct {
+	sql_token_id token_id;
+	guint offset;
+	guint len;
+} sql_token_span;
+
+/**
+ * a reusable scanner which emits sql_token_span
+ */
+typedef struct sql_scanner sql_scanner;
+
 /** @defgroup sql SQL Tokenizer
  * 
  * SQL tokenizer
@@ -345,17 +364,17 @@ typedef struct {
  *
  * @return         a empty SQL token
  */
-sql_token *sql_token_new(void);
+NETWORK_API sql_token *sql_token_new(void);
 
 /**
  * free a sql-token
  */
-void sql_token_free(sql_token *token);
+NETWORK_API void sql_token_free(sql_token *token);
 
 /**
  * get the name for a token-id
  */
-gchar *sql_token_get_name(sql_token_id token_id, size_t *name_len);
+NETWORK_API gchar *sql_token_get_name(sql_token_id token_id, size_t *name_len);
 
 /**
  * get the token_id for a literal
@@ -365,7 +384,7 @@ gchar *sql_token_get_name(sql_token_id token_id, size_t *name_len);
  * @param name     a SQL keyword
  * @return         TK_SQL_(keyword) or TK_LITERAL
  */
-sql_token_id sql_token_get_id(const gchar *name) G_GNUC_DEPRECATED;
+NETWORK_API sql_token_id sql_token_get_id(const gchar *name) G_GNUC_DEPRECATED;
 
 /**
  * get the token_id for a literal
@@ -375,7 +394,7 @@ sql_token_id sql_token_get_id(const gchar *name) G_GNUC_DEPRECATED;
  * @param name     a SQL keyword
  * @return         TK_SQL_(keyword) or TK_LITERAL
  */
-sql_token_id sql_token_get_id_len(const gchar *name, size_t name_len);
+NETWORK_API sql_token_id sql_token_get_id_len(const gchar *name, size_t name_len);
 
 
 /**
@@ -387,7 +406,7 @@ sql_token_id sql_token_get_id_len(const gchar *name, size_t name_len);
  * @return 0 on success
  *
  */
-int sql_tokenizer(GPtrArray *tokens, const gchar *str, gsize len);
+NETWORK_API int sql_tokenizer(GPtrArray *tokens, const gchar *str, gsize len);
 
 /**
  * create a empty token list
@@ -396,16 +415,51 @@ int sql_tokenizer(GPtrArray *tokens, const gchar *str, gsize len);
  *
  * @return a empty token list 
  */
-GPtrArray * sql_tokens_new(void);
+NETWORK_API GPtrArray * sql_tokens_new(void);
 
 /**
  * free a token-stream
  *
  * @param tokens   a token list to free
  */
-void sql_tokens_free(GPtrArray *tokens);
+NETWORK_API void sql_tokens_free(GPtrArray *tokens);
+
+NETWORK_API int sql_token_get_last_id();
+
+/**
+ * create a scanner which can be reused for many scans
+ *
+ * a scanner isn't thread-safe, use one per thread
+ */
+NETWORK_API sql_scanner *sql_scanner_new(void);
+NETWORK_API void sql_scanner_free(sql_scanner *sc);
 
-int sql_token_get_last_id();
+/**
+ * scan a string into token spans without allocating a token per token
+ *
+ * @param sc       a scanner
+ * @param spans    a GArray of sql_token_span, it is cleared first and only grows
+ * @param str      SQL string to tokenize
+ * @param len      length of str
+ * @return 0 on success
+ *
+ * @code
+ *   sql_scanner *sc = sql_scanner_new();
+ *   GArray *spans = g_array_new(FALSE, FALSE, sizeof(sql_token_span));
+ *
+ *   if (0 == sql_scanner_scan(sc, spans, C("SELECT 1 FROM tbl"))) {
+ *      sql_token_span *span = &g_array_index(spans, sql_token_span, 0);
+ *   }
+ * @endcode
+ */
+NETWORK_API int sql_scanner_scan(sql_scanner *sc, GArray *spans, const gchar *str, gsize len);
+
+/**
+ * scan a string with a scanner kept per thread
+ *
+ * @return the spans, owned by the thread and valid until its next scan. NULL on error
+ */
+NETWORK_API GArray *sql_scanner_thread_scan(const gchar *str, gsize len);
 
 /*@}*/
 
@@ -0,0 +1,244 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "chassis-mainloop.h"
+#include "chassis-event.h"
+#include "network-backend.h"
+#include "network-backend-probe.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-packet.h"
+#include "string-len.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+/**
+ * a backend which sends a handshake to each connection it accepts
+ */
+typedef struct {
+	int listen_fd;
+	int client_fd;
+	struct event listen_event;
+	guint accepted;
+} fake_backend;
+
+static void fake_backend_accept(int G_GNUC_UNUSED event_fd, short G_GNUC_UNUSED events, void *user_data) {
+	fake_backend *fb = user_data;
+	network_mysqld_auth_challenge *challenge;
+	GString *packet;
+
+	if (-1 == (fb->client_fd = accept(fb->listen_fd, NULL, NULL))) return;
+
+	fb->accepted++;
+
+	challenge = network_mysqld_auth_challenge_new();
+	challenge->protocol_version = 10;
+	challenge->server_version_str = g_strdup("5.5.99-fake");
+	challenge->server_version = 50599;
+	network_mysqld_auth_challenge_set_challenge(challenge);
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_auth_challenge(packet, challenge);
+	network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+	network_mysqld_auth_challenge_free(challenge);
+
+	g_assert_cmpint(packet->len, ==, write(fb->client_fd, S(packet)));
+
+	g_string_free(packet, TRUE);
+}
+
+/**
+ * listen on a free port of 127.0.0.1, handshakes are only sent if @a event_base is set
+ */
+static gchar *fake_backend_listen(fake_backend *fb, struct event_base *event_base) {
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+	addr.sin_port = 0;
+
+	fb->client_fd = -1;
+	fb->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	g_assert_cmpint(fb->listen_fd, !=, -1);
+	g_assert_cmpint(0, ==, bind(fb->listen_fd, (struct sockaddr *)&addr, sizeof(addr)));
+	g_assert_cmpint(0, ==, getsockname(fb->listen_fd, (struct sockaddr *)&addr, &addr_len));
+
+	if (event_base) {
+		g_assert_cmpint(0, ==, listen(fb->listen_fd, 8));
+
+		event_set(&(fb->listen_event), fb->listen_fd, EV_READ | EV_PERSIST, fake_backend_accept, fb);
+		event_base_set(event_base, &(fb->listen_event));
+		event_add(&(fb->listen_event), NULL);
+	}
+
+	return g_strdup_printf("127.0.0.1:%d", ntohs(addr.sin_port));
+}
+
+static void fake_backend_close(fake_backend *fb) {
+	if (fb->client_fd != -1) close(fb->client_fd);
+	close(fb->listen_fd);
+}
+
+/**
+ * set up the chassis like chassis_mainloop() does before the plugins apply their config
+ */
+static chassis *probe_chassis_new(void) {
+	chassis *chas;
+	chassis_event_t *mainloop;
+
+	chas = chassis_new();
+	g_assert(chas);
+
+	mainloop = chassis_event_new();
+	g_assert_cmpint(0, ==, chassis_event_init(mainloop, chas));
+
+	chas->event_base = mainloop->event_base;
+	chas->event_loop = mainloop;
+
+	return chas;
+}
+
+/**
+ * dispatch the main-loop until the backend leaves the UNKNOWN state
+ */
+static void probe_run_round(chassis *chas, network_backend_t *backend) {
+	guint i;
+
+	for (i = 0; i < 500 && backend->state == BACKEND_STATE_UNKNOWN; i++) {
+		event_base_loop(chas->event_base, EVLOOP_ONCE);
+	}
+}
+
+/**
+ * the health-checks are started from apply_config(), before the main-loop runs
+ */
+static void t_probe_start_before_loop(void) {
+	chassis *chas = probe_chassis_new();
+	network_backends_t *backends = network_backends_new();
+	network_backends_prober *p = network_backends_prober_new();
+	network_backend_t *backend;
+	fake_backend fb;
+	gchar *address;
+
+	address = fake_backend_listen(&fb, chas->event_base);
+	g_assert_cmpint(0, ==, network_backends_add(backends, address, BACKEND_TYPE_RW, BACKEND_STATE_UNKNOWN));
+	backend = network_backends_get(backends, 0);
+
+	p->interval.tv_sec = 0;
+	p->interval.tv_usec = 10 * 1000;
+
+	g_assert(NULL == chassis_event_get_current());
+	g_assert_cmpint(0, ==, network_backends_prober_start(p, chas, chassis_event_pick(chas), backends));
+
+	probe_run_round(chas, backend);
+
+	g_assert_cmpint(fb.accepted, ==, 1);
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_UP);
+	g_assert_cmpint(backend->rtt_us, >, 0);
+
+	network_backends_prober_free(p);
+	network_backends_free(backends);
+	fake_backend_close(&fb);
+	g_free(address);
+}
+
+/**
+ * a backend which refuses the connection is marked DOWN
+ */
+static void t_probe_refused(void) {
+	chassis *chas = probe_chassis_new();
+	network_backends_t *backends = network_backends_new();
+	network_backends_prober *p = network_backends_prober_new();
+	network_backend_t *backend;
+	fake_backend fb;
+	gchar *address;
+
+	/* bound, but not listening */
+	address = fake_backend_listen(&fb, NULL);
+	g_assert_cmpint(0, ==, network_backends_add(backends, address, BACKEND_TYPE_RW, BACKEND_STATE_UNKNOWN));
+	backend = network_backends_get(backends, 0);
+
+	p->interval.tv_sec = 0;
+	p->interval.tv_usec = 10 * 1000;
+
+	g_assert_cmpint(0, ==, network_backends_prober_start(p, chas, chassis_event_pick(chas), backends));
+
+	probe_run_round(chas, backend);
+
+	g_assert_cmpint(backend->state, ==, BACKEND_STATE_DOWN);
+
+	network_backends_prober_free(p);
+	network_backends_free(backends);
+	fake_backend_close(&fb);
+	g_free(address);
+}
+
+/**
+ * without a loop the prober refuses to start
+ */
+static void t_probe_no_loop(void) {
+	chassis *chas = chassis_new();
+	network_backends_t *backends = network_backends_new();
+	network_backends_prober *p = network_backends_prober_new();
+
+	g_log_set_always_fatal(G_LOG_FATAL_MASK);
+	g_assert(NULL == chassis_event_pick(chas));
+	g_assert_cmpint(-1, ==, network_backends_prober_start(p, chas, chassis_event_pick(chas), backends));
+
+	network_backends_prober_free(p);
+	network_backends_free(backends);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/backend_probe_start_before_loop", t_probe_start_before_loop);
+	g_test_add_func("/core/backend_probe_refused", t_probe_refused);
+	g_test_add_func("/core/backend_probe_no_loop", t_probe_no_loop);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,167 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+
+#include <glib.h>
+
+#ifdef HAVE_LUA_H
+#include <lua.h>
+#include <lauxlib.h>
+#endif
+
+#include "lua-scope.h"
+#include "network-backend.h"
+#include "network-mysqld.h"
+#include "network-mysqld-lua.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0) && defined(HAVE_LUA_H)
+
+/**
+ * the lua_State of an event-thread after its first connection ran the script
+ */
+static lua_scope *global_scope_new(chassis_private *g) {
+	lua_scope *sc = lua_scope_new();
+
+	network_mysqld_lua_setup_global(sc->L, g);
+	network_mysqld_lua_global_refresh(sc, g);
+	network_mysqld_lua_global_publish(sc, g);
+	sc->global_published = TRUE;
+
+	return sc;
+}
+
+static void global_run(lua_scope *sc, const char *chunk) {
+	if (0 != luaL_dostring(sc->L, chunk)) {
+		g_error("%s: %s", G_STRLOC, lua_tostring(sc->L, -1));
+	}
+}
+
+/**
+ * get proxy.global.config[key] as number, -1 if it isn't set
+ */
+static lua_Number global_get(lua_scope *sc, const char *key) {
+	lua_Number n = -1;
+
+	lua_getglobal(sc->L, "proxy");
+	lua_getfield(sc->L, -1, "global");
+	lua_getfield(sc->L, -1, "config");
+	lua_getfield(sc->L, -1, key);
+	if (lua_isnumber(sc->L, -1)) n = lua_tonumber(sc->L, -1);
+	lua_pop(sc->L, 4);
+
+	return n;
+}
+
+/**
+ * a script writes to proxy.global.config while another thread publishes
+ */
+static void t_global_script_write_survives_refresh(void) {
+	chassis_private *g = g_new0(chassis_private, 1);
+	lua_scope *sc_a, *sc_b;
+
+	g->backends = network_backends_new();
+
+	sc_a = global_scope_new(g);
+	global_run(sc_a, "proxy.global.config.a = 1");
+	network_mysqld_lua_global_publish(sc_a, g);
+
+	sc_b = global_scope_new(g);
+	g_assert_cmpint(global_get(sc_b, "a"), ==, 1);
+
+	/* a hook of B writes, the admin-script of A publishes something else */
+	global_run(sc_b, "cfg = proxy.global.config; proxy.global.config.b = 2");
+	global_run(sc_a, "proxy.global.config.a = 10");
+	network_mysqld_lua_global_publish(sc_a, g);
+
+	/* the next hook of B picks up the change of A and keeps its own write */
+	network_mysqld_lua_global_refresh(sc_b, g);
+	g_assert_cmpint(global_get(sc_b, "a"), ==, 10);
+	g_assert_cmpint(global_get(sc_b, "b"), ==, 2);
+
+	/* the reference the script kept is still proxy.global.config */
+	global_run(sc_b, "assert(cfg == proxy.global.config)");
+
+	/* ... and published it */
+	network_mysqld_lua_global_refresh(sc_a, g);
+	g_assert_cmpint(global_get(sc_a, "a"), ==, 10);
+	g_assert_cmpint(global_get(sc_a, "b"), ==, 2);
+
+	/* a key removed by A is gone in B, the untouched ones stay */
+	global_run(sc_a, "proxy.global.config.a = nil");
+	network_mysqld_lua_global_refresh(sc_a, g);
+	network_mysqld_lua_global_refresh(sc_b, g);
+	g_assert_cmpint(global_get(sc_b, "a"), ==, -1);
+	g_assert_cmpint(global_get(sc_b, "b"), ==, 2);
+
+	lua_scope_free(sc_a);
+	lua_scope_free(sc_b);
+	network_backends_free(g->backends);
+	g_free(g);
+}
+
+/**
+ * reloading the same snapshot isn't a write, the version stays
+ */
+static void t_global_refresh_is_stable(void) {
+	chassis_private *g = g_new0(chassis_private, 1);
+	lua_scope *sc_a, *sc_b;
+	gint version;
+
+	g->backends = network_backends_new();
+
+	sc_a = global_scope_new(g);
+	global_run(sc_a, "for i = 1, 50 do proxy.global.config['k' .. i] = i end proxy.global.config.t = { x = 1, y = 'z' }");
+	network_mysqld_lua_global_publish(sc_a, g);
+
+	sc_b = global_scope_new(g);
+	version = g->lua_global->version;
+
+	network_mysqld_lua_global_refresh(sc_b, g);
+	network_mysqld_lua_global_refresh(sc_a, g);
+	network_mysqld_lua_global_refresh(sc_b, g);
+	g_assert_cmpint(g->lua_global->version, ==, version);
+	g_assert_cmpint(global_get(sc_b, "k50"), ==, 50);
+
+	lua_scope_free(sc_a);
+	lua_scope_free(sc_b);
+	network_backends_free(g->backends);
+	g_free(g);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/lua_global_script_write_survives_refresh", t_global_script_write_survives_refresh);
+	g_test_add_func("/core/lua_global_refresh_is_stable", t_global_refresh_is_stable);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
@@ -0,0 +1,114 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-mysqld-proto.h"
+#include "network-mysqld-session.h"
+#include "string-len.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+/**
+ * track a COM_QUERY and the OK of the server like the proxy does
+ */
+static void session_run_query(network_mysqld_session *session, const gchar *query, gsize query_len) {
+	GString *packet;
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, COM_QUERY);
+	g_string_append_len(packet, query, query_len);
+
+	network_mysqld_session_track_query(session, packet, NET_HEADER_SIZE);
+	session->server_status = SERVER_STATUS_AUTOCOMMIT;
+
+	g_string_free(packet, TRUE);
+}
+
+/**
+ * LAST_INSERT_ID() and ROW_COUNT() have to run on the connection of the write
+ */
+static void t_session_pin_last_write(void) {
+	network_mysqld_session *session = network_mysqld_session_new();
+
+	session_run_query(session, C("SELECT 1"));
+	g_assert(network_mysqld_session_is_idle(session));
+
+	session_run_query(session, C("INSERT INTO t1 VALUES (1)"));
+	g_assert(!network_mysqld_session_is_idle(session));
+
+	/* the connection was kept for it, it goes back to the pool afterwards */
+	session_run_query(session, C("SELECT LAST_INSERT_ID()"));
+	g_assert(network_mysqld_session_is_idle(session));
+
+	session_run_query(session, C("UPDATE t1 SET id = 2"));
+	g_assert(!network_mysqld_session_is_idle(session));
+
+	session_run_query(session, C("SELECT ROW_COUNT()"));
+	g_assert(network_mysqld_session_is_idle(session));
+
+	/* the write in a multi-statement counts too */
+	session_run_query(session, C("SELECT 1; DELETE FROM t1"));
+	g_assert(!network_mysqld_session_is_idle(session));
+
+	network_mysqld_session_free(session);
+}
+
+/**
+ * FOUND_ROWS() has to run on the connection of the SQL_CALC_FOUND_ROWS
+ */
+static void t_session_pin_found_rows(void) {
+	network_mysqld_session *session = network_mysqld_session_new();
+
+	session_run_query(session, C("SELECT SQL_CALC_FOUND_ROWS * FROM t1 LIMIT 1"));
+	g_assert(!network_mysqld_session_is_idle(session));
+
+	session_run_query(session, C("SELECT FOUND_ROWS()"));
+	g_assert(network_mysqld_session_is_idle(session));
+
+	network_mysqld_session_free(session);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/session_pin_last_write", t_session_pin_last_write);
+	g_test_add_func("/core/session_pin_found_rows", t_session_pin_found_rows);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
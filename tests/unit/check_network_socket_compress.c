@@ -0,0 +1,183 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-mysqld.h"
+#include "network-mysqld-proto.h"
+#include "string-len.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0) && defined(HAVE_ZLIB_H)
+
+#define COMPRESSED_HEADER_SIZE 7
+
+/**
+ * a compressed socket and the other end of it
+ */
+static network_socket *compress_sock_new(int *peer_fd) {
+	network_socket *sock;
+	int fds[2];
+
+	g_assert_cmpint(0, ==, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+	g_assert_cmpint(0, ==, fcntl(fds[1], F_SETFL, O_NONBLOCK));
+
+	sock = network_socket_new();
+	sock->fd = fds[0];
+	network_socket_set_compressed(sock);
+
+	*peer_fd = fds[1];
+
+	return sock;
+}
+
+/**
+ * write the send-queue and append the sequence-ids of the frames the peer got to @a seqs
+ */
+static void compress_sock_flush(network_socket *sock, int peer_fd, GArray *seqs) {
+	GString *buf = g_string_new(NULL);
+	char chunk[4096];
+	gssize len;
+	gsize off;
+
+	g_assert_cmpint(NETWORK_SOCKET_SUCCESS, ==, network_socket_write(sock, -1));
+
+	while ((len = read(peer_fd, chunk, sizeof(chunk))) > 0) {
+		g_string_append_len(buf, chunk, len);
+	}
+	g_assert_cmpint(errno, ==, EAGAIN);
+
+	for (off = 0; off < buf->len; ) {
+		unsigned char *p = (unsigned char *)buf->str + off;
+		guint32 frame_len = p[0] | p[1] << 8 | p[2] << 16;
+		guint8 seq = p[3];
+
+		g_array_append_val(seqs, seq);
+
+		off += COMPRESSED_HEADER_SIZE + frame_len;
+	}
+	g_assert_cmpint(off, ==, buf->len);
+
+	g_string_free(buf, TRUE);
+}
+
+/**
+ * the packet-ids of a resultset of more than 256 rows wrap through 0, a flush
+ * starting at such a packet continues the sequence of the frames
+ */
+static void t_compress_large_resultset(void) {
+	network_socket *sock;
+	GArray *seqs = g_array_new(FALSE, FALSE, sizeof(guint8));
+	int peer_fd;
+	guint i;
+
+	sock = compress_sock_new(&peer_fd);
+
+	/* the client sent its command in frame 0 */
+	sock->compressed_packet_id = 0;
+	sock->last_packet_id = 0;
+	sock->packet_id_is_reset = FALSE;
+
+	for (i = 0; i < 300; i++) {
+		GString *packet = g_string_new(NULL);
+
+		network_mysqld_proto_append_packet_len(packet, 0);
+		network_mysqld_proto_append_packet_id(packet, (i + 1) & 0xff);
+		g_string_append_printf(packet, "row %u", i);
+		network_mysqld_proto_set_packet_len(packet, packet->len - NET_HEADER_SIZE);
+
+		network_mysqld_queue_append_raw(sock, sock->send_queue, packet);
+
+		/* one of the flushes starts with the packet-id 0 */
+		if ((i + 1) % 85 == 0) compress_sock_flush(sock, peer_fd, seqs);
+	}
+	compress_sock_flush(sock, peer_fd, seqs);
+
+	g_assert_cmpint(seqs->len, ==, 300 / 85 + 1);
+	for (i = 0; i < seqs->len; i++) {
+		g_assert_cmpint(g_array_index(seqs, guint8, i), ==, i + 1);
+	}
+
+	/* the next command starts at 0 again */
+	g_array_set_size(seqs, 0);
+	network_mysqld_queue_reset(sock);
+	network_mysqld_queue_append(sock, sock->send_queue, C("\x03SELECT 1"));
+	compress_sock_flush(sock, peer_fd, seqs);
+
+	g_assert_cmpint(seqs->len, ==, 1);
+	g_assert_cmpint(g_array_index(seqs, guint8, 0), ==, 0);
+
+	g_array_free(seqs, TRUE);
+	network_socket_free(sock);
+	close(peer_fd);
+}
+
+/**
+ * two commands in one write each start at sequence-id 0
+ */
+static void t_compress_pipelined_commands(void) {
+	network_socket *sock;
+	GArray *seqs = g_array_new(FALSE, FALSE, sizeof(guint8));
+	int peer_fd;
+
+	sock = compress_sock_new(&peer_fd);
+
+	network_mysqld_queue_reset(sock);
+	network_mysqld_queue_append(sock, sock->send_queue, C("\x03SET NAMES utf8"));
+	network_mysqld_queue_reset(sock);
+	network_mysqld_queue_append(sock, sock->send_queue, C("\x03SELECT 1"));
+	compress_sock_flush(sock, peer_fd, seqs);
+
+	g_assert_cmpint(seqs->len, ==, 2);
+	g_assert_cmpint(g_array_index(seqs, guint8, 0), ==, 0);
+	g_assert_cmpint(g_array_index(seqs, guint8, 1), ==, 0);
+
+	g_array_free(seqs, TRUE);
+	network_socket_free(sock);
+	close(peer_fd);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/compress_large_resultset", t_compress_large_resultset);
+	g_test_add_func("/core/compress_pipelined_commands", t_compress_pipelined_commands);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif
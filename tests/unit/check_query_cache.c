@@ -0,0 +1,165 @@
+/* $%BEGINLICENSE%$
+ Copyright (c) 2008, 2012, Oracle and/or its affiliates. All rights reserved.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License as
+ published by the Free Software Foundation; version 2 of the
+ License.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ 02110-1301  USA
+
+ $%ENDLICENSE%$ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "network-socket.h"
+#include "network-mysqld-proto.h"
+#include "network-mysqld-session.h"
+#include "network-query-cache.h"
+#include "glib-ext.h"
+#include "string-len.h"
+
+#if GLIB_CHECK_VERSION(2, 16, 0)
+
+#define SELECT_QUERY "SELECT * FROM t1"
+
+/**
+ * run a COM_QUERY through the session-tracker like the proxy does: track the
+ * command, then the OK of the server
+ */
+static void session_run_query(network_mysqld_session *session, network_socket *client, const gchar *query, gsize query_len) {
+	GString *packet;
+
+	packet = g_string_new(NULL);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, 0);
+	network_mysqld_proto_append_int8(packet, COM_QUERY);
+	g_string_append_len(packet, query, query_len);
+
+	network_mysqld_session_track_query(session, packet, NET_HEADER_SIZE);
+	network_mysqld_session_track_result(session, NULL, TRUE, client, NULL);
+
+	g_string_free(packet, TRUE);
+}
+
+/**
+ * without multiplexing the cache-session keeps the charsets and the sql_mode
+ * of the client current, the key changes with them
+ */
+static void t_cache_key_follows_session(void) {
+	network_mysqld_session *session = network_mysqld_session_new();
+	network_socket *client = network_socket_new();
+	GString *key_before = g_string_new(NULL);
+	GString *key_after = g_string_new(NULL);
+
+	g_string_assign(client->default_db, "db1");
+	network_query_cache_key(key_before, client, C(SELECT_QUERY));
+
+	session_run_query(session, client, C("SET NAMES latin1"));
+	g_assert_cmpstr(client->charset_client->str, ==, "latin1");
+	g_assert_cmpstr(client->charset_results->str, ==, "latin1");
+	g_assert(network_mysqld_session_is_cacheable(session));
+
+	network_query_cache_key(key_after, client, C(SELECT_QUERY));
+	g_assert(!g_string_equal(key_before, key_after));
+
+	g_string_assign_len(key_before, S(key_after));
+	session_run_query(session, client, C("SET sql_mode = 'ANSI_QUOTES'"));
+	g_assert(network_mysqld_session_is_cacheable(session));
+
+	network_query_cache_key(key_after, client, C(SELECT_QUERY));
+	g_assert(!g_string_equal(key_before, key_after));
+
+	g_string_free(key_before, TRUE);
+	g_string_free(key_after, TRUE);
+	network_socket_free(client);
+	network_mysqld_session_free(session);
+}
+
+/**
+ * the key doesn't cover time_zone and friends, the session isn't cached anymore
+ */
+static void t_cache_untracked_session_vars(void) {
+	network_mysqld_session *session = network_mysqld_session_new();
+	network_socket *client = network_socket_new();
+
+	session_run_query(session, client, C("SELECT 1"));
+	g_assert(network_mysqld_session_is_cacheable(session));
+
+	session_run_query(session, client, C("SET time_zone = '+01:00'"));
+	g_assert(!network_mysqld_session_is_cacheable(session));
+
+	/* it stays disabled */
+	session_run_query(session, client, C("SET NAMES utf8"));
+	g_assert(!network_mysqld_session_is_cacheable(session));
+
+	/* COM_CHANGE_USER resets the session on the server */
+	network_mysqld_session_reset(session);
+	g_assert(network_mysqld_session_is_cacheable(session));
+
+	network_socket_free(client);
+	network_mysqld_session_free(session);
+}
+
+/**
+ * a temporary table shadows the table of the same name, its results must not
+ * reach other clients with the same user and default-db
+ */
+static void t_cache_temp_tables(void) {
+	network_mysqld_session *session = network_mysqld_session_new();
+	network_socket *client = network_socket_new();
+	network_socket *other = network_socket_new();
+	GString *key = g_string_new(NULL);
+	GString *other_key = g_string_new(NULL);
+
+	g_string_assign(client->default_db, "db1");
+	g_string_assign(other->default_db, "db1");
+
+	session_run_query(session, client, C("CREATE TEMPORARY TABLE t1 (id INT)"));
+	g_assert(!network_mysqld_session_is_cacheable(session));
+
+	/* the key can't tell the two apart */
+	network_query_cache_key(key, client, C(SELECT_QUERY));
+	network_query_cache_key(other_key, other, C(SELECT_QUERY));
+	g_assert(g_string_equal(key, other_key));
+
+	g_string_free(key, TRUE);
+	g_string_free(other_key, TRUE);
+	network_socket_free(other);
+	network_socket_free(client);
+	network_mysqld_session_free(session);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+
+	g_test_init(&argc, &argv, NULL);
+	g_test_bug_base("http://bugs.mysql.com/");
+
+	g_test_add_func("/core/query_cache_key_follows_session", t_cache_key_follows_session);
+	g_test_add_func("/core/query_cache_untracked_session_vars", t_cache_untracked_session_vars);
+	g_test_add_func("/core/query_cache_temp_tables", t_cache_temp_tables);
+
+	return g_test_run();
+}
+#else
+int main() {
+	return 77;
+}
+#endif